@@ -0,0 +1,126 @@
+#ifndef CAFFE_BATCHING_SERVER_HPP_
+#define CAFFE_BATCHING_SERVER_HPP_
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <deque>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/inference_session.hpp"
+#include "caffe/internal_thread.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Serves single-item requests by running them through a net in
+ *        dynamic batches.
+ *
+ * Callers Submit one item of the net's only input blob at a time, from any
+ * thread. A worker thread takes the oldest waiting request and keeps
+ * collecting more until it has max_batch_size of them, or until the oldest
+ * has waited max_latency_us. It then reshapes the input blob to the batch
+ * size, runs one Forward, and hands each request its share of every output
+ * blob. At most queue_depth requests wait at once; Submit blocks while the
+ * queue is full.
+ *
+ * Stop() serves the requests still queued before it returns, so all of them
+ * complete. stats() then reports the latencies and throughput.
+ */
+template <typename Dtype>
+class BatchingServer : public InternalThread {
+ public:
+  class Request;
+
+  /// Serves through context, which the server must be the only user of.
+  BatchingServer(
+      shared_ptr<typename InferenceSession<Dtype>::Context> context,
+      int max_batch_size, int max_latency_us, int queue_depth);
+  virtual ~BatchingServer();
+
+  void Start();
+  /// @brief Serve the remaining requests, then stop the worker.
+  void Stop();
+
+  /// @brief Queue one item of input_size() values; does not wait for it.
+  shared_ptr<Request> Submit(const Dtype* input);
+
+  /// The number of values of one item of the input blob.
+  int input_size() const { return input_size_; }
+  /// The number of values of one item of all the output blobs.
+  int output_size() const { return output_size_; }
+
+  struct Stats {
+    int requests;
+    int batches;
+    double mean_batch_size;
+    double p50_latency_ms;
+    double p99_latency_ms;
+    // Completed requests per second, from the first request to the last.
+    double requests_per_second;
+  };
+  /// @brief Statistics over all the requests completed so far. The
+  ///        latency percentiles are the upper bounds of histogram buckets,
+  ///        at most 1/kLatencyBucketsPerOctave of an octave (about 4.4%)
+  ///        above the exact values.
+  Stats stats() const;
+
+  static const int kLatencyBucketsPerOctave = 16;
+  /// Latencies up to 2^32 us, over an hour; longer ones count in the last.
+  static const int kLatencyBuckets = 32 * kLatencyBucketsPerOctave + 1;
+
+ protected:
+  /// The lock and conditions of the queue and of every request; kept out of
+  /// the header like BlockingQueue's.
+  class Sync;
+
+  virtual void InternalThreadEntry();
+  void RunBatch(const vector<shared_ptr<Request> >& batch);
+  static int LatencyBucket(int64_t us);
+  double LatencyPercentile(double p) const;
+
+  shared_ptr<typename InferenceSession<Dtype>::Context> context_;
+  const int max_batch_size_;
+  const int max_latency_us_;
+  const int queue_depth_;
+  int input_size_;
+  int output_size_;
+  shared_ptr<Sync> sync_;
+  // Guarded by sync_.
+  std::deque<shared_ptr<Request> > queue_;
+  bool stopping_;
+  /// The number of completed requests whose latency in us is at most
+  /// 2^(b / kLatencyBucketsPerOctave), and above that of bucket b - 1.
+  vector<int64_t> latency_counts_;
+  int requests_;
+  int batches_;
+  boost::posix_time::ptime first_arrival_;
+  boost::posix_time::ptime last_completion_;
+
+  DISABLE_COPY_AND_ASSIGN(BatchingServer);
+};
+
+/// @brief One item submitted to a BatchingServer.
+template <typename Dtype>
+class BatchingServer<Dtype>::Request {
+ public:
+  /// @brief Wait until the item is served, and return the values of each
+  ///        output blob for it, one blob after the other.
+  const vector<Dtype>& Wait();
+
+ private:
+  friend class BatchingServer<Dtype>;
+  Request(const Dtype* input, int input_size, shared_ptr<Sync> sync);
+
+  vector<Dtype> input_;
+  vector<Dtype> output_;
+  boost::posix_time::ptime arrival_;
+  bool done_;
+  shared_ptr<Sync> sync_;
+
+  DISABLE_COPY_AND_ASSIGN(Request);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_BATCHING_SERVER_HPP_
@@ -263,6 +263,16 @@ class Blob {
    * shared_ptr calls its destructor when reset with the "=" operator.
    */
   void ShareDiff(const Blob& other);
+  /**
+   * @brief Set the data_ shared_ptr to storage that may also be used by other
+   *        Blob%s -- used by Net to let activations whose lifetimes do not
+   *        overlap share memory.
+   *
+   * The storage must hold at least count() elements. The Blob keeps using it
+   * when reshaped within its size, and only allocates its own data_ again when
+   * reshaped beyond it.
+   */
+  void ShareDataStorage(const shared_ptr<SyncedMemory>& storage);
 
   bool ShapeEquals(const BlobProto& other);
 
@@ -0,0 +1,97 @@
+#ifndef CAFFE_CPU_PARALLEL_HPP_
+#define CAFFE_CPU_PARALLEL_HPP_
+
+#include <utility>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/net.hpp"
+#include "caffe/solver.hpp"
+#include "caffe/syncedmem.hpp"
+#include "caffe/util/blocking_queue.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Data-parallel training on the CPU: several replicas of a solver,
+ *        each on its own thread, that average their gradients every
+ *        iteration.
+ *
+ * Each replica keeps its learnable parameters in one buffer for the data and
+ * one for the diffs (the net's own with contiguous_params), allocated by the
+ * replica's thread. The gradients are averaged through shared memory: every
+ * replica sums and scales its 1/N share of the buffer over all replicas
+ * (reduce-scatter), then copies the shares of the others (all-gather). Each
+ * gradient value thus crosses between replicas, and sockets, only twice, and
+ * all replicas end up with bit-identical averages.
+ *
+ * With layer_wise_reduce (and iter_size 1), a communication thread per
+ * replica reduces the gradients of each layer as soon as its Backward is
+ * done, overlapping with the Backward of the layers below it;
+ * on_gradients_ready waits for the last of them. Otherwise all the gradients
+ * are reduced at once in on_gradients_ready.
+ */
+template <typename Dtype>
+class CPUParallel : public InternalThread,
+                    public Solver<Dtype>::Callback,
+                    public Net<Dtype>::Callback {
+ public:
+  /// The replicas of one Run, and the barriers they meet at.
+  class Group;
+
+  /// Takes over the parameters of the solver's net, which must be in CPU
+  /// mode. Unless the net has contiguous_params, they then live in buffers
+  /// owned by this object. The solver's rank is the current
+  /// Caffe::solver_rank().
+  explicit CPUParallel(shared_ptr<Solver<Dtype> > solver);
+  virtual ~CPUParallel();
+
+  /**
+   * @brief Train the solver, as rank 0, with num_workers - 1 more replicas
+   *        on their own threads, until max_iter.
+   *
+   * Caffe::solver_count() must already be num_workers when the solver is
+   * created, so that its data layers read their own share of the data. The
+   * other replicas are restored from restore if it is not NULL.
+   */
+  void Run(int num_workers, const char* restore);
+
+  /// @brief Join the group as the replica of our rank, and start from the
+  ///        parameters of rank 0.
+  void Join(Group* group);
+
+ protected:
+  void on_start() {}
+  void on_gradients_ready();
+  void run(int layer);  // Net callback, after the Backward of each layer
+  virtual void InternalThreadEntry();
+  /// @brief Average the gradients [offset, offset + count) over the group.
+  void Allreduce(int offset, int count);
+
+  shared_ptr<Solver<Dtype> > solver_;
+  const int rank_;
+  Group* group_;
+  bool layer_wise_;
+  // The parameter buffers, and the memory behind them unless they belong to
+  // the net.
+  shared_ptr<SyncedMemory> data_buffer_;
+  shared_ptr<SyncedMemory> diff_buffer_;
+  Dtype* data_;
+  Dtype* diff_;
+  int size_;
+  // (offset, count) of the gradients of each layer that owns parameters,
+  // followed by the whole buffer; and each layer's segment, or -1.
+  vector<std::pair<int, int> > segments_;
+  vector<int> layer_segment_;
+  // Segments for the communication thread to reduce, and the end-of-iteration
+  // marker it returns once everything before it is reduced.
+  BlockingQueue<int> ready_;
+  BlockingQueue<int> done_;
+
+DISABLE_COPY_AND_ASSIGN(CPUParallel);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_CPU_PARALLEL_HPP_
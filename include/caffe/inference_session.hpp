@@ -0,0 +1,91 @@
+#ifndef CAFFE_INFERENCE_SESSION_HPP_
+#define CAFFE_INFERENCE_SESSION_HPP_
+
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Serves a trained net to concurrent callers: one copy of the weights,
+ *        shared by any number of lightweight execution contexts.
+ *
+ * The session holds a TEST phase net whose parameters are the only copy of
+ * the weights; it is never run. Each Context is a net with its own layers and
+ * activations, whose parameters share their data with the session's (see
+ * Net::ShareTrainedLayersWith). Contexts may run Forward on different threads
+ * at the same time, but each one must be used by one thread at a time. The
+ * weights must not change while contexts run.
+ *
+ * Caffe's mode and device are per thread. The session records those of the
+ * thread that creates it, and a Context applies them to whichever thread
+ * calls it.
+ */
+template <typename Dtype>
+class InferenceSession {
+ public:
+  class Context;
+
+  /// Loads the TEST phase of param, with the weights of weights_file unless
+  /// it is empty.
+  InferenceSession(const NetParameter& param, const string& weights_file);
+  /// Loads the TEST phase of the net in param_file, with the weights of
+  /// weights_file unless it is empty.
+  InferenceSession(const string& param_file, const string& weights_file);
+
+  /// @brief Create a new execution context. May be called from any thread,
+  ///        and sets its Caffe mode to that of the session.
+  shared_ptr<Context> CreateContext() const;
+
+  /// @brief The net that holds the weights.
+  const Net<Dtype>& weights() const { return *weights_; }
+
+ protected:
+  void Init(const NetParameter& param, const string& weights_file);
+
+  NetParameter param_;
+  shared_ptr<Net<Dtype> > weights_;
+  Caffe::Brew mode_;
+  int device_;
+
+  DISABLE_COPY_AND_ASSIGN(InferenceSession);
+};
+
+/// @brief The activations of one concurrent use of an InferenceSession. It
+///        keeps the weights alive, and may outlive the session.
+template <typename Dtype>
+class InferenceSession<Dtype>::Context {
+ public:
+  /// @brief Run the net on the calling thread, in the session's mode, and
+  ///        return its output blobs.
+  const vector<Blob<Dtype>*>& Forward(Dtype* loss = NULL);
+
+  const vector<Blob<Dtype>*>& input_blobs() const {
+    return net_->input_blobs();
+  }
+  const vector<Blob<Dtype>*>& output_blobs() const {
+    return net_->output_blobs();
+  }
+  /// @brief The context's net, for access to its blobs by name. Its
+  ///        parameters belong to the session and must not be changed.
+  Net<Dtype>& net() { return *net_; }
+
+ private:
+  friend class InferenceSession<Dtype>;
+  explicit Context(const InferenceSession<Dtype>& session);
+
+  shared_ptr<Net<Dtype> > net_;
+  Caffe::Brew mode_;
+  int device_;
+
+  DISABLE_COPY_AND_ASSIGN(Context);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_INFERENCE_SESSION_HPP_
@@ -38,7 +38,8 @@ class Layer {
    * layer.
    */
   explicit Layer(const LayerParameter& param)
-    : layer_param_(param) {
+    : layer_param_(param), skip_unchanged_reshape_(false),
+      reshaped_(false), reshapes_skipped_(0) {
       // Set phase and copy blobs (if there are any).
       phase_ = param.phase();
       if (layer_param_.blobs_size() > 0) {
@@ -106,6 +107,16 @@ class Layer {
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) = 0;
 
+  /**
+   * @brief Calls Reshape, unless skipping is enabled (see
+   *        set_skip_unchanged_reshape) and the bottom blobs have the shapes
+   *        they had at the last call. Returns whether it reshaped.
+   *
+   * Forward reshapes through this method.
+   */
+  inline bool ReshapeIfChanged(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
   /**
    * @brief Given the bottom blobs, compute the top blobs and the loss.
    *
@@ -269,6 +280,36 @@ class Layer {
     return true;
   }
 
+  /**
+   * @brief Returns true if the layer may point its top blobs at the data of
+   *        its bottom blobs (with Blob::ShareData) instead of computing them.
+   *
+   * Net's memory optimization then treats the bottoms and tops as one blob,
+   * since they hold the same storage whenever the layer has run.
+   */
+  virtual inline bool SharesBottomData() const { return false; }
+
+  /**
+   * @brief Returns true if Reshape depends on nothing but the shapes of the
+   *        bottom blobs and the layer's own settings.
+   *
+   * Only then may ReshapeIfChanged skip Reshape. Layers that size their tops
+   * from the bottom data, like Filter, must return false.
+   */
+  virtual inline bool ReshapeDependsOnlyOnShapes() const { return true; }
+
+  /**
+   * @brief Sets whether ReshapeIfChanged skips Reshape while the bottom
+   *        shapes are unchanged. Net enables it for nets with shape buckets;
+   *        the layer must then only be reshaped through ReshapeIfChanged.
+   */
+  inline void set_skip_unchanged_reshape(const bool value) {
+    skip_unchanged_reshape_ = value && ReshapeDependsOnlyOnShapes();
+    reshaped_ = false;
+  }
+  /// @brief The number of times ReshapeIfChanged skipped Reshape.
+  inline int reshapes_skipped() const { return reshapes_skipped_; }
+
   /**
    * @brief Specifies whether the layer should compute gradients w.r.t. a
    *        parameter at a particular index given by param_id.
@@ -291,6 +332,20 @@ class Layer {
     param_propagate_down_[param_id] = value;
   }
 
+  /**
+   * @brief Returns the rows (indices along the first axis) of the diff of
+   *        parameter param_id that Backward_cpu has added to since the last
+   *        ClearParamDiffRows, or NULL if it may add to any of them.
+   *
+   * A layer whose gradient touches few rows of a large parameter, like Embed,
+   * lists them so that Net and the solvers clear and update only those.
+   */
+  virtual const vector<int>* param_diff_rows(const int param_id) const {
+    return NULL;
+  }
+  /// @brief Forget the rows listed by param_diff_rows, once Net has cleared
+  ///        them.
+  virtual void ClearParamDiffRows() {}
 
  protected:
   /** The protobuf that stores the layer parameters */
@@ -306,6 +361,13 @@ class Layer {
    *  the objective function. */
   vector<Dtype> loss_;
 
+  /** Whether ReshapeIfChanged may skip Reshape, and the bottom shapes of
+   *  its last Reshape if reshaped_. */
+  bool skip_unchanged_reshape_;
+  bool reshaped_;
+  vector<vector<int> > reshaped_bottom_shapes_;
+  int reshapes_skipped_;
+
   /** @brief Using the CPU device, compute the layer output. */
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) = 0;
@@ -413,7 +475,7 @@ template <typename Dtype>
 inline Dtype Layer<Dtype>::Forward(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   Dtype loss = 0;
-  Reshape(bottom, top);
+  ReshapeIfChanged(bottom, top);
   switch (Caffe::mode()) {
   case Caffe::CPU:
     Forward_cpu(bottom, top);
@@ -445,6 +507,30 @@ inline Dtype Layer<Dtype>::Forward(const vector<Blob<Dtype>*>& bottom,
   return loss;
 }
 
+template <typename Dtype>
+inline bool Layer<Dtype>::ReshapeIfChanged(const vector<Blob<Dtype>*>& bottom,
+    const vector<Blob<Dtype>*>& top) {
+  if (!skip_unchanged_reshape_) {
+    Reshape(bottom, top);
+    return true;
+  }
+  bool unchanged = reshaped_ && reshaped_bottom_shapes_.size() == bottom.size();
+  for (int i = 0; unchanged && i < bottom.size(); ++i) {
+    unchanged = bottom[i]->shape() == reshaped_bottom_shapes_[i];
+  }
+  if (unchanged) {
+    ++reshapes_skipped_;
+    return false;
+  }
+  Reshape(bottom, top);
+  reshaped_bottom_shapes_.resize(bottom.size());
+  for (int i = 0; i < bottom.size(); ++i) {
+    reshaped_bottom_shapes_[i] = bottom[i]->shape();
+  }
+  reshaped_ = true;
+  return true;
+}
+
 template <typename Dtype>
 inline void Layer<Dtype>::Backward(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down,
@@ -5,6 +5,7 @@
 
 #include "caffe/blob.hpp"
 #include "caffe/layer.hpp"
+#include "caffe/metric_accumulator.hpp"
 #include "caffe/proto/caffe.pb.h"
 
 #include "caffe/layers/loss_layer.hpp"
@@ -14,9 +15,13 @@ namespace caffe {
 /**
  * @brief Computes the classification accuracy for a one-of-many
  *        classification task.
+ *
+ * While accumulating (see MetricAccumulator), it outputs the accuracy of all
+ * the instances since ResetMetric, which differs from the mean over the
+ * batches when their numbers of labelled instances differ.
  */
 template <typename Dtype>
-class AccuracyLayer : public Layer<Dtype> {
+class AccuracyLayer : public Layer<Dtype>, public MetricAccumulator<Dtype> {
  public:
   /**
    * @param param provides AccuracyParameter accuracy_param,
@@ -82,6 +87,12 @@ class AccuracyLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  /// @brief The accuracy of the counts in state: the correct and all
+  ///        instances, then with per class accuracy the correct instances of
+  ///        each class and all of them.
+  virtual void ComputeMetric(const vector<double>& state,
+      const vector<Blob<Dtype>*>& top) const;
+
   int label_axis_, outer_num_, inner_num_;
 
   int top_k_;
@@ -1,11 +1,13 @@
 #ifndef CAFFE_BASE_CONVOLUTION_LAYER_HPP_
 #define CAFFE_BASE_CONVOLUTION_LAYER_HPP_
 
+#include <algorithm>
 #include <vector>
 
 #include "caffe/blob.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/syncedmem.hpp"
 #include "caffe/util/im2col.hpp"
 
 namespace caffe {
@@ -30,17 +32,46 @@ class BaseConvolutionLayer : public Layer<Dtype> {
 
  protected:
   // Helper functions that abstract away the column buffer and gemm arguments.
-  // The last argument in forward_cpu_gemm is so that we can skip the im2col if
-  // we just called weight_cpu_gemm with the same input.
+  // The skip_im2col argument in forward_cpu_gemm is so that we can skip the
+  // im2col if we just called weight_cpu_gemm with the same input. The CPU
+  // helpers work in col_buffer_ unless a column buffer is passed explicitly,
+  // which the batch-parallel path below uses to give every thread its own.
   void forward_cpu_gemm(const Dtype* input, const Dtype* weights,
-      Dtype* output, bool skip_im2col = false);
-  void forward_cpu_bias(Dtype* output, const Dtype* bias);
+      Dtype* output, bool skip_im2col = false, Dtype* col_buff = NULL);
+  // Adds the bias (unless NULL) to the output of one image and applies the
+  // fused ReLU, in one pass while the output is still in cache.
+  void forward_cpu_bias_relu(Dtype* output, const Dtype* bias);
   void backward_cpu_gemm(const Dtype* input, const Dtype* weights,
-      Dtype* output);
+      Dtype* output, Dtype* col_buff = NULL);
   void weight_cpu_gemm(const Dtype* input, const Dtype* output, Dtype*
-      weights);
+      weights, Dtype* col_buff = NULL);
   void backward_cpu_bias(Dtype* bias, const Dtype* input);
 
+  // Batch-parallel CPU support: the images of a batch are spread over
+  // num_cpu_threads() threads. Thread t uses the column buffer at
+  // cpu_col_buffers() + t * col_buffer_count() and accumulates its weight
+  // gradient into slot t of cpu_weight_diff_buffers(), which
+  // reduce_cpu_weight_diffs() then sums into the parameter diff. The buffer
+  // accessors may allocate, so call them before entering the parallel region.
+  // 1x1 convolutions need no column buffer: cpu_col_buffers() is NULL then.
+  inline int num_cpu_threads() const { return std::min(num_threads_, num_); }
+  inline int col_buffer_count() const {
+    return is_1x1_ ? 0 : col_buffer_.count();
+  }
+  Dtype* cpu_col_buffers();
+  Dtype* cpu_weight_diff_buffers();
+  void reduce_cpu_weight_diffs(Dtype* weight_diff);
+
+  // int8 inference (see QuantizationParameter): prepare_cpu_int8() quantizes
+  // the weights on first use (or when the weight blob's storage changed) and
+  // sizes the per-thread buffers, and must be called before entering the
+  // parallel region; forward_cpu_int8() then computes one image in thread t
+  // using col_buff for im2col, with bias and fused ReLU applied while
+  // converting the int32 products back to Dtype.
+  void prepare_cpu_int8(int num_threads);
+  void forward_cpu_int8(const Dtype* input, Dtype* output, Dtype* col_buff,
+      int t);
+
 #ifndef CPU_ONLY
   void forward_gpu_gemm(const Dtype* col_input, const Dtype* weights,
       Dtype* output, bool skip_im2col = false);
@@ -50,6 +81,9 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   void weight_gpu_gemm(const Dtype* col_input, const Dtype* output, Dtype*
       weights);
   void backward_gpu_bias(Dtype* bias, const Dtype* input);
+  // The all ones vector by which the GPU helpers add the bias with BLAS,
+  // sized on first use; the CPU helpers do without it.
+  const Dtype* gpu_bias_multiplier();
 #endif
 
   /// @brief The spatial dimensions of the input.
@@ -92,6 +126,15 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   bool bias_term_;
   bool is_1x1_;
   bool force_nd_im2col_;
+  int num_threads_;
+  /// Whether convolution_param.fused_relu is set: Forward applies the ReLU
+  /// per image together with the bias, and Backward applies its gradient to the
+  /// top diff in place, as an in-place ReLU layer would.
+  bool fused_relu_;
+  Dtype relu_negative_slope_;
+  /// Whether Forward_cpu runs in int8: quantization_param selects INT8 and
+  /// the layer is in a TEST net.
+  bool int8_;
 
  private:
   // wrap im2col/col2im so we don't have to remember the (long) argument lists
@@ -167,6 +210,22 @@ class BaseConvolutionLayer : public Layer<Dtype> {
 
   Blob<Dtype> col_buffer_;
   Blob<Dtype> bias_multiplier_;
+  // Per-thread column buffers and weight gradients for the batch-parallel path.
+  Blob<Dtype> thread_col_buffers_;
+  Blob<Dtype> thread_weight_diffs_;
+
+  // int8 state: the quantized weights, the factor converting an accumulated
+  // product of each output channel back to Dtype, the SyncedMemory::version
+  // of the weights they were quantized from, and per-thread buffers for the
+  // quantized columns and the int32 products.
+  Dtype int8_input_scale_;
+  shared_ptr<SyncedMemory> int8_weights_;
+  vector<Dtype> int8_output_scales_;
+  uint64_t int8_weights_version_;
+  shared_ptr<SyncedMemory> int8_col_buffers_;
+  shared_ptr<SyncedMemory> int8_products_;
+  int8_t* int8_col_data_;
+  int32_t* int8_product_data_;
 };
 
 }  // namespace caffe
@@ -8,7 +8,7 @@
 #include "caffe/internal_thread.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
-#include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/spsc_queue.hpp"
 
 namespace caffe {
 
@@ -49,6 +49,13 @@ class Batch {
   Blob<Dtype> data_, label_;
 };
 
+// A batch for data layers with any number of tops, one blob each.
+template <typename Dtype>
+class BlobsBatch {
+ public:
+  vector<shared_ptr<Blob<Dtype> > > blobs_;
+};
+
 template <typename Dtype>
 class BasePrefetchingDataLayer :
     public BaseDataLayer<Dtype>, public InternalThread {
@@ -70,8 +77,10 @@ class BasePrefetchingDataLayer :
   virtual void load_batch(Batch<Dtype>* batch) = 0;
 
   vector<shared_ptr<Batch<Dtype> > > prefetch_;
-  BlockingQueue<Batch<Dtype>*> prefetch_free_;
-  BlockingQueue<Batch<Dtype>*> prefetch_full_;
+  // Batches only move between this layer's Forward and its prefetch thread,
+  // so the hand-off queues are single-producer/single-consumer.
+  SPSCQueue<Batch<Dtype>*> prefetch_free_;
+  SPSCQueue<Batch<Dtype>*> prefetch_full_;
   Batch<Dtype>* prefetch_current_;
 
   Blob<Dtype> transformed_data_;
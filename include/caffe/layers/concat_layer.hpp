@@ -24,6 +24,10 @@ class ConcatLayer : public Layer<Dtype> {
       const vector<Blob<Dtype>*>& top);
 
   virtual inline const char* type() const { return "Concat"; }
+  // A single blob is passed through by sharing its data.
+  virtual inline bool SharesBottomData() const {
+    return this->layer_param_.bottom_size() == 1;
+  }
   virtual inline int MinBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
 
@@ -28,11 +28,19 @@ class DataLayer : public BasePrefetchingDataLayer<Dtype> {
  protected:
   void Next();
   bool Skip();
+  void ParseCurrentDatum(Datum* datum);
   virtual void load_batch(Batch<Dtype>* batch);
 
   shared_ptr<db::DB> db_;
   shared_ptr<db::Cursor> cursor_;
   uint64_t offset_;
+
+  /// Records of the batch being loaded, reused across batches.
+  vector<Datum> batch_datums_;
+  /// Transformer and output view of each decode/transform worker; worker 0
+  /// shares the layer's own data_transformer_.
+  vector<shared_ptr<DataTransformer<Dtype> > > worker_transformers_;
+  vector<shared_ptr<Blob<Dtype> > > worker_transformed_data_;
 };
 
 }  // namespace caffe
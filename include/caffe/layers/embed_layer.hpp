@@ -30,6 +30,13 @@ class EmbedLayer : public Layer<Dtype> {
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
 
+  /// @brief With sparse_gradient, the rows of the weights indexed since the
+  ///        last ClearParamDiffRows.
+  virtual const vector<int>* param_diff_rows(const int param_id) const {
+    return (sparse_gradient_ && param_id == 0) ? &weight_diff_rows_ : NULL;
+  }
+  virtual void ClearParamDiffRows();
+
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
@@ -45,6 +52,11 @@ class EmbedLayer : public Layer<Dtype> {
   int N_;
   bool bias_term_;
   Blob<Dtype> bias_multiplier_;
+  bool sparse_gradient_;
+  /// @brief The rows of the weight diff added to, and which of the K_ rows
+  ///        are among them.
+  vector<int> weight_diff_rows_;
+  vector<bool> weight_diff_row_listed_;
 };
 
 }  // namespace caffe
@@ -0,0 +1,103 @@
+#ifndef CAFFE_FUSED_LSTM_LAYER_HPP_
+#define CAFFE_FUSED_LSTM_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Computes the same LSTM as LSTMLayer, with the same inputs, outputs
+ *        and parameters, without unrolling it into a net of layers per
+ *        timestep.
+ *
+ * The input transform @f$ W_{xc} x_t + b_c @f$ of all the timesteps is one
+ * GEMM over the @f$ T N @f$ rows of the input, and so is each of the
+ * parameter gradients in the backward pass. Only the recurrent transform
+ * @f$ W_{hc} h_{t-1} @f$ remains a GEMM per timestep; the gate
+ * nonlinearities and the cell and hidden updates of a timestep then run as
+ * one fused loop, over the streams in parallel on the CPU and as one kernel
+ * on the GPU. The gates, cells and recurrent inputs of all the timesteps are
+ * kept in a workspace of fixed size, and setting the layer up takes no
+ * sub-net, so it costs the same for any number of timesteps.
+ *
+ * As with LSTMLayer, no gradient flows into the exposed initial states
+ * @f$ h_0 @f$ and @f$ c_0 @f$, nor back across batches.
+ */
+template <typename Dtype>
+class FusedLSTMLayer : public Layer<Dtype> {
+ public:
+  explicit FusedLSTMLayer(const LayerParameter& param)
+      : Layer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  /// @brief Zero the hidden and cell states carried over between batches.
+  virtual void Reset();
+
+  virtual inline const char* type() const { return "LSTM"; }
+  virtual inline int MinBottomBlobs() const {
+    return expose_hidden() ? 4 : 2;
+  }
+  virtual inline int MaxBottomBlobs() const { return MinBottomBlobs() + 1; }
+  virtual inline int ExactNumTopBlobs() const {
+    return expose_hidden() ? 3 : 1;
+  }
+
+  virtual inline bool AllowForceBackward(const int bottom_index) const {
+    // Can't propagate to sequence continuation indicators.
+    return bottom_index != 1;
+  }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+
+  inline bool expose_hidden() const {
+    return this->layer_param_.recurrent_param().expose_hidden();
+  }
+  /// @brief The index in blobs_ of @f$ W_{hc} @f$, after @f$ W_{xc} @f$,
+  ///        @f$ b_c @f$ and, with a static input, @f$ W_{xc,static} @f$.
+  inline int recurrent_weight_index() const { return 2 + static_input_; }
+
+  /// @brief The number of timesteps T, of streams N, and the hidden
+  ///        dimension H.
+  int T_, N_, H_;
+  /// @brief The dimensions of an input and of a static input.
+  int input_dim_, static_dim_;
+  bool static_input_;
+
+  /// @brief (T x N x 4H) gate activations (i, f, o, g); their diff holds the
+  ///        gradient with respect to the gate inputs.
+  Blob<Dtype> gates_;
+  /// @brief ((T + 1) x N x H) cells, with @f$ c_0 @f$ first.
+  Blob<Dtype> cell_;
+  /// @brief (T x N x H) @f$ \tanh(c_t) @f$.
+  Blob<Dtype> tanh_cell_;
+  /// @brief (T x N x H) @f$ \delta_t h_{t-1} @f$, the input of the
+  ///        recurrent transform.
+  Blob<Dtype> hidden_conted_;
+  /// @brief (N x 4H) static input transform; its diff sums the gate
+  ///        gradients over the timesteps.
+  Blob<Dtype> static_gates_;
+  /// @brief (2 x N x H) the gradients with respect to @f$ h_{t-1} @f$ and
+  ///        @f$ c_{t-1} @f$ carried between timesteps of the backward pass.
+  Blob<Dtype> recurrent_diff_;
+  /// @brief (1 x N x H) the final hidden and cell states of the last batch,
+  ///        the initial ones of the next unless expose_hidden.
+  Blob<Dtype> hidden_T_, cell_T_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_FUSED_LSTM_LAYER_HPP_
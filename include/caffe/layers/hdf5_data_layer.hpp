@@ -7,8 +7,10 @@
 #include <vector>
 
 #include "caffe/blob.hpp"
+#include "caffe/internal_thread.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/spsc_queue.hpp"
 
 #include "caffe/layers/base_data_layer.hpp"
 
@@ -17,13 +19,18 @@ namespace caffe {
 /**
  * @brief Provides data to the Net from HDF5 files.
  *
+ * Each top reads the dataset of the same name from the files listed in
+ * hdf5_data_param.source. A background thread streams the files in chunks
+ * of hdf5_data_param.chunk_size rows, reading only those rows, and
+ * assembles batches ahead of Forward, so files may be much larger than
+ * memory and switching files does not stall the Net.
+ *
  * TODO(dox): thorough documentation for Forward and proto params.
  */
 template <typename Dtype>
-class HDF5DataLayer : public Layer<Dtype> {
+class HDF5DataLayer : public Layer<Dtype>, public InternalThread {
  public:
-  explicit HDF5DataLayer(const LayerParameter& param)
-      : Layer<Dtype>(param), offset_() {}
+  explicit HDF5DataLayer(const LayerParameter& param);
   virtual ~HDF5DataLayer();
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
@@ -36,8 +43,16 @@ class HDF5DataLayer : public Layer<Dtype> {
   virtual inline int MinTopBlobs() const { return 1; }
 
  protected:
+  // The members below, up to the prefetch queues, belong to the prefetch
+  // thread while it runs.
   void Next();
   bool Skip();
+  void OpenFile();
+  void CloseFile();
+  void LoadChunk();
+
+  virtual void InternalThreadEntry();
+  void load_batch(BlobsBatch<Dtype>* batch);
 
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
@@ -47,16 +62,25 @@ class HDF5DataLayer : public Layer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {}
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {}
-  virtual void LoadHDF5FileData(const char* filename);
 
   std::vector<std::string> hdf_filenames_;
   unsigned int num_files_;
   unsigned int current_file_;
+  hid_t file_id_;
+  hsize_t file_rows_;
+  std::vector<unsigned int> chunk_permutation_;
+  unsigned int current_chunk_;
   hsize_t current_row_;
+  // The rows of the current chunk.
   std::vector<shared_ptr<Blob<Dtype> > > hdf_blobs_;
   std::vector<unsigned int> data_permutation_;
   std::vector<unsigned int> file_permutation_;
   uint64_t offset_;
+
+  vector<shared_ptr<BlobsBatch<Dtype> > > prefetch_;
+  SPSCQueue<BlobsBatch<Dtype>*> prefetch_free_;
+  SPSCQueue<BlobsBatch<Dtype>*> prefetch_full_;
+  BlobsBatch<Dtype>* prefetch_current_;
 };
 
 }  // namespace caffe
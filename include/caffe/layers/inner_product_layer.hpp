@@ -6,6 +6,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/syncedmem.hpp"
 
 namespace caffe {
 
@@ -38,6 +39,12 @@ class InnerProductLayer : public Layer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  /// @brief Forward_cpu in int8, see QuantizationParameter.
+  void Forward_cpu_int8(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  /// @brief The M_ ones by which the GPU passes add the bias with BLAS; the
+  ///        CPU passes do without them.
+  const Dtype* gpu_bias_multiplier();
 
   int M_;
   int K_;
@@ -45,6 +52,19 @@ class InnerProductLayer : public Layer<Dtype> {
   bool bias_term_;
   Blob<Dtype> bias_multiplier_;
   bool transpose_;  ///< if true, assume transposed weights
+  bool fused_relu_;  ///< if true, apply inner_product_param.fused_relu
+  Dtype relu_negative_slope_;
+  /// if true, Forward_cpu runs in int8 (quantization_param, TEST nets only)
+  bool int8_;
+  Dtype int8_input_scale_;
+  /// The weights quantized per output, as a K_ x N_ matrix.
+  shared_ptr<SyncedMemory> int8_weights_;
+  /// Converts an accumulated product of each output back to Dtype.
+  vector<Dtype> int8_output_scales_;
+  /// The SyncedMemory::version of the weights int8_weights_ holds.
+  uint64_t int8_weights_version_;
+  shared_ptr<SyncedMemory> int8_input_;
+  shared_ptr<SyncedMemory> int8_products_;
 };
 
 }  // namespace caffe
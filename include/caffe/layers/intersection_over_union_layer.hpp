@@ -5,6 +5,7 @@
 
 #include "caffe/blob.hpp"
 #include "caffe/layer.hpp"
+#include "caffe/metric_accumulator.hpp"
 #include "caffe/proto/caffe.pb.h"
 
 #include "caffe/layers/loss_layer.hpp"
@@ -14,9 +15,16 @@ namespace caffe {
 /**
  * @brief Computes the classification intersection over union for a one-of-many
  *        classification task.
+ *
+ * The layer counts, for each image, the pixels of each class in the ground
+ * truth, in the predictions, and in both. By default it outputs the mean over
+ * the images of their IoU, also in tests. With accumulate, the counts of the
+ * classes add up over Forward passes (see MetricAccumulator), and it outputs
+ * the IoU of all the pixels since ResetMetric, the dataset IoU in tests.
  */
 template <typename Dtype>
-class IntersectionOverUnionLayer : public Layer<Dtype> {
+class IntersectionOverUnionLayer
+    : public Layer<Dtype>, public MetricAccumulator<Dtype> {
  public:
   /**
    * @param param provides IntersectionOverUnionParameter intersectionoverunion_param,
@@ -24,6 +32,7 @@ class IntersectionOverUnionLayer : public Layer<Dtype> {
    *   - axis (\b optional, default 1).
    *   - has_ignore_label (\b optional, default false)
    *   - ignore_label (\b optional, default 0)
+   *   - accumulate (\b optional, default false)
    */
   explicit IntersectionOverUnionLayer(const LayerParameter& param)
       : Layer<Dtype>(param) {}
@@ -38,7 +47,11 @@ class IntersectionOverUnionLayer : public Layer<Dtype> {
   // If there are two top blobs, then the second blob will contain
   // intersection over union per class.
   virtual inline int MinTopBlobs() const { return 1; }
-  virtual inline int MaxTopBlos() const { return 2; }
+  virtual inline int MaxTopBlobs() const { return 2; }
+
+  virtual inline bool AccumulatesInScope() const {
+    return this->layer_param_.intersectionoverunion_param().accumulate();
+  }
 
  protected:
   /**
@@ -63,9 +76,12 @@ class IntersectionOverUnionLayer : public Layer<Dtype> {
    */
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
 
 
-  /// @brief Not implemented -- IntersectionOverUnionLayer cannot be used as a loss.
+  /// @brief Not implemented -- IntersectionOverUnionLayer cannot be used as a
+  ///        loss.
   virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
     for (int i = 0; i < propagate_down.size(); ++i) {
@@ -73,21 +89,24 @@ class IntersectionOverUnionLayer : public Layer<Dtype> {
     }
   }
 
+  /// @brief Compute the outputs from counts_, which both Forward passes fill.
+  void ComputeIoU(const vector<Blob<Dtype>*>& top);
+  /// @brief The IoU of the pixels counted in state (3 x C).
+  virtual void ComputeMetric(const vector<double>& state,
+      const vector<Blob<Dtype>*>& top) const;
+
   int label_axis_, outer_num_, inner_num_;
 
   /// Whether to ignore instances with a certain label.
   bool has_ignore_label_;
   /// The label indicating that an instance should be ignored.
   int ignore_label_;
-  /// Keeps count of outer number with occurences of each label
-  Blob<Dtype> nums_buffer_;
-
-  /// Keeps counts of the number of true predictions (intersection)
-  /// for each class.
-  Blob<Dtype> nums_intersect_;
-  /// Keeps counts of the number of predictions and ground truths (union)
-  /// for each class.
-  Blob<Dtype> nums_union_;
+
+  /// For each image, the number of pixels of each class in the ground truth,
+  /// in the predictions, and in both: (N x 3 x C).
+  Blob<int> counts_;
+  /// One copy of counts_ per CPU thread, merged after counting.
+  vector<int> thread_counts_;
 };
 
 }  // namespace caffe
@@ -17,6 +17,11 @@ namespace caffe {
 /**
  * @brief Normalize the input in a local region across or within feature maps.
  *
+ * On the CPU both regions are computed in a single pass, in parallel over
+ * images and blocks of positions (ACROSS_CHANNELS) or over feature maps
+ * (WITHIN_CHANNEL). The GPU builds WITHIN_CHANNEL from split, power, pooling
+ * and eltwise layers.
+ *
  * TODO(dox): thorough documentation for Forward, Backward, and proto params.
  */
 template <typename Dtype>
@@ -47,12 +52,16 @@ class LRNLayer : public Layer<Dtype> {
       const vector<Blob<Dtype>*>& top);
   virtual void CrossChannelForward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
+  virtual void WithinChannelForward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
   virtual void WithinChannelForward(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
   virtual void CrossChannelBackward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual void CrossChannelBackward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  virtual void WithinChannelBackward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual void WithinChannelBackward(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
@@ -66,11 +75,11 @@ class LRNLayer : public Layer<Dtype> {
   int height_;
   int width_;
 
-  // Fields used for normalization ACROSS_CHANNELS
-  // scale_ stores the intermediate summing results
+  // Fields used for normalization ACROSS_CHANNELS, and WITHIN_CHANNEL on the
+  // CPU: scale_ stores the intermediate summing results
   Blob<Dtype> scale_;
 
-  // Fields used for normalization WITHIN_CHANNEL
+  // Fields used for normalization WITHIN_CHANNEL on the GPU
   shared_ptr<SplitLayer<Dtype> > split_layer_;
   vector<Blob<Dtype>*> split_top_vec_;
   shared_ptr<PowerLayer<Dtype> > square_layer_;
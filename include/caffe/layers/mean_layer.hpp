@@ -5,6 +5,7 @@
 
 #include "caffe/blob.hpp"
 #include "caffe/layer.hpp"
+#include "caffe/metric_accumulator.hpp"
 #include "caffe/proto/caffe.pb.h"
 
 #include "caffe/layers/loss_layer.hpp"
@@ -13,9 +14,12 @@ namespace caffe {
 
 /**
  * @brief Computes the mean operation of an array
+ *
+ * While accumulating (see MetricAccumulator), it outputs the mean of all the
+ * values since ResetMetric.
  */
 template <typename Dtype>
-class MeanLayer : public Layer<Dtype> {
+class MeanLayer : public Layer<Dtype>, public MetricAccumulator<Dtype> {
  public:
   /**
    * @param param provides AccuracyParameter accuracy_param,
@@ -59,6 +63,10 @@ class MeanLayer : public Layer<Dtype> {
     }
   }
 
+  /// @brief The mean of the values in state: their sum and their number.
+  virtual void ComputeMetric(const vector<double>& state,
+      const vector<Blob<Dtype>*>& top) const;
+
   /// Whether to ignore instances with a certain label.
   bool has_ignore_label_;
   /// The label indicating that an instance should be ignored.
@@ -18,7 +18,7 @@ template <typename Dtype>
 class PoolingLayer : public Layer<Dtype> {
  public:
   explicit PoolingLayer(const LayerParameter& param)
-      : Layer<Dtype>(param) {}
+      : Layer<Dtype>(param), max_idx_filled_(false) {}
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
@@ -44,6 +44,13 @@ class PoolingLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  /// @brief Max pool one (num, channel) plane on the CPU, writing the index of
+  ///        each maximum within the plane to mask unless it is NULL.
+  template <typename Mask>
+  void MaxPoolPlane_cpu(const Dtype* bottom, Dtype* top, Mask* mask) const;
+  /// @brief Average pool one (num, channel) plane on the CPU.
+  void AvePoolPlane_cpu(const Dtype* bottom, Dtype* top) const;
+
   int kernel_h_, kernel_w_;
   int stride_h_, stride_w_;
   int pad_h_, pad_w_;
@@ -54,6 +61,14 @@ class PoolingLayer : public Layer<Dtype> {
   PoolingParameter_RoundMode round_mode_;
   Blob<Dtype> rand_idx_;
   Blob<int> max_idx_;
+  // Whether the last Forward_cpu filled max_idx_; TEST nets skip it.
+  bool max_idx_filled_;
+  // The pooling windows of each output row and column, clipped to the input,
+  // and their extents including padding, which average pooling divides by.
+  vector<int> row_start_, row_end_, row_size_;
+  vector<int> col_start_, col_end_, col_size_;
+  // The output columns whose windows lie entirely inside the input.
+  int interior_col_begin_, interior_col_end_;
 };
 
 }  // namespace caffe
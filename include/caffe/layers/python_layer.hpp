@@ -35,6 +35,9 @@ class PythonLayer : public Layer<Dtype> {
   }
 
   virtual inline const char* type() const { return "Python"; }
+  // Python code may share data between its blobs.
+  virtual inline bool SharesBottomData() const { return true; }
+  virtual inline bool ReshapeDependsOnlyOnShapes() const { return false; }
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -26,6 +26,10 @@ class SliceLayer : public Layer<Dtype> {
       const vector<Blob<Dtype>*>& top);
 
   virtual inline const char* type() const { return "Slice"; }
+  // A single blob is passed through by sharing its data.
+  virtual inline bool SharesBottomData() const {
+    return this->layer_param_.top_size() == 1;
+  }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int MinTopBlobs() const { return 1; }
 
@@ -0,0 +1,72 @@
+#ifndef CAFFE_WINOGRAD_CONV_LAYER_HPP_
+#define CAFFE_WINOGRAD_CONV_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#include "caffe/layers/conv_layer.hpp"
+
+namespace caffe {
+
+/**
+ * @brief CPU convolution without the im2col buffer for the filter geometries
+ *        that dominate modern models. Falls back to ConvolutionLayer for
+ *        everything else, for the backward pass, and in GPU mode.
+ *
+ * - 3x3 filters with stride 1 and no dilation use Winograd minimal filtering
+ *   (Lavin & Gray, "Fast Algorithms for Convolutional Neural Networks"):
+ *   F(4x4, 3x3) when both output dimensions are at least 8 and F(2x2, 3x3)
+ *   otherwise. The inputs and filters are transformed to the Winograd domain,
+ *   multiplied by one GEMM per tile element, and the products transformed
+ *   back, which takes 4 (F(2x2, 3x3)) or 2.25 (F(4x4, 3x3)) multiplies per
+ *   output instead of 9. F(4x4, 3x3) is somewhat less accurate; expect
+ *   relative errors around 1e-5 in single precision. The transformed filters
+ *   are kept until the weights are written or the tile size changes.
+ * - 1x1 filters with stride or padding (where ConvolutionLayer would still
+ *   run im2col) are computed directly from the input, with inner loops over
+ *   output columns laid out for the compiler to vectorize.
+ *
+ * Bias is added while writing the output instead of by a separate GEMM.
+ */
+template <typename Dtype>
+class WinogradConvolutionLayer : public ConvolutionLayer<Dtype> {
+ public:
+  explicit WinogradConvolutionLayer(const LayerParameter& param)
+      : ConvolutionLayer<Dtype>(param), tile_size_(0),
+        transformed_weights_version_(0) {}
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  enum Algorithm { IM2COL, WINOGRAD, DIRECT_1X1 };
+
+  void WinogradTransformWeights(const Dtype* weights);
+  void WinogradForward(const Dtype* input, const Dtype* bias, Dtype* output,
+      Dtype* workspace);
+  void Direct1x1Forward(const Dtype* input, const Dtype* weights,
+      const Dtype* bias, Dtype* output);
+
+  Algorithm algorithm_;
+  /// @brief Winograd output tile size m and input tile size m + 2.
+  int tile_size_, tile_input_size_;
+  int tiles_h_, tiles_w_;
+  /// @brief Per-thread workspace size for the transformed inputs and outputs.
+  int workspace_count_;
+  /// @brief Filters in the Winograd domain, (m + 2)^2 x num_output x
+  ///        (channels / group).
+  Blob<Dtype> transformed_weights_;
+  /// @brief The SyncedMemory::version of the weights transformed_weights_
+  ///        holds, or 0 if it must be computed again.
+  uint64_t transformed_weights_version_;
+  Blob<Dtype> workspace_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_WINOGRAD_CONV_LAYER_HPP_
@@ -0,0 +1,94 @@
+#ifndef CAFFE_METRIC_ACCUMULATOR_HPP_
+#define CAFFE_METRIC_ACCUMULATOR_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+template <typename Dtype> class Net;
+
+/**
+ * @brief Interface of the layers whose metric over a dataset is not the mean
+ *        of its values over the batches, such as accuracy with ignored
+ *        labels or intersection over union.
+ *
+ * Such a layer reduces each batch to a few sums, its state, from which it
+ * computes the metric. While accumulating, every Forward adds the sums of its
+ * batch to the state instead, and outputs the metric of all the batches since
+ * ResetMetric. No predictions are kept. States only ever add up, so the states
+ * of the same layer in nets that test different parts of a dataset merge into
+ * the state of the whole: MergeMetricState the others into one layer, then
+ * FinalizeMetric it.
+ */
+template <typename Dtype>
+class MetricAccumulator {
+ public:
+  MetricAccumulator() : accumulating_(false) {}
+  virtual ~MetricAccumulator() {}
+
+  /// @brief Forget the batches so far, and accumulate from now on.
+  void ResetMetric();
+  /// @brief Go back to computing the metric of each batch on its own.
+  void StopAccumulating() { accumulating_ = false; }
+  inline bool accumulating() const { return accumulating_; }
+  /// @brief Whether ScopedMetricAccumulation makes the layer accumulate; if
+  ///        not, its output over the passes is the mean of theirs.
+  virtual inline bool AccumulatesInScope() const { return true; }
+
+  /// @brief The sums of the batches since ResetMetric.
+  const vector<double>& metric_state() const { return metric_state_; }
+  /// @brief Add the state of the same layer in another net.
+  void MergeMetricState(const vector<double>& state);
+  /// @brief Output the metric of the state to top, as Forward does.
+  void FinalizeMetric(const vector<Blob<Dtype>*>& top) const {
+    ComputeMetric(metric_state_, top);
+  }
+
+ protected:
+  /// @brief Compute the outputs of the layer from a state.
+  virtual void ComputeMetric(const vector<double>& state,
+      const vector<Blob<Dtype>*>& top) const = 0;
+  /// @brief Size the state, from Reshape; a new size starts over.
+  void ReshapeMetricState(int size);
+  /// @brief Output the metric of the batch whose sums are batch_state, or of
+  ///        all the batches so far while accumulating.
+  void UpdateMetric(const vector<double>& batch_state,
+      const vector<Blob<Dtype>*>& top);
+
+  bool accumulating_;
+  vector<double> metric_state_;
+};
+
+/**
+ * @brief Accumulates the metrics of a net over the Forward passes made while
+ *        it exists, as Solver::Test and caffe test do over their iterations.
+ *
+ * Every MetricAccumulator layer of the net that AccumulatesInScope is reset to
+ * accumulate; those that did not accumulate before stop again when the scope
+ * ends.
+ */
+template <typename Dtype>
+class ScopedMetricAccumulation {
+ public:
+  explicit ScopedMetricAccumulation(const Net<Dtype>& net);
+  ~ScopedMetricAccumulation();
+
+  /// @brief Whether the value of output blob i after the last pass is already
+  ///        the metric over all the passes, rather than that of one pass to
+  ///        average: the outputs of accumulating layers, and of the layers
+  ///        computed from them.
+  bool accumulated_output(int i) const { return accumulated_output_[i]; }
+
+ private:
+  vector<MetricAccumulator<Dtype>*> started_;
+  vector<bool> accumulated_output_;
+
+  DISABLE_COPY_AND_ASSIGN(ScopedMetricAccumulation);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_METRIC_ACCUMULATOR_HPP_
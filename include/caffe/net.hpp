@@ -14,6 +14,8 @@
 
 namespace caffe {
 
+template <typename Dtype> class NetProfiler;
+
 /**
  * @brief Connects Layer%s together into a directed acyclic graph (DAG)
  *        specified by a NetParameter.
@@ -78,10 +80,23 @@ class Net {
    * @brief Reshape all layers from bottom to top.
    *
    * This is useful to propagate changes to layer sizes without running
-   * a forward pass, e.g. to compute output feature size.
+   * a forward pass, e.g. to compute output feature size. In a net with
+   * shape buckets, layers whose bottom shapes are unchanged are skipped.
    */
   void Reshape();
 
+  /// @brief Whether the net was planned for NetParameter.shape_bucket.
+  inline bool has_shape_buckets() const { return has_shape_buckets_; }
+  /// @brief The number of layer Reshapes skipped, in a net with shape
+  ///        buckets, because their bottom shapes were unchanged.
+  int reshapes_skipped() const;
+  /**
+   * @brief The number of times, in a net with shape buckets, that a blob grew
+   *        past any shape it had since Init but stayed within what was
+   *        planned. Without the buckets, each would have reallocated it.
+   */
+  inline int reallocations_avoided() const { return reallocations_avoided_; }
+
   Dtype ForwardBackward() {
     Dtype loss;
     Forward(&loss);
@@ -91,6 +106,17 @@ class Net {
 
   /// @brief Updates the network weights based on the diff values computed.
   void Update();
+  /**
+   * @brief Whether the diff of learnable_params()[param_id] is row-sparse:
+   *        zero but for the rows (indices along its first axis) that the
+   *        Backward passes since ClearParamDiffs added to. If so, fills rows
+   *        with them, in increasing order.
+   *
+   * A parameter is row-sparse in CPU mode with a single solver, when every
+   * layer using it lists its rows with Layer::param_diff_rows, and until
+   * Update writes all of its diff.
+   */
+  bool ParamDiffRows(int param_id, vector<int>* rows) const;
   /**
    * @brief Shares weight data of owner blobs with shared blobs.
    *
@@ -116,8 +142,16 @@ class Net {
   void CopyTrainedLayersFromHDF5(const string& trained_filename);
   /// @brief Writes the net to a proto.
   void ToProto(NetParameter* param, bool write_diff = false) const;
+  /// @brief Writes the net to a proto with the parameter values of params,
+  ///        e.g. a copy of params() taken earlier.
+  void ToProto(NetParameter* param,
+      const vector<shared_ptr<Blob<Dtype> > >& params, bool write_diff) const;
   /// @brief Writes the net to an HDF5 file.
   void ToHDF5(const string& filename, bool write_diff = false) const;
+  /// @brief Writes the parameter values of params, shaped like params(), to
+  ///        an HDF5 file.
+  void ToHDF5(const string& filename,
+      const vector<shared_ptr<Blob<Dtype> > >& params, bool write_diff) const;
 
   /// @brief returns the network name.
   inline const string& name() const { return name_; }
@@ -177,6 +211,32 @@ class Net {
   inline const vector<Blob<Dtype>*>& learnable_params() const {
     return learnable_params_;
   }
+  /**
+   * @brief Whether the learnable parameters live in one contiguous buffer for
+   *        their data and one for their diffs (contiguous_params), laid out
+   *        in the order of learnable_params().
+   *
+   * The mutable_{cpu,gpu}_params_{data,diff} accessors bring every learnable
+   * parameter up to date on the CPU or GPU and return the start of the
+   * buffer, which holds params_count() values. The GPU buffers exist only if
+   * the net was created in GPU mode.
+   */
+  inline bool contiguous_params() const {
+    return params_data_arena_.get() != NULL;
+  }
+  inline int params_count() const { return params_count_; }
+  Dtype* mutable_cpu_params_data() {
+    return SyncContiguousParams(false, false);
+  }
+  Dtype* mutable_cpu_params_diff() {
+    return SyncContiguousParams(true, false);
+  }
+  Dtype* mutable_gpu_params_data() {
+    return SyncContiguousParams(false, true);
+  }
+  Dtype* mutable_gpu_params_diff() {
+    return SyncContiguousParams(true, true);
+  }
   /// @brief returns the learnable parameter learning rate multipliers
   inline const vector<float>& params_lr() const { return params_lr_; }
   inline const vector<bool>& has_params_lr() const { return has_params_lr_; }
@@ -252,6 +312,16 @@ class Net {
     after_backward_.push_back(value);
   }
 
+  /**
+   * @brief Start recording per-layer timings, memory use and FLOP estimates
+   *        through the callbacks above; see NetProfiler. Returns the
+   *        profiler, which is created on the first call and lives as long
+   *        as the net.
+   */
+  NetProfiler<Dtype>* EnableProfiling();
+  /// @brief The profiler attached by EnableProfiling(), or NULL.
+  NetProfiler<Dtype>* profiler() const { return profiler_.get(); }
+
  protected:
   // Helpers for Init.
   /// @brief Append a new top blob to the net.
@@ -265,6 +335,19 @@ class Net {
   /// @brief Append a new parameter blob to the net.
   void AppendParam(const NetParameter& param, const int layer_id,
                    const int param_id);
+  /// @brief Let blobs with disjoint lifetimes share storage (optimize_memory).
+  void OptimizeMemory(const NetParameter& param);
+  /// @brief Reshape the net for each shape bucket of param, then back to its
+  ///        input shapes, and let its layers skip unchanged reshapes.
+  void PlanShapeBuckets(const NetParameter& param);
+  /// @brief Count the blobs that grew within their planned counts.
+  void CountAvoidedReallocations();
+  /// @brief Move the learnable parameters into one buffer for their data and
+  ///        one for their diffs (contiguous_params).
+  void AllocateContiguousParams();
+  /// @brief Sync the data or diff of every learnable parameter to the CPU or
+  ///        GPU and return the contiguous buffer holding them.
+  Dtype* SyncContiguousParams(bool diff, bool gpu);
 
   /// @brief Helper for displaying debug info in Forward.
   void ForwardDebugInfo(const int layer_id);
@@ -287,6 +370,8 @@ class Net {
   vector<string> blob_names_;
   map<string, int> blob_names_index_;
   vector<bool> blob_need_backward_;
+  /// Whether each blob's storage is shared by OptimizeMemory; empty otherwise.
+  vector<bool> blob_shares_storage_;
   /// bottom_vecs stores the vectors containing the input for each layer.
   /// They don't actually host the blobs (blobs_ does), so we simply store
   /// pointers.
@@ -326,6 +411,24 @@ class Net {
   /// the weight decay multipliers for learnable_params_
   vector<float> params_weight_decay_;
   vector<bool> has_params_decay_;
+  /// The buffers behind the learnable parameters with contiguous_params,
+  /// and their total count.
+  shared_ptr<SyncedMemory> params_data_arena_;
+  shared_ptr<SyncedMemory> params_diff_arena_;
+  int params_count_;
+  Dtype* params_cpu_data_;
+  Dtype* params_cpu_diff_;
+  Dtype* params_gpu_data_;
+  Dtype* params_gpu_diff_;
+  /// Whether the diffs of the row-sparse parameters are zero outside the rows
+  /// their layers list; false from Update until ClearParamDiffs.
+  bool param_diff_rows_valid_;
+  /// With shape buckets, the largest count of each blob over the buckets,
+  /// and the largest it has had outside of planning.
+  bool has_shape_buckets_;
+  vector<int> blob_planned_counts_;
+  vector<int> blob_unplanned_counts_;
+  int reallocations_avoided_;
   /// The bytes of memory used by this net
   size_t memory_used_;
   /// Whether to compute and display debug info for the net.
@@ -335,6 +438,7 @@ class Net {
   vector<Callback*> after_forward_;
   vector<Callback*> before_backward_;
   vector<Callback*> after_backward_;
+  shared_ptr<NetProfiler<Dtype> > profiler_;
 
 DISABLE_COPY_AND_ASSIGN(Net);
 };
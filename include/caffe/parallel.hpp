@@ -48,7 +48,9 @@ class Params {
 DISABLE_COPY_AND_ASSIGN(Params);
 };
 
-// Params stored in GPU memory.
+// Params stored in GPU memory. If the net already keeps its parameters in
+// contiguous buffers on the device (contiguous_params), they are used in
+// place instead of being copied.
 template<typename Dtype>
 class GPUParams : public Params<Dtype> {
  public:
@@ -61,6 +63,7 @@ class GPUParams : public Params<Dtype> {
   using Params<Dtype>::size_;
   using Params<Dtype>::data_;
   using Params<Dtype>::diff_;
+  bool own_buffers_;            // False when the buffers belong to the net
 };
 
 template<typename Dtype>
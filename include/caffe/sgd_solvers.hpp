@@ -19,6 +19,7 @@ class SGDSolver : public Solver<Dtype> {
       : Solver<Dtype>(param) { PreSolve(); }
   explicit SGDSolver(const string& param_file)
       : Solver<Dtype>(param_file) { PreSolve(); }
+  virtual ~SGDSolver() { this->WaitForSnapshots(); }
   virtual inline const char* type() const { return "SGD"; }
 
   const vector<shared_ptr<Blob<Dtype> > >& history() { return history_; }
@@ -31,10 +32,36 @@ class SGDSolver : public Solver<Dtype> {
   virtual void Normalize(int param_id);
   virtual void Regularize(int param_id);
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  // The CPU counterpart of ComputeUpdateValue for the fused update: compute
+  // the update of count elements of a parameter, starting at offset, from
+  // their gradient in diff, and store it in diff.
+  virtual void FusedUpdateValue(int param_id, Dtype rate, int offset,
+      int count, Dtype* diff);
+  // Normalize, regularize, compute and apply the update of all the learnable
+  // parameters in one multithreaded pass over blocks small enough to stay in
+  // cache through all the steps (fused_update in CPU mode).
+  void ApplyFusedUpdate(Dtype rate);
+  // The same steps for the listed rows of a row-sparse parameter only, in
+  // CPU mode; the others keep their values and solver state.
+  void ApplySparseUpdate(int param_id, Dtype rate);
+  // The steps of the fused and sparse updates for count elements of a
+  // parameter, starting at offset, in the data and diff of the parameter.
+  // The normalization, the decay of the parameter and whether it is L1 are
+  // computed once by the callers, outside their loops over ranges.
+  void FusedUpdateRange(int param_id, Dtype rate, Dtype accum_normalization,
+      Dtype local_decay, bool l1, int offset, int count, Dtype* data,
+      Dtype* diff);
+  // Checks regularization_type and returns whether it is L1.
+  bool FusedRegularizationL1() const;
+  void SetFusedHistory();
   virtual void ClipGradients();
-  virtual void SnapshotSolverState(const string& model_filename);
-  virtual void SnapshotSolverStateToBinaryProto(const string& model_filename);
-  virtual void SnapshotSolverStateToHDF5(const string& model_filename);
+  virtual void StageSnapshot(SolverSnapshot<Dtype>* snapshot, bool copy);
+  virtual void SnapshotSolverState(const SolverSnapshot<Dtype>& snapshot,
+      const string& model_filename);
+  virtual void SnapshotSolverStateToBinaryProto(
+      const SolverSnapshot<Dtype>& snapshot, const string& model_filename);
+  virtual void SnapshotSolverStateToHDF5(
+      const SolverSnapshot<Dtype>& snapshot, const string& model_filename);
   virtual void RestoreSolverStateFromHDF5(const string& state_file);
   virtual void RestoreSolverStateFromBinaryProto(const string& state_file);
   // history maintains the historical momentum data.
@@ -42,6 +69,12 @@ class SGDSolver : public Solver<Dtype> {
   // temp maintains other information that might be needed in computation
   //   of gradients/updates and is not needed in snapshots
   vector<shared_ptr<Blob<Dtype> > > history_, update_, temp_;
+  // The CPU data of history_, taken before the fused update threads start.
+  vector<Dtype*> fused_history_;
+  // Which learnable parameters have a row-sparse gradient in this update
+  // (see Net::ParamDiffRows), and its rows.
+  vector<bool> row_sparse_;
+  vector<vector<int> > sparse_rows_;
 
   DISABLE_COPY_AND_ASSIGN(SGDSolver);
 };
@@ -57,6 +90,8 @@ class NesterovSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void FusedUpdateValue(int param_id, Dtype rate, int offset,
+      int count, Dtype* diff);
 
   DISABLE_COPY_AND_ASSIGN(NesterovSolver);
 };
@@ -72,6 +107,8 @@ class AdaGradSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void FusedUpdateValue(int param_id, Dtype rate, int offset,
+      int count, Dtype* diff);
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with AdaGrad.";
@@ -92,6 +129,8 @@ class RMSPropSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void FusedUpdateValue(int param_id, Dtype rate, int offset,
+      int count, Dtype* diff);
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with RMSProp.";
@@ -116,6 +155,8 @@ class AdaDeltaSolver : public SGDSolver<Dtype> {
  protected:
   void AdaDeltaPreSolve();
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void FusedUpdateValue(int param_id, Dtype rate, int offset,
+      int count, Dtype* diff);
 
   DISABLE_COPY_AND_ASSIGN(AdaDeltaSolver);
 };
@@ -140,6 +181,8 @@ class AdamSolver : public SGDSolver<Dtype> {
  protected:
   void AdamPreSolve();
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void FusedUpdateValue(int param_id, Dtype rate, int offset,
+      int count, Dtype* diff);
 
   DISABLE_COPY_AND_ASSIGN(AdamSolver);
 };
@@ -4,9 +4,11 @@
 #include <string>
 #include <vector>
 
+#include "caffe/internal_thread.hpp"
 #include "caffe/net.hpp"
 #include "caffe/solver_factory.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/spsc_queue.hpp"
 
 namespace caffe {
 
@@ -32,6 +34,21 @@ namespace caffe {
  */
 typedef boost::function<SolverAction::Enum()> ActionCallback;
 
+/**
+ * @brief The state a snapshot saves. The blobs are either the Solver's own or,
+ *        for an asynchronous snapshot, copies of them that training does not
+ *        touch while they are written.
+ */
+template <typename Dtype>
+struct SolverSnapshot {
+  int iter;
+  int current_step;
+  // Shaped like Net::params(), with diffs if snapshot_diff is set.
+  vector<shared_ptr<Blob<Dtype> > > params;
+  // The solver history, e.g. the momentum of SGD.
+  vector<shared_ptr<Blob<Dtype> > > history;
+};
+
 /**
  * @brief An interface for classes that perform optimization on Net%s.
  *
@@ -64,8 +81,14 @@ class Solver {
   // The Solver::Snapshot function implements the basic snapshotting utility
   // that stores the learned net. You should implement the SnapshotSolverState()
   // function that produces a SolverState protocol buffer that needs to be
-  // written to disk together with the learned net.
+  // written to disk together with the learned net. With snapshot_async the
+  // files are written in the background; see WaitForSnapshots().
   void Snapshot();
+  // Returns once all the snapshots taken so far are written.
+  void WaitForSnapshots();
+  // Subclasses that implement SnapshotSolverState() should call
+  // WaitForSnapshots() in their destructors, since it may still be running
+  // for an asynchronous snapshot.
   virtual ~Solver() {}
   inline const SolverParameter& param() const { return param_; }
   inline shared_ptr<Net<Dtype> > net() { return net_; }
@@ -98,17 +121,45 @@ class Solver {
   virtual void ApplyUpdate() = 0;
 
  protected:
+  // Writes staged snapshots in the background.
+  class SnapshotThread : public InternalThread {
+   public:
+    SnapshotThread(Solver* solver, int max_pending);
+    virtual ~SnapshotThread() { StopInternalThread(); }
+
+    // Snapshots free for staging, and staged ones waiting to be written.
+    SPSCQueue<SolverSnapshot<Dtype>*> free_;
+    SPSCQueue<SolverSnapshot<Dtype>*> full_;
+
+   protected:
+    virtual void InternalThreadEntry();
+
+    Solver* solver_;
+    vector<shared_ptr<SolverSnapshot<Dtype> > > snapshots_;
+  };
+
   string SnapshotFilename(const string& extension);
-  string SnapshotToBinaryProto();
-  string SnapshotToHDF5();
+  string SnapshotFilename(const string& extension, int iter);
+  // Fill snapshot with the current state, copying the blobs if copy is set.
+  virtual void StageSnapshot(SolverSnapshot<Dtype>* snapshot, bool copy);
+  // Point staged at blobs, or with copy, copy their data (and diffs, with
+  // diff) into the host memory of staged.
+  static void StageBlobs(const vector<shared_ptr<Blob<Dtype> > >& blobs,
+      bool copy, bool diff, vector<shared_ptr<Blob<Dtype> > >* staged);
+  void WriteSnapshot(const SolverSnapshot<Dtype>& snapshot);
+  string SnapshotToBinaryProto(const SolverSnapshot<Dtype>& snapshot);
+  string SnapshotToHDF5(const SolverSnapshot<Dtype>& snapshot);
   // The test routine
   void TestAll();
   void Test(const int test_net_id = 0);
-  virtual void SnapshotSolverState(const string& model_filename) = 0;
+  virtual void SnapshotSolverState(const SolverSnapshot<Dtype>& snapshot,
+      const string& model_filename) = 0;
   virtual void RestoreSolverStateFromHDF5(const string& state_file) = 0;
   virtual void RestoreSolverStateFromBinaryProto(const string& state_file) = 0;
   void DisplayOutputBlobs(const int net_id);
   void UpdateSmoothedLoss(Dtype loss, int start_iter, int average_loss);
+  // Log, and possibly write out, the train net profile since the last report.
+  void ReportProfile();
 
   SolverParameter param_;
   int iter_;
@@ -130,6 +181,9 @@ class Solver {
   Timer iteration_timer_;
   float iterations_last_;
 
+  // Started by the first asynchronous snapshot.
+  shared_ptr<SnapshotThread> snapshot_thread_;
+
   DISABLE_COPY_AND_ASSIGN(Solver);
 };
 
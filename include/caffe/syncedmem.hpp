@@ -1,6 +1,7 @@
 #ifndef CAFFE_SYNCEDMEM_HPP_
 #define CAFFE_SYNCEDMEM_HPP_
 
+#include <stdint.h>
 #include <cstdlib>
 
 #ifdef USE_MKL
@@ -68,6 +69,15 @@ class SyncedMemory {
   enum SyncedHead { UNINITIALIZED, HEAD_AT_CPU, HEAD_AT_GPU, SYNCED };
   SyncedHead head() const { return head_; }
   size_t size() const { return size_; }
+  /**
+   * @brief Changes, to a value no SyncedMemory has had before, whenever the
+   *        data may be written: on mutable_{cpu,gpu}_data and
+   *        set_{cpu,gpu}_data.
+   *
+   * Caches derived from the data, like the int8 weights of a quantized layer,
+   * compare it to know when to recompute.
+   */
+  uint64_t version() const { return version_; }
 
 #ifndef CPU_ONLY
   void async_gpu_push(const cudaStream_t& stream);
@@ -78,6 +88,7 @@ class SyncedMemory {
 
   void to_cpu();
   void to_gpu();
+  void bump_version();
   void* cpu_ptr_;
   void* gpu_ptr_;
   size_t size_;
@@ -86,6 +97,7 @@ class SyncedMemory {
   bool cpu_malloc_use_cuda_;
   bool own_gpu_data_;
   int device_;
+  uint64_t version_;
 
   DISABLE_COPY_AND_ASSIGN(SyncedMemory);
 };  // class SyncedMemory
@@ -0,0 +1,24 @@
+#ifndef CAFFE_UTIL_CALIBRATE_INT8_HPP_
+#define CAFFE_UTIL_CALIBRATE_INT8_HPP_
+
+#include <set>
+#include <string>
+
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Run iterations forward passes of a TEST phase net over representative data,
+// recording the largest absolute input of every Convolution (CAFFE engine)
+// and InnerProduct layer, and write them as the quantization_param of the
+// layers of the same name in param, selecting their int8 implementation.
+// Layers named in skip_layers keep computing in floating point. Returns the
+// number of layers quantized.
+template <typename Dtype>
+int CalibrateInt8(Net<Dtype>* net, int iterations, NetParameter* param,
+    const std::set<string>& skip_layers = std::set<string>());
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_CALIBRATE_INT8_HPP_
@@ -18,8 +18,25 @@ class Cursor {
   virtual void Next() = 0;
   virtual string key() = 0;
   virtual string value() = 0;
+  /**
+   * @brief Zero-copy access to the current value: returns a pointer to its
+   *        bytes and stores their count in size. The bytes stay valid until
+   *        the cursor is moved or destroyed, so parse them right away.
+   *
+   * Backends that can expose their storage directly (LMDB's memory-mapped
+   * pages, LevelDB's iterator slices) override this; the default keeps a copy
+   * of value() in the cursor.
+   */
+  virtual const char* value_data(size_t* size) {
+    value_copy_ = value();
+    *size = value_copy_.size();
+    return value_copy_.data();
+  }
   virtual bool valid() = 0;
 
+ protected:
+  string value_copy_;
+
   DISABLE_COPY_AND_ASSIGN(Cursor);
 };
 
@@ -23,6 +23,11 @@ class LevelDBCursor : public Cursor {
   virtual void Next() { iter_->Next(); }
   virtual string key() { return iter_->key().ToString(); }
   virtual string value() { return iter_->value().ToString(); }
+  virtual const char* value_data(size_t* size) {
+    leveldb::Slice value = iter_->value();
+    *size = value.size();
+    return value.data();
+  }
   virtual bool valid() { return iter_->Valid(); }
 
  private:
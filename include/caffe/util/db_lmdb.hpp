@@ -34,6 +34,11 @@ class LMDBCursor : public Cursor {
     return string(static_cast<const char*>(mdb_value_.mv_data),
         mdb_value_.mv_size);
   }
+  // Points into the read-only memory map; valid until the cursor moves.
+  virtual const char* value_data(size_t* size) {
+    *size = mdb_value_.mv_size;
+    return static_cast<const char*>(mdb_value_.mv_data);
+  }
   virtual bool valid() { return valid_; }
 
  private:
@@ -0,0 +1,22 @@
+#ifndef CAFFE_UTIL_FUSE_LAYERS_HPP_
+#define CAFFE_UTIL_FUSE_LAYERS_HPP_
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Copy a TEST phase NetParameter into param_fused with the layers that only
+// transform the output of a Convolution or InnerProduct folded into it, for
+// a shorter but numerically equivalent inference net:
+//  - BatchNorm layers using global statistics, and following Scale and Bias
+//    layers, are folded into the producer's weights and bias;
+//  - a ReLU ending such a chain becomes the producer's fused_relu.
+// Folding into the weights needs the trained blobs in the layers of param (as
+// in a .caffemodel); without them only ReLUs are fused. A layer is only
+// folded when it is the sole consumer of the producer's output. Returns the
+// number of layers removed.
+int FuseLayers(const NetParameter& param, NetParameter* param_fused);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_FUSE_LAYERS_HPP_
@@ -3,6 +3,7 @@
 #define CAFFE_UTIL_HDF5_H_
 
 #include <string>
+#include <vector>
 
 #include "hdf5.h"
 #include "hdf5_hl.h"
@@ -11,6 +12,22 @@
 
 namespace caffe {
 
+// Holds a process-wide lock on the HDF5 library, which is only safe to call
+// from one thread at a time unless built thread-safe. Take it around HDF5
+// calls in code that may run while a prefetching HDF5DataLayer reads.
+class HDF5Lock {
+ public:
+  HDF5Lock();
+  ~HDF5Lock();
+
+DISABLE_COPY_AND_ASSIGN(HDF5Lock);
+};
+
+// The dimensions of a float or integer dataset, checking that it has between
+// min_dim and max_dim axes.
+std::vector<hsize_t> hdf5_get_nd_dataset_dims(
+    hid_t file_id, const char* dataset_name_, int min_dim, int max_dim);
+
 template <typename Dtype>
 void hdf5_load_nd_dataset_helper(
     hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
@@ -21,6 +38,12 @@ void hdf5_load_nd_dataset(
     hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
     Blob<Dtype>* blob, bool reshape = false);
 
+// Read num_rows entries along the first axis of a dataset, starting at row,
+// without loading the rest of it.
+template <typename Dtype>
+void hdf5_load_nd_dataset_rows(hid_t file_id, const char* dataset_name_,
+    hsize_t row, hsize_t num_rows, Dtype* data);
+
 template <typename Dtype>
 void hdf5_save_nd_dataset(
     const hid_t file_id, const string& dataset_name, const Blob<Dtype>& blob,
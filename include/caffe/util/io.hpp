@@ -90,6 +90,12 @@ inline void WriteProtoToBinaryFile(
   WriteProtoToBinaryFile(proto, filename.c_str());
 }
 
+/**
+ * @brief Flushes the file written to temp_filename to disk and renames it to
+ *        filename, so that filename never holds a partially written file.
+ */
+void CommitFile(const string& temp_filename, const string& filename);
+
 bool ReadFileToDatum(const string& filename, const int label, Datum* datum);
 
 inline bool ReadFileToDatum(const string& filename, Datum* datum) {
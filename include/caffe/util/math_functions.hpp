@@ -145,6 +145,61 @@ DEFINE_CAFFE_CPU_UNARY_FUNC(fabs, y[i] = std::fabs(x[i]))
 template <typename Dtype>
 void caffe_cpu_scale(const int n, const Dtype alpha, const Dtype *x, Dtype* y);
 
+// In-place ReLU, as applied by layers with a fused activation:
+// x = max(x, 0) + negative_slope * min(x, 0).
+template <typename Dtype>
+void caffe_cpu_relu(const int n, const Dtype negative_slope, Dtype* x);
+
+// In-place ReLU gradient computed from the ReLU output y: dy is scaled by
+// negative_slope wherever y <= 0.
+template <typename Dtype>
+void caffe_cpu_relu_backward(const int n, const Dtype negative_slope,
+    const Dtype* y, Dtype* dy);
+
+// GEMM epilogue on the row-major M x N matrix C, in one pass: adds bias[i] to
+// row i (row_bias) or bias[j] to column j, unless bias is NULL, then with relu
+// applies caffe_cpu_relu. Replaces adding the bias by a rank-1 GEMM.
+template <typename Dtype>
+void caffe_cpu_bias_relu(const int M, const int N, const Dtype* bias,
+    const bool row_bias, const bool relu, const Dtype negative_slope,
+    Dtype* C);
+
+// The bias gradient of caffe_cpu_bias_relu: adds the sum of row i of the
+// row-major M x N matrix X to y[i] (row_bias), or that of column j to y[j].
+template <typename Dtype>
+void caffe_cpu_bias_backward(const int M, const int N, const Dtype* X,
+    const bool row_bias, Dtype* y);
+
+// Elementwise activations for the CPU neuron layers, safe in place:
+// y = exp(x), y = 1 / (1 + exp(-x)), y = tanh(x) and the ELU
+// y = max(x, 0) + alpha * (exp(min(x, 0)) - 1). Large arrays are split across
+// OpenMP threads. For float, CPUs with AVX2 and FMA (detected at run time)
+// evaluate exp with a polynomial of relative error below 3e-7, which leaves
+// sigmoid, tanh and ELU within 2e-7 * max(1, alpha) of the exact values;
+// exp saturates outside [-87, 88].
+template <typename Dtype>
+void caffe_cpu_exp(const int n, const Dtype* x, Dtype* y);
+
+template <typename Dtype>
+void caffe_cpu_sigmoid(const int n, const Dtype* x, Dtype* y);
+
+template <typename Dtype>
+void caffe_cpu_tanh(const int n, const Dtype* x, Dtype* y);
+
+template <typename Dtype>
+void caffe_cpu_elu(const int n, const Dtype alpha, const Dtype* x, Dtype* y);
+
+// Symmetric int8 quantization: y = round(scale * x), saturated to
+// [-127, 127].
+template <typename Dtype>
+void caffe_cpu_quantize(const int n, const Dtype scale, const Dtype* x,
+    int8_t* y);
+
+// C = A * B for row-major int8 matrices A (M x K) and B (K x N), accumulated
+// in int32 and stored into the row-major M x N matrix C.
+void caffe_cpu_gemm_s8(const int M, const int N, const int K,
+    const int8_t* A, const int8_t* B, int32_t* C);
+
 #ifndef CPU_ONLY  // GPU
 
 // Decaf gpu gemm provides an interface that is almost the same as the cpu
@@ -257,6 +312,13 @@ void caffe_gpu_fabs(const int n, const Dtype* x, Dtype* y);
 template <typename Dtype>
 void caffe_gpu_scale(const int n, const Dtype alpha, const Dtype *x, Dtype* y);
 
+template <typename Dtype>
+void caffe_gpu_relu(const int n, const Dtype negative_slope, Dtype* x);
+
+template <typename Dtype>
+void caffe_gpu_relu_backward(const int n, const Dtype negative_slope,
+    const Dtype* y, Dtype* dy);
+
 #define DEFINE_AND_INSTANTIATE_GPU_UNARY_FUNC(name, operation) \
 template<typename Dtype> \
 __global__ void name##_kernel(const int n, const Dtype* x, Dtype* y) { \
@@ -0,0 +1,96 @@
+#ifndef CAFFE_UTIL_NET_PROFILER_HPP_
+#define CAFFE_UTIL_NET_PROFILER_HPP_
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/benchmark.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Records the wall time of every layer's Forward and Backward through
+ *        the Net Callback hooks, along with the memory held by each layer's
+ *        outputs and parameters and an estimate of its floating point
+ *        operations.
+ *
+ * Attach one with Net::EnableProfiling(). Every call is timed, so in GPU
+ * mode each layer is synchronized with the host, which slows training
+ * down a little. Timings accumulate until Reset(); Summary() reports the
+ * per-call averages and WriteChromeTrace() the individual calls, in the
+ * trace-event format read by chrome://tracing.
+ */
+template <typename Dtype>
+class NetProfiler {
+ public:
+  explicit NetProfiler(Net<Dtype>* net);
+
+  struct LayerStats {
+    LayerStats()
+        : forward_calls(0), forward_us(0), backward_calls(0),
+          backward_us(0) {}
+    int forward_calls;
+    double forward_us;
+    int backward_calls;
+    double backward_us;
+  };
+  const vector<LayerStats>& layer_stats() const { return layer_stats_; }
+
+  /// @brief Estimated floating point operations of one Forward of a layer,
+  ///        counting a multiply-add as two.
+  double ForwardFlops(int layer_id) const;
+  /// @brief Bytes allocated for a layer's top blobs (data and diff) that no
+  ///        earlier layer already holds, e.g. through in-place computation.
+  size_t TopBytes(int layer_id) const;
+  /// @brief Bytes allocated for a layer's parameters (data and diff).
+  size_t ParamBytes(int layer_id) const;
+
+  /// @brief A table of the average time, throughput and memory per layer.
+  string Summary() const;
+  /// @brief Write the calls recorded since the last Reset() as a Chrome
+  ///        trace-event JSON file.
+  void WriteChromeTrace(const string& filename) const;
+  void Reset();
+
+ protected:
+  class Hook : public Net<Dtype>::Callback {
+   public:
+    Hook(NetProfiler* profiler, bool forward, bool before)
+        : profiler_(profiler), forward_(forward), before_(before) {}
+
+   protected:
+    virtual void run(int layer);
+
+    NetProfiler* profiler_;
+    bool forward_;
+    bool before_;
+  };
+
+  struct TraceEvent {
+    int layer_id;
+    bool forward;
+    double start_us;
+    double duration_us;
+  };
+
+  void Begin(int layer_id);
+  void End(int layer_id, bool forward);
+
+  Net<Dtype>* net_;
+  vector<shared_ptr<Hook> > hooks_;
+  vector<LayerStats> layer_stats_;
+  vector<TraceEvent> events_;
+  Timer timer_;
+  boost::posix_time::ptime origin_;
+  double start_us_;
+
+DISABLE_COPY_AND_ASSIGN(NetProfiler);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_NET_PROFILER_HPP_
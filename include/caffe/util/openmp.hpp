@@ -0,0 +1,28 @@
+#ifndef CAFFE_UTIL_OPENMP_H_
+#define CAFFE_UTIL_OPENMP_H_
+
+namespace caffe {
+
+// Thin wrappers around the OpenMP runtime so that CPU code can size per-thread
+// state without caring whether Caffe was built with USE_OPENMP. Parallel loops
+// themselves are written as `#pragma omp` guarded by `#ifdef _OPENMP`.
+
+// The number of threads a CPU parallel region may use: the OpenMP default team
+// size, or 1 when Caffe is built without OpenMP.
+int caffe_cpu_max_threads();
+
+// The index of the calling thread within the current parallel region; 0
+// outside of one, or when Caffe is built without OpenMP.
+int caffe_cpu_thread_num();
+
+// Elementwise loops over at least this many values are split across OpenMP
+// threads; for shorter ones starting the threads costs more than it saves.
+const int kCpuParallelMinCount = 1 << 16;
+
+// Resolves a user-facing thread count setting: 0 means "all available
+// threads", and the result is clamped to [1, caffe_cpu_max_threads()].
+int caffe_cpu_resolve_threads(int requested);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_OPENMP_H_
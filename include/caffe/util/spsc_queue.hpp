@@ -0,0 +1,66 @@
+#ifndef CAFFE_UTIL_SPSC_QUEUE_HPP_
+#define CAFFE_UTIL_SPSC_QUEUE_HPP_
+
+#include <string>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A bounded, lock-free single-producer/single-consumer queue with the
+ *        same interface as BlockingQueue.
+ *
+ * push() and pop() only touch two atomic counters when they do not have to
+ * wait, so handing items between two threads costs no mutex or condition
+ * variable. A thread that has to wait first spins for an adaptive number of
+ * iterations (grown when spinning pays off, shrunk when it ends up parking)
+ * and then parks on a condition variable, which is a boost interruption
+ * point just as for BlockingQueue.
+ *
+ * At any given time at most one thread may push and at most one thread may
+ * pop or peek; the roles may move between threads as long as the hand-over
+ * is synchronized, e.g. a Net used by a different thread after a join.
+ */
+template<typename T>
+class SPSCQueue {
+ public:
+  explicit SPSCQueue(size_t capacity);
+
+  // Waits while the queue holds capacity() items.
+  void push(const T& t);
+
+  bool try_pop(T* t);
+
+  // This logs a message if the threads needs to be blocked
+  // useful for detecting e.g. when data feeding is too slow
+  T pop(const string& log_on_wait = "");
+
+  bool try_peek(T* t);
+
+  // Return element without removing it
+  T peek();
+
+  size_t size() const;
+  size_t capacity() const { return capacity_; }
+
+ protected:
+  /**
+   Atomics and synchronization fields live out of line, as in BlockingQueue,
+   to keep boost/thread.hpp and boost/atomic.hpp away from NVCC.
+   */
+  class sync;
+
+  // Spin, then park, until the consumer can pop (consumer == true) or the
+  // producer can push (consumer == false).
+  void wait(bool consumer, const string& log_on_wait);
+
+  const size_t capacity_;
+  shared_ptr<sync> sync_;
+
+DISABLE_COPY_AND_ASSIGN(SPSCQueue);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SPSC_QUEUE_HPP_
@@ -0,0 +1,233 @@
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "caffe/batching_server.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class BatchingServer<Dtype>::Sync {
+ public:
+  boost::mutex mutex;
+  boost::condition_variable not_empty;
+  boost::condition_variable not_full;
+  // Notified whenever a batch of requests is done.
+  boost::condition_variable done;
+};
+
+template <typename Dtype>
+BatchingServer<Dtype>::BatchingServer(
+    shared_ptr<typename InferenceSession<Dtype>::Context> context,
+    int max_batch_size, int max_latency_us, int queue_depth)
+    : context_(context), max_batch_size_(max_batch_size),
+      max_latency_us_(max_latency_us), queue_depth_(queue_depth),
+      sync_(new Sync()), stopping_(false),
+      latency_counts_(kLatencyBuckets, 0), requests_(0), batches_(0) {
+  CHECK_GT(max_batch_size, 0);
+  CHECK_GE(max_latency_us, 0);
+  CHECK_GT(queue_depth, 0);
+  Net<Dtype>& net = context->net();
+  CHECK_EQ(net.input_blobs().size(), 1)
+      << "Batched serving needs a net with exactly one input blob.";
+  const Blob<Dtype>& input = *net.input_blobs()[0];
+  CHECK_GT(input.num_axes(), 0);
+  input_size_ = input.count(1);
+  CHECK_GT(input_size_, 0) << "Batched serving needs a non-empty input item.";
+  output_size_ = 0;
+  for (int i = 0; i < net.output_blobs().size(); ++i) {
+    output_size_ += net.output_blobs()[i]->count(1);
+  }
+}
+
+template <typename Dtype>
+BatchingServer<Dtype>::~BatchingServer() {
+  Stop();
+}
+
+template <typename Dtype>
+void BatchingServer<Dtype>::Start() {
+  stopping_ = false;
+  StartInternalThread();
+}
+
+template <typename Dtype>
+void BatchingServer<Dtype>::Stop() {
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex);
+    stopping_ = true;
+  }
+  sync_->not_empty.notify_all();
+  // The worker returns once the queue is empty; a stop request would cut its
+  // waits short instead.
+  if (is_started()) {
+    boost::mutex::scoped_lock lock(sync_->mutex);
+    while (!queue_.empty()) {
+      sync_->done.wait(lock);
+    }
+  }
+  StopInternalThread();
+}
+
+template <typename Dtype>
+shared_ptr<typename BatchingServer<Dtype>::Request>
+BatchingServer<Dtype>::Submit(const Dtype* input) {
+  shared_ptr<Request> request(new Request(input, input_size_, sync_));
+  boost::mutex::scoped_lock lock(sync_->mutex);
+  CHECK(!stopping_) << "Submit to a stopped BatchingServer.";
+  while (queue_.size() >= queue_depth_) {
+    sync_->not_full.wait(lock);
+  }
+  if (first_arrival_.is_not_a_date_time()) {
+    first_arrival_ = request->arrival_;
+  }
+  queue_.push_back(request);
+  sync_->not_empty.notify_one();
+  return request;
+}
+
+template <typename Dtype>
+void BatchingServer<Dtype>::InternalThreadEntry() {
+  while (true) {
+    vector<shared_ptr<Request> > batch;
+    {
+      boost::mutex::scoped_lock lock(sync_->mutex);
+      while (queue_.empty() && !stopping_) {
+        sync_->not_empty.wait(lock);
+      }
+      if (queue_.empty()) {
+        return;
+      }
+      // Wait for a full batch until the oldest request is due. Once stopping,
+      // no more requests come.
+      const boost::posix_time::ptime deadline = queue_.front()->arrival_ +
+          boost::posix_time::microseconds(max_latency_us_);
+      while (queue_.size() < max_batch_size_ && !stopping_ &&
+             sync_->not_empty.timed_wait(lock, deadline)) {}
+      const int batch_size = std::min<int>(queue_.size(), max_batch_size_);
+      batch.assign(queue_.begin(), queue_.begin() + batch_size);
+      queue_.erase(queue_.begin(), queue_.begin() + batch_size);
+    }
+    sync_->not_full.notify_all();
+    RunBatch(batch);
+  }
+}
+
+template <typename Dtype>
+void BatchingServer<Dtype>::RunBatch(
+    const vector<shared_ptr<Request> >& batch) {
+  Net<Dtype>& net = context_->net();
+  Blob<Dtype>* input = net.input_blobs()[0];
+  // Forward reshapes the layers whose bottoms change with the batch size.
+  if (input->shape(0) != batch.size()) {
+    vector<int> shape = input->shape();
+    shape[0] = batch.size();
+    input->Reshape(shape);
+  }
+  Dtype* input_data = input->mutable_cpu_data();
+  for (int i = 0; i < batch.size(); ++i) {
+    caffe_copy(input_size_, &batch[i]->input_[0],
+        input_data + i * input_size_);
+  }
+  const vector<Blob<Dtype>*>& outputs = context_->Forward();
+  for (int i = 0; i < batch.size(); ++i) {
+    vector<Dtype>& output = batch[i]->output_;
+    output.clear();
+    output.reserve(output_size_);
+    for (int j = 0; j < outputs.size(); ++j) {
+      CHECK_EQ(outputs[j]->shape(0), batch.size())
+          << "Output blobs must have one item per input item.";
+      const int size = outputs[j]->count(1);
+      const Dtype* data = outputs[j]->cpu_data() + i * size;
+      output.insert(output.end(), data, data + size);
+    }
+  }
+  const boost::posix_time::ptime now = boost::get_system_time();
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex);
+    for (int i = 0; i < batch.size(); ++i) {
+      batch[i]->done_ = true;
+      ++latency_counts_[LatencyBucket(
+          (now - batch[i]->arrival_).total_microseconds())];
+    }
+    requests_ += batch.size();
+    ++batches_;
+    last_completion_ = now;
+  }
+  sync_->done.notify_all();
+}
+
+template <typename Dtype>
+const int BatchingServer<Dtype>::kLatencyBucketsPerOctave;
+template <typename Dtype>
+const int BatchingServer<Dtype>::kLatencyBuckets;
+
+// The bucket of latency_counts_ a latency of us microseconds counts in.
+template <typename Dtype>
+int BatchingServer<Dtype>::LatencyBucket(int64_t us) {
+  if (us <= 1) { return 0; }
+  const int bucket = static_cast<int>(
+      std::ceil(std::log(static_cast<double>(us)) / std::log(2.) *
+                kLatencyBucketsPerOctave));
+  return std::min(bucket, kLatencyBuckets - 1);
+}
+
+// The latency in ms below which a fraction p of those counted lie, rounded
+// up to the bound of its bucket.
+template <typename Dtype>
+double BatchingServer<Dtype>::LatencyPercentile(double p) const {
+  const int64_t rank = std::max<int64_t>(
+      static_cast<int64_t>(std::ceil(p * requests_)), 1);
+  int64_t counted = 0;
+  int bucket = 0;
+  for (; bucket < kLatencyBuckets - 1; ++bucket) {
+    counted += latency_counts_[bucket];
+    if (counted >= rank) { break; }
+  }
+  return std::pow(2., static_cast<double>(bucket) / kLatencyBucketsPerOctave)
+      / 1000;
+}
+
+template <typename Dtype>
+typename BatchingServer<Dtype>::Stats BatchingServer<Dtype>::stats() const {
+  boost::mutex::scoped_lock lock(sync_->mutex);
+  Stats stats;
+  stats.requests = requests_;
+  stats.batches = batches_;
+  stats.mean_batch_size = batches_ == 0 ? 0 :
+      static_cast<double>(stats.requests) / batches_;
+  stats.p50_latency_ms = stats.p99_latency_ms = 0;
+  stats.requests_per_second = 0;
+  if (stats.requests > 0) {
+    stats.p50_latency_ms = LatencyPercentile(0.5);
+    stats.p99_latency_ms = LatencyPercentile(0.99);
+    const double seconds =
+        (last_completion_ - first_arrival_).total_microseconds() / 1e6;
+    if (seconds > 0) {
+      stats.requests_per_second = stats.requests / seconds;
+    }
+  }
+  return stats;
+}
+
+template <typename Dtype>
+BatchingServer<Dtype>::Request::Request(const Dtype* input, int input_size,
+    shared_ptr<Sync> sync)
+    : input_(input, input + input_size),
+      arrival_(boost::get_system_time()), done_(false), sync_(sync) {}
+
+template <typename Dtype>
+const vector<Dtype>& BatchingServer<Dtype>::Request::Wait() {
+  boost::mutex::scoped_lock lock(sync_->mutex);
+  while (!done_) {
+    sync_->done.wait(lock);
+  }
+  return output_;
+}
+
+INSTANTIATE_CLASS(BatchingServer);
+
+}  // namespace caffe
@@ -164,6 +164,20 @@ void Blob<Dtype>::ShareDiff(const Blob& other) {
   diff_ = other.diff();
 }
 
+template <typename Dtype>
+void Blob<Dtype>::ShareDataStorage(const shared_ptr<SyncedMemory>& storage) {
+  CHECK(storage);
+  const size_t capacity = storage->size() / sizeof(Dtype);
+  CHECK_LE(count_, capacity);
+  data_ = storage;
+  // Reshape trusts capacity_ for both data_ and diff_, so keep diff_ at least
+  // as large. Its memory is only allocated if it is ever used.
+  capacity_ = capacity;
+  if (!diff_ || diff_->size() < capacity_ * sizeof(Dtype)) {
+    diff_.reset(new SyncedMemory(capacity_ * sizeof(Dtype)));
+  }
+}
+
 // The "update" method is used for parameter blobs in a Net, which are stored
 // as Blob<float> or Blob<double> -- hence we do not define it for
 // Blob<int> or Blob<unsigned int>.
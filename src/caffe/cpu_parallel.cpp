@@ -0,0 +1,235 @@
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "caffe/cpu_parallel.hpp"
+#include "caffe/solver_factory.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class CPUParallel<Dtype>::Group {
+ public:
+  explicit Group(int size)
+      : replicas(size), barrier(size), comm_barrier(size) {}
+
+  vector<CPUParallel<Dtype>*> replicas;
+  // Met by the solver threads, and by the communication threads.
+  boost::barrier barrier;
+  boost::barrier comm_barrier;
+};
+
+// Start of the share of [offset, offset + count) reduced by rank.
+static int ShareBegin(int offset, int count, int rank, int num_replicas) {
+  return offset + static_cast<int64_t>(count) * rank / num_replicas;
+}
+
+template <typename Dtype>
+CPUParallel<Dtype>::CPUParallel(shared_ptr<Solver<Dtype> > solver)
+    : solver_(solver), rank_(Caffe::solver_rank()), group_(NULL),
+      layer_wise_(solver->param().layer_wise_reduce() &&
+                  solver->param().iter_size() == 1) {
+  CHECK(Caffe::mode() == Caffe::CPU)
+      << "CPUParallel trains in CPU mode; use NCCL for GPUs.";
+  Net<Dtype>& net = *solver->net();
+  const vector<Blob<Dtype>*>& params = net.learnable_params();
+  vector<int> offsets(params.size() + 1, 0);
+  for (int i = 0; i < params.size(); ++i) {
+    offsets[i + 1] = offsets[i] + params[i]->count();
+  }
+  size_ = offsets.back();
+  if (net.contiguous_params()) {
+    data_ = net.mutable_cpu_params_data();
+    diff_ = net.mutable_cpu_params_diff();
+  } else {
+    // The buffers are first touched by this thread, so on NUMA machines they
+    // are local to the socket it runs on, as is the net's own buffer.
+    const size_t size = std::max(size_, 1) * sizeof(Dtype);
+    data_buffer_.reset(new SyncedMemory(size));
+    diff_buffer_.reset(new SyncedMemory(size));
+    data_ = static_cast<Dtype*>(data_buffer_->mutable_cpu_data());
+    diff_ = static_cast<Dtype*>(diff_buffer_->mutable_cpu_data());
+    for (int i = 0; i < params.size(); ++i) {
+      Blob<Dtype>* param = params[i];
+      if (param->count() == 0) { continue; }
+      caffe_copy(param->count(), param->cpu_data(), data_ + offsets[i]);
+      caffe_copy(param->count(), param->cpu_diff(), diff_ + offsets[i]);
+      param->data()->set_cpu_data(data_ + offsets[i]);
+      param->diff()->set_cpu_data(diff_ + offsets[i]);
+    }
+  }
+
+  // The parameters a layer owns are next to each other in the buffer. Shared
+  // parameters are reduced with their owner, whose Backward comes last.
+  std::map<const Blob<Dtype>*, int> learnable_ids;
+  for (int i = 0; i < params.size(); ++i) {
+    learnable_ids[params[i]] = i;
+  }
+  layer_segment_.assign(net.layers().size(), -1);
+  for (int layer_id = 0; layer_id < net.layers().size(); ++layer_id) {
+    const vector<shared_ptr<Blob<Dtype> > >& blobs =
+        net.layers()[layer_id]->blobs();
+    for (int i = 0; i < blobs.size(); ++i) {
+      typename std::map<const Blob<Dtype>*, int>::const_iterator it =
+          learnable_ids.find(blobs[i].get());
+      if (it == learnable_ids.end()) { continue; }
+      if (layer_segment_[layer_id] < 0) {
+        layer_segment_[layer_id] = segments_.size();
+        segments_.push_back(std::make_pair(offsets[it->second], 0));
+      }
+      CHECK_EQ(segments_.back().first + segments_.back().second,
+               offsets[it->second]);
+      segments_.back().second += blobs[i]->count();
+    }
+  }
+  segments_.push_back(std::make_pair(0, size_));
+}
+
+template <typename Dtype>
+CPUParallel<Dtype>::~CPUParallel() {
+  StopInternalThread();
+}
+
+template <typename Dtype>
+void CPUParallel<Dtype>::Join(Group* group) {
+  group_ = group;
+  group->replicas[rank_] = this;
+  solver_->add_callback(this);
+  if (layer_wise_) {
+    solver_->net()->add_after_backward(this);
+  }
+  StartInternalThread();
+  // Wait for all replicas, then start from the parameters of rank 0.
+  group->barrier.wait();
+  if (rank_ > 0) {
+    CHECK_EQ(size_, group->replicas[0]->size_);
+    caffe_copy(size_, group->replicas[0]->data_, data_);
+  }
+  group->barrier.wait();
+}
+
+template <typename Dtype>
+void CPUParallel<Dtype>::run(int layer) {
+  if (layer_segment_[layer] >= 0) {
+    ready_.push(layer_segment_[layer]);
+  }
+}
+
+template <typename Dtype>
+void CPUParallel<Dtype>::on_gradients_ready() {
+  if (!layer_wise_) {
+    ready_.push(segments_.size() - 1);
+  }
+  ready_.push(-1);
+  done_.pop();
+}
+
+template <typename Dtype>
+void CPUParallel<Dtype>::InternalThreadEntry() {
+  while (!must_stop()) {
+    const int segment = ready_.pop();
+    if (segment < 0) {
+      done_.push(segment);
+    } else {
+      Allreduce(segments_[segment].first, segments_[segment].second);
+    }
+  }
+}
+
+template <typename Dtype>
+void CPUParallel<Dtype>::Allreduce(int offset, int count) {
+  const vector<CPUParallel<Dtype>*>& replicas = group_->replicas;
+  const int num_replicas = replicas.size();
+  // Wait until every replica has computed these gradients.
+  group_->comm_barrier.wait();
+  // Reduce-scatter: average our share over all replicas, summing in the same
+  // order on every replica.
+  const int begin = ShareBegin(offset, count, rank_, num_replicas);
+  const int end = ShareBegin(offset, count, rank_ + 1, num_replicas);
+  for (int i = 0; i < num_replicas; ++i) {
+    if (i != rank_) {
+      caffe_axpy(end - begin, Dtype(1), replicas[i]->diff_ + begin,
+                 diff_ + begin);
+    }
+  }
+  caffe_scal(end - begin, Dtype(1) / num_replicas, diff_ + begin);
+  group_->comm_barrier.wait();
+  // All-gather: copy the shares of the others.
+  for (int i = 0; i < num_replicas; ++i) {
+    if (i != rank_) {
+      const int share_begin = ShareBegin(offset, count, i, num_replicas);
+      const int share_end = ShareBegin(offset, count, i + 1, num_replicas);
+      caffe_copy(share_end - share_begin, replicas[i]->diff_ + share_begin,
+                 diff_ + share_begin);
+    }
+  }
+  // Nobody may touch its share again until everyone has copied it.
+  group_->comm_barrier.wait();
+}
+
+template <typename Dtype>
+class CPUWorker : public InternalThread {
+ public:
+  CPUWorker(shared_ptr<Solver<Dtype> > rank0,
+            typename CPUParallel<Dtype>::Group* group, const char* restore)
+      : rank0_(rank0), group_(group), restore_(restore) {}
+  virtual ~CPUWorker() {}
+
+ protected:
+  void InternalThreadEntry() {
+    {
+      SolverParameter param(rank0_->param());
+      param.set_type(rank0_->type());
+      shared_ptr<Solver<Dtype> > s(
+          SolverRegistry<Dtype>::CreateSolver(param));
+      if (restore_) {
+        s->Restore(restore_);
+      }
+      CPUParallel<Dtype> replica(s);
+      replica.Join(group_);
+      s->Step(param.max_iter() - s->iter());
+    }
+    // Wait for rank 0 to finish. The replica is gone by now, as stopping
+    // this thread afterwards would interrupt the joins of its threads.
+    group_->barrier.wait();
+  }
+
+  shared_ptr<Solver<Dtype> > rank0_;
+  typename CPUParallel<Dtype>::Group* group_;
+  const char* restore_;
+};
+
+template <typename Dtype>
+void CPUParallel<Dtype>::Run(int num_workers, const char* restore) {
+  CHECK_EQ(rank_, 0);
+  CHECK_EQ(num_workers, Caffe::solver_count())
+      << "Set the solver count before creating the solver.";
+  Group group(num_workers);
+  vector<shared_ptr<CPUWorker<Dtype> > > workers(num_workers);
+  for (int i = 1; i < num_workers; ++i) {
+    Caffe::set_solver_rank(i);
+    workers[i].reset(new CPUWorker<Dtype>(solver_, &group, restore));
+    workers[i]->StartInternalThread();
+  }
+  Caffe::set_solver_rank(0);
+  Join(&group);
+  solver_->Solve();
+  // After a requested early exit the workers are left waiting for our
+  // gradients rather than here, and are interrupted instead.
+  if (solver_->iter() >= solver_->param().max_iter()) {
+    group.barrier.wait();
+  }
+  for (int i = 1; i < num_workers; ++i) {
+    workers[i]->StopInternalThread();
+  }
+  group_ = NULL;
+}
+
+INSTANTIATE_CLASS(CPUParallel);
+INSTANTIATE_CLASS(CPUWorker);
+
+}  // namespace caffe
@@ -0,0 +1,90 @@
+#include <string>
+#include <vector>
+
+#include "caffe/inference_session.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+namespace caffe {
+
+// Caffe's mode and device are per thread; apply those of a session.
+static void SetThreadMode(Caffe::Brew mode, int device) {
+  Caffe::set_mode(mode);
+#ifndef CPU_ONLY
+  if (mode == Caffe::GPU) {
+    Caffe::SetDevice(device);
+  }
+#endif
+}
+
+template <typename Dtype>
+InferenceSession<Dtype>::InferenceSession(const NetParameter& param,
+    const string& weights_file) {
+  Init(param, weights_file);
+}
+
+template <typename Dtype>
+InferenceSession<Dtype>::InferenceSession(const string& param_file,
+    const string& weights_file) {
+  NetParameter param;
+  ReadNetParamsFromTextFileOrDie(param_file, &param);
+  Init(param, weights_file);
+}
+
+template <typename Dtype>
+void InferenceSession<Dtype>::Init(const NetParameter& param,
+    const string& weights_file) {
+  mode_ = Caffe::mode();
+  device_ = 0;
+#ifndef CPU_ONLY
+  if (mode_ == Caffe::GPU) {
+    CUDA_CHECK(cudaGetDevice(&device_));
+  }
+#endif
+  param_ = param;
+  param_.mutable_state()->set_phase(TEST);
+  // The parameters of the contexts are views of the session's, which would
+  // not live in their contiguous buffers.
+  param_.set_contiguous_params(false);
+  weights_.reset(new Net<Dtype>(param_));
+  if (!weights_file.empty()) {
+    weights_->CopyTrainedLayersFrom(weights_file);
+  }
+  // Move the weights to where the contexts read them now. The first read of
+  // a blob on a device syncs it, which concurrent contexts would race to do;
+  // after that, reads change nothing.
+  const vector<shared_ptr<Blob<Dtype> > >& params = weights_->params();
+  for (int i = 0; i < params.size(); ++i) {
+    if (params[i]->count() == 0) { continue; }
+    if (mode_ == Caffe::GPU) {
+      params[i]->gpu_data();
+    } else {
+      params[i]->cpu_data();
+    }
+  }
+}
+
+template <typename Dtype>
+shared_ptr<typename InferenceSession<Dtype>::Context>
+InferenceSession<Dtype>::CreateContext() const {
+  return shared_ptr<Context>(new Context(*this));
+}
+
+template <typename Dtype>
+InferenceSession<Dtype>::Context::Context(
+    const InferenceSession<Dtype>& session)
+    : mode_(session.mode_), device_(session.device_) {
+  SetThreadMode(mode_, device_);
+  net_.reset(new Net<Dtype>(session.param_));
+  net_->ShareTrainedLayersWith(session.weights_.get());
+}
+
+template <typename Dtype>
+const vector<Blob<Dtype>*>& InferenceSession<Dtype>::Context::Forward(
+    Dtype* loss) {
+  SetThreadMode(mode_, device_);
+  return net_->Forward(loss);
+}
+
+INSTANTIATE_CLASS(InferenceSession);
+
+}  // namespace caffe
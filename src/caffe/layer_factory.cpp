@@ -10,12 +10,15 @@
 #include "caffe/layers/clip_layer.hpp"
 #include "caffe/layers/conv_layer.hpp"
 #include "caffe/layers/deconv_layer.hpp"
+#include "caffe/layers/fused_lstm_layer.hpp"
 #include "caffe/layers/lrn_layer.hpp"
+#include "caffe/layers/lstm_layer.hpp"
 #include "caffe/layers/pooling_layer.hpp"
 #include "caffe/layers/relu_layer.hpp"
 #include "caffe/layers/sigmoid_layer.hpp"
 #include "caffe/layers/softmax_layer.hpp"
 #include "caffe/layers/tanh_layer.hpp"
+#include "caffe/layers/winograd_conv_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 
 #ifdef USE_CUDNN
@@ -42,6 +45,10 @@ shared_ptr<Layer<Dtype> > GetConvolutionLayer(
     const LayerParameter& param) {
   ConvolutionParameter conv_param = param.convolution_param();
   ConvolutionParameter_Engine engine = conv_param.engine();
+  // Only the Caffe engine implements int8 inference.
+  const bool use_int8 = param.has_quantization_param() &&
+      param.quantization_param().precision() ==
+      QuantizationParameter_Precision_INT8;
 #ifdef USE_CUDNN
   bool use_dilation = false;
   for (int i = 0; i < conv_param.dilation_size(); ++i) {
@@ -53,19 +60,30 @@ shared_ptr<Layer<Dtype> > GetConvolutionLayer(
   if (engine == ConvolutionParameter_Engine_DEFAULT) {
     engine = ConvolutionParameter_Engine_CAFFE;
 #ifdef USE_CUDNN
-    if (!use_dilation) {
+    if (!use_dilation && !conv_param.has_fused_relu() && !use_int8) {
       engine = ConvolutionParameter_Engine_CUDNN;
     }
 #endif
   }
+  if (engine != ConvolutionParameter_Engine_CAFFE && use_int8) {
+    LOG(FATAL) << "Only the CAFFE engine supports int8 quantization at Layer "
+               << param.name();
+  }
   if (engine == ConvolutionParameter_Engine_CAFFE) {
     return shared_ptr<Layer<Dtype> >(new ConvolutionLayer<Dtype>(param));
+  } else if (engine == ConvolutionParameter_Engine_WINOGRAD) {
+    return shared_ptr<Layer<Dtype> >(
+        new WinogradConvolutionLayer<Dtype>(param));
 #ifdef USE_CUDNN
   } else if (engine == ConvolutionParameter_Engine_CUDNN) {
     if (use_dilation) {
       LOG(FATAL) << "CuDNN doesn't support the dilated convolution at Layer "
                  << param.name();
     }
+    if (conv_param.has_fused_relu()) {
+      LOG(FATAL) << "CuDNN doesn't support fused_relu at Layer "
+                 << param.name();
+    }
     return shared_ptr<Layer<Dtype> >(new CuDNNConvolutionLayer<Dtype>(param));
 #endif
   } else {
@@ -92,7 +110,7 @@ shared_ptr<Layer<Dtype> > GetDeconvolutionLayer(const LayerParameter& param) {
   if (engine == ConvolutionParameter_Engine_DEFAULT) {
     engine = ConvolutionParameter_Engine_CAFFE;
 #ifdef USE_CUDNN
-    if (!use_dilation) {
+    if (!use_dilation && !conv_param.has_fused_relu()) {
       engine = ConvolutionParameter_Engine_CUDNN;
     }
 #endif
@@ -105,6 +123,10 @@ shared_ptr<Layer<Dtype> > GetDeconvolutionLayer(const LayerParameter& param) {
       LOG(FATAL) << "CuDNN doesn't support the dilated deconvolution at Layer "
                  << param.name();
     }
+    if (conv_param.has_fused_relu()) {
+      LOG(FATAL) << "CuDNN doesn't support fused_relu at Layer "
+                 << param.name();
+    }
     return shared_ptr<Layer<Dtype> >(new CuDNNDeconvolutionLayer<Dtype>(param));
 #endif
   } else {
@@ -195,6 +217,28 @@ shared_ptr<Layer<Dtype> > GetLRNLayer(const LayerParameter& param) {
 
 REGISTER_LAYER_CREATOR(LRN, GetLRNLayer);
 
+// Get LSTM layer according to engine.
+template <typename Dtype>
+shared_ptr<Layer<Dtype> > GetLSTMLayer(const LayerParameter& param) {
+  const RecurrentParameter& recurrent_param = param.recurrent_param();
+  RecurrentParameter_Engine engine = recurrent_param.engine();
+  if (engine == RecurrentParameter_Engine_DEFAULT) {
+    // Only the unrolled net has layers to show debug_info of.
+    engine = recurrent_param.debug_info() ?
+        RecurrentParameter_Engine_UNROLLED : RecurrentParameter_Engine_FUSED;
+  }
+  if (engine == RecurrentParameter_Engine_UNROLLED) {
+    return shared_ptr<Layer<Dtype> >(new LSTMLayer<Dtype>(param));
+  } else if (engine == RecurrentParameter_Engine_FUSED) {
+    return shared_ptr<Layer<Dtype> >(new FusedLSTMLayer<Dtype>(param));
+  } else {
+    LOG(FATAL) << "Layer " << param.name() << " has unknown engine.";
+    throw;  // Avoids missing return warning
+  }
+}
+
+REGISTER_LAYER_CREATOR(LSTM, GetLSTMLayer);
+
 // Get relu layer according to engine.
 template <typename Dtype>
 shared_ptr<Layer<Dtype> > GetReLULayer(const LayerParameter& param) {
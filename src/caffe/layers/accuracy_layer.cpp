@@ -42,21 +42,21 @@ void AccuracyLayer<Dtype>::Reshape(
     top[1]->Reshape(top_shape_per_class);
     nums_buffer_.Reshape(top_shape_per_class);
   }
+  const int num_labels = bottom[0]->shape(label_axis_);
+  this->ReshapeMetricState(top.size() > 1 ? 2 + 2 * num_labels : 2);
 }
 
 template <typename Dtype>
 void AccuracyLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
-  Dtype accuracy = 0;
   const Dtype* bottom_data = bottom[0]->cpu_data();
   const Dtype* bottom_label = bottom[1]->cpu_data();
   const int dim = bottom[0]->count() / outer_num_;
   const int num_labels = bottom[0]->shape(label_axis_);
-  if (top.size() > 1) {
-    caffe_set(nums_buffer_.count(), Dtype(0), nums_buffer_.mutable_cpu_data());
-    caffe_set(top[1]->count(), Dtype(0), top[1]->mutable_cpu_data());
-  }
-  int count = 0;
+  // The correct instances and all of them, then the same per class.
+  vector<double> counts(top.size() > 1 ? 2 + 2 * num_labels : 2, 0);
+  double* class_correct = top.size() > 1 ? &counts[2] : NULL;
+  double* class_count = top.size() > 1 ? &counts[2 + num_labels] : NULL;
   for (int i = 0; i < outer_num_; ++i) {
     for (int j = 0; j < inner_num_; ++j) {
       const int label_value =
@@ -66,7 +66,7 @@ void AccuracyLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       }
       DCHECK_GE(label_value, 0);
       DCHECK_LT(label_value, num_labels);
-      if (top.size() > 1) ++nums_buffer_.mutable_cpu_data()[label_value];
+      if (class_count) ++class_count[label_value];
       const Dtype prob_of_true_class = bottom_data[i * dim
                                                    + label_value * inner_num_
                                                    + j];
@@ -78,23 +78,29 @@ void AccuracyLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       }
       // check if there are less than top_k_ predictions
       if (num_better_predictions < top_k_) {
-        ++accuracy;
-        if (top.size() > 1) ++top[1]->mutable_cpu_data()[label_value];
+        ++counts[0];
+        if (class_correct) ++class_correct[label_value];
       }
-      ++count;
+      ++counts[1];
     }
   }
+  this->UpdateMetric(counts, top);
+  // Accuracy layer should not be used as a loss function.
+}
 
-  // LOG(INFO) << "Accuracy: " << accuracy;
-  top[0]->mutable_cpu_data()[0] = (count == 0) ? 0 : (accuracy / count);
+template <typename Dtype>
+void AccuracyLayer<Dtype>::ComputeMetric(const vector<double>& state,
+    const vector<Blob<Dtype>*>& top) const {
+  top[0]->mutable_cpu_data()[0] = (state[1] == 0) ? 0 : (state[0] / state[1]);
   if (top.size() > 1) {
-    for (int i = 0; i < top[1]->count(); ++i) {
+    const int num_labels = top[1]->count();
+    const double* class_correct = &state[2];
+    const double* class_count = &state[2 + num_labels];
+    for (int i = 0; i < num_labels; ++i) {
       top[1]->mutable_cpu_data()[i] =
-          nums_buffer_.cpu_data()[i] == 0 ? 0
-          : top[1]->cpu_data()[i] / nums_buffer_.cpu_data()[i];
+          class_count[i] == 0 ? 0 : class_correct[i] / class_count[i];
     }
   }
-  // Accuracy layer should not be used as a loss function.
 }
 
 #ifdef CPU_ONLY
@@ -89,11 +89,10 @@ void AccuracyLayer<Dtype>::Forward_gpu(
     caffe_gpu_asum(nthreads, acc_data, &acc);
     Dtype valid_count;
     caffe_gpu_asum(nthreads, counts, &valid_count);
-    if (valid_count > 0) {
-      top[0]->mutable_cpu_data()[0] = acc / valid_count;
-    } else {
-      top[0]->mutable_cpu_data()[0] = 0;
-    }
+    vector<double> state(2);
+    state[0] = acc;
+    state[1] = valid_count;
+    this->UpdateMetric(state, top);
   } else {
     // need to report per-class accuracy as well
 
@@ -110,28 +109,21 @@ void AccuracyLayer<Dtype>::Forward_gpu(
         acc_data, counts, outer_num_, dim, inner_num_, num_labels, top_k_,
         has_ignore_label_, ignore_label_);
 
-    // get the overall accuracy
+    // get the overall accuracy, then the per-class one
+    vector<double> state(2 + 2 * num_labels);
     Dtype acc;
     caffe_gpu_asum(bottom[0]->count(), acc_data, &acc);
     Dtype valid_count;
     caffe_gpu_asum(nums_buffer_.count(), counts, &valid_count);
-    if (valid_count > 0) {
-      top[0]->mutable_cpu_data()[0] = acc / valid_count;
-    } else {
-      top[0]->mutable_cpu_data()[0] = 0;
-    }
-
-    // get per-class accuracy
-    Dtype* per_class_acc = top[1]->mutable_cpu_data();
+    state[0] = acc;
+    state[1] = valid_count;
     for (int l = 0; l < num_labels; l++) {
-      caffe_gpu_asum(nthreads, acc_data + l*nthreads, per_class_acc+l);
+      caffe_gpu_asum(nthreads, acc_data + l*nthreads, &acc);
       caffe_gpu_asum(nthreads, counts + l*nthreads, &valid_count);
-      if (valid_count > 0) {
-        per_class_acc[l] /= valid_count;
-      } else {
-        per_class_acc[l] = 0;
-      }
+      state[2 + l] = acc;
+      state[2 + num_labels + l] = valid_count;
     }
+    this->UpdateMetric(state, top);
   }
   // Clear scratch memory to prevent interfering with backward (see #6202).
   caffe_gpu_set(bottom[0]->count(), Dtype(0), bottom[0]->mutable_gpu_diff());
@@ -5,6 +5,7 @@
 #include "caffe/layers/base_conv_layer.hpp"
 #include "caffe/util/im2col.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/openmp.hpp"
 
 namespace caffe {
 
@@ -14,6 +15,25 @@ void BaseConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // Configure the kernel size, padding, stride, and inputs.
   ConvolutionParameter conv_param = this->layer_param_.convolution_param();
   force_nd_im2col_ = conv_param.force_nd_im2col();
+  num_threads_ = caffe_cpu_resolve_threads(conv_param.num_threads());
+  LOG_IF(INFO, num_threads_ > 1) << "Convolution layer "
+      << this->layer_param_.name() << " uses up to " << num_threads_
+      << " CPU threads per batch";
+  fused_relu_ = conv_param.has_fused_relu();
+  relu_negative_slope_ = conv_param.fused_relu().negative_slope();
+  const LayerParameter& layer_param = this->layer_param_;
+  int8_ = layer_param.has_quantization_param() &&
+      layer_param.quantization_param().precision() ==
+      QuantizationParameter_Precision_INT8 && this->phase_ == TEST;
+  int8_weights_version_ = 0;
+  if (int8_) {
+    CHECK(!reverse_dimensions()) << "int8 quantization is not implemented "
+        << "for " << this->type() << " layers";
+    const float input_max = layer_param.quantization_param().input_max();
+    CHECK_GT(input_max, 0) << "int8 quantization of layer "
+        << layer_param.name() << " needs a calibrated input_max";
+    int8_input_scale_ = 127 / input_max;
+  }
   channel_axis_ = bottom[0]->CanonicalAxisIndex(conv_param.axis());
   const int first_spatial_axis = channel_axis_ + 1;
   const int num_axes = bottom[0]->num_axes();
@@ -244,48 +264,44 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   top_dim_ = top[0]->count(channel_axis_);
   num_kernels_im2col_ = conv_in_channels_ * conv_out_spatial_dim_;
   num_kernels_col2im_ = reverse_dimensions() ? top_dim_ : bottom_dim_;
-  // Set up the all ones "bias multiplier" for adding biases by BLAS
   out_spatial_dim_ = top[0]->count(first_spatial_axis);
-  if (bias_term_) {
-    vector<int> bias_multiplier_shape(1, out_spatial_dim_);
-    bias_multiplier_.Reshape(bias_multiplier_shape);
-    caffe_set(bias_multiplier_.count(), Dtype(1),
-        bias_multiplier_.mutable_cpu_data());
-  }
 }
 
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::forward_cpu_gemm(const Dtype* input,
-    const Dtype* weights, Dtype* output, bool skip_im2col) {
-  const Dtype* col_buff = input;
+    const Dtype* weights, Dtype* output, bool skip_im2col, Dtype* col_buff) {
+  const Dtype* col_input = input;
   if (!is_1x1_) {
+    if (!col_buff) {
+      col_buff = col_buffer_.mutable_cpu_data();
+    }
     if (!skip_im2col) {
-      conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
+      conv_im2col_cpu(input, col_buff);
     }
-    col_buff = col_buffer_.cpu_data();
+    col_input = col_buff;
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_ /
         group_, conv_out_spatial_dim_, kernel_dim_,
-        (Dtype)1., weights + weight_offset_ * g, col_buff + col_offset_ * g,
+        (Dtype)1., weights + weight_offset_ * g, col_input + col_offset_ * g,
         (Dtype)0., output + output_offset_ * g);
   }
 }
 
 template <typename Dtype>
-void BaseConvolutionLayer<Dtype>::forward_cpu_bias(Dtype* output,
+void BaseConvolutionLayer<Dtype>::forward_cpu_bias_relu(Dtype* output,
     const Dtype* bias) {
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
-      out_spatial_dim_, 1, (Dtype)1., bias, bias_multiplier_.cpu_data(),
-      (Dtype)1., output);
+  caffe_cpu_bias_relu(num_output_, out_spatial_dim_, bias, true, fused_relu_,
+      relu_negative_slope_, output);
 }
 
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
-    const Dtype* weights, Dtype* input) {
-  Dtype* col_buff = col_buffer_.mutable_cpu_data();
+    const Dtype* weights, Dtype* input, Dtype* col_buff) {
   if (is_1x1_) {
     col_buff = input;
+  } else if (!col_buff) {
+    col_buff = col_buffer_.mutable_cpu_data();
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_,
@@ -300,16 +316,19 @@ void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
 
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::weight_cpu_gemm(const Dtype* input,
-    const Dtype* output, Dtype* weights) {
-  const Dtype* col_buff = input;
+    const Dtype* output, Dtype* weights, Dtype* col_buff) {
+  const Dtype* col_input = input;
   if (!is_1x1_) {
-    conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
-    col_buff = col_buffer_.cpu_data();
+    if (!col_buff) {
+      col_buff = col_buffer_.mutable_cpu_data();
+    }
+    conv_im2col_cpu(input, col_buff);
+    col_input = col_buff;
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
         kernel_dim_, conv_out_spatial_dim_,
-        (Dtype)1., output + output_offset_ * g, col_buff + col_offset_ * g,
+        (Dtype)1., output + output_offset_ * g, col_input + col_offset_ * g,
         (Dtype)1., weights + weight_offset_ * g);
   }
 }
@@ -317,8 +336,112 @@ void BaseConvolutionLayer<Dtype>::weight_cpu_gemm(const Dtype* input,
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_cpu_bias(Dtype* bias,
     const Dtype* input) {
-  caffe_cpu_gemv<Dtype>(CblasNoTrans, num_output_, out_spatial_dim_, 1.,
-      input, bias_multiplier_.cpu_data(), 1., bias);
+  caffe_cpu_bias_backward(num_output_, out_spatial_dim_, input, true, bias);
+}
+
+template <typename Dtype>
+Dtype* BaseConvolutionLayer<Dtype>::cpu_col_buffers() {
+  const int num_threads = num_cpu_threads();
+  if (is_1x1_) {
+    return NULL;
+  } else if (num_threads == 1) {
+    return col_buffer_.mutable_cpu_data();
+  }
+  thread_col_buffers_.Reshape(vector<int>(1, num_threads * col_buffer_count()));
+  return thread_col_buffers_.mutable_cpu_data();
+}
+
+template <typename Dtype>
+Dtype* BaseConvolutionLayer<Dtype>::cpu_weight_diff_buffers() {
+  const int count = num_cpu_threads() * this->blobs_[0]->count();
+  thread_weight_diffs_.Reshape(vector<int>(1, count));
+  Dtype* weight_diffs = thread_weight_diffs_.mutable_cpu_data();
+  caffe_set(count, Dtype(0), weight_diffs);
+  return weight_diffs;
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::reduce_cpu_weight_diffs(Dtype* weight_diff) {
+  const int count = this->blobs_[0]->count();
+  const Dtype* weight_diffs = thread_weight_diffs_.cpu_data();
+  for (int t = 0; t < num_cpu_threads(); ++t) {
+    caffe_axpy(count, Dtype(1), weight_diffs + t * count, weight_diff);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::prepare_cpu_int8(int num_threads) {
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  // Quantize again whenever the weights may have been written, e.g. loaded,
+  // copied in, or updated by the training net that shares them.
+  const uint64_t weights_version = this->blobs_[0]->data()->version();
+  if (weights_version != int8_weights_version_) {
+    // Quantize every output channel's filter with its own scale.
+    const int dim = this->blobs_[0]->count() / conv_out_channels_;
+    int8_weights_.reset(new SyncedMemory(this->blobs_[0]->count()));
+    int8_t* quantized = static_cast<int8_t*>(int8_weights_->mutable_cpu_data());
+    int8_output_scales_.resize(conv_out_channels_);
+    for (int c = 0; c < conv_out_channels_; ++c) {
+      const Dtype* filter = weight + c * dim;
+      Dtype filter_max = 0;
+      for (int i = 0; i < dim; ++i) {
+        filter_max = std::max(filter_max, std::abs(filter[i]));
+      }
+      const Dtype scale = filter_max > 0 ? 127 / filter_max : 0;
+      caffe_cpu_quantize(dim, scale, filter, quantized + c * dim);
+      int8_output_scales_[c] =
+          filter_max > 0 ? 1 / (scale * int8_input_scale_) : 0;
+    }
+    int8_weights_version_ = weights_version;
+  }
+  const size_t col_bytes =
+      num_threads * kernel_dim_ * group_ * conv_out_spatial_dim_;
+  if (!int8_col_buffers_ || int8_col_buffers_->size() < col_bytes) {
+    int8_col_buffers_.reset(new SyncedMemory(col_bytes));
+  }
+  const size_t product_bytes = num_threads * conv_out_channels_ *
+      conv_out_spatial_dim_ * sizeof(int32_t);
+  if (!int8_products_ || int8_products_->size() < product_bytes) {
+    int8_products_.reset(new SyncedMemory(product_bytes));
+  }
+  int8_col_data_ = static_cast<int8_t*>(int8_col_buffers_->mutable_cpu_data());
+  int8_product_data_ =
+      static_cast<int32_t*>(int8_products_->mutable_cpu_data());
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_int8(const Dtype* input,
+    Dtype* output, Dtype* col_buff, int t) {
+  const Dtype* col_input = input;
+  if (!is_1x1_) {
+    conv_im2col_cpu(input, col_buff);
+    col_input = col_buff;
+  }
+  const int col_count = kernel_dim_ * group_ * conv_out_spatial_dim_;
+  int8_t* quantized_col = int8_col_data_ + t * col_count;
+  int32_t* products =
+      int8_product_data_ + t * conv_out_channels_ * conv_out_spatial_dim_;
+  caffe_cpu_quantize(col_count, int8_input_scale_, col_input, quantized_col);
+  const int8_t* quantized_weights =
+      static_cast<const int8_t*>(int8_weights_->cpu_data());
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_gemm_s8(conv_out_channels_ / group_, conv_out_spatial_dim_,
+        kernel_dim_, quantized_weights + weight_offset_ * g,
+        quantized_col + col_offset_ * g, products + output_offset_ * g);
+  }
+  const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  for (int c = 0; c < conv_out_channels_; ++c) {
+    const Dtype scale = int8_output_scales_[c];
+    const Dtype shift = bias ? bias[c] : Dtype(0);
+    const int32_t* product = products + c * conv_out_spatial_dim_;
+    Dtype* out = output + c * conv_out_spatial_dim_;
+    for (int j = 0; j < conv_out_spatial_dim_; ++j) {
+      out[j] = product[j] * scale + shift;
+    }
+    if (fused_relu_) {
+      caffe_cpu_relu(conv_out_spatial_dim_, relu_negative_slope_, out);
+    }
+  }
 }
 
 #ifndef CPU_ONLY
@@ -345,7 +468,7 @@ template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::forward_gpu_bias(Dtype* output,
     const Dtype* bias) {
   caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
-      out_spatial_dim_, 1, (Dtype)1., bias, bias_multiplier_.gpu_data(),
+      out_spatial_dim_, 1, (Dtype)1., bias, gpu_bias_multiplier(),
       (Dtype)1., output);
 }
 
@@ -387,7 +510,17 @@ template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_gpu_bias(Dtype* bias,
     const Dtype* input) {
   caffe_gpu_gemv<Dtype>(CblasNoTrans, num_output_, out_spatial_dim_, 1.,
-      input, bias_multiplier_.gpu_data(), 1., bias);
+      input, gpu_bias_multiplier(), 1., bias);
+}
+
+template <typename Dtype>
+const Dtype* BaseConvolutionLayer<Dtype>::gpu_bias_multiplier() {
+  if (bias_multiplier_.count() != out_spatial_dim_) {
+    bias_multiplier_.Reshape(vector<int>(1, out_spatial_dim_));
+    caffe_gpu_set(out_spatial_dim_, Dtype(1),
+        bias_multiplier_.mutable_gpu_data());
+  }
+  return bias_multiplier_.gpu_data();
 }
 
 #endif  // !CPU_ONLY
@@ -2,6 +2,7 @@
 #include <vector>
 
 #include "caffe/layers/clip_layer.hpp"
+#include "caffe/util/openmp.hpp"
 
 namespace caffe {
 
@@ -15,6 +16,9 @@ void ClipLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   Dtype min = this->layer_param_.clip_param().min();
   Dtype max = this->layer_param_.clip_param().max();
 
+#ifdef _OPENMP
+#pragma omp parallel for simd if (count >= kCpuParallelMinCount)
+#endif
   for (int i = 0; i < count; ++i) {
     top_data[i] = std::max(min, std::min(bottom_data[i], max));
   }
@@ -33,6 +37,9 @@ void ClipLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     Dtype min = this->layer_param_.clip_param().min();
     Dtype max = this->layer_param_.clip_param().max();
 
+#ifdef _OPENMP
+#pragma omp parallel for simd if (count >= kCpuParallelMinCount)
+#endif
     for (int i = 0; i < count; ++i) {
       bottom_diff[i] = top_diff[i] * (
               bottom_data[i] >= min && bottom_data[i] <= max);
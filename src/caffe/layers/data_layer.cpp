@@ -3,11 +3,13 @@
 #endif  // USE_OPENCV
 #include <stdint.h>
 
+#include <algorithm>
 #include <vector>
 
 #include "caffe/data_transformer.hpp"
 #include "caffe/layers/data_layer.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/openmp.hpp"
 
 namespace caffe {
 
@@ -31,7 +33,7 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   const int batch_size = this->layer_param_.data_param().batch_size();
   // Read a data point, and use it to initialize the top blob.
   Datum datum;
-  datum.ParseFromString(cursor_->value());
+  ParseCurrentDatum(&datum);
 
   // Use data_transformer to infer the expected blob shape from datum.
   vector<int> top_shape = this->data_transformer_->InferBlobShape(datum);
@@ -42,6 +44,27 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   for (int i = 0; i < this->prefetch_.size(); ++i) {
     this->prefetch_[i]->data_.Reshape(top_shape);
   }
+  // Decode/transform workers: each needs its own transformer since the
+  // transformer's random generator is not thread safe.
+  const int num_workers = std::min(caffe_cpu_resolve_threads(
+      this->layer_param_.data_param().num_threads()), batch_size);
+  LOG_IF(INFO, num_workers > 1 && Caffe::root_solver())
+      << "Data layer " << this->layer_param_.name() << " uses "
+      << num_workers << " decode/transform threads";
+  batch_datums_.resize(batch_size);
+  worker_transformers_.clear();
+  worker_transformed_data_.clear();
+  for (int i = 0; i < num_workers; ++i) {
+    if (i == 0) {
+      worker_transformers_.push_back(this->data_transformer_);
+    } else {
+      worker_transformers_.push_back(shared_ptr<DataTransformer<Dtype> >(
+          new DataTransformer<Dtype>(this->transform_param_, this->phase_)));
+      worker_transformers_.back()->InitRand();
+    }
+    worker_transformed_data_.push_back(
+        shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+  }
   LOG_IF(INFO, Caffe::root_solver())
       << "output data size: " << top[0]->num() << ","
       << top[0]->channels() << "," << top[0]->height() << ","
@@ -77,6 +100,17 @@ void DataLayer<Dtype>::Next() {
   offset_++;
 }
 
+// Parses the Datum under the cursor straight from the database's storage,
+// without copying the record into a string first. Reusing the same Datum
+// across records also reuses its buffers.
+template<typename Dtype>
+void DataLayer<Dtype>::ParseCurrentDatum(Datum* datum) {
+  size_t size;
+  const char* data = cursor_->value_data(&size);
+  CHECK(datum->ParseFromArray(data, size))
+      << "Failed to parse Datum at key " << cursor_->key();
+}
+
 // This function is called on prefetch thread
 template<typename Dtype>
 void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
@@ -89,40 +123,55 @@ void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   CHECK(this->transformed_data_.count());
   const int batch_size = this->layer_param_.data_param().batch_size();
 
-  Datum datum;
+  // Read the records of the batch in order; the cursor is not thread safe.
+  timer.Start();
   for (int item_id = 0; item_id < batch_size; ++item_id) {
-    timer.Start();
     while (Skip()) {
       Next();
     }
-    datum.ParseFromString(cursor_->value());
-    read_time += timer.MicroSeconds();
-
-    if (item_id == 0) {
-      // Reshape according to the first datum of each batch
-      // on single input batches allows for inputs of varying dimension.
-      // Use data_transformer to infer the expected blob shape from datum.
-      vector<int> top_shape = this->data_transformer_->InferBlobShape(datum);
-      this->transformed_data_.Reshape(top_shape);
-      // Reshape batch according to the batch_size.
-      top_shape[0] = batch_size;
-      batch->data_.Reshape(top_shape);
-    }
+    ParseCurrentDatum(&batch_datums_[item_id]);
+    Next();
+  }
+  read_time += timer.MicroSeconds();
 
-    // Apply data transformations (mirror, scale, crop...)
-    timer.Start();
-    int offset = batch->data_.offset(item_id);
-    Dtype* top_data = batch->data_.mutable_cpu_data();
-    this->transformed_data_.set_cpu_data(top_data + offset);
-    this->data_transformer_->Transform(datum, &(this->transformed_data_));
-    // Copy label.
-    if (this->output_labels_) {
-      Dtype* top_label = batch->label_.mutable_cpu_data();
-      top_label[item_id] = datum.label();
+  // Reshape according to the first datum of each batch
+  // on single input batches allows for inputs of varying dimension.
+  // Use data_transformer to infer the expected blob shape from datum.
+  vector<int> top_shape =
+      this->data_transformer_->InferBlobShape(batch_datums_[0]);
+  this->transformed_data_.Reshape(top_shape);
+  for (int i = 0; i < worker_transformed_data_.size(); ++i) {
+    worker_transformed_data_[i]->Reshape(top_shape);
+  }
+  // Reshape batch according to the batch_size.
+  top_shape[0] = batch_size;
+  batch->data_.Reshape(top_shape);
+
+  // Apply data transformations (mirror, scale, crop...), decoding first if
+  // needed. Worker w handles items w, w + num_workers, ... so that every
+  // item sees the same random generator whatever the OpenMP team size.
+  timer.Start();
+  Dtype* top_data = batch->data_.mutable_cpu_data();
+  Dtype* top_label = this->output_labels_ ?
+      batch->label_.mutable_cpu_data() : NULL;
+  const int num_workers = worker_transformers_.size();
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_workers) if (num_workers > 1)
+#endif
+  for (int worker = 0; worker < num_workers; ++worker) {
+    Blob<Dtype>* transformed_data = worker_transformed_data_[worker].get();
+    for (int item_id = worker; item_id < batch_size;
+         item_id += num_workers) {
+      const Datum& datum = batch_datums_[item_id];
+      transformed_data->set_cpu_data(top_data + batch->data_.offset(item_id));
+      worker_transformers_[worker]->Transform(datum, transformed_data);
+      // Copy label.
+      if (top_label) {
+        top_label[item_id] = datum.label();
+      }
     }
-    trans_time += timer.MicroSeconds();
-    Next();
   }
+  trans_time += timer.MicroSeconds();
   timer.Stop();
   batch_timer.Stop();
   DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
@@ -1,6 +1,7 @@
 #include <vector>
 
 #include "caffe/layers/deconv_layer.hpp"
+#include "caffe/util/openmp.hpp"
 
 namespace caffe {
 
@@ -25,16 +26,21 @@ template <typename Dtype>
 void DeconvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const Dtype* weight = this->blobs_[0]->cpu_data();
+  const Dtype* bias = this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  const int num_threads = this->num_cpu_threads();
+  Dtype* col_buffers = this->cpu_col_buffers();
   for (int i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* top_data = top[i]->mutable_cpu_data();
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) if (num_threads > 1)
+#endif
     for (int n = 0; n < this->num_; ++n) {
+      Dtype* col_buff =
+          col_buffers + caffe_cpu_thread_num() * this->col_buffer_count();
       this->backward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
-          top_data + n * this->top_dim_);
-      if (this->bias_term_) {
-        const Dtype* bias = this->blobs_[1]->cpu_data();
-        this->forward_cpu_bias(top_data + n * this->top_dim_, bias);
-      }
+          top_data + n * this->top_dim_, col_buff);
+      this->forward_cpu_bias_relu(top_data + n * this->top_dim_, bias);
     }
   }
 }
@@ -44,7 +50,14 @@ void DeconvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
   const Dtype* weight = this->blobs_[0]->cpu_data();
   Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+  const int weight_count = this->blobs_[0]->count();
+  const int num_threads = this->num_cpu_threads();
+  Dtype* col_buffers = this->cpu_col_buffers();
   for (int i = 0; i < top.size(); ++i) {
+    if (this->fused_relu_) {
+      caffe_cpu_relu_backward(top[i]->count(), this->relu_negative_slope_,
+          top[i]->cpu_data(), top[i]->mutable_cpu_diff());
+    }
     const Dtype* top_diff = top[i]->cpu_diff();
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* bottom_diff = bottom[i]->mutable_cpu_diff();
@@ -56,20 +69,35 @@ void DeconvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       }
     }
     if (this->param_propagate_down_[0] || propagate_down[i]) {
+      // When several threads share the batch, each accumulates its weight
+      // gradient separately and the partial sums are reduced afterwards.
+      const bool reduce_weight_diffs =
+          this->param_propagate_down_[0] && num_threads > 1;
+      Dtype* weight_diffs = reduce_weight_diffs ?
+          this->cpu_weight_diff_buffers() : weight_diff;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) if (num_threads > 1)
+#endif
       for (int n = 0; n < this->num_; ++n) {
+        const int t = caffe_cpu_thread_num();
+        Dtype* col_buff = col_buffers + t * this->col_buffer_count();
         // Gradient w.r.t. weight. Note that we will accumulate diffs.
         if (this->param_propagate_down_[0]) {
           this->weight_cpu_gemm(top_diff + n * this->top_dim_,
-              bottom_data + n * this->bottom_dim_, weight_diff);
+              bottom_data + n * this->bottom_dim_,
+              weight_diffs + t * weight_count, col_buff);
         }
         // Gradient w.r.t. bottom data, if necessary, reusing the column buffer
         // we might have just computed above.
         if (propagate_down[i]) {
           this->forward_cpu_gemm(top_diff + n * this->top_dim_, weight,
               bottom_diff + n * this->bottom_dim_,
-              this->param_propagate_down_[0]);
+              this->param_propagate_down_[0], col_buff);
         }
       }
+      if (reduce_weight_diffs) {
+        this->reduce_cpu_weight_diffs(weight_diff);
+      }
     }
   }
 }
@@ -18,6 +18,10 @@ void DeconvolutionLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
         const Dtype* bias = this->blobs_[1]->gpu_data();
         this->forward_gpu_bias(top_data + n * this->top_dim_, bias);
       }
+      if (this->fused_relu_) {
+        caffe_gpu_relu(this->top_dim_, this->relu_negative_slope_,
+            top_data + n * this->top_dim_);
+      }
     }
   }
 }
@@ -28,6 +32,10 @@ void DeconvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
   const Dtype* weight = this->blobs_[0]->gpu_data();
   Dtype* weight_diff = this->blobs_[0]->mutable_gpu_diff();
   for (int i = 0; i < top.size(); ++i) {
+    if (this->fused_relu_) {
+      caffe_gpu_relu_backward(top[i]->count(), this->relu_negative_slope_,
+          top[i]->gpu_data(), top[i]->mutable_gpu_diff());
+    }
     const Dtype* top_diff = top[i]->gpu_diff();
     const Dtype* bottom_data = bottom[i]->gpu_data();
     Dtype* bottom_diff = bottom[i]->mutable_gpu_diff();
@@ -2,6 +2,7 @@
 #include <vector>
 
 #include "caffe/layers/elu_layer.hpp"
+#include "caffe/util/openmp.hpp"
 
 namespace caffe {
 
@@ -12,10 +13,7 @@ void ELULayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   Dtype* top_data = top[0]->mutable_cpu_data();
   const int count = bottom[0]->count();
   Dtype alpha = this->layer_param_.elu_param().alpha();
-  for (int i = 0; i < count; ++i) {
-    top_data[i] = std::max(bottom_data[i], Dtype(0))
-        + alpha * (exp(std::min(bottom_data[i], Dtype(0))) - Dtype(1));
-  }
+  caffe_cpu_elu(count, alpha, bottom_data, top_data);
 }
 
 template <typename Dtype>
@@ -29,6 +27,9 @@ void ELULayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     const int count = bottom[0]->count();
     Dtype alpha = this->layer_param_.elu_param().alpha();
+#ifdef _OPENMP
+#pragma omp parallel for simd if (count >= kCpuParallelMinCount)
+#endif
     for (int i = 0; i < count; ++i) {
       bottom_diff[i] = top_diff[i] * ((bottom_data[i] > 0)
           + (alpha + top_data[i]) * (bottom_data[i] <= 0));
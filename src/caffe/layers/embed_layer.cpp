@@ -14,6 +14,9 @@ void EmbedLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   K_ = this->layer_param_.embed_param().input_dim();
   CHECK_GT(K_, 0) << "EmbedLayer input_dim must be positive.";
   bias_term_ = this->layer_param_.embed_param().bias_term();
+  sparse_gradient_ = this->layer_param_.embed_param().sparse_gradient();
+  weight_diff_rows_.clear();
+  weight_diff_row_listed_.assign(sparse_gradient_ ? K_ : 0, false);
   // Check if we need to set up the weights
   if (this->blobs_.size() > 0) {
     LOG(INFO) << "Skipping parameter initialization";
@@ -99,6 +102,10 @@ void EmbedLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       DCHECK_EQ(static_cast<Dtype>(index), bottom_data[n])
           << "non-integer input";
       caffe_axpy(N_, Dtype(1), top_diff + n * N_, weight_diff + index * N_);
+      if (sparse_gradient_ && !weight_diff_row_listed_[index]) {
+        weight_diff_row_listed_[index] = true;
+        weight_diff_rows_.push_back(index);
+      }
     }
   }
   if (bias_term_ && this->param_propagate_down_[1]) {
@@ -109,6 +116,14 @@ void EmbedLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   }
 }
 
+template <typename Dtype>
+void EmbedLayer<Dtype>::ClearParamDiffRows() {
+  for (int i = 0; i < weight_diff_rows_.size(); ++i) {
+    weight_diff_row_listed_[weight_diff_rows_[i]] = false;
+  }
+  weight_diff_rows_.clear();
+}
+
 #ifdef CPU_ONLY
 STUB_GPU(EmbedLayer);
 #endif
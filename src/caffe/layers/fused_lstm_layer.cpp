@@ -0,0 +1,354 @@
+#include <vector>
+
+#include "caffe/filler.hpp"
+#include "caffe/layers/fused_lstm_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/openmp.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void FusedLSTMLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  CHECK_GE(bottom[0]->num_axes(), 2)
+      << "bottom[0] must have at least 2 axes -- (#timesteps, #streams, ...)";
+  const RecurrentParameter& param = this->layer_param_.recurrent_param();
+  H_ = param.num_output();
+  CHECK_GT(H_, 0) << "num_output must be positive";
+  input_dim_ = bottom[0]->count(2);
+  static_input_ = (bottom.size() > 2 + 2 * expose_hidden());
+  static_dim_ = 0;
+  if (static_input_) {
+    CHECK_GE(bottom[2]->num_axes(), 1);
+    static_dim_ = bottom[2]->count(1);
+  }
+  // The parameters are those of the unrolled LSTMLayer, in its order, so that
+  // the two load each other's weights.
+  if (this->blobs_.size() > 0) {
+    LOG(INFO) << "Skipping parameter initialization";
+  } else {
+    this->blobs_.resize(3 + static_input_);
+    shared_ptr<Filler<Dtype> > weight_filler(
+        GetFiller<Dtype>(param.weight_filler()));
+    vector<int> weight_shape(2);
+    weight_shape[0] = 4 * H_;
+    weight_shape[1] = input_dim_;
+    this->blobs_[0].reset(new Blob<Dtype>(weight_shape));
+    weight_filler->Fill(this->blobs_[0].get());
+    vector<int> bias_shape(1, 4 * H_);
+    this->blobs_[1].reset(new Blob<Dtype>(bias_shape));
+    shared_ptr<Filler<Dtype> > bias_filler(
+        GetFiller<Dtype>(param.bias_filler()));
+    bias_filler->Fill(this->blobs_[1].get());
+    if (static_input_) {
+      weight_shape[1] = static_dim_;
+      this->blobs_[2].reset(new Blob<Dtype>(weight_shape));
+      weight_filler->Fill(this->blobs_[2].get());
+    }
+    weight_shape[1] = H_;
+    this->blobs_[recurrent_weight_index()].reset(new Blob<Dtype>(weight_shape));
+    weight_filler->Fill(this->blobs_[recurrent_weight_index()].get());
+  }
+  this->param_propagate_down_.resize(this->blobs_.size(), true);
+}
+
+template <typename Dtype>
+void FusedLSTMLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  CHECK_GE(bottom[0]->num_axes(), 2)
+      << "bottom[0] must have at least 2 axes -- (#timesteps, #streams, ...)";
+  T_ = bottom[0]->shape(0);
+  N_ = bottom[0]->shape(1);
+  CHECK_EQ(input_dim_, bottom[0]->count(2))
+      << "Input size incompatible with LSTM parameters.";
+  CHECK_EQ(bottom[1]->num_axes(), 2)
+      << "bottom[1] must have exactly 2 axes -- (#timesteps, #streams)";
+  CHECK_EQ(T_, bottom[1]->shape(0));
+  CHECK_EQ(N_, bottom[1]->shape(1));
+  if (static_input_) {
+    CHECK_EQ(N_, bottom[2]->shape(0));
+    CHECK_EQ(static_dim_, bottom[2]->count(1))
+        << "Static input size incompatible with LSTM parameters.";
+  }
+  vector<int> state_shape(3);
+  state_shape[0] = 1;
+  state_shape[1] = N_;
+  state_shape[2] = H_;
+  if (expose_hidden()) {
+    for (int i = 2 + static_input_; i < bottom.size(); ++i) {
+      CHECK(bottom[i]->shape() == state_shape)
+          << "bottom[" << i << "] must be the (1, #streams, num_output) "
+          << "initial state, not " << bottom[i]->shape_string();
+    }
+    top[1]->Reshape(state_shape);
+    top[2]->Reshape(state_shape);
+  } else if (hidden_T_.shape() != state_shape) {
+    // The carried state belongs to other streams; start over.
+    hidden_T_.Reshape(state_shape);
+    cell_T_.Reshape(state_shape);
+    Reset();
+  }
+  vector<int> shape(3);
+  shape[0] = T_;
+  shape[1] = N_;
+  shape[2] = H_;
+  top[0]->Reshape(shape);
+  tanh_cell_.Reshape(shape);
+  hidden_conted_.Reshape(shape);
+  shape[0] = T_ + 1;
+  cell_.Reshape(shape);
+  shape[0] = 2;
+  recurrent_diff_.Reshape(shape);
+  shape[0] = T_;
+  shape[2] = 4 * H_;
+  gates_.Reshape(shape);
+  if (static_input_) {
+    vector<int> static_shape(2);
+    static_shape[0] = N_;
+    static_shape[1] = 4 * H_;
+    static_gates_.Reshape(static_shape);
+  }
+}
+
+template <typename Dtype>
+void FusedLSTMLayer<Dtype>::Reset() {
+  caffe_set(hidden_T_.count(), Dtype(0), hidden_T_.mutable_cpu_data());
+  caffe_set(cell_T_.count(), Dtype(0), cell_T_.mutable_cpu_data());
+}
+
+// One timestep of the LSTM for the N streams, as LSTMUnitLayer computes it:
+// turns the gate inputs into the activations (i, f, o, g) in place, and
+// computes the cell c, tanh(c) and the hidden state h.
+template <typename Dtype>
+static void LSTMForwardStep(const int N, const int H, const Dtype* cont,
+    const Dtype* c_prev, Dtype* gates, Dtype* c, Dtype* tanh_c, Dtype* h) {
+#ifdef _OPENMP
+#pragma omp parallel for if (N * 4 * H >= kCpuParallelMinCount)
+#endif
+  for (int n = 0; n < N; ++n) {
+    Dtype* gate = gates + n * 4 * H;
+    caffe_cpu_sigmoid(3 * H, gate, gate);
+    caffe_cpu_tanh(H, gate + 3 * H, gate + 3 * H);
+    const Dtype cont_n = cont[n];
+    const Dtype* i = gate;
+    const Dtype* f = gate + H;
+    const Dtype* o = gate + 2 * H;
+    const Dtype* g = gate + 3 * H;
+    const Dtype* c_prev_n = c_prev + n * H;
+    Dtype* c_n = c + n * H;
+    Dtype* tanh_c_n = tanh_c + n * H;
+    Dtype* h_n = h + n * H;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for (int d = 0; d < H; ++d) {
+      c_n[d] = cont_n * f[d] * c_prev_n[d] + i[d] * g[d];
+    }
+    caffe_cpu_tanh(H, c_n, tanh_c_n);
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for (int d = 0; d < H; ++d) {
+      h_n[d] = o[d] * tanh_c_n[d];
+    }
+  }
+}
+
+// The backward pass of LSTMForwardStep: from the gradient dh with respect to
+// h, and dc with respect to c, computes the gradients with respect to the
+// gate inputs, and replaces dc by that with respect to c_prev.
+template <typename Dtype>
+static void LSTMBackwardStep(const int N, const int H, const Dtype* cont,
+    const Dtype* c_prev, const Dtype* gates, const Dtype* tanh_c,
+    const Dtype* h_diff, const Dtype* h_recurrent_diff, Dtype* c_diff,
+    Dtype* gates_diff) {
+#ifdef _OPENMP
+#pragma omp parallel for if (N * 4 * H >= kCpuParallelMinCount)
+#endif
+  for (int n = 0; n < N; ++n) {
+    const Dtype cont_n = cont[n];
+    const Dtype* i = gates + n * 4 * H;
+    const Dtype* f = i + H;
+    const Dtype* o = i + 2 * H;
+    const Dtype* g = i + 3 * H;
+    Dtype* i_diff = gates_diff + n * 4 * H;
+    Dtype* f_diff = i_diff + H;
+    Dtype* o_diff = i_diff + 2 * H;
+    Dtype* g_diff = i_diff + 3 * H;
+    const Dtype* c_prev_n = c_prev + n * H;
+    const Dtype* tanh_c_n = tanh_c + n * H;
+    const Dtype* h_diff_n = h_diff + n * H;
+    const Dtype* h_recurrent_diff_n = h_recurrent_diff + n * H;
+    Dtype* c_diff_n = c_diff + n * H;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for (int d = 0; d < H; ++d) {
+      const Dtype dh = h_diff_n[d] + h_recurrent_diff_n[d];
+      const Dtype c_term_diff =
+          c_diff_n[d] + dh * o[d] * (1 - tanh_c_n[d] * tanh_c_n[d]);
+      i_diff[d] = c_term_diff * g[d] * i[d] * (1 - i[d]);
+      f_diff[d] = cont_n * c_term_diff * c_prev_n[d] * f[d] * (1 - f[d]);
+      o_diff[d] = dh * tanh_c_n[d] * o[d] * (1 - o[d]);
+      g_diff[d] = c_term_diff * i[d] * (1 - g[d] * g[d]);
+      c_diff_n[d] = cont_n * c_term_diff * f[d];
+    }
+  }
+}
+
+// y = cont[n] * x for the rows x of N x H; safe in place.
+template <typename Dtype>
+static void ScaleRows(const int N, const int H, const Dtype* cont,
+    const Dtype* x, Dtype* y) {
+  for (int n = 0; n < N; ++n) {
+    const Dtype cont_n = cont[n];
+    const Dtype* x_n = x + n * H;
+    Dtype* y_n = y + n * H;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for (int d = 0; d < H; ++d) {
+      y_n[d] = cont_n * x_n[d];
+    }
+  }
+}
+
+template <typename Dtype>
+void FusedLSTMLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+    const vector<Blob<Dtype>*>& top) {
+  const int gate_dim = 4 * H_;
+  const int step_gates = N_ * gate_dim;
+  const int step_state = N_ * H_;
+  const Dtype* cont = bottom[1]->cpu_data();
+  Dtype* gates = gates_.mutable_cpu_data();
+  Dtype* cell = cell_.mutable_cpu_data();
+  Dtype* tanh_cell = tanh_cell_.mutable_cpu_data();
+  Dtype* hidden_conted = hidden_conted_.mutable_cpu_data();
+  Dtype* hidden = top[0]->mutable_cpu_data();
+  // The input transform of all the timesteps at once:
+  //     gate_input_t := W_xc * x_t + b_c (+ W_xc_static * x_static)
+  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, T_ * N_, gate_dim,
+      input_dim_, (Dtype)1., bottom[0]->cpu_data(),
+      this->blobs_[0]->cpu_data(), (Dtype)0., gates);
+  caffe_cpu_bias_relu(T_ * N_, gate_dim, this->blobs_[1]->cpu_data(), false,
+      false, Dtype(0), gates);
+  if (static_input_) {
+    Dtype* static_gates = static_gates_.mutable_cpu_data();
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, N_, gate_dim, static_dim_,
+        (Dtype)1., bottom[2]->cpu_data(), this->blobs_[2]->cpu_data(),
+        (Dtype)0., static_gates);
+    for (int t = 0; t < T_; ++t) {
+      caffe_axpy(step_gates, Dtype(1), static_gates, gates + t * step_gates);
+    }
+  }
+  const Dtype* hidden_0 = expose_hidden() ?
+      bottom[2 + static_input_]->cpu_data() : hidden_T_.cpu_data();
+  const Dtype* cell_0 = expose_hidden() ?
+      bottom[3 + static_input_]->cpu_data() : cell_T_.cpu_data();
+  caffe_copy(step_state, cell_0, cell);
+  const Dtype* recurrent_weight =
+      this->blobs_[recurrent_weight_index()]->cpu_data();
+  for (int t = 0; t < T_; ++t) {
+    const Dtype* hidden_prev =
+        t == 0 ? hidden_0 : hidden + (t - 1) * step_state;
+    Dtype* hidden_conted_t = hidden_conted + t * step_state;
+    Dtype* gates_t = gates + t * step_gates;
+    //     h_conted_{t-1} := cont_t * h_{t-1}
+    //     gate_input_t += W_hc * h_conted_{t-1}
+    ScaleRows(N_, H_, cont + t * N_, hidden_prev, hidden_conted_t);
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, N_, gate_dim, H_,
+        (Dtype)1., hidden_conted_t, recurrent_weight, (Dtype)1., gates_t);
+    LSTMForwardStep(N_, H_, cont + t * N_, cell + t * step_state, gates_t,
+        cell + (t + 1) * step_state, tanh_cell + t * step_state,
+        hidden + t * step_state);
+  }
+  Dtype* hidden_T = expose_hidden() ?
+      top[1]->mutable_cpu_data() : hidden_T_.mutable_cpu_data();
+  Dtype* cell_T = expose_hidden() ?
+      top[2]->mutable_cpu_data() : cell_T_.mutable_cpu_data();
+  caffe_copy(step_state, hidden + (T_ - 1) * step_state, hidden_T);
+  caffe_copy(step_state, cell + T_ * step_state, cell_T);
+}
+
+template <typename Dtype>
+void FusedLSTMLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
+    const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  CHECK(!propagate_down[1]) << "Cannot backpropagate to sequence indicators.";
+  const int gate_dim = 4 * H_;
+  const int step_gates = N_ * gate_dim;
+  const int step_state = N_ * H_;
+  const Dtype* cont = bottom[1]->cpu_data();
+  const Dtype* gates = gates_.cpu_data();
+  const Dtype* cell = cell_.cpu_data();
+  const Dtype* tanh_cell = tanh_cell_.cpu_data();
+  const Dtype* hidden_diff = top[0]->cpu_diff();
+  const Dtype* recurrent_weight =
+      this->blobs_[recurrent_weight_index()]->cpu_data();
+  Dtype* gates_diff = gates_.mutable_cpu_diff();
+  // Nothing flows back from the next batch.
+  Dtype* hidden_recurrent_diff = recurrent_diff_.mutable_cpu_data();
+  Dtype* cell_diff = hidden_recurrent_diff + step_state;
+  caffe_set(2 * step_state, Dtype(0), hidden_recurrent_diff);
+  for (int t = T_ - 1; t >= 0; --t) {
+    Dtype* gates_diff_t = gates_diff + t * step_gates;
+    LSTMBackwardStep(N_, H_, cont + t * N_, cell + t * step_state,
+        gates + t * step_gates, tanh_cell + t * step_state,
+        hidden_diff + t * step_state, hidden_recurrent_diff, cell_diff,
+        gates_diff_t);
+    if (t > 0) {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, N_, H_, gate_dim,
+          (Dtype)1., gates_diff_t, recurrent_weight, (Dtype)0.,
+          hidden_recurrent_diff);
+      ScaleRows(N_, H_, cont + t * N_, hidden_recurrent_diff,
+          hidden_recurrent_diff);
+    }
+  }
+  // The gradients with respect to the parameters and inputs, each one GEMM
+  // over all the timesteps.
+  if (this->param_propagate_down_[0]) {
+    caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, gate_dim, input_dim_,
+        T_ * N_, (Dtype)1., gates_diff, bottom[0]->cpu_data(), (Dtype)1.,
+        this->blobs_[0]->mutable_cpu_diff());
+  }
+  if (this->param_propagate_down_[1]) {
+    caffe_cpu_bias_backward(T_ * N_, gate_dim, gates_diff, false,
+        this->blobs_[1]->mutable_cpu_diff());
+  }
+  if (this->param_propagate_down_[recurrent_weight_index()]) {
+    caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, gate_dim, H_, T_ * N_,
+        (Dtype)1., gates_diff, hidden_conted_.cpu_data(), (Dtype)1.,
+        this->blobs_[recurrent_weight_index()]->mutable_cpu_diff());
+  }
+  if (propagate_down[0]) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, T_ * N_, input_dim_,
+        gate_dim, (Dtype)1., gates_diff, this->blobs_[0]->cpu_data(),
+        (Dtype)0., bottom[0]->mutable_cpu_diff());
+  }
+  if (static_input_ &&
+      (this->param_propagate_down_[2] || propagate_down[2])) {
+    Dtype* static_gates_diff = static_gates_.mutable_cpu_diff();
+    caffe_copy(step_gates, gates_diff, static_gates_diff);
+    for (int t = 1; t < T_; ++t) {
+      caffe_axpy(step_gates, Dtype(1), gates_diff + t * step_gates,
+          static_gates_diff);
+    }
+    if (this->param_propagate_down_[2]) {
+      caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, gate_dim, static_dim_,
+          N_, (Dtype)1., static_gates_diff, bottom[2]->cpu_data(), (Dtype)1.,
+          this->blobs_[2]->mutable_cpu_diff());
+    }
+    if (propagate_down[2]) {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, N_, static_dim_,
+          gate_dim, (Dtype)1., static_gates_diff, this->blobs_[2]->cpu_data(),
+          (Dtype)0., bottom[2]->mutable_cpu_diff());
+    }
+  }
+}
+
+#ifdef CPU_ONLY
+STUB_GPU(FusedLSTMLayer);
+#endif
+
+INSTANTIATE_CLASS(FusedLSTMLayer);
+
+}  // namespace caffe
@@ -0,0 +1,246 @@
+#include <vector>
+
+#include "caffe/layers/fused_lstm_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+__device__ Dtype fused_lstm_sigmoid(const Dtype x) {
+  return Dtype(1) / (Dtype(1) + exp(-x));
+}
+
+// Adds the bias, and the static input transform if any, to the gate inputs of
+// all the timesteps.
+template <typename Dtype>
+__global__ void FusedLSTMAddBias(const int nthreads, const int gate_dim,
+    const int step_gates, const Dtype* bias, const Dtype* static_gates,
+    Dtype* gates) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    Dtype gate = gates[index] + bias[index % gate_dim];
+    if (static_gates) {
+      gate += static_gates[index % step_gates];
+    }
+    gates[index] = gate;
+  }
+}
+
+// y = cont[n] * x for the rows x of N x H; safe in place.
+template <typename Dtype>
+__global__ void FusedLSTMScaleRows(const int nthreads, const int dim,
+    const Dtype* cont, const Dtype* x, Dtype* y) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    y[index] = cont[index / dim] * x[index];
+  }
+}
+
+template <typename Dtype>
+__global__ void FusedLSTMForward(const int nthreads, const int dim,
+    const Dtype* cont, const Dtype* c_prev, Dtype* gates, Dtype* c,
+    Dtype* tanh_c, Dtype* h) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int n = index / dim;
+    const int d = index % dim;
+    Dtype* gate = gates + 4 * dim * n + d;
+    const Dtype i = fused_lstm_sigmoid(gate[0]);
+    const Dtype f = fused_lstm_sigmoid(gate[dim]);
+    const Dtype o = fused_lstm_sigmoid(gate[2 * dim]);
+    const Dtype g = tanh(gate[3 * dim]);
+    gate[0] = i;
+    gate[dim] = f;
+    gate[2 * dim] = o;
+    gate[3 * dim] = g;
+    const Dtype c_index = cont[n] * f * c_prev[index] + i * g;
+    const Dtype tanh_c_index = tanh(c_index);
+    c[index] = c_index;
+    tanh_c[index] = tanh_c_index;
+    h[index] = o * tanh_c_index;
+  }
+}
+
+template <typename Dtype>
+__global__ void FusedLSTMBackward(const int nthreads, const int dim,
+    const Dtype* cont, const Dtype* c_prev, const Dtype* gates,
+    const Dtype* tanh_c, const Dtype* h_diff, const Dtype* h_recurrent_diff,
+    Dtype* c_diff, Dtype* gates_diff) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int n = index / dim;
+    const int d = index % dim;
+    const Dtype* gate = gates + 4 * dim * n + d;
+    const Dtype i = gate[0];
+    const Dtype f = gate[dim];
+    const Dtype o = gate[2 * dim];
+    const Dtype g = gate[3 * dim];
+    const Dtype cont_n = cont[n];
+    const Dtype tanh_c_index = tanh_c[index];
+    const Dtype dh = h_diff[index] + h_recurrent_diff[index];
+    const Dtype c_term_diff =
+        c_diff[index] + dh * o * (1 - tanh_c_index * tanh_c_index);
+    Dtype* gate_diff = gates_diff + 4 * dim * n + d;
+    gate_diff[0] = c_term_diff * g * i * (1 - i);
+    gate_diff[dim] = cont_n * c_term_diff * c_prev[index] * f * (1 - f);
+    gate_diff[2 * dim] = dh * tanh_c_index * o * (1 - o);
+    gate_diff[3 * dim] = c_term_diff * i * (1 - g * g);
+    c_diff[index] = cont_n * c_term_diff * f;
+  }
+}
+
+// y[j] (+)= the sum over the rows of the num x dim matrix X of column j.
+template <typename Dtype>
+__global__ void FusedLSTMSumRows(const int nthreads, const int num,
+    const Dtype* X, const bool accumulate, Dtype* y) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    Dtype sum = accumulate ? y[index] : Dtype(0);
+    for (int r = 0; r < num; ++r) {
+      sum += X[r * nthreads + index];
+    }
+    y[index] = sum;
+  }
+}
+
+template <typename Dtype>
+void FusedLSTMLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+    const vector<Blob<Dtype>*>& top) {
+  const int gate_dim = 4 * H_;
+  const int step_gates = N_ * gate_dim;
+  const int step_state = N_ * H_;
+  const Dtype* cont = bottom[1]->gpu_data();
+  Dtype* gates = gates_.mutable_gpu_data();
+  Dtype* cell = cell_.mutable_gpu_data();
+  Dtype* tanh_cell = tanh_cell_.mutable_gpu_data();
+  Dtype* hidden_conted = hidden_conted_.mutable_gpu_data();
+  Dtype* hidden = top[0]->mutable_gpu_data();
+  caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans, T_ * N_, gate_dim,
+      input_dim_, (Dtype)1., bottom[0]->gpu_data(),
+      this->blobs_[0]->gpu_data(), (Dtype)0., gates);
+  const Dtype* static_gates = NULL;
+  if (static_input_) {
+    caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans, N_, gate_dim, static_dim_,
+        (Dtype)1., bottom[2]->gpu_data(), this->blobs_[2]->gpu_data(),
+        (Dtype)0., static_gates_.mutable_gpu_data());
+    static_gates = static_gates_.gpu_data();
+  }
+  const int gates_count = gates_.count();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  FusedLSTMAddBias<Dtype><<<CAFFE_GET_BLOCKS(gates_count),
+      CAFFE_CUDA_NUM_THREADS>>>(gates_count, gate_dim, step_gates,
+      this->blobs_[1]->gpu_data(), static_gates, gates);
+  CUDA_POST_KERNEL_CHECK;
+  const Dtype* hidden_0 = expose_hidden() ?
+      bottom[2 + static_input_]->gpu_data() : hidden_T_.gpu_data();
+  const Dtype* cell_0 = expose_hidden() ?
+      bottom[3 + static_input_]->gpu_data() : cell_T_.gpu_data();
+  caffe_copy(step_state, cell_0, cell);
+  const Dtype* recurrent_weight =
+      this->blobs_[recurrent_weight_index()]->gpu_data();
+  for (int t = 0; t < T_; ++t) {
+    const Dtype* hidden_prev =
+        t == 0 ? hidden_0 : hidden + (t - 1) * step_state;
+    Dtype* hidden_conted_t = hidden_conted + t * step_state;
+    Dtype* gates_t = gates + t * step_gates;
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    FusedLSTMScaleRows<Dtype><<<CAFFE_GET_BLOCKS(step_state),
+        CAFFE_CUDA_NUM_THREADS>>>(step_state, H_, cont + t * N_, hidden_prev,
+        hidden_conted_t);
+    CUDA_POST_KERNEL_CHECK;
+    caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans, N_, gate_dim, H_,
+        (Dtype)1., hidden_conted_t, recurrent_weight, (Dtype)1., gates_t);
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    FusedLSTMForward<Dtype><<<CAFFE_GET_BLOCKS(step_state),
+        CAFFE_CUDA_NUM_THREADS>>>(step_state, H_, cont + t * N_,
+        cell + t * step_state, gates_t, cell + (t + 1) * step_state,
+        tanh_cell + t * step_state, hidden + t * step_state);
+    CUDA_POST_KERNEL_CHECK;
+  }
+  Dtype* hidden_T = expose_hidden() ?
+      top[1]->mutable_gpu_data() : hidden_T_.mutable_gpu_data();
+  Dtype* cell_T = expose_hidden() ?
+      top[2]->mutable_gpu_data() : cell_T_.mutable_gpu_data();
+  caffe_copy(step_state, hidden + (T_ - 1) * step_state, hidden_T);
+  caffe_copy(step_state, cell + T_ * step_state, cell_T);
+}
+
+template <typename Dtype>
+void FusedLSTMLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
+    const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  CHECK(!propagate_down[1]) << "Cannot backpropagate to sequence indicators.";
+  const int gate_dim = 4 * H_;
+  const int step_gates = N_ * gate_dim;
+  const int step_state = N_ * H_;
+  const Dtype* cont = bottom[1]->gpu_data();
+  const Dtype* gates = gates_.gpu_data();
+  const Dtype* cell = cell_.gpu_data();
+  const Dtype* tanh_cell = tanh_cell_.gpu_data();
+  const Dtype* hidden_diff = top[0]->gpu_diff();
+  const Dtype* recurrent_weight =
+      this->blobs_[recurrent_weight_index()]->gpu_data();
+  Dtype* gates_diff = gates_.mutable_gpu_diff();
+  Dtype* hidden_recurrent_diff = recurrent_diff_.mutable_gpu_data();
+  Dtype* cell_diff = hidden_recurrent_diff + step_state;
+  caffe_gpu_set(2 * step_state, Dtype(0), hidden_recurrent_diff);
+  for (int t = T_ - 1; t >= 0; --t) {
+    Dtype* gates_diff_t = gates_diff + t * step_gates;
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    FusedLSTMBackward<Dtype><<<CAFFE_GET_BLOCKS(step_state),
+        CAFFE_CUDA_NUM_THREADS>>>(step_state, H_, cont + t * N_,
+        cell + t * step_state, gates + t * step_gates,
+        tanh_cell + t * step_state, hidden_diff + t * step_state,
+        hidden_recurrent_diff, cell_diff, gates_diff_t);
+    CUDA_POST_KERNEL_CHECK;
+    if (t > 0) {
+      caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, N_, H_, gate_dim,
+          (Dtype)1., gates_diff_t, recurrent_weight, (Dtype)0.,
+          hidden_recurrent_diff);
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      FusedLSTMScaleRows<Dtype><<<CAFFE_GET_BLOCKS(step_state),
+          CAFFE_CUDA_NUM_THREADS>>>(step_state, H_, cont + t * N_,
+          hidden_recurrent_diff, hidden_recurrent_diff);
+      CUDA_POST_KERNEL_CHECK;
+    }
+  }
+  if (this->param_propagate_down_[0]) {
+    caffe_gpu_gemm<Dtype>(CblasTrans, CblasNoTrans, gate_dim, input_dim_,
+        T_ * N_, (Dtype)1., gates_diff, bottom[0]->gpu_data(), (Dtype)1.,
+        this->blobs_[0]->mutable_gpu_diff());
+  }
+  if (this->param_propagate_down_[1]) {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    FusedLSTMSumRows<Dtype><<<CAFFE_GET_BLOCKS(gate_dim),
+        CAFFE_CUDA_NUM_THREADS>>>(gate_dim, T_ * N_, gates_diff, true,
+        this->blobs_[1]->mutable_gpu_diff());
+    CUDA_POST_KERNEL_CHECK;
+  }
+  if (this->param_propagate_down_[recurrent_weight_index()]) {
+    caffe_gpu_gemm<Dtype>(CblasTrans, CblasNoTrans, gate_dim, H_, T_ * N_,
+        (Dtype)1., gates_diff, hidden_conted_.gpu_data(), (Dtype)1.,
+        this->blobs_[recurrent_weight_index()]->mutable_gpu_diff());
+  }
+  if (propagate_down[0]) {
+    caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, T_ * N_, input_dim_,
+        gate_dim, (Dtype)1., gates_diff, this->blobs_[0]->gpu_data(),
+        (Dtype)0., bottom[0]->mutable_gpu_diff());
+  }
+  if (static_input_ &&
+      (this->param_propagate_down_[2] || propagate_down[2])) {
+    Dtype* static_gates_diff = static_gates_.mutable_gpu_diff();
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    FusedLSTMSumRows<Dtype><<<CAFFE_GET_BLOCKS(step_gates),
+        CAFFE_CUDA_NUM_THREADS>>>(step_gates, T_, gates_diff, false,
+        static_gates_diff);
+    CUDA_POST_KERNEL_CHECK;
+    if (this->param_propagate_down_[2]) {
+      caffe_gpu_gemm<Dtype>(CblasTrans, CblasNoTrans, gate_dim, static_dim_,
+          N_, (Dtype)1., static_gates_diff, bottom[2]->gpu_data(), (Dtype)1.,
+          this->blobs_[2]->mutable_gpu_diff());
+    }
+    if (propagate_down[2]) {
+      caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, N_, static_dim_,
+          gate_dim, (Dtype)1., static_gates_diff, this->blobs_[2]->gpu_data(),
+          (Dtype)0., bottom[2]->mutable_gpu_diff());
+    }
+  }
+}
+
+INSTANTIATE_LAYER_GPU_FUNCS(FusedLSTMLayer);
+
+}  // namespace caffe
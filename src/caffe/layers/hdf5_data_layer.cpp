@@ -1,12 +1,7 @@
 #ifdef USE_HDF5
-/*
-TODO:
-- load file in a separate thread ("prefetch")
-- can be smarter about the memcpy call instead of doing it row-by-row
-  :: use util functions caffe_copy, and Blob->offset()
-  :: don't forget to update hdf5_daa_layer.cu accordingly
-- add ability to shuffle filenames if flag is set
-*/
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <climits>
 #include <fstream>  // NOLINT(readability/streams)
 #include <string>
 #include <vector>
@@ -17,57 +12,105 @@ TODO:
 
 #include "caffe/layers/hdf5_data_layer.hpp"
 #include "caffe/util/hdf5.hpp"
+#include "caffe/util/rng.hpp"
 
 namespace caffe {
 
 template <typename Dtype>
-HDF5DataLayer<Dtype>::~HDF5DataLayer<Dtype>() { }
+HDF5DataLayer<Dtype>::HDF5DataLayer(const LayerParameter& param)
+    : Layer<Dtype>(param), file_id_(-1), offset_(),
+      prefetch_(param.hdf5_data_param().prefetch()),
+      prefetch_free_(param.hdf5_data_param().prefetch()),
+      prefetch_full_(param.hdf5_data_param().prefetch()),
+      prefetch_current_() {
+  for (int i = 0; i < prefetch_.size(); ++i) {
+    prefetch_[i].reset(new BlobsBatch<Dtype>());
+    prefetch_free_.push(prefetch_[i].get());
+  }
+}
+
+template <typename Dtype>
+HDF5DataLayer<Dtype>::~HDF5DataLayer<Dtype>() {
+  // Stop before the members the thread uses go away.
+  StopInternalThread();
+}
 
-// Load data and label from HDF5 filename into the class property blobs.
+// Open the current file and check its datasets against the tops.
 template <typename Dtype>
-void HDF5DataLayer<Dtype>::LoadHDF5FileData(const char* filename) {
-  DLOG(INFO) << "Loading HDF5 file: " << filename;
-  hid_t file_id = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
-  if (file_id < 0) {
+void HDF5DataLayer<Dtype>::OpenFile() {
+  const string& filename = hdf_filenames_[file_permutation_[current_file_]];
+  DLOG(INFO) << "Opening HDF5 file: " << filename;
+  HDF5Lock lock;
+  file_id_ = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+  if (file_id_ < 0) {
     LOG(FATAL) << "Failed opening HDF5 file: " << filename;
   }
-
-  int top_size = this->layer_param_.top_size();
-  hdf_blobs_.resize(top_size);
-
-  const int MIN_DATA_DIM = 1;
-  const int MAX_DATA_DIM = INT_MAX;
-
+  const int top_size = this->layer_param_.top_size();
   for (int i = 0; i < top_size; ++i) {
-    hdf_blobs_[i] = shared_ptr<Blob<Dtype> >(new Blob<Dtype>());
-    // Allow reshape here, as we are loading data not params
-    hdf5_load_nd_dataset(file_id, this->layer_param_.top(i).c_str(),
-        MIN_DATA_DIM, MAX_DATA_DIM, hdf_blobs_[i].get(), true);
+    const string& dataset = this->layer_param_.top(i);
+    const std::vector<hsize_t> dims =
+        hdf5_get_nd_dataset_dims(file_id_, dataset.c_str(), 1, INT_MAX);
+    CHECK_EQ(dims.size(), hdf_blobs_[i]->num_axes())
+        << "Dataset " << dataset << " of " << filename
+        << " differs in shape from the first file";
+    for (int j = 1; j < dims.size(); ++j) {
+      CHECK_EQ(dims[j], hdf_blobs_[i]->shape(j))
+          << "Dataset " << dataset << " of " << filename
+          << " differs in shape from the first file";
+    }
+    if (i == 0) {
+      file_rows_ = dims[0];
+    } else {
+      CHECK_EQ(dims[0], file_rows_);
+    }
   }
+  CHECK_GT(file_rows_, 0) << "No rows in HDF5 file: " << filename;
+  // Default to identity permutation.
+  const hsize_t chunk_size = this->layer_param_.hdf5_data_param().chunk_size();
+  chunk_permutation_.resize((file_rows_ + chunk_size - 1) / chunk_size);
+  for (int i = 0; i < chunk_permutation_.size(); ++i) {
+    chunk_permutation_[i] = i;
+  }
+  if (this->layer_param_.hdf5_data_param().shuffle()) {
+    shuffle(chunk_permutation_.begin(), chunk_permutation_.end());
+  }
+  current_chunk_ = 0;
+}
 
-  herr_t status = H5Fclose(file_id);
-  CHECK_GE(status, 0) << "Failed to close HDF5 file: " << filename;
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::CloseFile() {
+  if (file_id_ < 0) { return; }
+  HDF5Lock lock;
+  herr_t status = H5Fclose(file_id_);
+  CHECK_GE(status, 0) << "Failed to close HDF5 file: "
+      << hdf_filenames_[file_permutation_[current_file_]];
+  file_id_ = -1;
+}
 
-  // MinTopBlobs==1 guarantees at least one top blob
-  CHECK_GE(hdf_blobs_[0]->num_axes(), 1) << "Input must have at least 1 axis.";
-  const int num = hdf_blobs_[0]->shape(0);
-  for (int i = 1; i < top_size; ++i) {
-    CHECK_EQ(hdf_blobs_[i]->shape(0), num);
+// Read the rows of the current chunk into hdf_blobs_.
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::LoadChunk() {
+  const hsize_t chunk_size = this->layer_param_.hdf5_data_param().chunk_size();
+  const hsize_t begin = chunk_permutation_[current_chunk_] * chunk_size;
+  const hsize_t rows = std::min(chunk_size, file_rows_ - begin);
+  {
+    HDF5Lock lock;
+    for (int i = 0; i < hdf_blobs_.size(); ++i) {
+      vector<int> shape = hdf_blobs_[i]->shape();
+      shape[0] = rows;
+      hdf_blobs_[i]->Reshape(shape);
+      hdf5_load_nd_dataset_rows(file_id_, this->layer_param_.top(i).c_str(),
+          begin, rows, hdf_blobs_[i]->mutable_cpu_data());
+    }
   }
-  // Default to identity permutation.
-  data_permutation_.clear();
-  data_permutation_.resize(hdf_blobs_[0]->shape(0));
-  for (int i = 0; i < hdf_blobs_[0]->shape(0); i++)
+  data_permutation_.resize(rows);
+  for (int i = 0; i < rows; ++i) {
     data_permutation_[i] = i;
-
-  // Shuffle if needed.
+  }
   if (this->layer_param_.hdf5_data_param().shuffle()) {
-    std::random_shuffle(data_permutation_.begin(), data_permutation_.end());
-    DLOG(INFO) << "Successfully loaded " << hdf_blobs_[0]->shape(0)
-               << " rows (shuffled)";
-  } else {
-    DLOG(INFO) << "Successfully loaded " << hdf_blobs_[0]->shape(0) << " rows";
+    shuffle(data_permutation_.begin(), data_permutation_.end());
   }
+  current_row_ = 0;
 }
 
 template <typename Dtype>
@@ -76,8 +119,22 @@ void HDF5DataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // Refuse transformation parameters since HDF5 is totally generic.
   CHECK(!this->layer_param_.has_transform_param()) <<
       this->type() << " does not transform data.";
+  const HDF5DataParameter& param = this->layer_param_.hdf5_data_param();
+  CHECK_GT(param.chunk_size(), 0);
+  CHECK_GT(param.prefetch(), 0);
+  // Start over from the first file if set up again.
+  StopInternalThread();
+  BlobsBatch<Dtype>* batch;
+  while (prefetch_full_.try_pop(&batch)) {
+    prefetch_free_.push(batch);
+  }
+  if (prefetch_current_) {
+    prefetch_free_.push(prefetch_current_);
+    prefetch_current_ = NULL;
+  }
+
   // Read the source to parse the filenames.
-  const string& source = this->layer_param_.hdf5_data_param().source();
+  const string& source = param.source();
   LOG(INFO) << "Loading list of HDF5 filenames from: " << source;
   hdf_filenames_.clear();
   std::ifstream source_file(source.c_str());
@@ -98,32 +155,66 @@ void HDF5DataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
 
   file_permutation_.clear();
   file_permutation_.resize(num_files_);
-  // Default to identity permutation.
+  // Default to identity permutation; the prefetch thread shuffles it.
   for (int i = 0; i < num_files_; i++) {
     file_permutation_[i] = i;
   }
 
-  // Shuffle if needed.
-  if (this->layer_param_.hdf5_data_param().shuffle()) {
-    std::random_shuffle(file_permutation_.begin(), file_permutation_.end());
+  // Shape the tops like the datasets of the first file, whose other
+  // dimensions all files share.
+  const int batch_size = param.batch_size();
+  const int top_size = this->layer_param_.top_size();
+  hdf_blobs_.resize(top_size);
+  {
+    HDF5Lock lock;
+    const string& filename = hdf_filenames_[0];
+    hid_t file_id = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (file_id < 0) {
+      LOG(FATAL) << "Failed opening HDF5 file: " << filename;
+    }
+    for (int i = 0; i < top_size; ++i) {
+      const std::vector<hsize_t> dims = hdf5_get_nd_dataset_dims(
+          file_id, this->layer_param_.top(i).c_str(), 1, INT_MAX);
+      vector<int> top_shape(dims.begin(), dims.end());
+      top_shape[0] = 0;
+      hdf_blobs_[i].reset(new Blob<Dtype>(top_shape));
+      top_shape[0] = batch_size;
+      top[i]->Reshape(top_shape);
+    }
+    herr_t status = H5Fclose(file_id);
+    CHECK_GE(status, 0) << "Failed to close HDF5 file: " << filename;
+  }
+  for (int i = 0; i < prefetch_.size(); ++i) {
+    prefetch_[i]->blobs_.resize(top_size);
+    for (int j = 0; j < top_size; ++j) {
+      prefetch_[i]->blobs_[j].reset(new Blob<Dtype>(top[j]->shape()));
+      prefetch_[i]->blobs_[j]->mutable_cpu_data();
+    }
   }
 
-  // Load the first HDF5 file and initialize the line counter.
-  LoadHDF5FileData(hdf_filenames_[file_permutation_[current_file_]].c_str());
-  current_row_ = 0;
+  offset_ = 0;
+  DLOG(INFO) << "Initializing prefetch";
+  StartInternalThread();
+  DLOG(INFO) << "Prefetch initialized.";
+}
 
-  // Reshape blobs.
-  const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
-  const int top_size = this->layer_param_.top_size();
-  vector<int> top_shape;
-  for (int i = 0; i < top_size; ++i) {
-    top_shape.resize(hdf_blobs_[i]->num_axes());
-    top_shape[0] = batch_size;
-    for (int j = 1; j < top_shape.size(); ++j) {
-      top_shape[j] = hdf_blobs_[i]->shape(j);
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::InternalThreadEntry() {
+  if (this->layer_param_.hdf5_data_param().shuffle()) {
+    shuffle(file_permutation_.begin(), file_permutation_.end());
+  }
+  OpenFile();
+  LoadChunk();
+  try {
+    while (!must_stop()) {
+      BlobsBatch<Dtype>* batch = prefetch_free_.pop();
+      load_batch(batch);
+      prefetch_full_.push(batch);
     }
-    top[i]->Reshape(top_shape);
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
   }
+  CloseFile();
 }
 
 template <typename Dtype>
@@ -138,45 +229,72 @@ bool HDF5DataLayer<Dtype>::Skip() {
 
 template<typename Dtype>
 void HDF5DataLayer<Dtype>::Next() {
-  if (++current_row_ == hdf_blobs_[0]->shape(0)) {
-    if (num_files_ > 1) {
-      ++current_file_;
-      if (current_file_ == num_files_) {
-        current_file_ = 0;
-        if (this->layer_param_.hdf5_data_param().shuffle()) {
-          std::random_shuffle(file_permutation_.begin(),
-                              file_permutation_.end());
+  if (++current_row_ == data_permutation_.size()) {
+    const bool shuffle_data = this->layer_param_.hdf5_data_param().shuffle();
+    if (++current_chunk_ == chunk_permutation_.size()) {
+      if (num_files_ > 1) {
+        CloseFile();
+        ++current_file_;
+        if (current_file_ == num_files_) {
+          current_file_ = 0;
+          if (shuffle_data) {
+            shuffle(file_permutation_.begin(), file_permutation_.end());
+          }
+          DLOG(INFO) << "Looping around to first file.";
+        }
+        OpenFile();
+      } else {
+        current_chunk_ = 0;
+        if (shuffle_data) {
+          shuffle(chunk_permutation_.begin(), chunk_permutation_.end());
         }
-        DLOG(INFO) << "Looping around to first file.";
       }
-      LoadHDF5FileData(
-        hdf_filenames_[file_permutation_[current_file_]].c_str());
     }
-    current_row_ = 0;
-    if (this->layer_param_.hdf5_data_param().shuffle())
-      std::random_shuffle(data_permutation_.begin(), data_permutation_.end());
+    if (num_files_ > 1 || chunk_permutation_.size() > 1) {
+      LoadChunk();
+    } else {
+      // All the data is in the one chunk already loaded.
+      current_row_ = 0;
+      if (shuffle_data) {
+        shuffle(data_permutation_.begin(), data_permutation_.end());
+      }
+    }
   }
   offset_++;
 }
 
 template <typename Dtype>
-void HDF5DataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-      const vector<Blob<Dtype>*>& top) {
+void HDF5DataLayer<Dtype>::load_batch(BlobsBatch<Dtype>* batch) {
   const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
   for (int i = 0; i < batch_size; ++i) {
     while (Skip()) {
       Next();
     }
-    for (int j = 0; j < this->layer_param_.top_size(); ++j) {
-      int data_dim = top[j]->count() / top[j]->shape(0);
+    for (int j = 0; j < batch->blobs_.size(); ++j) {
+      Blob<Dtype>* blob = batch->blobs_[j].get();
+      int data_dim = blob->count() / blob->shape(0);
       caffe_copy(data_dim,
           &hdf_blobs_[j]->cpu_data()[data_permutation_[current_row_]
-            * data_dim], &top[j]->mutable_cpu_data()[i * data_dim]);
+            * data_dim], &blob->mutable_cpu_data()[i * data_dim]);
     }
     Next();
   }
 }
 
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  if (prefetch_current_) {
+    prefetch_free_.push(prefetch_current_);
+  }
+  prefetch_current_ = prefetch_full_.pop("Waiting for data");
+  for (int j = 0; j < prefetch_current_->blobs_.size(); ++j) {
+    Blob<Dtype>* blob = prefetch_current_->blobs_[j].get();
+    top[j]->ReshapeLike(*blob);
+    top[j]->set_cpu_data(blob->mutable_cpu_data());
+  }
+}
+
 #ifdef CPU_ONLY
 STUB_GPU_FORWARD(HDF5DataLayer, Forward);
 #endif
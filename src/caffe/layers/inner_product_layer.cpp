@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <vector>
 
 #include "caffe/filler.hpp"
@@ -12,6 +13,20 @@ void InnerProductLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   const int num_output = this->layer_param_.inner_product_param().num_output();
   bias_term_ = this->layer_param_.inner_product_param().bias_term();
   transpose_ = this->layer_param_.inner_product_param().transpose();
+  fused_relu_ = this->layer_param_.inner_product_param().has_fused_relu();
+  relu_negative_slope_ =
+      this->layer_param_.inner_product_param().fused_relu().negative_slope();
+  const LayerParameter& layer_param = this->layer_param_;
+  int8_ = layer_param.has_quantization_param() &&
+      layer_param.quantization_param().precision() ==
+      QuantizationParameter_Precision_INT8 && this->phase_ == TEST;
+  int8_weights_version_ = 0;
+  if (int8_) {
+    const float input_max = layer_param.quantization_param().input_max();
+    CHECK_GT(input_max, 0) << "int8 quantization of layer "
+        << layer_param.name() << " needs a calibrated input_max";
+    int8_input_scale_ = 127 / input_max;
+  }
   N_ = num_output;
   const int axis = bottom[0]->CanonicalAxisIndex(
       this->layer_param_.inner_product_param().axis());
@@ -72,27 +87,77 @@ void InnerProductLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   top_shape.resize(axis + 1);
   top_shape[axis] = N_;
   top[0]->Reshape(top_shape);
-  // Set up the bias multiplier
-  if (bias_term_) {
-    vector<int> bias_shape(1, M_);
-    bias_multiplier_.Reshape(bias_shape);
-    caffe_set(M_, Dtype(1), bias_multiplier_.mutable_cpu_data());
-  }
 }
 
 template <typename Dtype>
 void InnerProductLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
+  if (int8_) {
+    Forward_cpu_int8(bottom, top);
+    return;
+  }
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   const Dtype* weight = this->blobs_[0]->cpu_data();
   caffe_cpu_gemm<Dtype>(CblasNoTrans, transpose_ ? CblasNoTrans : CblasTrans,
       M_, N_, K_, (Dtype)1.,
       bottom_data, weight, (Dtype)0., top_data);
-  if (bias_term_) {
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, 1, (Dtype)1.,
-        bias_multiplier_.cpu_data(),
-        this->blobs_[1]->cpu_data(), (Dtype)1., top_data);
+  caffe_cpu_bias_relu(M_, N_, bias_term_ ? this->blobs_[1]->cpu_data() : NULL,
+      false, fused_relu_, relu_negative_slope_, top_data);
+}
+
+template <typename Dtype>
+void InnerProductLayer<Dtype>::Forward_cpu_int8(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  // Quantize again whenever the weights may have been written, e.g. loaded,
+  // copied in, or updated by the training net that shares them.
+  const uint64_t weights_version = this->blobs_[0]->data()->version();
+  if (weights_version != int8_weights_version_) {
+    // Quantize the weights of every output with its own scale, stored as
+    // K_ x N_ whether or not they are transposed.
+    int8_weights_.reset(new SyncedMemory(K_ * N_));
+    int8_t* quantized = static_cast<int8_t*>(int8_weights_->mutable_cpu_data());
+    const int k_stride = transpose_ ? N_ : 1;
+    const int n_stride = transpose_ ? 1 : K_;
+    int8_output_scales_.resize(N_);
+    for (int n = 0; n < N_; ++n) {
+      Dtype weight_max = 0;
+      for (int k = 0; k < K_; ++k) {
+        weight_max = std::max(weight_max,
+            std::abs(weight[n * n_stride + k * k_stride]));
+      }
+      const Dtype scale = weight_max > 0 ? 127 / weight_max : 0;
+      for (int k = 0; k < K_; ++k) {
+        caffe_cpu_quantize(1, scale, weight + n * n_stride + k * k_stride,
+            quantized + k * N_ + n);
+      }
+      int8_output_scales_[n] =
+          weight_max > 0 ? 1 / (scale * int8_input_scale_) : 0;
+    }
+    int8_weights_version_ = weights_version;
+  }
+  if (!int8_input_ || int8_input_->size() < M_ * K_) {
+    int8_input_.reset(new SyncedMemory(M_ * K_));
+    int8_products_.reset(new SyncedMemory(M_ * N_ * sizeof(int32_t)));
+  }
+  int8_t* quantized_input =
+      static_cast<int8_t*>(int8_input_->mutable_cpu_data());
+  int32_t* products = static_cast<int32_t*>(int8_products_->mutable_cpu_data());
+  caffe_cpu_quantize(M_ * K_, int8_input_scale_, bottom[0]->cpu_data(),
+      quantized_input);
+  caffe_cpu_gemm_s8(M_, N_, K_, quantized_input,
+      static_cast<const int8_t*>(int8_weights_->cpu_data()), products);
+  // Convert back, adding the bias and applying the ReLU on the way.
+  const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  for (int m = 0; m < M_; ++m) {
+    for (int n = 0; n < N_; ++n) {
+      Dtype value = products[m * N_ + n] * int8_output_scales_[n];
+      if (bias) { value += bias[n]; }
+      if (fused_relu_ && value < 0) { value *= relu_negative_slope_; }
+      top_data[m * N_ + n] = value;
+    }
   }
 }
 
@@ -100,6 +165,11 @@ template <typename Dtype>
 void InnerProductLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down,
     const vector<Blob<Dtype>*>& bottom) {
+  if (fused_relu_) {
+    // Backpropagate through the ReLU in place, like an in-place ReLU layer.
+    caffe_cpu_relu_backward(top[0]->count(), relu_negative_slope_,
+        top[0]->cpu_data(), top[0]->mutable_cpu_diff());
+  }
   if (this->param_propagate_down_[0]) {
     const Dtype* top_diff = top[0]->cpu_diff();
     const Dtype* bottom_data = bottom[0]->cpu_data();
@@ -119,8 +189,7 @@ void InnerProductLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   if (bias_term_ && this->param_propagate_down_[1]) {
     const Dtype* top_diff = top[0]->cpu_diff();
     // Gradient with respect to bias
-    caffe_cpu_gemv<Dtype>(CblasTrans, M_, N_, (Dtype)1., top_diff,
-        bias_multiplier_.cpu_data(), (Dtype)1.,
+    caffe_cpu_bias_backward(M_, N_, top_diff, false,
         this->blobs_[1]->mutable_cpu_diff());
   }
   if (propagate_down[0]) {
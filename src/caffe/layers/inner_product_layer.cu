@@ -6,6 +6,15 @@
 
 namespace caffe {
 
+template <typename Dtype>
+const Dtype* InnerProductLayer<Dtype>::gpu_bias_multiplier() {
+  if (bias_multiplier_.count() != M_) {
+    bias_multiplier_.Reshape(vector<int>(1, M_));
+    caffe_gpu_set(M_, Dtype(1), bias_multiplier_.mutable_gpu_data());
+  }
+  return bias_multiplier_.gpu_data();
+}
+
 template <typename Dtype>
 void InnerProductLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
@@ -16,7 +25,7 @@ void InnerProductLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
     caffe_gpu_gemv<Dtype>(CblasNoTrans, N_, K_, (Dtype)1.,
                          weight, bottom_data, (Dtype)0., top_data);
     if (bias_term_)
-      caffe_gpu_axpy<Dtype>(N_, bias_multiplier_.cpu_data()[0],
+      caffe_gpu_axpy<Dtype>(N_, (Dtype)1.,
                             this->blobs_[1]->gpu_data(), top_data);
   } else {
     caffe_gpu_gemm<Dtype>(CblasNoTrans,
@@ -25,15 +34,23 @@ void InnerProductLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
                           bottom_data, weight, (Dtype)0., top_data);
     if (bias_term_)
       caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, 1, (Dtype)1.,
-                            bias_multiplier_.gpu_data(),
+                            gpu_bias_multiplier(),
                             this->blobs_[1]->gpu_data(), (Dtype)1., top_data);
   }
+  if (fused_relu_) {
+    caffe_gpu_relu(M_ * N_, relu_negative_slope_, top_data);
+  }
 }
 
 template <typename Dtype>
 void InnerProductLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down,
     const vector<Blob<Dtype>*>& bottom) {
+  if (fused_relu_) {
+    // Backpropagate through the ReLU in place, like an in-place ReLU layer.
+    caffe_gpu_relu_backward(top[0]->count(), relu_negative_slope_,
+        top[0]->gpu_data(), top[0]->mutable_gpu_diff());
+  }
   if (this->param_propagate_down_[0]) {
     const Dtype* top_diff = top[0]->gpu_diff();
     const Dtype* bottom_data = bottom[0]->gpu_data();
@@ -54,7 +71,7 @@ void InnerProductLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     const Dtype* top_diff = top[0]->gpu_diff();
     // Gradient with respect to bias
     caffe_gpu_gemv<Dtype>(CblasTrans, M_, N_, (Dtype)1., top_diff,
-        bias_multiplier_.gpu_data(), (Dtype)1.,
+        gpu_bias_multiplier(), (Dtype)1.,
         this->blobs_[1]->mutable_gpu_diff());
   }
   if (propagate_down[0]) {
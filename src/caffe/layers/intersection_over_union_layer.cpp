@@ -1,27 +1,35 @@
-#include <functional>
-#include <utility>
+#include <algorithm>
 #include <vector>
 
 #include "caffe/layers/intersection_over_union_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/openmp.hpp"
 
 namespace caffe {
 
+// Pixels are counted in blocks of one image, which is also the unit of work
+// of the CPU threads.
+static const int kIoUBlockSize = 256;
+
 template <typename Dtype>
 void IntersectionOverUnionLayer<Dtype>::LayerSetUp(
   const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  has_ignore_label_ =
-    this->layer_param_.intersectionoverunion_param().has_ignore_label();
+  const IntersectionOverUnionParameter& iou_param =
+      this->layer_param_.intersectionoverunion_param();
+  has_ignore_label_ = iou_param.has_ignore_label();
   if (has_ignore_label_) {
-    ignore_label_ = this->layer_param_.intersectionoverunion_param().ignore_label();
+    ignore_label_ = iou_param.ignore_label();
+  }
+  if (iou_param.accumulate()) {
+    this->ResetMetric();
   }
 }
 
 template <typename Dtype>
 void IntersectionOverUnionLayer<Dtype>::Reshape(
   const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  label_axis_ =
-      bottom[0]->CanonicalAxisIndex(this->layer_param_.intersectionoverunion_param().axis());
+  label_axis_ = bottom[0]->CanonicalAxisIndex(
+      this->layer_param_.intersectionoverunion_param().axis());
   outer_num_ = bottom[0]->count(0, label_axis_);
   inner_num_ = bottom[0]->count(label_axis_ + 1);
   CHECK_EQ(outer_num_ * inner_num_, bottom[1]->count())
@@ -33,96 +41,189 @@ void IntersectionOverUnionLayer<Dtype>::Reshape(
   top[0]->Reshape(top_shape);
 
   // Intersect and unions are per-class vectors. 1 axis
-  vector<int> top_shape_per_class(1);
-  top_shape_per_class[0] = bottom[0]->shape(label_axis_);
-  nums_intersect_.Reshape(top_shape_per_class);
-  nums_union_.Reshape(top_shape_per_class);
+  const int num_labels = bottom[0]->shape(label_axis_);
+  vector<int> top_shape_per_class(1, num_labels);
   if (top.size() > 1) {
     top[1]->Reshape(top_shape_per_class);
-    nums_buffer_.Reshape(top_shape_per_class);
   }
+  vector<int> counts_shape(3);
+  counts_shape[0] = outer_num_;
+  counts_shape[1] = 3;
+  counts_shape[2] = num_labels;
+  counts_.Reshape(counts_shape);
+  this->ReshapeMetricState(3 * num_labels);
 }
 
+// Add the pixels [begin, end) of one image to its counts: those of each class
+// in the ground truth, in the predictions (the argmax of the scores, found for
+// the whole block one class at a time) and in both.
 template <typename Dtype>
-void IntersectionOverUnionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-    const vector<Blob<Dtype>*>& top) {
+static void CountBlock(const Dtype* scores, const Dtype* labels,
+    int num_labels, int inner_num, int begin, int end, bool has_ignore_label,
+    int ignore_label, int* counts) {
+  const int size = end - begin;
+  Dtype max_val[kIoUBlockSize];
+  int max_id[kIoUBlockSize];
+  for (int i = 0; i < size; ++i) {
+    max_val[i] = scores[begin + i];
+    max_id[i] = 0;
+  }
+  for (int k = 1; k < num_labels; ++k) {
+    const Dtype* class_scores = scores + k * inner_num + begin;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for (int i = 0; i < size; ++i) {
+      const bool better = class_scores[i] > max_val[i];
+      max_val[i] = better ? class_scores[i] : max_val[i];
+      max_id[i] = better ? k : max_id[i];
+    }
+  }
+  for (int i = 0; i < size; ++i) {
+    const int label_value = static_cast<int>(labels[begin + i]);
+    if (has_ignore_label && label_value == ignore_label) {
+      continue;
+    }
+    DCHECK_GE(label_value, 0);
+    DCHECK_LT(label_value, num_labels);
+    ++counts[label_value];
+    ++counts[num_labels + max_id[i]];
+    counts[2 * num_labels + label_value] += (max_id[i] == label_value);
+  }
+}
+
+template <typename Dtype>
+void IntersectionOverUnionLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   const Dtype* bottom_label = bottom[1]->cpu_data();
   const int dim = bottom[0]->count() / outer_num_;
   const int num_labels = bottom[0]->shape(label_axis_);
-
-  Dtype outer_accum = 0;
-  if (top.size() > 1) {
-    caffe_set(nums_buffer_.count(), Dtype(0), nums_buffer_.mutable_cpu_data());
-    caffe_set(top[1]->count(), Dtype(0), top[1]->mutable_cpu_data());
+  const int image_counts = counts_.count(1);
+  const int blocks = (inner_num_ + kIoUBlockSize - 1) / kIoUBlockSize;
+  // Each thread counts its blocks on its own copy of the counts.
+  const int num_threads = bottom[0]->count() >= kCpuParallelMinCount ?
+      caffe_cpu_max_threads() : 1;
+  thread_counts_.assign(num_threads * counts_.count(), 0);
+#ifdef _OPENMP
+#pragma omp parallel num_threads(num_threads)
+#endif
+  {
+    int* counts = &thread_counts_[caffe_cpu_thread_num() * counts_.count()];
+#ifdef _OPENMP
+#pragma omp for
+#endif
+    for (int task = 0; task < outer_num_ * blocks; ++task) {
+      const int n = task / blocks;
+      const int begin = task % blocks * kIoUBlockSize;
+      CountBlock(bottom_data + n * dim, bottom_label + n * inner_num_,
+          num_labels, inner_num_, begin,
+          std::min(begin + kIoUBlockSize, inner_num_), has_ignore_label_,
+          ignore_label_, counts + n * image_counts);
+    }
   }
+  int* counts = counts_.mutable_cpu_data();
+  caffe_copy(counts_.count(), &thread_counts_[0], counts);
+  for (int t = 1; t < num_threads; ++t) {
+    const int* other = &thread_counts_[t * counts_.count()];
+    for (int i = 0; i < counts_.count(); ++i) {
+      counts[i] += other[i];
+    }
+  }
+  ComputeIoU(top);
+}
 
-  for (int i = 0; i < outer_num_; ++i) {
-    caffe_set(nums_intersect_.count(), Dtype(0), nums_intersect_.mutable_cpu_data());
-    caffe_set(nums_union_.count(), Dtype(0), nums_union_.mutable_cpu_data());
-    for (int j = 0; j < inner_num_; ++j) {
-      const int label_value =
-          static_cast<int>(bottom_label[i * inner_num_ + j]);
-      if (has_ignore_label_ && label_value == ignore_label_) {
-        continue;
-      }
-      // Count union of gt up
-      // Union: GT + False predictions
-      // Intersection: True predictions
-      ++nums_union_.mutable_cpu_data()[label_value];
-      DCHECK_GE(label_value, 0);
-      DCHECK_LT(label_value, num_labels);
-      Dtype max_val = -1;
-      Dtype cur_val;
-      int max_id = 0;
-      for (int k = 0; k < num_labels; ++k) {
-        cur_val = bottom_data[i * dim + k * inner_num_ + j];
-        if (cur_val > max_val) {
-          max_val = cur_val;
-          max_id  = k;
-        }
-      }
-      if (max_id == label_value) {
-        // True prediction. Add one to intersection of label_value
-        ++nums_intersect_.mutable_cpu_data()[label_value];
-      } else {
-        // False prediction. Add one to union of predicted class
-        ++nums_union_.mutable_cpu_data()[max_id];
+template <typename Dtype>
+void IntersectionOverUnionLayer<Dtype>::ComputeIoU(
+    const vector<Blob<Dtype>*>& top) {
+  const int num_labels = counts_.shape(2);
+  const int* counts = counts_.cpu_data();
+  if (this->accumulating()) {
+    vector<double> batch_state(3 * num_labels, 0);
+    for (int n = 0; n < outer_num_; ++n) {
+      for (int i = 0; i < 3 * num_labels; ++i) {
+        batch_state[i] += counts[n * 3 * num_labels + i];
       }
     }
+    this->UpdateMetric(batch_state, top);
+    return;
+  }
+  Dtype* per_class = top.size() > 1 ? top[1]->mutable_cpu_data() : NULL;
+  if (per_class) {
+    caffe_set(num_labels, Dtype(0), per_class);
+  }
+  // The mean over the images of their IoU, which is the mean over the classes
+  // in the image or its prediction. The IoU per class is the mean over the
+  // images with that class. Images whose every pixel is ignored are left out.
+  vector<int> class_images(num_labels, 0);
+  Dtype outer_accum = 0;
+  int num_images = 0;
+  for (int i = 0; i < outer_num_; ++i) {
+    const int* image = counts + i * 3 * num_labels;
     Dtype inner_accum = 0;
-    Dtype num_inner_labels = 0;
+    int num_inner_labels = 0;
     for (int j = 0; j < num_labels; ++j) {
-      if (has_ignore_label_ && j == ignore_label_) {
+      // Union: ground truth and false predictions.
+      const int union_count =
+          image[j] + image[num_labels + j] - image[2 * num_labels + j];
+      if ((has_ignore_label_ && j == ignore_label_) || union_count == 0) {
         continue;
       }
-      if (nums_union_.mutable_cpu_data()[j] > 0) {
-        ++num_inner_labels;
-        Dtype iou = nums_intersect_.mutable_cpu_data()[j] / nums_union_.mutable_cpu_data()[j];
-        inner_accum += iou;
-        if (top.size() > 1) {
-          ++nums_buffer_.mutable_cpu_data()[j];
-          top[1]->mutable_cpu_data()[j] += iou;
-        }
+      const Dtype iou = Dtype(image[2 * num_labels + j]) / union_count;
+      inner_accum += iou;
+      ++num_inner_labels;
+      if (per_class) {
+        per_class[j] += iou;
+        ++class_images[j];
       }
     }
-    inner_accum /= num_inner_labels;
-    outer_accum += inner_accum;
+    if (num_inner_labels > 0) {
+      outer_accum += inner_accum / num_inner_labels;
+      ++num_images;
+    }
   }
+  top[0]->mutable_cpu_data()[0] =
+      num_images == 0 ? 0 : outer_accum / num_images;
+  if (per_class) {
+    for (int j = 0; j < num_labels; ++j) {
+      if (class_images[j] > 0) {
+        per_class[j] /= class_images[j];
+      }
+    }
+  }
+}
 
-  // Do mean division by number of images (outer_num_)
-  top[0]->mutable_cpu_data()[0] = outer_accum / outer_num_;
-
-  // MeanIU layer should not be used as a loss function.
-  if (top.size() > 1) {
-    for (int i = 0; i < top[1]->count(); ++i) {
-      top[1]->mutable_cpu_data()[i] =
-          nums_buffer_.mutable_cpu_data()[i] == 0 ? 0
-          : top[1]->cpu_data()[i] / nums_buffer_.cpu_data()[i];
+// The mean over the classes seen so far of their IoU over all the pixels.
+template <typename Dtype>
+void IntersectionOverUnionLayer<Dtype>::ComputeMetric(
+    const vector<double>& state, const vector<Blob<Dtype>*>& top) const {
+  const int num_labels = state.size() / 3;
+  Dtype* per_class = top.size() > 1 ? top[1]->mutable_cpu_data() : NULL;
+  if (per_class) {
+    caffe_set(num_labels, Dtype(0), per_class);
+  }
+  double iou_sum = 0;
+  int num_classes = 0;
+  for (int j = 0; j < num_labels; ++j) {
+    const double union_count =
+        state[j] + state[num_labels + j] - state[2 * num_labels + j];
+    if ((has_ignore_label_ && j == ignore_label_) || union_count == 0) {
+      continue;
+    }
+    const double iou = state[2 * num_labels + j] / union_count;
+    iou_sum += iou;
+    ++num_classes;
+    if (per_class) {
+      per_class[j] = iou;
     }
   }
+  top[0]->mutable_cpu_data()[0] = num_classes == 0 ? 0 : iou_sum / num_classes;
 }
 
+#ifdef CPU_ONLY
+STUB_GPU_FORWARD(IntersectionOverUnionLayer, Forward);
+#endif
+
 INSTANTIATE_CLASS(IntersectionOverUnionLayer);
 REGISTER_LAYER_CLASS(IntersectionOverUnion);
 
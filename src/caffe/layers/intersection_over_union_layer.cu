@@ -0,0 +1,61 @@
+#include <vector>
+
+#include "caffe/layers/intersection_over_union_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// One thread per pixel: find the predicted class and add the pixel to the
+// counts of its image (ground truth, prediction, and both when they agree).
+template <typename Dtype>
+__global__ void IntersectionOverUnionCountGPU(const int nthreads,
+          const Dtype* bottom_data, const Dtype* label, const int dim,
+          const int spatial_dim, const int num_labels,
+          const bool has_ignore_label_, const int ignore_label_,
+          int* counts) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int n = index / spatial_dim;
+    const int s = index % spatial_dim;
+    const int label_value = static_cast<int>(label[index]);
+    if (!has_ignore_label_ || label_value != ignore_label_) {
+      const Dtype* scores = bottom_data + n * dim + s;
+      Dtype max_val = scores[0];
+      int max_id = 0;
+      for (int k = 1; k < num_labels; ++k) {
+        if (scores[k * spatial_dim] > max_val) {
+          max_val = scores[k * spatial_dim];
+          max_id = k;
+        }
+      }
+      int* image_counts = counts + n * 3 * num_labels;
+      atomicAdd(image_counts + label_value, 1);
+      atomicAdd(image_counts + num_labels + max_id, 1);
+      if (max_id == label_value) {
+        atomicAdd(image_counts + 2 * num_labels + label_value, 1);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void IntersectionOverUnionLayer<Dtype>::Forward_gpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const Dtype* bottom_data = bottom[0]->gpu_data();
+  const Dtype* bottom_label = bottom[1]->gpu_data();
+  const int dim = bottom[0]->count() / outer_num_;
+  const int num_labels = bottom[0]->shape(label_axis_);
+  const int nthreads = outer_num_ * inner_num_;
+  int* counts = counts_.mutable_gpu_data();
+  caffe_gpu_set(counts_.count(), 0, counts);
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  IntersectionOverUnionCountGPU<Dtype><<<CAFFE_GET_BLOCKS(nthreads),
+      CAFFE_CUDA_NUM_THREADS>>>(nthreads, bottom_data, bottom_label, dim,
+      inner_num_, num_labels, has_ignore_label_, ignore_label_, counts);
+  CUDA_POST_KERNEL_CHECK;
+  // The counts are few; the IoU is computed from them on the host.
+  ComputeIoU(top);
+}
+
+INSTANTIATE_LAYER_GPU_FORWARD(IntersectionOverUnionLayer);
+
+}  // namespace caffe
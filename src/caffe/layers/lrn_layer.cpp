@@ -1,10 +1,82 @@
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "caffe/layers/lrn_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/openmp.hpp"
 
 namespace caffe {
 
+using std::min;
+using std::max;
+
+// The number of positions of an image that ACROSS_CHANNELS slides over the
+// channels at once, with the running sums kept on the stack.
+static const int kLRNBlockSize = 256;
+
+// sum += sign * x^2.
+template <typename Dtype>
+static void AccumulateSquares(int n, Dtype sign, const Dtype* x, Dtype* sum) {
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+  for (int i = 0; i < n; ++i) {
+    sum[i] += sign * x[i] * x[i];
+  }
+}
+
+// y = x * scale^-beta. The common beta of 0.75 takes square roots, which
+// vectorize, instead of pow.
+template <typename Dtype>
+static void ScaleByPowx(int n, const Dtype* x, const Dtype* scale, Dtype beta,
+    Dtype* y) {
+  if (beta == Dtype(0.75)) {
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for (int i = 0; i < n; ++i) {
+      y[i] = x[i] / std::sqrt(scale[i] * std::sqrt(scale[i]));
+    }
+  } else {
+    for (int i = 0; i < n; ++i) {
+      y[i] = x[i] * std::pow(scale[i], -beta);
+    }
+  }
+}
+
+// Sums in over the size x size windows around each position of a plane,
+// clipped to the plane. rows is scratch of the same size, and out may be in.
+template <typename Dtype>
+static void BoxSum(const Dtype* in, int height, int width, int size,
+    Dtype* rows, Dtype* out) {
+  const int pre_pad = (size - 1) / 2;
+  for (int h = 0; h < height; ++h) {
+    for (int w = 0; w < width; ++w) {
+      const int wend = min(w + pre_pad + 1, width);
+      Dtype sum = 0;
+      for (int i = max(w - pre_pad, 0); i < wend; ++i) {
+        sum += in[h * width + i];
+      }
+      rows[h * width + w] = sum;
+    }
+  }
+  for (int h = 0; h < height; ++h) {
+    Dtype* out_row = out + h * width;
+    caffe_set(width, Dtype(0), out_row);
+    const int hend = min(h + pre_pad + 1, height);
+    for (int i = max(h - pre_pad, 0); i < hend; ++i) {
+      const Dtype* row = rows + i * width;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+      for (int w = 0; w < width; ++w) {
+        out_row[w] += row[w];
+      }
+    }
+  }
+}
+
 template <typename Dtype>
 void LRNLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
@@ -80,6 +152,7 @@ void LRNLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
     scale_.Reshape(num_, channels_, height_, width_);
     break;
   case LRNParameter_NormRegion_WITHIN_CHANNEL:
+    scale_.Reshape(num_, channels_, height_, width_);
     split_layer_->Reshape(bottom, split_top_vec_);
     square_layer_->Reshape(square_bottom_vec_, square_top_vec_);
     pool_layer_->Reshape(square_top_vec_, pool_top_vec_);
@@ -97,7 +170,7 @@ void LRNLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     CrossChannelForward_cpu(bottom, top);
     break;
   case LRNParameter_NormRegion_WITHIN_CHANNEL:
-    WithinChannelForward(bottom, top);
+    WithinChannelForward_cpu(bottom, top);
     break;
   default:
     LOG(FATAL) << "Unknown normalization region.";
@@ -110,45 +183,75 @@ void LRNLayer<Dtype>::CrossChannelForward_cpu(
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   Dtype* scale_data = scale_.mutable_cpu_data();
-  // start with the constant value
-  for (int i = 0; i < scale_.count(); ++i) {
-    scale_data[i] = k_;
-  }
-  Blob<Dtype> padded_square(1, channels_ + size_ - 1, height_, width_);
-  Dtype* padded_square_data = padded_square.mutable_cpu_data();
-  caffe_set(padded_square.count(), Dtype(0), padded_square_data);
-  Dtype alpha_over_size = alpha_ / size_;
-  // go through the images
-  for (int n = 0; n < num_; ++n) {
-    // compute the padded square
-    caffe_sqr(channels_ * height_ * width_,
-        bottom_data + bottom[0]->offset(n),
-        padded_square_data + padded_square.offset(0, pre_pad_));
-    // Create the first channel scale
-    for (int c = 0; c < size_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c),
-          scale_data + scale_.offset(n, 0));
+  const Dtype alpha_over_size = alpha_ / size_;
+  const int spatial = height_ * width_;
+  const int blocks = (spatial + kLRNBlockSize - 1) / kLRNBlockSize;
+  // Slide a window over the channels of each block of positions, adding the
+  // squares of its head and subtracting those of its tail.
+#ifdef _OPENMP
+#pragma omp parallel for if (bottom[0]->count() >= kCpuParallelMinCount)
+#endif
+  for (int task = 0; task < num_ * blocks; ++task) {
+    const int offset = bottom[0]->offset(task / blocks) +
+        task % blocks * kLRNBlockSize;
+    const int count = min(kLRNBlockSize, spatial - task % blocks *
+        kLRNBlockSize);
+    const Dtype* x = bottom_data + offset;
+    Dtype sum[kLRNBlockSize];
+    caffe_set(count, Dtype(0), sum);
+    for (int c = 0; c < min(pre_pad_, channels_); ++c) {
+      AccumulateSquares(count, Dtype(1), x + c * spatial, sum);
     }
-    for (int c = 1; c < channels_; ++c) {
-      // copy previous scale
-      caffe_copy<Dtype>(height_ * width_,
-          scale_data + scale_.offset(n, c - 1),
-          scale_data + scale_.offset(n, c));
-      // add head
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c + size_ - 1),
-          scale_data + scale_.offset(n, c));
-      // subtract tail
-      caffe_axpy<Dtype>(height_ * width_, -alpha_over_size,
-          padded_square_data + padded_square.offset(0, c - 1),
-          scale_data + scale_.offset(n, c));
+    for (int c = 0; c < channels_; ++c) {
+      if (c + pre_pad_ < channels_) {
+        AccumulateSquares(count, Dtype(1), x + (c + pre_pad_) * spatial, sum);
+      }
+      Dtype* scale = scale_data + offset + c * spatial;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+      for (int i = 0; i < count; ++i) {
+        scale[i] = k_ + alpha_over_size * sum[i];
+      }
+      ScaleByPowx(count, x + c * spatial, scale, beta_,
+          top_data + offset + c * spatial);
+      if (c >= pre_pad_) {
+        AccumulateSquares(count, Dtype(-1), x + (c - pre_pad_) * spatial, sum);
+      }
     }
   }
+}
 
-  // In the end, compute output
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, top_data);
-  caffe_mul<Dtype>(scale_.count(), top_data, bottom_data, top_data);
+template <typename Dtype>
+void LRNLayer<Dtype>::WithinChannelForward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  Dtype* scale_data = scale_.mutable_cpu_data();
+  const Dtype alpha_over_area = alpha_ / (size_ * size_);
+  const int spatial = height_ * width_;
+#ifdef _OPENMP
+#pragma omp parallel if (bottom[0]->count() >= kCpuParallelMinCount)
+#endif
+  {
+    vector<Dtype> buffer(2 * spatial);
+#ifdef _OPENMP
+#pragma omp for
+#endif
+    for (int plane = 0; plane < num_ * channels_; ++plane) {
+      const Dtype* x = bottom_data + plane * spatial;
+      Dtype* scale = scale_data + plane * spatial;
+      caffe_sqr(spatial, x, &buffer[0]);
+      BoxSum(&buffer[0], height_, width_, size_, &buffer[spatial], scale);
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+      for (int i = 0; i < spatial; ++i) {
+        scale[i] = 1 + alpha_over_area * scale[i];
+      }
+      ScaleByPowx(spatial, x, scale, beta_, top_data + plane * spatial);
+    }
+  }
 }
 
 template <typename Dtype>
@@ -169,13 +272,26 @@ void LRNLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     CrossChannelBackward_cpu(top, propagate_down, bottom);
     break;
   case LRNParameter_NormRegion_WITHIN_CHANNEL:
-    WithinChannelBackward(top, propagate_down, bottom);
+    WithinChannelBackward_cpu(top, propagate_down, bottom);
     break;
   default:
     LOG(FATAL) << "Unknown normalization region.";
   }
 }
 
+// accum += sign * top_diff * top_data / scale, the ratios that the gradient
+// of every input sums over its window.
+template <typename Dtype>
+static void AccumulateRatio(int n, Dtype sign, const Dtype* top_diff,
+    const Dtype* top_data, const Dtype* scale, Dtype* accum) {
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+  for (int i = 0; i < n; ++i) {
+    accum[i] += sign * top_diff[i] * top_data[i] / scale[i];
+  }
+}
+
 template <typename Dtype>
 void LRNLayer<Dtype>::CrossChannelBackward_cpu(
     const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
@@ -185,48 +301,88 @@ void LRNLayer<Dtype>::CrossChannelBackward_cpu(
   const Dtype* bottom_data = bottom[0]->cpu_data();
   const Dtype* scale_data = scale_.cpu_data();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  Blob<Dtype> padded_ratio(1, channels_ + size_ - 1, height_, width_);
-  Blob<Dtype> accum_ratio(1, 1, height_, width_);
-  Dtype* padded_ratio_data = padded_ratio.mutable_cpu_data();
-  Dtype* accum_ratio_data = accum_ratio.mutable_cpu_data();
-  // We hack a little bit by using the diff() to store an additional result
-  Dtype* accum_ratio_times_bottom = accum_ratio.mutable_cpu_diff();
-  caffe_set(padded_ratio.count(), Dtype(0), padded_ratio_data);
-  Dtype cache_ratio_value = 2. * alpha_ * beta_ / size_;
-
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, bottom_diff);
-  caffe_mul<Dtype>(scale_.count(), top_diff, bottom_diff, bottom_diff);
-
-  // go through individual data
-  int inverse_pre_pad = size_ - (size_ + 1) / 2;
-  for (int n = 0; n < num_; ++n) {
-    int block_offset = scale_.offset(n);
-    // first, compute diff_i * y_i / s_i
-    caffe_mul<Dtype>(channels_ * height_ * width_,
-        top_diff + block_offset, top_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
-    caffe_div<Dtype>(channels_ * height_ * width_,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad),
-        scale_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
-    // Now, compute the accumulated ratios and the bottom diff
-    caffe_set(accum_ratio.count(), Dtype(0), accum_ratio_data);
-    for (int c = 0; c < size_ - 1; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
+  const Dtype cache_ratio_value = 2. * alpha_ * beta_ / size_;
+  const int spatial = height_ * width_;
+  const int blocks = (spatial + kLRNBlockSize - 1) / kLRNBlockSize;
+  // Slide over the channels like the forward pass, accumulating the ratios.
+#ifdef _OPENMP
+#pragma omp parallel for if (bottom[0]->count() >= kCpuParallelMinCount)
+#endif
+  for (int task = 0; task < num_ * blocks; ++task) {
+    const int offset = bottom[0]->offset(task / blocks) +
+        task % blocks * kLRNBlockSize;
+    const int count = min(kLRNBlockSize, spatial - task % blocks *
+        kLRNBlockSize);
+    Dtype accum[kLRNBlockSize];
+    caffe_set(count, Dtype(0), accum);
+    for (int c = 0; c < min(pre_pad_, channels_); ++c) {
+      const int i = offset + c * spatial;
+      AccumulateRatio(count, Dtype(1), top_diff + i, top_data + i,
+          scale_data + i, accum);
     }
     for (int c = 0; c < channels_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c + size_ - 1),
-          accum_ratio_data);
-      // compute bottom diff
-      caffe_mul<Dtype>(height_ * width_,
-          bottom_data + top[0]->offset(n, c),
-          accum_ratio_data, accum_ratio_times_bottom);
-      caffe_axpy<Dtype>(height_ * width_, -cache_ratio_value,
-          accum_ratio_times_bottom, bottom_diff + top[0]->offset(n, c));
-      caffe_axpy<Dtype>(height_ * width_, -1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
+      if (c + pre_pad_ < channels_) {
+        const int i = offset + (c + pre_pad_) * spatial;
+        AccumulateRatio(count, Dtype(1), top_diff + i, top_data + i,
+            scale_data + i, accum);
+      }
+      const int i = offset + c * spatial;
+      ScaleByPowx(count, top_diff + i, scale_data + i, beta_,
+          bottom_diff + i);
+      const Dtype* x = bottom_data + i;
+      Dtype* dx = bottom_diff + i;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+      for (int j = 0; j < count; ++j) {
+        dx[j] -= cache_ratio_value * x[j] * accum[j];
+      }
+      if (c >= pre_pad_) {
+        const int tail = offset + (c - pre_pad_) * spatial;
+        AccumulateRatio(count, Dtype(-1), top_diff + tail, top_data + tail,
+            scale_data + tail, accum);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void LRNLayer<Dtype>::WithinChannelBackward_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<Dtype>*>& bottom) {
+  if (!propagate_down[0]) { return; }
+  const Dtype* top_diff = top[0]->cpu_diff();
+  const Dtype* top_data = top[0]->cpu_data();
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  const Dtype* scale_data = scale_.cpu_data();
+  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+  const Dtype cache_ratio_value = 2. * alpha_ * beta_ / (size_ * size_);
+  const int spatial = height_ * width_;
+#ifdef _OPENMP
+#pragma omp parallel if (bottom[0]->count() >= kCpuParallelMinCount)
+#endif
+  {
+    vector<Dtype> buffer(2 * spatial);
+    Dtype* accum = &buffer[0];
+#ifdef _OPENMP
+#pragma omp for
+#endif
+    for (int plane = 0; plane < num_ * channels_; ++plane) {
+      const int offset = plane * spatial;
+      caffe_set(spatial, Dtype(0), accum);
+      AccumulateRatio(spatial, Dtype(1), top_diff + offset,
+          top_data + offset, scale_data + offset, accum);
+      BoxSum(accum, height_, width_, size_, &buffer[spatial], accum);
+      ScaleByPowx(spatial, top_diff + offset, scale_data + offset, beta_,
+          bottom_diff + offset);
+      const Dtype* x = bottom_data + offset;
+      Dtype* dx = bottom_diff + offset;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+      for (int i = 0; i < spatial; ++i) {
+        dx[i] -= cache_ratio_value * x[i] * accum[i];
+      }
     }
   }
 }
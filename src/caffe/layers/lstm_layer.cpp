@@ -239,6 +239,5 @@ void LSTMLayer<Dtype>::FillUnrolledNet(NetParameter* net_param) const {
 }
 
 INSTANTIATE_CLASS(LSTMLayer);
-REGISTER_LAYER_CLASS(LSTM);
 
 }  // namespace caffe
@@ -18,26 +18,31 @@ void MeanLayer<Dtype>::Reshape(
 
   vector<int> top_shape(0);  // Mean performance measure is a scalar; 0 axes.
   top[0]->Reshape(top_shape);
+  this->ReshapeMetricState(2);
 }
 
 template <typename Dtype>
 void MeanLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
-  Dtype measure = 0;
   const Dtype* bottom_data = bottom[0]->cpu_data();
   const int num_measures = bottom[0]->shape(0); // For now just have one axis
 
-  int count = 0;
+  // The sum of the measures and their number.
+  vector<double> sums(2, 0);
   for (int i = 0; i < num_measures; ++i) {
-    measure += bottom_data[i];
-    ++count;
+    sums[0] += bottom_data[i];
+    ++sums[1];
   }
-
-  // LOG(INFO) << "Mean measure: " << accuracy;
-  top[0]->mutable_cpu_data()[0] = measure / count;
+  this->UpdateMetric(sums, top);
   // Mean layer should not be used as a loss function.
 }
 
+template <typename Dtype>
+void MeanLayer<Dtype>::ComputeMetric(const vector<double>& state,
+    const vector<Blob<Dtype>*>& top) const {
+  top[0]->mutable_cpu_data()[0] = state[1] == 0 ? 0 : state[0] / state[1];
+}
+
 INSTANTIATE_CLASS(MeanLayer);
 REGISTER_LAYER_CLASS(Mean);
 
@@ -4,6 +4,7 @@
 
 #include "caffe/layers/pooling_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/openmp.hpp"
 
 namespace caffe {
 
@@ -116,6 +117,33 @@ void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
     CHECK_LT((pooled_height_ - 1) * stride_h_, height_ + pad_h_);
     CHECK_LT((pooled_width_ - 1) * stride_w_, width_ + pad_w_);
   }
+  row_start_.resize(pooled_height_);
+  row_end_.resize(pooled_height_);
+  row_size_.resize(pooled_height_);
+  for (int ph = 0; ph < pooled_height_; ++ph) {
+    const int hstart = ph * stride_h_ - pad_h_;
+    const int hend = min(hstart + kernel_h_, height_ + pad_h_);
+    row_size_[ph] = hend - hstart;
+    row_start_[ph] = max(hstart, 0);
+    row_end_[ph] = min(hend, height_);
+  }
+  col_start_.resize(pooled_width_);
+  col_end_.resize(pooled_width_);
+  col_size_.resize(pooled_width_);
+  interior_col_begin_ = interior_col_end_ = 0;
+  for (int pw = 0; pw < pooled_width_; ++pw) {
+    const int wstart = pw * stride_w_ - pad_w_;
+    const int wend = min(wstart + kernel_w_, width_ + pad_w_);
+    col_size_[pw] = wend - wstart;
+    col_start_[pw] = max(wstart, 0);
+    col_end_[pw] = min(wend, width_);
+    if (wstart >= 0 && wstart + kernel_w_ <= width_) {
+      if (interior_col_end_ == 0) {
+        interior_col_begin_ = pw;
+      }
+      interior_col_end_ = pw + 1;
+    }
+  }
   top[0]->Reshape(bottom[0]->num(), channels_, pooled_height_,
       pooled_width_);
   if (top.size() > 1) {
@@ -135,100 +163,232 @@ void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
-// TODO(Yangqing): Is there a faster way to do pooling in the channel-first
-// case?
+// Max pools count K x K windows at stride 2, one per output, from the rows
+// starting at bottom, which is at index offset within its plane. The windows
+// lie entirely inside the input. Without a mask the outputs are independent,
+// and the loop over them is vectorized.
+template <typename Dtype, typename Mask, int K>
+static void MaxPoolStride2(const Dtype* bottom, int width, int offset,
+    int count, Dtype* top, Mask* mask) {
+  if (mask == NULL) {
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for (int i = 0; i < count; ++i) {
+      Dtype value = -FLT_MAX;
+      for (int h = 0; h < K; ++h) {
+        for (int w = 0; w < K; ++w) {
+          value = max(value, bottom[h * width + 2 * i + w]);
+        }
+      }
+      top[i] = value;
+    }
+  } else {
+    for (int i = 0; i < count; ++i) {
+      Dtype value = -FLT_MAX;
+      int index = -1;
+      for (int h = 0; h < K; ++h) {
+        for (int w = 0; w < K; ++w) {
+          const int j = h * width + 2 * i + w;
+          if (bottom[j] > value) {
+            value = bottom[j];
+            index = offset + j;
+          }
+        }
+      }
+      top[i] = value;
+      mask[i] = index;
+    }
+  }
+}
+
+// Average pools count K x K windows at stride 2 like MaxPoolStride2.
+template <typename Dtype, int K>
+static void AvePoolStride2(const Dtype* bottom, int width, int count,
+    Dtype* top) {
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+  for (int i = 0; i < count; ++i) {
+    Dtype sum = 0;
+    for (int h = 0; h < K; ++h) {
+      for (int w = 0; w < K; ++w) {
+        sum += bottom[h * width + 2 * i + w];
+      }
+    }
+    top[i] = sum / (K * K);
+  }
+}
+
+template <typename Dtype>
+template <typename Mask>
+void PoolingLayer<Dtype>::MaxPoolPlane_cpu(const Dtype* bottom, Dtype* top,
+    Mask* mask) const {
+  if (global_pooling_) {
+    const int count = height_ * width_;
+    Dtype value = -FLT_MAX;
+    if (mask == NULL) {
+#ifdef _OPENMP
+#pragma omp simd reduction(max:value)
+#endif
+      for (int i = 0; i < count; ++i) {
+        value = max(value, bottom[i]);
+      }
+    } else {
+      int index = -1;
+      for (int i = 0; i < count; ++i) {
+        if (bottom[i] > value) {
+          value = bottom[i];
+          index = i;
+        }
+      }
+      mask[0] = index;
+    }
+    top[0] = value;
+    return;
+  }
+  const bool stride2 = stride_w_ == 2 && kernel_h_ == kernel_w_ &&
+      (kernel_w_ == 2 || kernel_w_ == 3);
+  for (int ph = 0; ph < pooled_height_; ++ph) {
+    const int hstart = row_start_[ph];
+    const int hend = row_end_[ph];
+    Dtype* top_row = top + ph * pooled_width_;
+    Mask* mask_row = mask == NULL ? NULL : mask + ph * pooled_width_;
+    // Windows that lie inside the input take the stride 2 kernels.
+    int fast_begin = 0, fast_end = 0;
+    if (stride2 && hend - hstart == kernel_h_) {
+      fast_begin = interior_col_begin_;
+      fast_end = interior_col_end_;
+    }
+    for (int pw = 0; pw < pooled_width_; ++pw) {
+      if (pw == fast_begin && fast_begin < fast_end) {
+        const int offset = hstart * width_ + col_start_[pw];
+        Mask* fast_mask = mask_row == NULL ? NULL : mask_row + pw;
+        if (kernel_w_ == 2) {
+          MaxPoolStride2<Dtype, Mask, 2>(bottom + offset, width_, offset,
+              fast_end - fast_begin, top_row + pw, fast_mask);
+        } else {
+          MaxPoolStride2<Dtype, Mask, 3>(bottom + offset, width_, offset,
+              fast_end - fast_begin, top_row + pw, fast_mask);
+        }
+        pw = fast_end - 1;
+        continue;
+      }
+      Dtype value = -FLT_MAX;
+      int index = -1;
+      for (int h = hstart; h < hend; ++h) {
+        for (int w = col_start_[pw]; w < col_end_[pw]; ++w) {
+          if (bottom[h * width_ + w] > value) {
+            value = bottom[h * width_ + w];
+            index = h * width_ + w;
+          }
+        }
+      }
+      top_row[pw] = value;
+      if (mask_row != NULL) {
+        mask_row[pw] = index;
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void PoolingLayer<Dtype>::AvePoolPlane_cpu(const Dtype* bottom,
+    Dtype* top) const {
+  if (global_pooling_) {
+    const int count = height_ * width_;
+    Dtype sum = 0;
+#ifdef _OPENMP
+#pragma omp simd reduction(+:sum)
+#endif
+    for (int i = 0; i < count; ++i) {
+      sum += bottom[i];
+    }
+    top[0] = sum / count;
+    return;
+  }
+  const bool stride2 = stride_w_ == 2 && kernel_h_ == kernel_w_ &&
+      (kernel_w_ == 2 || kernel_w_ == 3);
+  for (int ph = 0; ph < pooled_height_; ++ph) {
+    const int hstart = row_start_[ph];
+    const int hend = row_end_[ph];
+    Dtype* top_row = top + ph * pooled_width_;
+    int fast_begin = 0, fast_end = 0;
+    if (stride2 && hend - hstart == kernel_h_) {
+      fast_begin = interior_col_begin_;
+      fast_end = interior_col_end_;
+    }
+    for (int pw = 0; pw < pooled_width_; ++pw) {
+      if (pw == fast_begin && fast_begin < fast_end) {
+        const Dtype* rows = bottom + hstart * width_ + col_start_[pw];
+        if (kernel_w_ == 2) {
+          AvePoolStride2<Dtype, 2>(rows, width_, fast_end - fast_begin,
+              top_row + pw);
+        } else {
+          AvePoolStride2<Dtype, 3>(rows, width_, fast_end - fast_begin,
+              top_row + pw);
+        }
+        pw = fast_end - 1;
+        continue;
+      }
+      Dtype sum = 0;
+      for (int h = hstart; h < hend; ++h) {
+        for (int w = col_start_[pw]; w < col_end_[pw]; ++w) {
+          sum += bottom[h * width_ + w];
+        }
+      }
+      top_row[pw] = sum / (row_size_[ph] * col_size_[pw]);
+    }
+  }
+}
+
 template <typename Dtype>
 void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   const int top_count = top[0]->count();
+  const int planes = bottom[0]->num() * channels_;
+  const int bottom_plane = height_ * width_;
+  const int top_plane = pooled_height_ * pooled_width_;
   // We'll output the mask to top[1] if it's of size >1.
   const bool use_top_mask = top.size() > 1;
   int* mask = NULL;  // suppress warnings about uninitialized variables
   Dtype* top_mask = NULL;
   // Different pooling methods. We explicitly do the switch outside the for
-  // loop to save time, although this results in more code.
+  // loop to save time, although this results in more code. MAX and AVE pool
+  // the (num, channel) planes in parallel.
   switch (this->layer_param_.pooling_param().pool()) {
   case PoolingParameter_PoolMethod_MAX:
-    // Initialize
+    // The mask is only needed for Backward, which TEST nets do not run unless
+    // forced to; Backward_cpu then finds the maxima again.
+    max_idx_filled_ = !use_top_mask && this->phase_ != TEST;
     if (use_top_mask) {
       top_mask = top[1]->mutable_cpu_data();
-      caffe_set(top_count, Dtype(-1), top_mask);
-    } else {
+    } else if (max_idx_filled_) {
       mask = max_idx_.mutable_cpu_data();
-      caffe_set(top_count, -1, mask);
     }
-    caffe_set(top_count, Dtype(-FLT_MAX), top_data);
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_);
-            int wend = min(wstart + kernel_w_, width_);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            const int pool_index = ph * pooled_width_ + pw;
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                const int index = h * width_ + w;
-                if (bottom_data[index] > top_data[pool_index]) {
-                  top_data[pool_index] = bottom_data[index];
-                  if (use_top_mask) {
-                    top_mask[pool_index] = static_cast<Dtype>(index);
-                  } else {
-                    mask[pool_index] = index;
-                  }
-                }
-              }
-            }
-          }
-        }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
-        if (use_top_mask) {
-          top_mask += top[0]->offset(0, 1);
-        } else {
-          mask += top[0]->offset(0, 1);
-        }
+#ifdef _OPENMP
+#pragma omp parallel for if (bottom[0]->count() >= kCpuParallelMinCount)
+#endif
+    for (int p = 0; p < planes; ++p) {
+      if (use_top_mask) {
+        MaxPoolPlane_cpu(bottom_data + p * bottom_plane,
+            top_data + p * top_plane, top_mask + p * top_plane);
+      } else {
+        MaxPoolPlane_cpu(bottom_data + p * bottom_plane,
+            top_data + p * top_plane,
+            mask == NULL ? NULL : mask + p * top_plane);
       }
     }
     break;
   case PoolingParameter_PoolMethod_AVE:
-    for (int i = 0; i < top_count; ++i) {
-      top_data[i] = 0;
-    }
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                top_data[ph * pooled_width_ + pw] +=
-                    bottom_data[h * width_ + w];
-              }
-            }
-            top_data[ph * pooled_width_ + pw] /= pool_size;
-          }
-        }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
-      }
+#ifdef _OPENMP
+#pragma omp parallel for if (bottom[0]->count() >= kCpuParallelMinCount)
+#endif
+    for (int p = 0; p < planes; ++p) {
+      AvePoolPlane_cpu(bottom_data + p * bottom_plane,
+          top_data + p * top_plane);
     }
     break;
   case PoolingParameter_PoolMethod_STOCHASTIC:
@@ -330,60 +490,62 @@ void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   const bool use_top_mask = top.size() > 1;
   const int* mask = NULL;  // suppress warnings about uninitialized variables
   const Dtype* top_mask = NULL;
+  const int planes = top[0]->num() * channels_;
+  const int bottom_plane = height_ * width_;
+  const int top_plane = pooled_height_ * pooled_width_;
   switch (this->layer_param_.pooling_param().pool()) {
   case PoolingParameter_PoolMethod_MAX:
-    // The main loop
     if (use_top_mask) {
       top_mask = top[1]->cpu_data();
     } else {
+      if (!max_idx_filled_) {
+        // Forward_cpu skipped the mask in the TEST phase.
+        const Dtype* bottom_data = bottom[0]->cpu_data();
+        int* max_idx = max_idx_.mutable_cpu_data();
+#ifdef _OPENMP
+#pragma omp parallel for if (bottom[0]->count() >= kCpuParallelMinCount)
+#endif
+        for (int p = 0; p < planes; ++p) {
+          vector<Dtype> values(top_plane);
+          MaxPoolPlane_cpu(bottom_data + p * bottom_plane, &values[0],
+              max_idx + p * top_plane);
+        }
+        max_idx_filled_ = true;
+      }
       mask = max_idx_.cpu_data();
     }
-    for (int n = 0; n < top[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            const int index = ph * pooled_width_ + pw;
-            const int bottom_index =
-                use_top_mask ? top_mask[index] : mask[index];
-            bottom_diff[bottom_index] += top_diff[index];
-          }
-        }
-        bottom_diff += bottom[0]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
-        if (use_top_mask) {
-          top_mask += top[0]->offset(0, 1);
-        } else {
-          mask += top[0]->offset(0, 1);
-        }
+    // The main loop
+#ifdef _OPENMP
+#pragma omp parallel for if (bottom[0]->count() >= kCpuParallelMinCount)
+#endif
+    for (int p = 0; p < planes; ++p) {
+      const Dtype* plane_top_diff = top_diff + p * top_plane;
+      Dtype* plane_bottom_diff = bottom_diff + p * bottom_plane;
+      for (int index = 0; index < top_plane; ++index) {
+        const int bottom_index = use_top_mask ?
+            top_mask[p * top_plane + index] : mask[p * top_plane + index];
+        plane_bottom_diff[bottom_index] += plane_top_diff[index];
       }
     }
     break;
   case PoolingParameter_PoolMethod_AVE:
     // The main loop
-    for (int n = 0; n < top[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                bottom_diff[h * width_ + w] +=
-                  top_diff[ph * pooled_width_ + pw] / pool_size;
-              }
+#ifdef _OPENMP
+#pragma omp parallel for if (bottom[0]->count() >= kCpuParallelMinCount)
+#endif
+    for (int p = 0; p < planes; ++p) {
+      const Dtype* plane_top_diff = top_diff + p * top_plane;
+      Dtype* plane_bottom_diff = bottom_diff + p * bottom_plane;
+      for (int ph = 0; ph < pooled_height_; ++ph) {
+        for (int pw = 0; pw < pooled_width_; ++pw) {
+          const Dtype gradient = plane_top_diff[ph * pooled_width_ + pw] /
+              (row_size_[ph] * col_size_[pw]);
+          for (int h = row_start_[ph]; h < row_end_[ph]; ++h) {
+            for (int w = col_start_[pw]; w < col_end_[pw]; ++w) {
+              plane_bottom_diff[h * width_ + w] += gradient;
             }
           }
         }
-        // offset
-        bottom_diff += bottom[0]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
       }
     }
     break;
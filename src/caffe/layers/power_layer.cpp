@@ -28,14 +28,20 @@ void PowerLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     return;
   }
   const Dtype* bottom_data = bottom[0]->cpu_data();
-  caffe_copy(count, bottom_data, top_data);
   if (scale_ != Dtype(1)) {
-    caffe_scal(count, scale_, top_data);
+    caffe_cpu_scale(count, scale_, bottom_data, top_data);
+  } else {
+    caffe_copy(count, bottom_data, top_data);
   }
   if (shift_ != Dtype(0)) {
     caffe_add_scalar(count, shift_, top_data);
   }
-  if (power_ != Dtype(1)) {
+  // Squares and square roots are far cheaper than the general pow.
+  if (power_ == Dtype(2)) {
+    caffe_sqr(count, top_data, top_data);
+  } else if (power_ == Dtype(0.5)) {
+    caffe_sqrt(count, top_data, top_data);
+  } else if (power_ != Dtype(1)) {
     caffe_powx(count, top_data, power_, top_data);
   }
 }
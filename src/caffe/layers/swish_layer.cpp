@@ -3,6 +3,7 @@
 
 #include "caffe/layers/swish_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/openmp.hpp"
 
 namespace caffe {
 
@@ -33,8 +34,7 @@ void SwishLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   Dtype* top_data = top[0]->mutable_cpu_data();
   const int count = bottom[0]->count();
   Dtype beta = this->layer_param_.swish_param().beta();
-  caffe_copy(count, bottom_data, sigmoid_input_data);
-  caffe_scal(count, beta, sigmoid_input_data);
+  caffe_cpu_scale(count, beta, bottom_data, sigmoid_input_data);
   sigmoid_layer_->Forward(sigmoid_bottom_vec_, sigmoid_top_vec_);
   caffe_mul(count, bottom_data, sigmoid_output_->cpu_data(), top_data);
 }
@@ -50,6 +50,9 @@ void SwishLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     const int count = bottom[0]->count();
     Dtype beta = this->layer_param_.swish_param().beta();
+#ifdef _OPENMP
+#pragma omp parallel for simd if (count >= kCpuParallelMinCount)
+#endif
     for (int i = 0; i < count; ++i) {
       const Dtype swish_x = top_data[i];
       bottom_diff[i] = top_diff[i] * (beta * swish_x + sigmoid_output_data[i]
@@ -0,0 +1,309 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/layers/winograd_conv_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/openmp.hpp"
+
+namespace caffe {
+
+// Winograd transform matrices, row major: G (alpha x 3) maps a 3x3 filter,
+// B^T (alpha x alpha) an input tile, and A^T (m x alpha) a product tile, with
+// alpha = m + 2.
+static const double kG_2x2[4 * 3] = {
+  1.0,  0.0, 0.0,
+  0.5,  0.5, 0.5,
+  0.5, -0.5, 0.5,
+  0.0,  0.0, 1.0
+};
+static const double kBT_2x2[4 * 4] = {
+  1.0,  0.0, -1.0,  0.0,
+  0.0,  1.0,  1.0,  0.0,
+  0.0, -1.0,  1.0,  0.0,
+  0.0,  1.0,  0.0, -1.0
+};
+static const double kAT_2x2[2 * 4] = {
+  1.0, 1.0,  1.0,  0.0,
+  0.0, 1.0, -1.0, -1.0
+};
+static const double kG_4x4[6 * 3] = {
+  1.0 / 4,   0.0,        0.0,
+  -1.0 / 6,  -1.0 / 6,   -1.0 / 6,
+  -1.0 / 6,  1.0 / 6,    -1.0 / 6,
+  1.0 / 24,  1.0 / 12,   1.0 / 6,
+  1.0 / 24,  -1.0 / 12,  1.0 / 6,
+  0.0,       0.0,        1.0
+};
+static const double kBT_4x4[6 * 6] = {
+  4.0,  0.0, -5.0,  0.0, 1.0, 0.0,
+  0.0, -4.0, -4.0,  1.0, 1.0, 0.0,
+  0.0,  4.0, -4.0, -1.0, 1.0, 0.0,
+  0.0, -2.0, -1.0,  2.0, 1.0, 0.0,
+  0.0,  2.0, -1.0, -2.0, 1.0, 0.0,
+  0.0,  4.0,  0.0, -5.0, 0.0, 1.0
+};
+static const double kAT_4x4[4 * 6] = {
+  1.0, 1.0,  1.0, 1.0,  1.0, 0.0,
+  0.0, 1.0, -1.0, 2.0, -2.0, 0.0,
+  0.0, 1.0,  1.0, 4.0,  4.0, 0.0,
+  0.0, 1.0, -1.0, 8.0, -8.0, 1.0
+};
+
+// out (rows x rows) = T * in * T^T for T (rows x cols) and in (cols x cols).
+template <typename Dtype>
+static void winograd_transform(const double* T, const int rows,
+    const int cols, const Dtype* in, Dtype* out) {
+  Dtype tmp[6 * 6];
+  for (int i = 0; i < rows; ++i) {
+    for (int j = 0; j < cols; ++j) {
+      Dtype sum = 0;
+      for (int k = 0; k < cols; ++k) {
+        sum += T[i * cols + k] * in[k * cols + j];
+      }
+      tmp[i * cols + j] = sum;
+    }
+  }
+  for (int i = 0; i < rows; ++i) {
+    for (int j = 0; j < rows; ++j) {
+      Dtype sum = 0;
+      for (int k = 0; k < cols; ++k) {
+        sum += tmp[i * cols + k] * T[j * cols + k];
+      }
+      out[i * rows + j] = sum;
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Reshape(
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  ConvolutionLayer<Dtype>::Reshape(bottom, top);
+  const int* kernel_shape = this->kernel_shape_.cpu_data();
+  const int* stride = this->stride_.cpu_data();
+  const int* dilation = this->dilation_.cpu_data();
+  algorithm_ = IM2COL;
+  if (this->num_spatial_axes_ == 2 && !this->reverse_dimensions()) {
+    if (kernel_shape[0] == 3 && kernel_shape[1] == 3 &&
+        stride[0] == 1 && stride[1] == 1 &&
+        dilation[0] == 1 && dilation[1] == 1) {
+      algorithm_ = WINOGRAD;
+    } else if (kernel_shape[0] == 1 && kernel_shape[1] == 1 &&
+        !this->is_1x1_) {
+      algorithm_ = DIRECT_1X1;
+    }
+  }
+  if (algorithm_ != WINOGRAD) {
+    return;
+  }
+  const int output_h = this->output_shape_[0];
+  const int output_w = this->output_shape_[1];
+  const int tile_size = (output_h >= 8 && output_w >= 8) ? 4 : 2;
+  if (tile_size != tile_size_) {
+    transformed_weights_version_ = 0;
+  }
+  tile_size_ = tile_size;
+  tile_input_size_ = tile_size_ + 2;
+  tiles_h_ = (output_h + tile_size_ - 1) / tile_size_;
+  tiles_w_ = (output_w + tile_size_ - 1) / tile_size_;
+  const int tile_elements = tile_input_size_ * tile_input_size_;
+  const int num_tiles = tiles_h_ * tiles_w_;
+  vector<int> weight_shape(3);
+  weight_shape[0] = tile_elements;
+  weight_shape[1] = this->num_output_;
+  weight_shape[2] = this->channels_ / this->group_;
+  transformed_weights_.Reshape(weight_shape);
+  workspace_count_ =
+      tile_elements * (this->channels_ + this->num_output_) * num_tiles;
+  workspace_.Reshape(vector<int>(1,
+      this->num_cpu_threads() * workspace_count_));
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::WinogradTransformWeights(
+      const Dtype* weights) {
+  const double* G = (tile_size_ == 4) ? kG_4x4 : kG_2x2;
+  const int alpha = tile_input_size_;
+  const int tile_elements = alpha * alpha;
+  const int channels = this->channels_ / this->group_;
+  const int filters = this->num_output_ * channels;
+  Dtype* transformed = transformed_weights_.mutable_cpu_data();
+  Dtype tile[6 * 6];
+  for (int f = 0; f < filters; ++f) {
+    winograd_transform(G, alpha, 3, weights + f * 9, tile);
+    for (int xi = 0; xi < tile_elements; ++xi) {
+      transformed[xi * filters + f] = tile[xi];
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::WinogradForward(const Dtype* input,
+      const Dtype* bias, Dtype* output, Dtype* workspace) {
+  const double* BT = (tile_size_ == 4) ? kBT_4x4 : kBT_2x2;
+  const double* AT = (tile_size_ == 4) ? kAT_4x4 : kAT_2x2;
+  const int m = tile_size_;
+  const int alpha = tile_input_size_;
+  const int tile_elements = alpha * alpha;
+  const int num_tiles = tiles_h_ * tiles_w_;
+  const int channels = this->channels_;
+  const int num_output = this->num_output_;
+  const int group_channels = channels / this->group_;
+  const int group_output = num_output / this->group_;
+  const int height = this->input_shape(1);
+  const int width = this->input_shape(2);
+  const int output_h = this->output_shape_[0];
+  const int output_w = this->output_shape_[1];
+  const int pad_h = this->pad_.cpu_data()[0];
+  const int pad_w = this->pad_.cpu_data()[1];
+  // transformed input: tile_elements x channels x num_tiles
+  Dtype* V = workspace;
+  // transformed output: tile_elements x num_output x num_tiles
+  Dtype* M = workspace + tile_elements * channels * num_tiles;
+  Dtype d[6 * 6];
+  Dtype v[6 * 6];
+  for (int c = 0; c < channels; ++c) {
+    const Dtype* input_c = input + c * height * width;
+    for (int th = 0; th < tiles_h_; ++th) {
+      for (int tw = 0; tw < tiles_w_; ++tw) {
+        const int h_start = th * m - pad_h;
+        const int w_start = tw * m - pad_w;
+        for (int i = 0; i < alpha; ++i) {
+          const int h = h_start + i;
+          for (int j = 0; j < alpha; ++j) {
+            const int w = w_start + j;
+            d[i * alpha + j] = (h >= 0 && h < height && w >= 0 && w < width) ?
+                input_c[h * width + w] : Dtype(0);
+          }
+        }
+        winograd_transform(BT, alpha, alpha, d, v);
+        const int t = th * tiles_w_ + tw;
+        for (int xi = 0; xi < tile_elements; ++xi) {
+          V[(xi * channels + c) * num_tiles + t] = v[xi];
+        }
+      }
+    }
+  }
+  const Dtype* U = transformed_weights_.cpu_data();
+  for (int xi = 0; xi < tile_elements; ++xi) {
+    for (int g = 0; g < this->group_; ++g) {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, group_output,
+          num_tiles, group_channels, (Dtype)1.,
+          U + (xi * num_output + g * group_output) * group_channels,
+          V + (xi * channels + g * group_channels) * num_tiles,
+          (Dtype)0., M + (xi * num_output + g * group_output) * num_tiles);
+    }
+  }
+  Dtype y[4 * 4];
+  for (int o = 0; o < num_output; ++o) {
+    Dtype* output_o = output + o * output_h * output_w;
+    const Dtype bias_o = bias ? bias[o] : Dtype(0);
+    for (int th = 0; th < tiles_h_; ++th) {
+      for (int tw = 0; tw < tiles_w_; ++tw) {
+        const int t = th * tiles_w_ + tw;
+        for (int xi = 0; xi < tile_elements; ++xi) {
+          d[xi] = M[(xi * num_output + o) * num_tiles + t];
+        }
+        winograd_transform(AT, m, alpha, d, y);
+        const int h_end = std::min(m, output_h - th * m);
+        const int w_end = std::min(m, output_w - tw * m);
+        for (int i = 0; i < h_end; ++i) {
+          Dtype* output_row = output_o + (th * m + i) * output_w + tw * m;
+          for (int j = 0; j < w_end; ++j) {
+            output_row[j] = y[i * m + j] + bias_o;
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Direct1x1Forward(const Dtype* input,
+      const Dtype* weights, const Dtype* bias, Dtype* output) {
+  const int channels = this->channels_;
+  const int num_output = this->num_output_;
+  const int group_channels = channels / this->group_;
+  const int group_output = num_output / this->group_;
+  const int height = this->input_shape(1);
+  const int width = this->input_shape(2);
+  const int output_h = this->output_shape_[0];
+  const int output_w = this->output_shape_[1];
+  const int pad_h = this->pad_.cpu_data()[0];
+  const int pad_w = this->pad_.cpu_data()[1];
+  const int stride_h = this->stride_.cpu_data()[0];
+  const int stride_w = this->stride_.cpu_data()[1];
+  // Output columns [w_begin, w_end) read inside the input, the rest only
+  // see padding.
+  const int w_begin = std::min(output_w, (pad_w + stride_w - 1) / stride_w);
+  const int w_end = std::max(w_begin,
+      std::min(output_w, (width - 1 + pad_w) / stride_w + 1));
+  for (int o = 0; o < num_output; ++o) {
+    Dtype* output_o = output + o * output_h * output_w;
+    caffe_set(output_h * output_w, bias ? bias[o] : Dtype(0), output_o);
+    const int g = o / group_output;
+    const Dtype* weights_o = weights + o * group_channels;
+    for (int c = 0; c < group_channels; ++c) {
+      const Dtype w = weights_o[c];
+      const Dtype* input_c = input + (g * group_channels + c) * height * width;
+      for (int oh = 0; oh < output_h; ++oh) {
+        const int h = oh * stride_h - pad_h;
+        if (h < 0 || h >= height) {
+          continue;
+        }
+        const Dtype* input_row = input_c + h * width;
+        Dtype* output_row = output_o + oh * output_w;
+        for (int ow = w_begin; ow < w_end; ++ow) {
+          output_row[ow] += w * input_row[ow * stride_w - pad_w];
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Forward_cpu(
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  if (algorithm_ == IM2COL) {
+    ConvolutionLayer<Dtype>::Forward_cpu(bottom, top);
+    return;
+  }
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  const Dtype* bias = this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  const int num_threads = this->num_cpu_threads();
+  Dtype* workspace = NULL;
+  if (algorithm_ == WINOGRAD) {
+    // Transform the weights again only once they have been written, e.g.
+    // by a solver update or by loading trained weights.
+    const uint64_t weights_version = this->blobs_[0]->data()->version();
+    if (weights_version != transformed_weights_version_) {
+      WinogradTransformWeights(weight);
+      transformed_weights_version_ = weights_version;
+    }
+    workspace = workspace_.mutable_cpu_data();
+  }
+  for (int i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = top[i]->mutable_cpu_data();
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) if (num_threads > 1)
+#endif
+    for (int n = 0; n < this->num_; ++n) {
+      if (algorithm_ == WINOGRAD) {
+        WinogradForward(bottom_data + n * this->bottom_dim_, bias,
+            top_data + n * this->top_dim_,
+            workspace + caffe_cpu_thread_num() * workspace_count_);
+      } else {
+        Direct1x1Forward(bottom_data + n * this->bottom_dim_, weight, bias,
+            top_data + n * this->top_dim_);
+      }
+      if (this->fused_relu_) {
+        caffe_cpu_relu(this->top_dim_, this->relu_negative_slope_,
+            top_data + n * this->top_dim_);
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(WinogradConvolutionLayer);
+
+}  // namespace caffe
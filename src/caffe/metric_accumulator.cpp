@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/metric_accumulator.hpp"
+#include "caffe/net.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void MetricAccumulator<Dtype>::ResetMetric() {
+  accumulating_ = true;
+  std::fill(metric_state_.begin(), metric_state_.end(), 0);
+}
+
+template <typename Dtype>
+void MetricAccumulator<Dtype>::MergeMetricState(const vector<double>& state) {
+  CHECK_EQ(state.size(), metric_state_.size())
+      << "Only states of the same layer on the same shapes merge.";
+  for (int i = 0; i < state.size(); ++i) {
+    metric_state_[i] += state[i];
+  }
+}
+
+template <typename Dtype>
+void MetricAccumulator<Dtype>::ReshapeMetricState(int size) {
+  if (metric_state_.size() != size) {
+    metric_state_.assign(size, 0);
+  }
+}
+
+template <typename Dtype>
+void MetricAccumulator<Dtype>::UpdateMetric(const vector<double>& batch_state,
+    const vector<Blob<Dtype>*>& top) {
+  if (!accumulating_) {
+    ComputeMetric(batch_state, top);
+    return;
+  }
+  CHECK_EQ(batch_state.size(), metric_state_.size());
+  for (int i = 0; i < batch_state.size(); ++i) {
+    metric_state_[i] += batch_state[i];
+  }
+  ComputeMetric(metric_state_, top);
+}
+
+template <typename Dtype>
+ScopedMetricAccumulation<Dtype>::ScopedMetricAccumulation(
+    const Net<Dtype>& net) {
+  vector<bool> accumulated_blob(net.blobs().size(), false);
+  for (int i = 0; i < net.layers().size(); ++i) {
+    MetricAccumulator<Dtype>* accumulator =
+        dynamic_cast<MetricAccumulator<Dtype>*>(net.layers()[i].get());
+    bool accumulated = false;
+    for (int j = 0; j < net.bottom_ids(i).size(); ++j) {
+      accumulated |= accumulated_blob[net.bottom_ids(i)[j]];
+    }
+    // A metric of metrics over all the passes, such as their mean, is over
+    // all the passes already; it must not accumulate them again.
+    if (accumulator && accumulator->AccumulatesInScope() && !accumulated) {
+      if (!accumulator->accumulating()) {
+        started_.push_back(accumulator);
+      }
+      accumulator->ResetMetric();
+      accumulated = true;
+    }
+    for (int j = 0; j < net.top_ids(i).size(); ++j) {
+      accumulated_blob[net.top_ids(i)[j]] = accumulated;
+    }
+  }
+  for (int i = 0; i < net.output_blob_indices().size(); ++i) {
+    accumulated_output_.push_back(
+        accumulated_blob[net.output_blob_indices()[i]]);
+  }
+}
+
+template <typename Dtype>
+ScopedMetricAccumulation<Dtype>::~ScopedMetricAccumulation() {
+  for (int i = 0; i < started_.size(); ++i) {
+    started_[i]->StopAccumulating();
+  }
+}
+
+INSTANTIATE_CLASS(MetricAccumulator);
+INSTANTIATE_CLASS(ScopedMetricAccumulation);
+
+}  // namespace caffe
@@ -17,6 +17,7 @@
 #include "caffe/util/hdf5.hpp"
 #include "caffe/util/insert_splits.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/net_profiler.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 namespace caffe {
@@ -253,10 +254,324 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     layer_names_index_[layer_names_[layer_id]] = layer_id;
   }
   ShareWeights();
+  params_count_ = 0;
+  if (param.contiguous_params()) {
+    AllocateContiguousParams();
+  }
+  param_diff_rows_valid_ = true;
   debug_info_ = param.debug_info();
+  has_shape_buckets_ = false;
+  reallocations_avoided_ = 0;
+  if (param.shape_bucket_size() > 0) {
+    PlanShapeBuckets(param);
+  }
+  if (param.optimize_memory()) {
+    OptimizeMemory(param);
+  }
   LOG_IF(INFO, Caffe::root_solver()) << "Network initialization done.";
 }
 
+template <typename Dtype>
+void Net<Dtype>::PlanShapeBuckets(const NetParameter& param) {
+  const int num_inputs = net_input_blobs_.size();
+  vector<vector<int> > input_shapes(num_inputs);
+  for (int i = 0; i < num_inputs; ++i) {
+    input_shapes[i] = net_input_blobs_[i]->shape();
+  }
+  blob_planned_counts_.resize(blobs_.size());
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    blob_planned_counts_[blob_id] = blobs_[blob_id]->count();
+  }
+  // Blob::Reshape keeps the largest allocation it has seen, so reshaping for
+  // every bucket leaves each blob, and the layers' own buffers, large enough
+  // for all of them.
+  for (int b = 0; b < param.shape_bucket_size(); ++b) {
+    const ShapeBucket& bucket = param.shape_bucket(b);
+    CHECK_EQ(bucket.input_shape_size(), num_inputs)
+        << "shape_bucket " << b << " must give a shape for each of the "
+        << num_inputs << " input blobs.";
+    for (int i = 0; i < num_inputs; ++i) {
+      net_input_blobs_[i]->Reshape(bucket.input_shape(i));
+    }
+    Reshape();
+    for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+      blob_planned_counts_[blob_id] =
+          std::max(blob_planned_counts_[blob_id], blobs_[blob_id]->count());
+    }
+  }
+  for (int i = 0; i < num_inputs; ++i) {
+    net_input_blobs_[i]->Reshape(input_shapes[i]);
+  }
+  Reshape();
+  blob_unplanned_counts_.resize(blobs_.size());
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    blob_unplanned_counts_[blob_id] = blobs_[blob_id]->count();
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    layers_[layer_id]->set_skip_unchanged_reshape(true);
+  }
+  has_shape_buckets_ = true;
+  LOG_IF(INFO, Caffe::root_solver())
+      << "Planned the net for " << param.shape_bucket_size()
+      << " shape buckets.";
+}
+
+template <typename Dtype>
+void Net<Dtype>::CountAvoidedReallocations() {
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    const int count = blobs_[blob_id]->count();
+    if (count > blob_unplanned_counts_[blob_id]) {
+      blob_unplanned_counts_[blob_id] = count;
+      if (count <= blob_planned_counts_[blob_id]) {
+        ++reallocations_avoided_;
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+int Net<Dtype>::reshapes_skipped() const {
+  int skipped = 0;
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    skipped += layers_[layer_id]->reshapes_skipped();
+  }
+  return skipped;
+}
+
+template <typename Dtype>
+void Net<Dtype>::AllocateContiguousParams() {
+  for (int i = 0; i < learnable_params_.size(); ++i) {
+    params_count_ += learnable_params_[i]->count();
+  }
+  if (params_count_ == 0) {
+    return;
+  }
+  const size_t size = params_count_ * sizeof(Dtype);
+  params_data_arena_.reset(new SyncedMemory(size));
+  params_diff_arena_.reset(new SyncedMemory(size));
+  params_cpu_data_ =
+      static_cast<Dtype*>(params_data_arena_->mutable_cpu_data());
+  params_cpu_diff_ =
+      static_cast<Dtype*>(params_diff_arena_->mutable_cpu_data());
+  int offset = 0;
+  for (int i = 0; i < learnable_params_.size(); ++i) {
+    Blob<Dtype>* param = learnable_params_[i];
+    if (param->count() == 0) { continue; }
+    caffe_copy(param->count(), param->cpu_data(), params_cpu_data_ + offset);
+    caffe_copy(param->count(), param->cpu_diff(), params_cpu_diff_ + offset);
+    offset += param->count();
+  }
+  params_gpu_data_ = NULL;
+  params_gpu_diff_ = NULL;
+#ifndef CPU_ONLY
+  if (Caffe::mode() == Caffe::GPU) {
+    params_gpu_data_ =
+        static_cast<Dtype*>(params_data_arena_->mutable_gpu_data());
+    params_gpu_diff_ =
+        static_cast<Dtype*>(params_diff_arena_->mutable_gpu_data());
+  }
+#endif
+  // Point the parameters at their slices, with the CPU copy current. Shared
+  // parameters follow their owners, as they share the owners' SyncedMemory.
+  // From here on the arenas are only reached through the parameters.
+  offset = 0;
+  for (int i = 0; i < learnable_params_.size(); ++i) {
+    Blob<Dtype>* param = learnable_params_[i];
+    if (param->count() == 0) { continue; }
+    if (params_gpu_data_) {
+      param->data()->set_gpu_data(params_gpu_data_ + offset);
+      param->diff()->set_gpu_data(params_gpu_diff_ + offset);
+    }
+    param->data()->set_cpu_data(params_cpu_data_ + offset);
+    param->diff()->set_cpu_data(params_cpu_diff_ + offset);
+    offset += param->count();
+  }
+  LOG_IF(INFO, Caffe::root_solver()) << "Allocated " << params_count_
+      << " learnable parameter values contiguously.";
+}
+
+template <typename Dtype>
+Dtype* Net<Dtype>::SyncContiguousParams(bool diff, bool gpu) {
+  CHECK(contiguous_params())
+      << "The net's parameters are not contiguous; set contiguous_params.";
+  Dtype* arena = gpu ? (diff ? params_gpu_diff_ : params_gpu_data_) :
+      (diff ? params_cpu_diff_ : params_cpu_data_);
+  CHECK(arena) << "No contiguous GPU parameters; create the net in GPU mode.";
+  int offset = 0;
+  for (int i = 0; i < learnable_params_.size(); ++i) {
+    Blob<Dtype>* param = learnable_params_[i];
+    if (param->count() == 0) { continue; }
+    Dtype* view;
+    if (gpu) {
+      view = diff ? param->mutable_gpu_diff() : param->mutable_gpu_data();
+    } else {
+      view = diff ? param->mutable_cpu_diff() : param->mutable_cpu_data();
+    }
+    // E.g. ShareTrainedLayersWith rebinds the data to another net's.
+    CHECK_EQ(view, arena + offset) << "Learnable parameter " << i
+        << " no longer lives in the contiguous parameter buffer.";
+    offset += param->count();
+  }
+  return arena;
+}
+
+// Union-find lookup with path halving, for OptimizeMemory.
+static int FindRoot(vector<int>* parent, int i) {
+  while ((*parent)[i] != i) {
+    (*parent)[i] = (*parent)[(*parent)[i]];
+    i = (*parent)[i];
+  }
+  return i;
+}
+
+template <typename Dtype>
+void Net<Dtype>::OptimizeMemory(const NetParameter& param) {
+  if (phase_ != TEST || param.force_backward()) {
+    LOG(WARNING) << "optimize_memory only applies to TEST phase nets without "
+        << "force_backward; keeping separate storage for every blob.";
+    return;
+  }
+  // Blobs that hold the same data must stay together: those that share a
+  // SyncedMemory after setup, and the bottoms and tops of layers that share
+  // data between them (Split, Flatten, Reshape...) when they run.
+  const int num_blobs = blobs_.size();
+  vector<int> parent(num_blobs);
+  for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+    parent[blob_id] = blob_id;
+  }
+  map<SyncedMemory*, int> blob_of_storage;
+  for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+    if (blobs_[blob_id]->count() == 0) {
+      continue;  // No storage yet.
+    }
+    SyncedMemory* storage = blobs_[blob_id]->data().get();
+    map<SyncedMemory*, int>::iterator it = blob_of_storage.find(storage);
+    if (it == blob_of_storage.end()) {
+      blob_of_storage[storage] = blob_id;
+    } else {
+      parent[FindRoot(&parent, blob_id)] = FindRoot(&parent, it->second);
+    }
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    if (!layers_[layer_id]->SharesBottomData()) { continue; }
+    const vector<int>& bottom_ids = bottom_id_vecs_[layer_id];
+    const vector<int>& top_ids = top_id_vecs_[layer_id];
+    for (int i = 0; i < bottom_ids.size() + top_ids.size(); ++i) {
+      const int blob_id = i < bottom_ids.size() ?
+          bottom_ids[i] : top_ids[i - bottom_ids.size()];
+      parent[FindRoot(&parent, blob_id)] = FindRoot(&parent, bottom_ids[0]);
+    }
+  }
+  vector<int> group(num_blobs);
+  map<int, int> group_of_root;
+  for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+    const int root = FindRoot(&parent, blob_id);
+    if (group_of_root.find(root) == group_of_root.end()) {
+      const int num_groups = group_of_root.size();
+      group_of_root[root] = num_groups;
+    }
+    group[blob_id] = group_of_root[root];
+  }
+  const int num_groups = group_of_root.size();
+  // Each group is live from the first layer that touches one of its blobs to
+  // the last. Groups containing a blob that must keep its own storage are
+  // left out.
+  vector<int> first_use(num_groups, layers_.size());
+  vector<int> last_use(num_groups, -1);
+  vector<size_t> group_count(num_groups, 0);
+  vector<bool> excluded(num_groups, false);
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int pass = 0; pass < 2; ++pass) {
+      const vector<int>& blob_ids =
+          pass ? top_id_vecs_[layer_id] : bottom_id_vecs_[layer_id];
+      for (int i = 0; i < blob_ids.size(); ++i) {
+        const int g = group[blob_ids[i]];
+        first_use[g] = std::min(first_use[g], layer_id);
+        last_use[g] = std::max(last_use[g], layer_id);
+        const int count = has_shape_buckets_ ?
+            blob_planned_counts_[blob_ids[i]] : blobs_[blob_ids[i]]->count();
+        group_count[g] = std::max(group_count[g], static_cast<size_t>(count));
+        // Tops of layers without bottoms (data layers) may point into the
+        // layer's own buffers.
+        if (pass && bottom_id_vecs_[layer_id].empty()) {
+          excluded[g] = true;
+        }
+      }
+    }
+  }
+  vector<int> kept_blob_ids(net_input_blob_indices_);
+  kept_blob_ids.insert(kept_blob_ids.end(), net_output_blob_indices_.begin(),
+                       net_output_blob_indices_.end());
+  for (int i = 0; i < param.preserve_blob_size(); ++i) {
+    const string& blob_name = param.preserve_blob(i);
+    CHECK(has_blob(blob_name)) << "Unknown blob " << blob_name
+        << " in preserve_blob";
+    kept_blob_ids.push_back(blob_names_index_[blob_name]);
+  }
+  for (int i = 0; i < kept_blob_ids.size(); ++i) {
+    excluded[group[kept_blob_ids[i]]] = true;
+  }
+  // Greedy assignment in order of first use: a group may reuse a storage slot
+  // whose groups were all last used by an earlier layer. Prefer the smallest
+  // free slot that is large enough, otherwise grow the largest free one.
+  vector<int> slot(num_groups, -1);
+  vector<size_t> slot_count;
+  vector<int> slot_last_use;
+  vector<pair<int, int> > order;  // (first use, group)
+  for (int g = 0; g < num_groups; ++g) {
+    if (!excluded[g] && last_use[g] >= 0) {
+      order.push_back(make_pair(first_use[g], g));
+    }
+  }
+  std::sort(order.begin(), order.end());
+  size_t count_before = 0;
+  for (int i = 0; i < order.size(); ++i) {
+    const int g = order[i].second;
+    int best = -1;
+    for (int s = 0; s < slot_count.size(); ++s) {
+      if (slot_last_use[s] >= first_use[g]) { continue; }
+      if (best < 0) {
+        best = s;
+      } else if (slot_count[s] >= group_count[g]) {
+        if (slot_count[best] < group_count[g] ||
+            slot_count[s] < slot_count[best]) {
+          best = s;
+        }
+      } else if (slot_count[best] < group_count[g] &&
+                 slot_count[s] > slot_count[best]) {
+        best = s;
+      }
+    }
+    if (best < 0) {
+      best = slot_count.size();
+      slot_count.push_back(0);
+      slot_last_use.push_back(-1);
+    }
+    slot[g] = best;
+    slot_count[best] = std::max(slot_count[best], group_count[g]);
+    slot_last_use[best] = last_use[g];
+    count_before += group_count[g];
+  }
+  // Allocate one SyncedMemory per slot and point its blobs at it.
+  vector<shared_ptr<SyncedMemory> > storage(slot_count.size());
+  size_t count_after = 0;
+  for (int s = 0; s < slot_count.size(); ++s) {
+    storage[s].reset(new SyncedMemory(slot_count[s] * sizeof(Dtype)));
+    count_after += slot_count[s];
+  }
+  blob_shares_storage_.assign(num_blobs, false);
+  for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+    if (slot[group[blob_id]] >= 0 && blobs_[blob_id]->count() > 0) {
+      blobs_[blob_id]->ShareDataStorage(storage[slot[group[blob_id]]]);
+      blob_shares_storage_[blob_id] = true;
+    }
+  }
+  LOG_IF(INFO, Caffe::root_solver())
+      << "Memory optimization: " << order.size() << " blob groups share "
+      << slot_count.size() << " buffers, " << count_before * sizeof(Dtype)
+      << " -> " << count_after * sizeof(Dtype) << " bytes of data";
+}
+
 template <typename Dtype>
 void Net<Dtype>::FilterNet(const NetParameter& param,
     NetParameter* param_filtered) {
@@ -530,6 +845,9 @@ Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
       after_forward_[c]->run(i);
     }
   }
+  if (has_shape_buckets_) {
+    CountAvoidedReallocations();
+  }
   return loss;
 }
 
@@ -584,6 +902,14 @@ void Net<Dtype>::BackwardFromTo(int start, int end) {
   }
 }
 
+template <typename Dtype>
+NetProfiler<Dtype>* Net<Dtype>::EnableProfiling() {
+  if (!profiler_) {
+    profiler_.reset(new NetProfiler<Dtype>(this));
+  }
+  return profiler_.get();
+}
+
 template <typename Dtype>
 void Net<Dtype>::ForwardDebugInfo(const int layer_id) {
   for (int top_id = 0; top_id < top_vecs_[layer_id].size(); ++top_id) {
@@ -727,7 +1053,10 @@ void Net<Dtype>::Backward() {
 template <typename Dtype>
 void Net<Dtype>::Reshape() {
   for (int i = 0; i < layers_.size(); ++i) {
-    layers_[i]->Reshape(bottom_vecs_[i], top_vecs_[i]);
+    layers_[i]->ReshapeIfChanged(bottom_vecs_[i], top_vecs_[i]);
+  }
+  if (has_shape_buckets_) {
+    CountAvoidedReallocations();
   }
 }
 
@@ -789,6 +1118,7 @@ void Net<Dtype>::CopyTrainedLayersFromBinaryProto(
 template <typename Dtype>
 void Net<Dtype>::CopyTrainedLayersFromHDF5(const string& trained_filename) {
 #ifdef USE_HDF5
+  HDF5Lock lock;
   hid_t file_hid = H5Fopen(trained_filename.c_str(), H5F_ACC_RDONLY,
                            H5P_DEFAULT);
   CHECK_GE(file_hid, 0) << "Couldn't open " << trained_filename;
@@ -853,10 +1183,36 @@ void Net<Dtype>::ToProto(NetParameter* param, bool write_diff) const {
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::ToProto(NetParameter* param,
+    const vector<shared_ptr<Blob<Dtype> > >& params, bool write_diff) const {
+  CHECK_EQ(params.size(), params_.size());
+  param->Clear();
+  param->set_name(name_);
+  DLOG(INFO) << "Serializing " << layers_.size() << " layers";
+  for (int i = 0; i < layers_.size(); ++i) {
+    LayerParameter* layer_param = param->add_layer();
+    layer_param->CopyFrom(layers_[i]->layer_param());
+    layer_param->clear_blobs();
+    for (int j = 0; j < param_id_vecs_[i].size(); ++j) {
+      params[param_id_vecs_[i][j]]->ToProto(layer_param->add_blobs(),
+          write_diff);
+    }
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::ToHDF5(const string& filename, bool write_diff) const {
+  ToHDF5(filename, params_, write_diff);
+}
+
+template <typename Dtype>
+void Net<Dtype>::ToHDF5(const string& filename,
+    const vector<shared_ptr<Blob<Dtype> > >& params, bool write_diff) const {
 // This code is taken from https://github.com/sh1r0/caffe-android-lib
 #ifdef USE_HDF5
+  CHECK_EQ(params.size(), params_.size());
+  HDF5Lock lock;
   hid_t file_hid = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT,
       H5P_DEFAULT);
   CHECK_GE(file_hid, 0)
@@ -892,12 +1248,12 @@ void Net<Dtype>::ToHDF5(const string& filename, bool write_diff) const {
       if (param_owners_[net_param_id] == -1) {
         // Only save params that own themselves
         hdf5_save_nd_dataset<Dtype>(layer_data_hid, dataset_name.str(),
-            *params_[net_param_id]);
+            *params[net_param_id]);
       }
       if (write_diff) {
         // Write diffs regardless of weight-sharing
         hdf5_save_nd_dataset<Dtype>(layer_diff_hid, dataset_name.str(),
-            *params_[net_param_id], true);
+            *params[net_param_id], true);
       }
     }
     H5Gclose(layer_data_hid);
@@ -918,13 +1274,102 @@ void Net<Dtype>::ToHDF5(const string& filename, bool write_diff) const {
 
 template <typename Dtype>
 void Net<Dtype>::Update() {
+  // The solvers leave the update values in every row of the diffs.
+  param_diff_rows_valid_ = false;
+  if (contiguous_params()) {
+    switch (Caffe::mode()) {
+    case Caffe::CPU:
+      caffe_axpy<Dtype>(params_count_, Dtype(-1), mutable_cpu_params_diff(),
+                        mutable_cpu_params_data());
+      break;
+    case Caffe::GPU:
+#ifndef CPU_ONLY
+      caffe_gpu_axpy<Dtype>(params_count_, Dtype(-1),
+          mutable_gpu_params_diff(), mutable_gpu_params_data());
+#else
+      NO_GPU;
+#endif
+      break;
+    }
+    return;
+  }
   for (int i = 0; i < learnable_params_.size(); ++i) {
     learnable_params_[i]->Update();
   }
 }
 
+template <typename Dtype>
+bool Net<Dtype>::ParamDiffRows(int param_id, vector<int>* rows) const {
+  // With several solvers, the rows of the others reach this one only
+  // through the reduced diffs.
+  if (!param_diff_rows_valid_ || Caffe::mode() != Caffe::CPU ||
+      Caffe::solver_count() > 1) {
+    return false;
+  }
+  rows->clear();
+  bool listed = false;
+  for (int i = 0; i < params_.size(); ++i) {
+    if (learnable_param_ids_[i] != param_id) { continue; }
+    const vector<int>* layer_rows =
+        layers_[param_layer_indices_[i].first]->param_diff_rows(
+            param_layer_indices_[i].second);
+    if (!layer_rows) { return false; }
+    rows->insert(rows->end(), layer_rows->begin(), layer_rows->end());
+    listed = true;
+  }
+  std::sort(rows->begin(), rows->end());
+  rows->erase(std::unique(rows->begin(), rows->end()), rows->end());
+  return listed;
+}
+
 template <typename Dtype>
 void Net<Dtype>::ClearParamDiffs() {
+  // Only the listed rows of the row-sparse diffs need clearing.
+  vector<vector<int> > rows(learnable_params_.size());
+  vector<bool> row_sparse(learnable_params_.size());
+  bool any_row_sparse = false;
+  for (int i = 0; i < learnable_params_.size(); ++i) {
+    row_sparse[i] = ParamDiffRows(i, &rows[i]);
+    any_row_sparse |= row_sparse[i];
+  }
+  for (int i = 0; i < layers_.size(); ++i) {
+    layers_[i]->ClearParamDiffRows();
+  }
+  param_diff_rows_valid_ = true;
+  if (any_row_sparse) {
+    for (int i = 0; i < learnable_params_.size(); ++i) {
+      Blob<Dtype>* blob = learnable_params_[i];
+      if (row_sparse[i]) {
+        const int row_count = blob->count(1);
+        Dtype* diff = blob->mutable_cpu_diff();
+        for (int j = 0; j < rows[i].size(); ++j) {
+          caffe_set(row_count, static_cast<Dtype>(0),
+                    diff + rows[i][j] * row_count);
+        }
+      } else {
+        caffe_set(blob->count(), static_cast<Dtype>(0),
+                  blob->mutable_cpu_diff());
+      }
+    }
+    return;
+  }
+  if (contiguous_params()) {
+    switch (Caffe::mode()) {
+    case Caffe::CPU:
+      caffe_set(params_count_, static_cast<Dtype>(0),
+                mutable_cpu_params_diff());
+      break;
+    case Caffe::GPU:
+#ifndef CPU_ONLY
+      caffe_gpu_set(params_count_, static_cast<Dtype>(0),
+                    mutable_gpu_params_diff());
+#else
+      NO_GPU;
+#endif
+      break;
+    }
+    return;
+  }
   for (int i = 0; i < learnable_params_.size(); ++i) {
     Blob<Dtype>* blob = learnable_params_[i];
     switch (Caffe::mode()) {
@@ -963,7 +1408,12 @@ const shared_ptr<Blob<Dtype> > Net<Dtype>::blob_by_name(
     const string& blob_name) const {
   shared_ptr<Blob<Dtype> > blob_ptr;
   if (has_blob(blob_name)) {
-    blob_ptr = blobs_[blob_names_index_.find(blob_name)->second];
+    const int blob_id = blob_names_index_.find(blob_name)->second;
+    blob_ptr = blobs_[blob_id];
+    LOG_IF(WARNING, !blob_shares_storage_.empty() &&
+        blob_shares_storage_[blob_id]) << "Blob " << blob_name
+        << " shares its storage with other blobs (optimize_memory), so later"
+        << " layers overwrite its data; list it in preserve_blob to keep it.";
   } else {
     blob_ptr.reset((Blob<Dtype>*)(NULL));
     LOG(WARNING) << "Unknown blob name " << blob_name;
@@ -74,18 +74,26 @@ Params<Dtype>::Params(shared_ptr<Solver<Dtype> > root_solver)
 
 template<typename Dtype>
 GPUParams<Dtype>::GPUParams(shared_ptr<Solver<Dtype> > root_solver, int device)
-  : Params<Dtype>(root_solver) {
+  : Params<Dtype>(root_solver), own_buffers_(true) {
   int initial_device;
   CUDA_CHECK(cudaGetDevice(&initial_device));
+  Net<Dtype>* net = root_solver->net().get();
+
+  if (net->contiguous_params() && device == initial_device) {
+    // The net's own buffers live on this device already; no packing needed
+    data_ = net->mutable_gpu_params_data();
+    diff_ = net->mutable_gpu_params_diff();
+    own_buffers_ = false;
+    caffe_gpu_set(size_, Dtype(0), diff_);
+    return;
+  }
 
   // Allocate device buffers
   CUDA_CHECK(cudaSetDevice(device));
   CUDA_CHECK(cudaMalloc(&data_, size_ * sizeof(Dtype)));
 
   // Copy blob values
-  const vector<Blob<Dtype>*>& net =
-    root_solver->net()->learnable_params();
-  apply_buffers(net, data_, size_, copy);
+  apply_buffers(net->learnable_params(), data_, size_, copy);
 
   CUDA_CHECK(cudaMalloc(&diff_, size_ * sizeof(Dtype)));
   caffe_gpu_set(size_, Dtype(0), diff_);
@@ -95,8 +103,10 @@ GPUParams<Dtype>::GPUParams(shared_ptr<Solver<Dtype> > root_solver, int device)
 
 template<typename Dtype>
 GPUParams<Dtype>::~GPUParams() {
-  CUDA_CHECK(cudaFree(data_));
-  CUDA_CHECK(cudaFree(diff_));
+  if (own_buffers_) {
+    CUDA_CHECK(cudaFree(data_));
+    CUDA_CHECK(cudaFree(diff_));
+  }
 }
 
 template<typename Dtype>
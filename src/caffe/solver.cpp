@@ -1,13 +1,16 @@
+#include <boost/thread.hpp>
 #include <cstdio>
 
 #include <string>
 #include <vector>
 
 #include "boost/algorithm/string.hpp"
+#include "caffe/metric_accumulator.hpp"
 #include "caffe/solver.hpp"
 #include "caffe/util/format.hpp"
 #include "caffe/util/hdf5.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/net_profiler.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 namespace caffe {
@@ -46,6 +49,8 @@ void Solver<Dtype>::Init(const SolverParameter& param) {
     << std::endl << param.DebugString();
   param_ = param;
   CHECK_GE(param_.average_loss(), 1) << "average_loss should be non-negative.";
+  CHECK_GE(param_.snapshot_max_pending(), 1)
+      << "snapshot_max_pending should be positive.";
   CheckSnapshotWritePermissions();
   if (param_.random_seed() >= 0) {
     Caffe::set_random_seed(param_.random_seed() + Caffe::solver_rank());
@@ -205,6 +210,9 @@ void Solver<Dtype>::Step(int iters) {
   losses_.clear();
   smoothed_loss_ = 0;
   iteration_timer_.Start();
+  if (param_.profile_interval() > 0) {
+    net_->EnableProfiling();
+  }
 
   while (iter_ < stop_iter) {
     // zero-init the params
@@ -265,6 +273,10 @@ void Solver<Dtype>::Step(int iters) {
       callbacks_[i]->on_gradients_ready();
     }
     ApplyUpdate();
+    if (param_.profile_interval()
+        && iter_ % param_.profile_interval() == 0) {
+      ReportProfile();
+    }
 
     SolverAction::Enum request = GetRequestedAction();
 
@@ -307,6 +319,7 @@ void Solver<Dtype>::Solve(const char* resume_file) {
       && (!param_.snapshot() || iter_ % param_.snapshot() != 0)) {
     Snapshot();
   }
+  WaitForSnapshots();
   if (requested_early_exit_) {
     LOG(INFO) << "Optimization stopped early.";
     return;
@@ -351,6 +364,9 @@ void Solver<Dtype>::Test(const int test_net_id) {
   vector<Dtype> test_score;
   vector<int> test_score_output_id;
   const shared_ptr<Net<Dtype> >& test_net = test_nets_[test_net_id];
+  // Metrics accumulate over the whole test, and their outputs are reported
+  // as they are after the last iteration instead of averaged over iterations.
+  ScopedMetricAccumulation<Dtype> accumulation(*test_net);
   Dtype loss = 0;
   for (int i = 0; i < param_.test_iter(test_net_id); ++i) {
     SolverAction::Enum request = GetRequestedAction();
@@ -386,8 +402,13 @@ void Solver<Dtype>::Test(const int test_net_id) {
       int idx = 0;
       for (int j = 0; j < result.size(); ++j) {
         const Dtype* result_vec = result[j]->cpu_data();
+        const bool accumulated = accumulation.accumulated_output(j);
         for (int k = 0; k < result[j]->count(); ++k) {
-          test_score[idx++] += result_vec[k];
+          if (accumulated) {
+            test_score[idx++] = result_vec[k];
+          } else {
+            test_score[idx++] += result_vec[k];
+          }
         }
       }
     }
@@ -406,7 +427,9 @@ void Solver<Dtype>::Test(const int test_net_id) {
     const string& output_name = test_net->blob_names()[output_blob_index];
     const Dtype loss_weight = test_net->blob_loss_weights()[output_blob_index];
     ostringstream loss_msg_stream;
-    const Dtype mean_score = test_score[i] / param_.test_iter(test_net_id);
+    const Dtype mean_score =
+        accumulation.accumulated_output(test_score_output_id[i]) ?
+        test_score[i] : test_score[i] / param_.test_iter(test_net_id);
     if (loss_weight) {
       loss_msg_stream << " (* " << loss_weight
                       << " = " << loss_weight * mean_score << " loss)";
@@ -419,19 +442,108 @@ void Solver<Dtype>::Test(const int test_net_id) {
 template <typename Dtype>
 void Solver<Dtype>::Snapshot() {
   CHECK(Caffe::root_solver());
+  if (!param_.snapshot_async()) {
+    SolverSnapshot<Dtype> snapshot;
+    StageSnapshot(&snapshot, false);
+    WriteSnapshot(snapshot);
+    return;
+  }
+  if (!snapshot_thread_) {
+    snapshot_thread_.reset(
+        new SnapshotThread(this, param_.snapshot_max_pending()));
+    snapshot_thread_->StartInternalThread();
+  }
+  SolverSnapshot<Dtype>* snapshot = snapshot_thread_->free_.pop(
+      "Waiting for an earlier snapshot to be written");
+  StageSnapshot(snapshot, true);
+  LOG(INFO) << "Snapshotting iteration " << iter_ << " in the background";
+  snapshot_thread_->full_.push(snapshot);
+}
+
+template <typename Dtype>
+void Solver<Dtype>::WaitForSnapshots() {
+  if (!snapshot_thread_) { return; }
+  // Once every snapshot is free again, the thread has written them all.
+  const int max_pending = snapshot_thread_->free_.capacity();
+  vector<SolverSnapshot<Dtype>*> snapshots(max_pending);
+  for (int i = 0; i < max_pending; ++i) {
+    snapshots[i] = snapshot_thread_->free_.pop(
+        "Waiting for snapshots to be written");
+  }
+  for (int i = 0; i < max_pending; ++i) {
+    snapshot_thread_->free_.push(snapshots[i]);
+  }
+}
+
+template <typename Dtype>
+Solver<Dtype>::SnapshotThread::SnapshotThread(Solver* solver, int max_pending)
+    : free_(max_pending), full_(max_pending), solver_(solver),
+      snapshots_(max_pending) {
+  for (int i = 0; i < max_pending; ++i) {
+    snapshots_[i].reset(new SolverSnapshot<Dtype>());
+    free_.push(snapshots_[i].get());
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::SnapshotThread::InternalThreadEntry() {
+  try {
+    while (!must_stop()) {
+      SolverSnapshot<Dtype>* snapshot = full_.pop();
+      solver_->WriteSnapshot(*snapshot);
+      free_.push(snapshot);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::StageSnapshot(SolverSnapshot<Dtype>* snapshot,
+    bool copy) {
+  snapshot->iter = iter_;
+  snapshot->current_step = current_step_;
+  StageBlobs(net_->params(), copy, param_.snapshot_diff(),
+      &snapshot->params);
+}
+
+template <typename Dtype>
+void Solver<Dtype>::StageBlobs(const vector<shared_ptr<Blob<Dtype> > >& blobs,
+    bool copy, bool diff, vector<shared_ptr<Blob<Dtype> > >* staged) {
+  if (!copy) {
+    *staged = blobs;
+    return;
+  }
+  staged->resize(blobs.size());
+  for (int i = 0; i < blobs.size(); ++i) {
+    if (!(*staged)[i]) {
+      (*staged)[i].reset(new Blob<Dtype>());
+    }
+    Blob<Dtype>* blob = (*staged)[i].get();
+    blob->ReshapeLike(*blobs[i]);
+    caffe_copy(blob->count(), blobs[i]->cpu_data(), blob->mutable_cpu_data());
+    if (diff) {
+      caffe_copy(blob->count(), blobs[i]->cpu_diff(),
+          blob->mutable_cpu_diff());
+    }
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::WriteSnapshot(const SolverSnapshot<Dtype>& snapshot) {
   string model_filename;
   switch (param_.snapshot_format()) {
   case caffe::SolverParameter_SnapshotFormat_BINARYPROTO:
-    model_filename = SnapshotToBinaryProto();
+    model_filename = SnapshotToBinaryProto(snapshot);
     break;
   case caffe::SolverParameter_SnapshotFormat_HDF5:
-    model_filename = SnapshotToHDF5();
+    model_filename = SnapshotToHDF5(snapshot);
     break;
   default:
     LOG(FATAL) << "Unsupported snapshot format.";
   }
 
-  SnapshotSolverState(model_filename);
+  SnapshotSolverState(snapshot, model_filename);
 }
 
 template <typename Dtype>
@@ -452,27 +564,52 @@ void Solver<Dtype>::CheckSnapshotWritePermissions() {
   }
 }
 
+template <typename Dtype>
+void Solver<Dtype>::ReportProfile() {
+  NetProfiler<Dtype>* profiler = net_->profiler();
+  if (Caffe::root_solver()) {
+    LOG(INFO) << "Iteration " << iter_ << ", train net profile:\n"
+              << profiler->Summary();
+    if (param_.has_snapshot_prefix()) {
+      const string trace_filename = SnapshotFilename(".trace.json");
+      LOG(INFO) << "Writing profile trace to " << trace_filename;
+      profiler->WriteChromeTrace(trace_filename);
+    }
+  }
+  profiler->Reset();
+}
+
 template <typename Dtype>
 string Solver<Dtype>::SnapshotFilename(const string& extension) {
-  return param_.snapshot_prefix() + "_iter_" + caffe::format_int(iter_)
+  return SnapshotFilename(extension, iter_);
+}
+
+template <typename Dtype>
+string Solver<Dtype>::SnapshotFilename(const string& extension, int iter) {
+  return param_.snapshot_prefix() + "_iter_" + caffe::format_int(iter)
     + extension;
 }
 
 template <typename Dtype>
-string Solver<Dtype>::SnapshotToBinaryProto() {
-  string model_filename = SnapshotFilename(".caffemodel");
+string Solver<Dtype>::SnapshotToBinaryProto(
+    const SolverSnapshot<Dtype>& snapshot) {
+  string model_filename = SnapshotFilename(".caffemodel", snapshot.iter);
   LOG(INFO) << "Snapshotting to binary proto file " << model_filename;
   NetParameter net_param;
-  net_->ToProto(&net_param, param_.snapshot_diff());
-  WriteProtoToBinaryFile(net_param, model_filename);
+  net_->ToProto(&net_param, snapshot.params, param_.snapshot_diff());
+  const string temp_filename = model_filename + ".tmp";
+  WriteProtoToBinaryFile(net_param, temp_filename);
+  CommitFile(temp_filename, model_filename);
   return model_filename;
 }
 
 template <typename Dtype>
-string Solver<Dtype>::SnapshotToHDF5() {
-  string model_filename = SnapshotFilename(".caffemodel.h5");
+string Solver<Dtype>::SnapshotToHDF5(const SolverSnapshot<Dtype>& snapshot) {
+  string model_filename = SnapshotFilename(".caffemodel.h5", snapshot.iter);
   LOG(INFO) << "Snapshotting to HDF5 file " << model_filename;
-  net_->ToHDF5(model_filename, param_.snapshot_diff());
+  const string temp_filename = model_filename + ".tmp";
+  net_->ToHDF5(temp_filename, snapshot.params, param_.snapshot_diff());
+  CommitFile(temp_filename, model_filename);
   return model_filename;
 }
 
@@ -1,3 +1,4 @@
+#include <cmath>
 #include <vector>
 
 #include "caffe/sgd_solvers.hpp"
@@ -106,6 +107,32 @@ void AdaDeltaSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void AdaDeltaSolver<Dtype>::FusedUpdateValue(int param_id, Dtype rate,
+    int offset, int count, Dtype* diff) {
+  const vector<float>& net_params_lr = this->net_->params_lr();
+  Dtype delta = this->param_.delta();
+  Dtype momentum = this->param_.momentum();
+  Dtype local_rate = rate * net_params_lr[param_id];
+  size_t update_history_offset = this->net_->learnable_params().size();
+  Dtype* history = this->fused_history_[param_id] + offset;
+  Dtype* update_history =
+      this->fused_history_[update_history_offset + param_id] + offset;
+  for (int i = 0; i < count; ++i) {
+    // update history of gradients
+    history[i] = momentum * history[i]
+        + (Dtype(1) - momentum) * std::pow(diff[i], Dtype(2));
+    // compute the update from the RMS of both histories
+    const Dtype update = diff[i] * std::pow(
+        (delta + update_history[i]) / (delta + history[i]), Dtype(0.5));
+    // update history of updates
+    update_history[i] = momentum * update_history[i]
+        + (Dtype(1) - momentum) * std::pow(update, Dtype(2));
+    // apply learning rate
+    diff[i] = local_rate * update;
+  }
+}
+
 INSTANTIATE_CLASS(AdaDeltaSolver);
 REGISTER_SOLVER_CLASS(AdaDelta);
 
@@ -1,3 +1,4 @@
+#include <cmath>
 #include <vector>
 
 #include "caffe/sgd_solvers.hpp"
@@ -88,6 +89,33 @@ void AdamSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void AdamSolver<Dtype>::FusedUpdateValue(int param_id, Dtype rate,
+    int offset, int count, Dtype* diff) {
+  const vector<float>& net_params_lr = this->net_->params_lr();
+  Dtype local_rate = rate * net_params_lr[param_id];
+  const Dtype beta1 = this->param_.momentum();
+  const Dtype beta2 = this->param_.momentum2();
+  size_t update_history_offset = this->net_->learnable_params().size();
+  Dtype* val_m = this->fused_history_[param_id] + offset;
+  Dtype* val_v =
+      this->fused_history_[param_id + update_history_offset] + offset;
+
+  const int t = this->iter_ + 1;
+  const Dtype correction = std::sqrt(Dtype(1) - pow(beta2, t)) /
+      (Dtype(1.) - pow(beta1, t));
+  const Dtype eps_hat = this->param_.delta();
+  for (int i = 0; i < count; ++i) {
+    // update m <- \beta_1 m_{t-1} + (1-\beta_1)g_t
+    val_m[i] = beta1 * val_m[i] + (Dtype(1)-beta1) * diff[i];
+    // update v <- \beta_2 m_{t-1} + (1-\beta_2)g_t^2
+    val_v[i] = beta2 * val_v[i] + (Dtype(1)-beta2) * (diff[i] * diff[i]);
+    // set update
+    diff[i] = local_rate*correction *
+        (val_m[i] / (std::pow(val_v[i], Dtype(0.5)) + eps_hat));
+  }
+}
+
 INSTANTIATE_CLASS(AdamSolver);
 REGISTER_SOLVER_CLASS(Adam);
 
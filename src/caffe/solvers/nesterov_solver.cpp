@@ -1,3 +1,4 @@
+#include <cmath>
 #include <vector>
 
 #include "caffe/sgd_solvers.hpp"
@@ -55,6 +56,23 @@ void NesterovSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void NesterovSolver<Dtype>::FusedUpdateValue(int param_id, Dtype rate,
+    int offset, int count, Dtype* diff) {
+  const vector<float>& net_params_lr = this->net_->params_lr();
+  Dtype momentum = this->param_.momentum();
+  Dtype local_rate = rate * net_params_lr[param_id];
+  Dtype* history = this->fused_history_[param_id] + offset;
+  for (int i = 0; i < count; ++i) {
+    // save history momentum for stepping back
+    const Dtype update = history[i];
+    // update history
+    history[i] = momentum * history[i] + local_rate * diff[i];
+    // compute update: step back then over step
+    diff[i] = -momentum * update + (Dtype(1) + momentum) * history[i];
+  }
+}
+
 INSTANTIATE_CLASS(NesterovSolver);
 REGISTER_SOLVER_CLASS(Nesterov);
 
@@ -1,3 +1,4 @@
+#include <cmath>
 #include <vector>
 
 #include "caffe/sgd_solvers.hpp"
@@ -64,6 +65,26 @@ void RMSPropSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void RMSPropSolver<Dtype>::FusedUpdateValue(int param_id, Dtype rate,
+    int offset, int count, Dtype* diff) {
+  const vector<float>& net_params_lr = this->net_->params_lr();
+  Dtype delta = this->param_.delta();
+  Dtype rms_decay = this->param_.rms_decay();
+  Dtype local_rate = rate * net_params_lr[param_id];
+  Dtype* history = this->fused_history_[param_id] + offset;
+  for (int i = 0; i < count; ++i) {
+    // update history
+    history[i] = rms_decay * history[i]
+        + Dtype(1-rms_decay) * std::pow(diff[i], Dtype(2));
+    // prepare update
+    const Dtype update =
+        diff[i] / (std::pow(history[i], Dtype(0.5)) + delta);
+    // scale
+    diff[i] = local_rate * update;
+  }
+}
+
 INSTANTIATE_CLASS(RMSPropSolver);
 REGISTER_SOLVER_CLASS(RMSProp);
 
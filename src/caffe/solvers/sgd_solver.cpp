@@ -1,9 +1,12 @@
+#include <algorithm>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "caffe/sgd_solvers.hpp"
 #include "caffe/util/hdf5.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/openmp.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 namespace caffe {
@@ -89,9 +92,44 @@ void SGDSolver<Dtype>::ClipGradients() {
   const Dtype clip_gradients = this->param_.clip_gradients();
   if (clip_gradients < 0) { return; }
   const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
+  // Row-sparse gradients are only summed and scaled over their rows.
+  const bool any_row_sparse =
+      std::find(row_sparse_.begin(), row_sparse_.end(), true) !=
+      row_sparse_.end();
+  const bool contiguous = this->net_->contiguous_params() && !any_row_sparse;
+  const int count = this->net_->params_count();
   Dtype sumsq_diff = 0;
-  for (int i = 0; i < net_params.size(); ++i) {
-    sumsq_diff += net_params[i]->sumsq_diff();
+  if (contiguous) {
+    // One reduction over the whole gradient.
+    switch (Caffe::mode()) {
+    case Caffe::CPU: {
+      const Dtype* diff = this->net_->mutable_cpu_params_diff();
+      sumsq_diff = caffe_cpu_dot(count, diff, diff);
+      break;
+    }
+    case Caffe::GPU: {
+#ifndef CPU_ONLY
+      const Dtype* diff = this->net_->mutable_gpu_params_diff();
+      caffe_gpu_dot(count, diff, diff, &sumsq_diff);
+#else
+      NO_GPU;
+#endif
+      break;
+    }
+    }
+  } else {
+    for (int i = 0; i < net_params.size(); ++i) {
+      if (row_sparse_[i]) {
+        const int row_count = net_params[i]->count(1);
+        const Dtype* diff = net_params[i]->cpu_diff();
+        for (int j = 0; j < sparse_rows_[i].size(); ++j) {
+          const Dtype* row = diff + sparse_rows_[i][j] * row_count;
+          sumsq_diff += caffe_cpu_dot(row_count, row, row);
+        }
+      } else {
+        sumsq_diff += net_params[i]->sumsq_diff();
+      }
+    }
   }
   const Dtype l2norm_diff = std::sqrt(sumsq_diff);
   if (l2norm_diff > clip_gradients) {
@@ -99,8 +137,33 @@ void SGDSolver<Dtype>::ClipGradients() {
     LOG(INFO) << "Gradient clipping: scaling down gradients (L2 norm "
         << l2norm_diff << " > " << clip_gradients << ") "
         << "by scale factor " << scale_factor;
-    for (int i = 0; i < net_params.size(); ++i) {
-      net_params[i]->scale_diff(scale_factor);
+    if (contiguous) {
+      switch (Caffe::mode()) {
+      case Caffe::CPU:
+        caffe_scal(count, scale_factor, this->net_->mutable_cpu_params_diff());
+        break;
+      case Caffe::GPU:
+#ifndef CPU_ONLY
+        caffe_gpu_scal(count, scale_factor,
+                       this->net_->mutable_gpu_params_diff());
+#else
+        NO_GPU;
+#endif
+        break;
+      }
+    } else {
+      for (int i = 0; i < net_params.size(); ++i) {
+        if (row_sparse_[i]) {
+          const int row_count = net_params[i]->count(1);
+          Dtype* diff = net_params[i]->mutable_cpu_diff();
+          for (int j = 0; j < sparse_rows_[i].size(); ++j) {
+            caffe_scal(row_count, scale_factor,
+                       diff + sparse_rows_[i][j] * row_count);
+          }
+        } else {
+          net_params[i]->scale_diff(scale_factor);
+        }
+      }
     }
   }
 }
@@ -112,20 +175,165 @@ void SGDSolver<Dtype>::ApplyUpdate() {
     LOG_IF(INFO, Caffe::root_solver()) << "Iteration " << this->iter_
         << ", lr = " << rate;
   }
+  const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
+  row_sparse_.resize(net_params.size());
+  sparse_rows_.resize(net_params.size());
+  bool any_row_sparse = false;
+  for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+    row_sparse_[param_id] =
+        this->net_->ParamDiffRows(param_id, &sparse_rows_[param_id]);
+    any_row_sparse |= row_sparse_[param_id];
+  }
   ClipGradients();
-  for (int param_id = 0; param_id < this->net_->learnable_params().size();
-       ++param_id) {
-    Normalize(param_id);
-    Regularize(param_id);
-    ComputeUpdateValue(param_id, rate);
+  if (this->param_.fused_update() && Caffe::mode() == Caffe::CPU) {
+    ApplyFusedUpdate(rate);
+  } else {
+    for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+      if (row_sparse_[param_id]) {
+        ApplySparseUpdate(param_id, rate);
+        continue;
+      }
+      Normalize(param_id);
+      Regularize(param_id);
+      ComputeUpdateValue(param_id, rate);
+    }
+    if (any_row_sparse) {
+      // Net::Update would go over every row of the sparse parameters.
+      for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+        if (!row_sparse_[param_id]) {
+          net_params[param_id]->Update();
+        }
+      }
+    } else {
+      this->net_->Update();
+    }
   }
-  this->net_->Update();
 
   // Increment the internal iter_ counter -- its value should always indicate
   // the number of times the weights have been updated.
   ++this->iter_;
 }
 
+// Values per block of the fused update; a multiple of the SIMD widths so that
+// blocks split vectorized loops the same way whole parameters do.
+const int kFusedBlockSize = 2048;
+
+template <typename Dtype>
+void SGDSolver<Dtype>::ApplyFusedUpdate(Dtype rate) {
+  const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
+  const vector<float>& net_params_weight_decay =
+      this->net_->params_weight_decay();
+  const Dtype weight_decay = this->param_.weight_decay();
+  const bool l1 = FusedRegularizationL1();
+  const Dtype accum_normalization = Dtype(1.) / this->param_.iter_size();
+  // Take the CPU pointers up front, as syncing blobs is not thread safe.
+  vector<Dtype*> data(net_params.size());
+  vector<Dtype*> diff(net_params.size());
+  vector<Dtype> local_decay(net_params.size());
+  vector<std::pair<int, int> > blocks;
+  int total_count = 0;
+  for (int i = 0; i < net_params.size(); ++i) {
+    if (row_sparse_[i]) { continue; }
+    data[i] = net_params[i]->mutable_cpu_data();
+    diff[i] = net_params[i]->mutable_cpu_diff();
+    local_decay[i] = weight_decay * net_params_weight_decay[i];
+    for (int offset = 0; offset < net_params[i]->count();
+         offset += kFusedBlockSize) {
+      blocks.push_back(std::make_pair(i, offset));
+    }
+    total_count += net_params[i]->count();
+  }
+  SetFusedHistory();
+  const int num_blocks = blocks.size();
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) \
+    if (total_count >= kCpuParallelMinCount)
+#endif
+  for (int b = 0; b < num_blocks; ++b) {
+    const int param_id = blocks[b].first;
+    const int offset = blocks[b].second;
+    const int count =
+        std::min(kFusedBlockSize, net_params[param_id]->count() - offset);
+    FusedUpdateRange(param_id, rate, accum_normalization,
+        local_decay[param_id], l1, offset, count, data[param_id],
+        diff[param_id]);
+  }
+  for (int i = 0; i < net_params.size(); ++i) {
+    if (row_sparse_[i]) {
+      ApplySparseUpdate(i, rate);
+    }
+  }
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::ApplySparseUpdate(int param_id, Dtype rate) {
+  Blob<Dtype>* param = this->net_->learnable_params()[param_id];
+  const vector<int>& rows = sparse_rows_[param_id];
+  const int row_count = param->count(1);
+  const int num_rows = rows.size();
+  Dtype* data = param->mutable_cpu_data();
+  Dtype* diff = param->mutable_cpu_diff();
+  const bool l1 = FusedRegularizationL1();
+  const Dtype accum_normalization = Dtype(1.) / this->param_.iter_size();
+  const Dtype local_decay = this->param_.weight_decay() *
+      this->net_->params_weight_decay()[param_id];
+  SetFusedHistory();
+#ifdef _OPENMP
+#pragma omp parallel for if (num_rows * row_count >= kCpuParallelMinCount)
+#endif
+  for (int i = 0; i < num_rows; ++i) {
+    FusedUpdateRange(param_id, rate, accum_normalization, local_decay, l1,
+        rows[i] * row_count, row_count, data, diff);
+  }
+}
+
+template <typename Dtype>
+bool SGDSolver<Dtype>::FusedRegularizationL1() const {
+  const string& regularization_type = this->param_.regularization_type();
+  CHECK(regularization_type == "L2" || regularization_type == "L1")
+      << "Unknown regularization type: " << regularization_type;
+  return regularization_type == "L1";
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::FusedUpdateRange(int param_id, Dtype rate,
+    Dtype accum_normalization, Dtype local_decay, bool l1, int offset,
+    int count, Dtype* data, Dtype* diff) {
+  Dtype* range_data = data + offset;
+  Dtype* range_diff = diff + offset;
+  // Normalize
+  if (accum_normalization != Dtype(1)) {
+    for (int i = 0; i < count; ++i) {
+      range_diff[i] *= accum_normalization;
+    }
+  }
+  // Regularize
+  if (local_decay) {
+    if (l1) {
+      for (int i = 0; i < count; ++i) {
+        range_diff[i] += local_decay * caffe_sign(range_data[i]);
+      }
+    } else {
+      for (int i = 0; i < count; ++i) {
+        range_diff[i] += local_decay * range_data[i];
+      }
+    }
+  }
+  FusedUpdateValue(param_id, rate, offset, count, range_diff);
+  // Update, as Net::Update does
+  for (int i = 0; i < count; ++i) {
+    range_data[i] -= range_diff[i];
+  }
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::SetFusedHistory() {
+  fused_history_.resize(history_.size());
+  for (int i = 0; i < history_.size(); ++i) {
+    fused_history_[i] = history_[i]->mutable_cpu_data();
+  }
+}
+
 template <typename Dtype>
 void SGDSolver<Dtype>::Normalize(int param_id) {
   if (this->param_.iter_size() == 1) { return; }
@@ -254,13 +462,34 @@ void SGDSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
 }
 
 template <typename Dtype>
-void SGDSolver<Dtype>::SnapshotSolverState(const string& model_filename) {
+void SGDSolver<Dtype>::FusedUpdateValue(int param_id, Dtype rate, int offset,
+    int count, Dtype* diff) {
+  const vector<float>& net_params_lr = this->net_->params_lr();
+  Dtype momentum = this->param_.momentum();
+  Dtype local_rate = rate * net_params_lr[param_id];
+  Dtype* history = fused_history_[param_id] + offset;
+  for (int i = 0; i < count; ++i) {
+    history[i] = momentum * history[i] + local_rate * diff[i];
+    diff[i] = history[i];
+  }
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::StageSnapshot(SolverSnapshot<Dtype>* snapshot,
+    bool copy) {
+  Solver<Dtype>::StageSnapshot(snapshot, copy);
+  this->StageBlobs(history_, copy, false, &snapshot->history);
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::SnapshotSolverState(
+    const SolverSnapshot<Dtype>& snapshot, const string& model_filename) {
   switch (this->param_.snapshot_format()) {
     case caffe::SolverParameter_SnapshotFormat_BINARYPROTO:
-      SnapshotSolverStateToBinaryProto(model_filename);
+      SnapshotSolverStateToBinaryProto(snapshot, model_filename);
       break;
     case caffe::SolverParameter_SnapshotFormat_HDF5:
-      SnapshotSolverStateToHDF5(model_filename);
+      SnapshotSolverStateToHDF5(snapshot, model_filename);
       break;
     default:
       LOG(FATAL) << "Unsupported snapshot format.";
@@ -269,49 +498,58 @@ void SGDSolver<Dtype>::SnapshotSolverState(const string& model_filename) {
 
 template <typename Dtype>
 void SGDSolver<Dtype>::SnapshotSolverStateToBinaryProto(
-    const string& model_filename) {
+    const SolverSnapshot<Dtype>& snapshot, const string& model_filename) {
   SolverState state;
-  state.set_iter(this->iter_);
+  state.set_iter(snapshot.iter);
   state.set_learned_net(model_filename);
-  state.set_current_step(this->current_step_);
+  state.set_current_step(snapshot.current_step);
   state.clear_history();
-  for (int i = 0; i < history_.size(); ++i) {
+  for (int i = 0; i < snapshot.history.size(); ++i) {
     // Add history
     BlobProto* history_blob = state.add_history();
-    history_[i]->ToProto(history_blob);
+    snapshot.history[i]->ToProto(history_blob);
   }
-  string snapshot_filename = Solver<Dtype>::SnapshotFilename(".solverstate");
+  string snapshot_filename =
+      Solver<Dtype>::SnapshotFilename(".solverstate", snapshot.iter);
   LOG(INFO)
     << "Snapshotting solver state to binary proto file " << snapshot_filename;
-  WriteProtoToBinaryFile(state, snapshot_filename.c_str());
+  const string temp_filename = snapshot_filename + ".tmp";
+  WriteProtoToBinaryFile(state, temp_filename);
+  CommitFile(temp_filename, snapshot_filename);
 }
 
 template <typename Dtype>
 void SGDSolver<Dtype>::SnapshotSolverStateToHDF5(
-    const string& model_filename) {
+    const SolverSnapshot<Dtype>& snapshot, const string& model_filename) {
 // This code is taken from https://github.com/sh1r0/caffe-android-lib
 #ifdef USE_HDF5
   string snapshot_filename =
-      Solver<Dtype>::SnapshotFilename(".solverstate.h5");
+      Solver<Dtype>::SnapshotFilename(".solverstate.h5", snapshot.iter);
   LOG(INFO) << "Snapshotting solver state to HDF5 file " << snapshot_filename;
-  hid_t file_hid = H5Fcreate(snapshot_filename.c_str(), H5F_ACC_TRUNC,
-      H5P_DEFAULT, H5P_DEFAULT);
-  CHECK_GE(file_hid, 0)
-      << "Couldn't open " << snapshot_filename << " to save solver state.";
-  hdf5_save_int(file_hid, "iter", this->iter_);
-  hdf5_save_string(file_hid, "learned_net", model_filename);
-  hdf5_save_int(file_hid, "current_step", this->current_step_);
-  hid_t history_hid = H5Gcreate2(file_hid, "history", H5P_DEFAULT, H5P_DEFAULT,
-      H5P_DEFAULT);
-  CHECK_GE(history_hid, 0)
-      << "Error saving solver state to " << snapshot_filename << ".";
-  for (int i = 0; i < history_.size(); ++i) {
-    ostringstream oss;
-    oss << i;
-    hdf5_save_nd_dataset<Dtype>(history_hid, oss.str(), *history_[i]);
+  const string temp_filename = snapshot_filename + ".tmp";
+  {
+    HDF5Lock lock;
+    hid_t file_hid = H5Fcreate(temp_filename.c_str(), H5F_ACC_TRUNC,
+        H5P_DEFAULT, H5P_DEFAULT);
+    CHECK_GE(file_hid, 0)
+        << "Couldn't open " << temp_filename << " to save solver state.";
+    hdf5_save_int(file_hid, "iter", snapshot.iter);
+    hdf5_save_string(file_hid, "learned_net", model_filename);
+    hdf5_save_int(file_hid, "current_step", snapshot.current_step);
+    hid_t history_hid = H5Gcreate2(file_hid, "history", H5P_DEFAULT,
+        H5P_DEFAULT, H5P_DEFAULT);
+    CHECK_GE(history_hid, 0)
+        << "Error saving solver state to " << temp_filename << ".";
+    for (int i = 0; i < snapshot.history.size(); ++i) {
+      ostringstream oss;
+      oss << i;
+      hdf5_save_nd_dataset<Dtype>(history_hid, oss.str(),
+          *snapshot.history[i]);
+    }
+    H5Gclose(history_hid);
+    H5Fclose(file_hid);
   }
-  H5Gclose(history_hid);
-  H5Fclose(file_hid);
+  CommitFile(temp_filename, snapshot_filename);
 // This code is taken from https://github.com/sh1r0/caffe-android-lib
 #else
   LOG(FATAL) << "SnapshotSolverStateToHDF5 requires hdf5;"
@@ -342,6 +580,7 @@ void SGDSolver<Dtype>::RestoreSolverStateFromBinaryProto(
 template <typename Dtype>
 void SGDSolver<Dtype>::RestoreSolverStateFromHDF5(const string& state_file) {
 #ifdef USE_HDF5
+  HDF5Lock lock;
   hid_t file_hid = H5Fopen(state_file.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
   CHECK_GE(file_hid, 0) << "Couldn't open solver state file " << state_file;
   this->iter_ = hdf5_load_int(file_hid, "iter");
@@ -1,11 +1,23 @@
+#include <boost/atomic.hpp>
+
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/math_functions.hpp"
 
 namespace caffe {
+
+// Shared by all SyncedMemory, so that no two states of any of them get the
+// same version, even at an address that was freed and allocated again.
+static boost::atomic<uint64_t> last_version(0);
+
+void SyncedMemory::bump_version() {
+  version_ = ++last_version;
+}
+
 SyncedMemory::SyncedMemory()
   : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(0), head_(UNINITIALIZED),
     own_cpu_data_(false), cpu_malloc_use_cuda_(false), own_gpu_data_(false) {
+  bump_version();
 #ifndef CPU_ONLY
 #ifdef DEBUG
   CUDA_CHECK(cudaGetDevice(&device_));
@@ -16,6 +28,7 @@ SyncedMemory::SyncedMemory()
 SyncedMemory::SyncedMemory(size_t size)
   : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(size), head_(UNINITIALIZED),
     own_cpu_data_(false), cpu_malloc_use_cuda_(false), own_gpu_data_(false) {
+  bump_version();
 #ifndef CPU_ONLY
 #ifdef DEBUG
   CUDA_CHECK(cudaGetDevice(&device_));
@@ -105,6 +118,7 @@ void SyncedMemory::set_cpu_data(void* data) {
   cpu_ptr_ = data;
   head_ = HEAD_AT_CPU;
   own_cpu_data_ = false;
+  bump_version();
 }
 
 const void* SyncedMemory::gpu_data() {
@@ -128,6 +142,7 @@ void SyncedMemory::set_gpu_data(void* data) {
   gpu_ptr_ = data;
   head_ = HEAD_AT_GPU;
   own_gpu_data_ = false;
+  bump_version();
 #else
   NO_GPU;
 #endif
@@ -137,6 +152,7 @@ void* SyncedMemory::mutable_cpu_data() {
   check_device();
   to_cpu();
   head_ = HEAD_AT_CPU;
+  bump_version();
   return cpu_ptr_;
 }
 
@@ -145,6 +161,7 @@ void* SyncedMemory::mutable_gpu_data() {
 #ifndef CPU_ONLY
   to_gpu();
   head_ = HEAD_AT_GPU;
+  bump_version();
   return gpu_ptr_;
 #else
   NO_GPU;
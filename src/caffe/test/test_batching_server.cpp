@@ -0,0 +1,151 @@
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/batching_server.hpp"
+#include "caffe/common.hpp"
+#include "caffe/inference_session.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class BatchingServerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+  typedef typename BatchingServer<Dtype>::Request Request;
+
+ protected:
+  virtual void SetUp() {
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        "name: 'ServedNet' "
+        "layer { "
+        "  name: 'data' type: 'Input' top: 'data' "
+        "  input_param { shape { dim: 1 dim: 3 } } "
+        "} "
+        "layer { "
+        "  name: 'ip' type: 'InnerProduct' bottom: 'data' top: 'ip' "
+        "  inner_product_param { "
+        "    num_output: 2 "
+        "    weight_filler { type: 'gaussian' } "
+        "    bias_filler { type: 'gaussian' } "
+        "  } "
+        "} ", &net_param_));
+    session_.reset(new InferenceSession<Dtype>(net_param_, ""));
+  }
+
+  // Submit num_requests items with values i, i + 1, i + 2, and check that
+  // each gets W x + b.
+  void SubmitAndCheck(BatchingServer<Dtype>* server, int num_requests) {
+    ASSERT_EQ(3, server->input_size());
+    ASSERT_EQ(2, server->output_size());
+    vector<shared_ptr<Request> > requests;
+    for (int i = 0; i < num_requests; ++i) {
+      const Dtype input[] = {Dtype(i), Dtype(i + 1), Dtype(i + 2)};
+      requests.push_back(server->Submit(input));
+    }
+    const Dtype* weights = session_->weights().params()[0]->cpu_data();
+    const Dtype* bias = session_->weights().params()[1]->cpu_data();
+    for (int i = 0; i < num_requests; ++i) {
+      const vector<Dtype>& output = requests[i]->Wait();
+      ASSERT_EQ(2, output.size());
+      for (int j = 0; j < 2; ++j) {
+        const Dtype expected = bias[j] + weights[j * 3] * i +
+            weights[j * 3 + 1] * (i + 1) + weights[j * 3 + 2] * (i + 2);
+        EXPECT_NEAR(expected, output[j], 1e-4);
+      }
+    }
+  }
+
+  NetParameter net_param_;
+  shared_ptr<InferenceSession<Dtype> > session_;
+};
+
+TYPED_TEST_CASE(BatchingServerTest, TestDtypesAndDevices);
+
+TYPED_TEST(BatchingServerTest, TestFullBatches) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The deadline is far enough that only full batches are run.
+  BatchingServer<Dtype> server(this->session_->CreateContext(), 4, 10000000,
+      16);
+  server.Start();
+  const boost::posix_time::ptime start = boost::get_system_time();
+  this->SubmitAndCheck(&server, 8);
+  const double elapsed_ms =
+      (boost::get_system_time() - start).total_microseconds() / 1000.;
+  server.Stop();
+  const typename BatchingServer<Dtype>::Stats stats = server.stats();
+  EXPECT_EQ(8, stats.requests);
+  EXPECT_EQ(2, stats.batches);
+  EXPECT_EQ(4, stats.mean_batch_size);
+  EXPECT_GT(stats.p50_latency_ms, 0);
+  EXPECT_LE(stats.p50_latency_ms, stats.p99_latency_ms);
+  // No request waited longer than the test, up to the bucket resolution.
+  EXPECT_LE(stats.p99_latency_ms, std::max(elapsed_ms, 0.001) * 1.05);
+}
+
+TYPED_TEST(BatchingServerTest, TestReshapesSkipped) {
+  typedef typename TypeParam::Dtype Dtype;
+  NetParameter param = this->net_param_;
+  param.add_shape_bucket()->add_input_shape()->add_dim(4);
+  param.mutable_shape_bucket(0)->mutable_input_shape(0)->add_dim(3);
+  InferenceSession<Dtype> session(param, "");
+  shared_ptr<typename InferenceSession<Dtype>::Context> context =
+      session.CreateContext();
+  ASSERT_TRUE(context->net().has_shape_buckets());
+  BatchingServer<Dtype> server(context, 4, 10000000, 16);
+  server.Start();
+  const int kBatches = 3;
+  for (int i = 0; i < kBatches; ++i) {
+    const Dtype input[] = {0, 0, 0};
+    vector<shared_ptr<typename BatchingServer<Dtype>::Request> > requests;
+    for (int j = 0; j < 4; ++j) {
+      requests.push_back(server.Submit(input));
+    }
+    for (int j = 0; j < 4; ++j) {
+      requests[j]->Wait();
+    }
+  }
+  server.Stop();
+  // Every batch after the first skips the Reshape of both layers, once each.
+  EXPECT_EQ(2 * (kBatches - 1), context->net().reshapes_skipped());
+}
+
+TYPED_TEST(BatchingServerTest, TestDeadline) {
+  typedef typename TypeParam::Dtype Dtype;
+  BatchingServer<Dtype> server(this->session_->CreateContext(), 8, 1000, 1);
+  server.Start();
+  // A lone request is served at its deadline; with a queue depth of 1 the
+  // others wait for it.
+  for (int i = 0; i < 3; ++i) {
+    this->SubmitAndCheck(&server, 1);
+  }
+  server.Stop();
+  EXPECT_EQ(3, server.stats().requests);
+  EXPECT_EQ(3, server.stats().batches);
+}
+
+TYPED_TEST(BatchingServerTest, TestStopServesQueue) {
+  typedef typename TypeParam::Dtype Dtype;
+  typedef typename BatchingServer<Dtype>::Request Request;
+  BatchingServer<Dtype> server(this->session_->CreateContext(), 8, 10000000,
+      8);
+  server.Start();
+  vector<shared_ptr<Request> > requests;
+  for (int i = 0; i < 3; ++i) {
+    const Dtype input[] = {0, 0, 0};
+    requests.push_back(server.Submit(input));
+  }
+  // Stopping does not wait for the deadline, or for a full batch.
+  server.Stop();
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(2, requests[i]->Wait().size());
+  }
+  EXPECT_EQ(3, server.stats().requests);
+}
+
+}  // namespace caffe
@@ -0,0 +1,91 @@
+#include <set>
+#include <string>
+
+#include "google/protobuf/text_format.h"
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/calibrate_int8.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class CalibrateInt8Test : public MultiDeviceTest<TypeParam> {
+ protected:
+  CalibrateInt8Test()
+      : net_proto_(
+          "name: 'CalibrateNet' "
+          "state { phase: TEST } "
+          "layer { "
+          "  name: 'data' type: 'DummyData' top: 'data' "
+          "  dummy_data_param { "
+          "    shape { dim: 2 dim: 3 dim: 4 dim: 4 } "
+          "    data_filler { type: 'constant' value: -2 } "
+          "  } "
+          "} "
+          "layer { "
+          "  name: 'conv' type: 'Convolution' bottom: 'data' top: 'conv' "
+          "  convolution_param { "
+          "    num_output: 2 kernel_size: 1 "
+          "    weight_filler { type: 'constant' value: -0.5 } "
+          "  } "
+          "} "
+          "layer { name: 'relu' type: 'ReLU' bottom: 'conv' top: 'conv' } "
+          "layer { "
+          "  name: 'ip' type: 'InnerProduct' bottom: 'conv' top: 'ip' "
+          "  inner_product_param { "
+          "    num_output: 3 weight_filler { type: 'constant' value: 0.25 } "
+          "  } "
+          "} ") {}
+
+  const string net_proto_;
+};
+
+TYPED_TEST_CASE(CalibrateInt8Test, TestDtypesAndDevices);
+
+TYPED_TEST(CalibrateInt8Test, TestCalibrate) {
+  typedef typename TypeParam::Dtype Dtype;
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(this->net_proto_,
+      &param));
+  Net<Dtype> net(param);
+  EXPECT_EQ(2, CalibrateInt8(&net, 2, &param));
+  // The conv sees the data, and the ip the ReLU of 3 * -2 * -0.5.
+  EXPECT_FALSE(param.layer(0).has_quantization_param());
+  ASSERT_TRUE(param.layer(1).has_quantization_param());
+  EXPECT_EQ(QuantizationParameter_Precision_INT8,
+      param.layer(1).quantization_param().precision());
+  EXPECT_FLOAT_EQ(2, param.layer(1).quantization_param().input_max());
+  EXPECT_FALSE(param.layer(2).has_quantization_param());
+  EXPECT_FLOAT_EQ(3, param.layer(3).quantization_param().input_max());
+
+  // These values are exact in int8, so the quantized net computes the same
+  // up to rounding of the scales.
+  Net<Dtype> int8_net(param);
+  int8_net.ShareTrainedLayersWith(&net);
+  const Blob<Dtype>& out = *int8_net.Forward()[0];
+  const Blob<Dtype>& expected_out = *net.Forward()[0];
+  ASSERT_EQ(expected_out.count(), out.count());
+  for (int i = 0; i < out.count(); ++i) {
+    EXPECT_NEAR(expected_out.cpu_data()[i], out.cpu_data()[i], 1e-4);
+  }
+}
+
+TYPED_TEST(CalibrateInt8Test, TestSkipLayers) {
+  typedef typename TypeParam::Dtype Dtype;
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(this->net_proto_,
+      &param));
+  Net<Dtype> net(param);
+  std::set<string> skip_layers;
+  skip_layers.insert("conv");
+  EXPECT_EQ(1, CalibrateInt8(&net, 1, &param, skip_layers));
+  EXPECT_FALSE(param.layer(1).has_quantization_param());
+  EXPECT_TRUE(param.layer(3).has_quantization_param());
+}
+
+}  // namespace caffe
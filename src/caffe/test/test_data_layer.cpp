@@ -67,7 +67,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     db->Close();
   }
 
-  void TestRead() {
+  void TestRead(int num_threads = 1) {
     const Dtype scale = 3;
     LayerParameter param;
     param.set_phase(TRAIN);
@@ -75,6 +75,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     data_param->set_batch_size(5);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
+    data_param->set_num_threads(num_threads);
 
     TransformationParameter* transform_param =
         param.mutable_transform_param();
@@ -382,6 +383,12 @@ TYPED_TEST(DataLayerTest, TestReadLevelDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadMultithreadedLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestRead(0);
+}
+
 TYPED_TEST(DataLayerTest, TestSkipLevelDB) {
   this->Fill(false, DataParameter_DB_LEVELDB);
   this->TestSkip();
@@ -427,6 +434,12 @@ TYPED_TEST(DataLayerTest, TestReadLMDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadMultithreadedLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestRead(0);
+}
+
 TYPED_TEST(DataLayerTest, TestSkipLMDB) {
   this->Fill(false, DataParameter_DB_LMDB);
   this->TestSkip();
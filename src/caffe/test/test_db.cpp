@@ -117,6 +117,29 @@ TYPED_TEST(DBTest, TestKeyValue) {
   EXPECT_FALSE(cursor->valid());
 }
 
+TYPED_TEST(DBTest, TestValueData) {
+  scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
+  db->Open(this->source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  EXPECT_TRUE(cursor->valid());
+  size_t size;
+  const char* data = cursor->value_data(&size);
+  EXPECT_EQ(string(data, size), cursor->value());
+  Datum datum;
+  EXPECT_TRUE(datum.ParseFromArray(data, size));
+  EXPECT_EQ(datum.channels(), 3);
+  EXPECT_EQ(datum.height(), 360);
+  EXPECT_EQ(datum.width(), 480);
+  cursor->Next();
+  EXPECT_TRUE(cursor->valid());
+  data = cursor->value_data(&size);
+  EXPECT_EQ(string(data, size), cursor->value());
+  EXPECT_TRUE(datum.ParseFromArray(data, size));
+  EXPECT_EQ(datum.channels(), 3);
+  EXPECT_EQ(datum.height(), 323);
+  EXPECT_EQ(datum.width(), 481);
+}
+
 TYPED_TEST(DBTest, TestWrite) {
   scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
   db->Open(this->source_, db::WRITE);
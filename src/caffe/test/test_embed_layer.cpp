@@ -134,6 +134,75 @@ TYPED_TEST(EmbedLayerTest, TestForwardWithBias) {
   }
 }
 
+TYPED_TEST(EmbedLayerTest, TestSparseGradientRows) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  EmbedParameter* embed_param = layer_param.mutable_embed_param();
+  embed_param->set_num_output(10);
+  embed_param->set_input_dim(5);
+  embed_param->mutable_weight_filler()->set_type("uniform");
+  EmbedLayer<Dtype> dense_layer(layer_param);
+  dense_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_TRUE(dense_layer.param_diff_rows(0) == NULL);
+  embed_param->set_sparse_gradient(true);
+  EmbedLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  ASSERT_TRUE(layer.param_diff_rows(0) != NULL);
+  EXPECT_TRUE(layer.param_diff_rows(1) == NULL);
+  EXPECT_EQ(0, layer.param_diff_rows(0)->size());
+  layer.blobs()[0]->CopyFrom(*dense_layer.blobs()[0]);
+  layer.blobs()[1]->CopyFrom(*dense_layer.blobs()[1]);
+  this->blob_bottom_->mutable_cpu_data()[0] = 4;
+  this->blob_bottom_->mutable_cpu_data()[1] = 2;
+  this->blob_bottom_->mutable_cpu_data()[2] = 2;
+  this->blob_bottom_->mutable_cpu_data()[3] = 0;
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  vector<bool> propagate_down(1, false);
+  filler.Fill(this->blob_top_);
+  Blob<Dtype> top_diff;
+  top_diff.CopyFrom(*this->blob_top_, false, true);
+  for (int i = 0; i < 2; ++i) {
+    dense_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    caffe_copy(top_diff.count(), top_diff.cpu_data(),
+        this->blob_top_->mutable_cpu_diff());
+    dense_layer.Backward(this->blob_top_vec_, propagate_down,
+        this->blob_bottom_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    caffe_copy(top_diff.count(), top_diff.cpu_data(),
+        this->blob_top_->mutable_cpu_diff());
+    layer.Backward(this->blob_top_vec_, propagate_down,
+        this->blob_bottom_vec_);
+  }
+  for (int i = 0; i < 2; ++i) {
+    const Blob<Dtype>& dense_diff = *dense_layer.blobs()[i];
+    const Blob<Dtype>& diff = *layer.blobs()[i];
+    for (int j = 0; j < diff.count(); ++j) {
+      EXPECT_EQ(dense_diff.cpu_diff()[j], diff.cpu_diff()[j]);
+    }
+  }
+  if (Caffe::mode() == Caffe::CPU) {
+    // The rows in the order they were first looked up.
+    const vector<int>& rows = *layer.param_diff_rows(0);
+    ASSERT_EQ(3, rows.size());
+    EXPECT_EQ(4, rows[0]);
+    EXPECT_EQ(2, rows[1]);
+    EXPECT_EQ(0, rows[2]);
+  }
+  layer.ClearParamDiffRows();
+  EXPECT_EQ(0, layer.param_diff_rows(0)->size());
+  this->blob_bottom_->mutable_cpu_data()[0] = 3;
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Backward(this->blob_top_vec_, propagate_down, this->blob_bottom_vec_);
+  if (Caffe::mode() == Caffe::CPU) {
+    const vector<int>& rows = *layer.param_diff_rows(0);
+    ASSERT_EQ(3, rows.size());
+    EXPECT_EQ(3, rows[0]);
+    EXPECT_EQ(2, rows[1]);
+    EXPECT_EQ(0, rows[2]);
+  }
+}
+
 TYPED_TEST(EmbedLayerTest, TestGradient) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
@@ -0,0 +1,175 @@
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/fuse_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class FuseLayersTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  void FillBlob(const string& type, Dtype min, Dtype max, Blob<Dtype>* blob) {
+    FillerParameter filler_param;
+    filler_param.set_type(type);
+    filler_param.set_min(min);
+    filler_param.set_max(max);
+    shared_ptr<Filler<Dtype> > filler(GetFiller<Dtype>(filler_param));
+    filler->Fill(blob);
+  }
+};
+
+TYPED_TEST_CASE(FuseLayersTest, TestDtypesAndDevices);
+
+TYPED_TEST(FuseLayersTest, TestFusedNetMatches) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string proto =
+      "name: 'FuseNet' "
+      "state { phase: TEST } "
+      "layer { "
+      "  name: 'data' type: 'Input' top: 'data' "
+      "  input_param { shape { dim: 2 dim: 3 dim: 6 dim: 5 } } "
+      "} "
+      "layer { "
+      "  name: 'conv1' type: 'Convolution' bottom: 'data' top: 'conv1' "
+      "  convolution_param { "
+      "    num_output: 4 kernel_size: 3 pad: 1 bias_term: false "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "} "
+      "layer { name: 'bn1' type: 'BatchNorm' bottom: 'conv1' top: 'conv1' } "
+      "layer { "
+      "  name: 'scale1' type: 'Scale' bottom: 'conv1' top: 'conv1' "
+      "  scale_param { bias_term: true } "
+      "} "
+      "layer { name: 'relu1' type: 'ReLU' bottom: 'conv1' top: 'conv1' } "
+      "layer { "
+      "  name: 'ip1' type: 'InnerProduct' bottom: 'conv1' top: 'ip1' "
+      "  inner_product_param { "
+      "    num_output: 5 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "    bias_filler { type: 'gaussian' } "
+      "  } "
+      "} "
+      "layer { name: 'bn2' type: 'BatchNorm' bottom: 'ip1' top: 'bn2' } "
+      "layer { name: 'bias2' type: 'Bias' bottom: 'bn2' top: 'bias2' } "
+      "layer { "
+      "  name: 'relu2' type: 'ReLU' bottom: 'bias2' top: 'out' "
+      "  relu_param { negative_slope: 0.1 } "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Net<Dtype> net(param);
+  // Give the BatchNorm, Scale and Bias layers non-trivial parameters.
+  const char* const stats_layers[] = {"bn1", "bn2"};
+  for (int i = 0; i < 2; ++i) {
+    const vector<shared_ptr<Blob<Dtype> > >& blobs =
+        net.layer_by_name(stats_layers[i])->blobs();
+    this->FillBlob("uniform", -1, 1, blobs[0].get());
+    this->FillBlob("uniform", 0.5, 2, blobs[1].get());
+    blobs[2]->mutable_cpu_data()[0] = 2;
+  }
+  this->FillBlob("uniform", 0.5, 2,
+      net.layer_by_name("scale1")->blobs()[0].get());
+  this->FillBlob("uniform", -1, 1,
+      net.layer_by_name("scale1")->blobs()[1].get());
+  this->FillBlob("uniform", -1, 1,
+      net.layer_by_name("bias2")->blobs()[0].get());
+  Blob<Dtype>* data = net.input_blobs()[0];
+  this->FillBlob("gaussian", 0, 0, data);
+  net.Forward();
+  Blob<Dtype> expected_out;
+  expected_out.CopyFrom(*net.blob_by_name("out"), false, true);
+
+  NetParameter trained_param, fused_param;
+  net.ToProto(&trained_param);
+  EXPECT_EQ(6, FuseLayers(trained_param, &fused_param));
+  ASSERT_EQ(3, fused_param.layer_size());
+  EXPECT_EQ("conv1", fused_param.layer(1).top(0));
+  EXPECT_TRUE(fused_param.layer(1).convolution_param().bias_term());
+  EXPECT_TRUE(fused_param.layer(1).convolution_param().has_fused_relu());
+  EXPECT_EQ("out", fused_param.layer(2).top(0));
+  EXPECT_EQ(0.1f, fused_param.layer(2).inner_product_param().fused_relu()
+      .negative_slope());
+
+  Net<Dtype> fused_net(fused_param);
+  fused_net.CopyTrainedLayersFrom(fused_param);
+  fused_net.input_blobs()[0]->CopyFrom(*data);
+  fused_net.Forward();
+  const Blob<Dtype>& out = *fused_net.blob_by_name("out");
+  ASSERT_EQ(expected_out.count(), out.count());
+  for (int i = 0; i < out.count(); ++i) {
+    EXPECT_NEAR(expected_out.cpu_data()[i], out.cpu_data()[i], 1e-4);
+  }
+}
+
+class FuseLayersStructureTest : public ::testing::Test {
+ protected:
+  void RunFuseLayersTest(const string& input_param_string,
+      const string& output_param_string, int expected_removed) {
+    NetParameter input_param, expected_output_param, actual_output_param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        input_param_string, &input_param));
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        output_param_string, &expected_output_param));
+    EXPECT_EQ(expected_removed,
+        FuseLayers(input_param, &actual_output_param));
+    EXPECT_EQ(expected_output_param.DebugString(),
+        actual_output_param.DebugString());
+  }
+};
+
+TEST_F(FuseLayersStructureTest, TestReLUOnlyWithoutWeights) {
+  // Without trained blobs the BatchNorm stays, and so does the ReLU after it;
+  // the ReLU directly after conv2 is fused.
+  const string input_proto =
+      "layer { name: 'data' type: 'Input' top: 'data' } "
+      "layer { "
+      "  name: 'conv1' type: 'Convolution' bottom: 'data' top: 'conv1' "
+      "  convolution_param { num_output: 2 } "
+      "} "
+      "layer { name: 'bn1' type: 'BatchNorm' bottom: 'conv1' top: 'conv1' } "
+      "layer { name: 'relu1' type: 'ReLU' bottom: 'conv1' top: 'conv1' } "
+      "layer { "
+      "  name: 'conv2' type: 'Convolution' bottom: 'conv1' top: 'conv2' "
+      "  convolution_param { num_output: 2 } "
+      "} "
+      "layer { name: 'relu2' type: 'ReLU' bottom: 'conv2' top: 'relu2' } ";
+  const string expected_output_proto =
+      "layer { name: 'data' type: 'Input' top: 'data' } "
+      "layer { "
+      "  name: 'conv1' type: 'Convolution' bottom: 'data' top: 'conv1' "
+      "  convolution_param { num_output: 2 } "
+      "} "
+      "layer { name: 'bn1' type: 'BatchNorm' bottom: 'conv1' top: 'conv1' } "
+      "layer { name: 'relu1' type: 'ReLU' bottom: 'conv1' top: 'conv1' } "
+      "layer { "
+      "  name: 'conv2' type: 'Convolution' bottom: 'conv1' top: 'relu2' "
+      "  convolution_param { num_output: 2 fused_relu { } } "
+      "} ";
+  this->RunFuseLayersTest(input_proto, expected_output_proto, 1);
+}
+
+TEST_F(FuseLayersStructureTest, TestNoFusionWithMultipleConsumers) {
+  const string input_proto =
+      "layer { name: 'data' type: 'Input' top: 'data' } "
+      "layer { "
+      "  name: 'ip1' type: 'InnerProduct' bottom: 'data' top: 'ip1' "
+      "  inner_product_param { num_output: 2 } "
+      "} "
+      "layer { name: 'relu1' type: 'ReLU' bottom: 'ip1' top: 'relu1' } "
+      "layer { name: 'sigmoid1' type: 'Sigmoid' bottom: 'ip1' top: 'sig1' } ";
+  this->RunFuseLayersTest(input_proto, input_proto, 0);
+}
+
+}  // namespace caffe
@@ -0,0 +1,280 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/fused_lstm_layer.hpp"
+#include "caffe/layers/lstm_layer.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class FusedLSTMLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  FusedLSTMLayerTest() : num_output_(5) {
+    layer_param_.mutable_recurrent_param()->set_num_output(num_output_);
+    FillerParameter* weight_filler =
+        layer_param_.mutable_recurrent_param()->mutable_weight_filler();
+    weight_filler->set_type("gaussian");
+    weight_filler->set_std(0.2);
+    FillerParameter* bias_filler =
+        layer_param_.mutable_recurrent_param()->mutable_bias_filler();
+    bias_filler->set_type("gaussian");
+    bias_filler->set_std(0.1);
+    layer_param_.set_phase(TEST);
+  }
+
+  // Fill bottom_vec_ with T timesteps of N streams of inputs, of which some
+  // start a sequence and the others continue that of the previous batch; then
+  // with the static input and the initial states, if asked for.
+  void FillBottoms(int num_timesteps, int num_instances, bool static_input,
+      bool expose_hidden) {
+    blob_bottom_.Reshape(num_timesteps, num_instances, 3, 2);
+    vector<int> shape(2);
+    shape[0] = num_timesteps;
+    shape[1] = num_instances;
+    blob_bottom_cont_.Reshape(shape);
+    for (int i = 0; i < blob_bottom_cont_.count(); ++i) {
+      blob_bottom_cont_.mutable_cpu_data()[i] = i % 3 != 2;
+    }
+    blob_bottom_static_.Reshape(num_instances, 2, 3, 1);
+    shape[0] = 1;
+    shape[1] = num_instances;
+    shape.push_back(num_output_);
+    blob_bottom_h_0_.Reshape(shape);
+    blob_bottom_c_0_.Reshape(shape);
+    FillerParameter filler_param;
+    filler_param.set_min(-1);
+    filler_param.set_max(1);
+    UniformFiller<Dtype> filler(filler_param);
+    filler.Fill(&blob_bottom_);
+    filler.Fill(&blob_bottom_static_);
+    filler.Fill(&blob_bottom_h_0_);
+    filler.Fill(&blob_bottom_c_0_);
+    blob_bottom_vec_.clear();
+    blob_bottom_vec_.push_back(&blob_bottom_);
+    blob_bottom_vec_.push_back(&blob_bottom_cont_);
+    if (static_input) {
+      blob_bottom_vec_.push_back(&blob_bottom_static_);
+    }
+    if (expose_hidden) {
+      blob_bottom_vec_.push_back(&blob_bottom_h_0_);
+      blob_bottom_vec_.push_back(&blob_bottom_c_0_);
+    }
+    layer_param_.mutable_recurrent_param()->set_expose_hidden(expose_hidden);
+  }
+
+  // Start a sequence in every stream at the first timestep.
+  void StartSequences() {
+    caffe_set(blob_bottom_cont_.shape(1), Dtype(0),
+              blob_bottom_cont_.mutable_cpu_data());
+  }
+
+  // Check that the fused layer computes what the unrolled one does, over two
+  // batches so that the state carried between them counts.
+  void CheckMatchesUnrolled(bool static_input, bool expose_hidden) {
+    const int kNumTimesteps = 4;
+    const int kNumInstances = 3;
+    FillBottoms(kNumTimesteps, kNumInstances, static_input, expose_hidden);
+    const int num_tops = expose_hidden ? 3 : 1;
+    vector<Blob<Dtype>*> unrolled_top_vec;
+    vector<Blob<Dtype>*> fused_top_vec;
+    for (int i = 0; i < num_tops; ++i) {
+      unrolled_top_vec.push_back(new Blob<Dtype>());
+      fused_top_vec.push_back(new Blob<Dtype>());
+    }
+    LSTMLayer<Dtype> unrolled(layer_param_);
+    unrolled.SetUp(blob_bottom_vec_, unrolled_top_vec);
+    FusedLSTMLayer<Dtype> fused(layer_param_);
+    fused.SetUp(blob_bottom_vec_, fused_top_vec);
+    ASSERT_EQ(unrolled.blobs().size(), fused.blobs().size());
+    for (int i = 0; i < unrolled.blobs().size(); ++i) {
+      ASSERT_TRUE(unrolled.blobs()[i]->shape() == fused.blobs()[i]->shape());
+      fused.blobs()[i]->CopyFrom(*unrolled.blobs()[i]);
+    }
+    for (int i = 0; i < num_tops; ++i) {
+      ASSERT_TRUE(unrolled_top_vec[i]->shape() == fused_top_vec[i]->shape());
+    }
+
+    const Dtype kEpsilon = 1e-4;
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    vector<bool> propagate_down(blob_bottom_vec_.size(), false);
+    propagate_down[0] = true;
+    if (static_input) {
+      propagate_down[2] = true;
+    }
+    Blob<Dtype> top_diff(fused_top_vec[0]->shape());
+    Blob<Dtype> unrolled_bottom_diff;
+    Blob<Dtype> unrolled_static_diff;
+    for (int batch = 0; batch < 2; ++batch) {
+      unrolled.Forward(blob_bottom_vec_, unrolled_top_vec);
+      fused.Forward(blob_bottom_vec_, fused_top_vec);
+      for (int i = 0; i < num_tops; ++i) {
+        for (int j = 0; j < fused_top_vec[i]->count(); ++j) {
+          EXPECT_NEAR(unrolled_top_vec[i]->cpu_data()[j],
+                      fused_top_vec[i]->cpu_data()[j], kEpsilon)
+              << "batch = " << batch << "; top = " << i << "; j = " << j;
+        }
+      }
+      filler.Fill(&top_diff);
+      caffe_copy(top_diff.count(), top_diff.cpu_data(),
+                 unrolled_top_vec[0]->mutable_cpu_diff());
+      caffe_copy(top_diff.count(), top_diff.cpu_data(),
+                 fused_top_vec[0]->mutable_cpu_diff());
+      unrolled.Backward(unrolled_top_vec, propagate_down, blob_bottom_vec_);
+      unrolled_bottom_diff.CopyFrom(blob_bottom_, true, true);
+      if (static_input) {
+        unrolled_static_diff.CopyFrom(blob_bottom_static_, true, true);
+      }
+      fused.Backward(fused_top_vec, propagate_down, blob_bottom_vec_);
+      for (int j = 0; j < blob_bottom_.count(); ++j) {
+        EXPECT_NEAR(unrolled_bottom_diff.cpu_diff()[j],
+                    blob_bottom_.cpu_diff()[j], kEpsilon)
+            << "batch = " << batch << "; j = " << j;
+      }
+      if (static_input) {
+        for (int j = 0; j < blob_bottom_static_.count(); ++j) {
+          EXPECT_NEAR(unrolled_static_diff.cpu_diff()[j],
+                      blob_bottom_static_.cpu_diff()[j], kEpsilon)
+              << "batch = " << batch << "; j = " << j;
+        }
+      }
+      // The parameter gradients accumulate over the batches in both.
+      for (int i = 0; i < fused.blobs().size(); ++i) {
+        for (int j = 0; j < fused.blobs()[i]->count(); ++j) {
+          EXPECT_NEAR(unrolled.blobs()[i]->cpu_diff()[j],
+                      fused.blobs()[i]->cpu_diff()[j], kEpsilon)
+              << "batch = " << batch << "; param = " << i << "; j = " << j;
+        }
+      }
+    }
+    for (int i = 0; i < num_tops; ++i) {
+      delete unrolled_top_vec[i];
+      delete fused_top_vec[i];
+    }
+  }
+
+  int num_output_;
+  LayerParameter layer_param_;
+  Blob<Dtype> blob_bottom_;
+  Blob<Dtype> blob_bottom_cont_;
+  Blob<Dtype> blob_bottom_static_;
+  Blob<Dtype> blob_bottom_h_0_;
+  Blob<Dtype> blob_bottom_c_0_;
+  Blob<Dtype> blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(FusedLSTMLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(FusedLSTMLayerTest, TestSetUp) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->FillBottoms(3, 2, true, false);
+  this->blob_top_vec_.push_back(&this->blob_top_);
+  FusedLSTMLayer<Dtype> layer(this->layer_param_);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  vector<int> expected_top_shape = this->blob_bottom_.shape();
+  expected_top_shape.resize(3);
+  expected_top_shape[2] = this->num_output_;
+  EXPECT_TRUE(this->blob_top_.shape() == expected_top_shape);
+  // W_xc, b_c, W_xc_static and W_hc, as in LSTMLayer.
+  ASSERT_EQ(4, layer.blobs().size());
+  EXPECT_EQ(4 * this->num_output_, layer.blobs()[0]->shape(0));
+  EXPECT_EQ(6, layer.blobs()[0]->shape(1));
+  EXPECT_EQ(4 * this->num_output_, layer.blobs()[1]->count());
+  EXPECT_EQ(6, layer.blobs()[2]->shape(1));
+  EXPECT_EQ(this->num_output_, layer.blobs()[3]->shape(1));
+}
+
+TYPED_TEST(FusedLSTMLayerTest, TestMatchesUnrolled) {
+  this->CheckMatchesUnrolled(false, false);
+}
+
+TYPED_TEST(FusedLSTMLayerTest, TestMatchesUnrolledWithStaticInput) {
+  this->CheckMatchesUnrolled(true, false);
+}
+
+TYPED_TEST(FusedLSTMLayerTest, TestMatchesUnrolledExposeHidden) {
+  this->CheckMatchesUnrolled(true, true);
+}
+
+TYPED_TEST(FusedLSTMLayerTest, TestForwardTimestepAtATime) {
+  typedef typename TypeParam::Dtype Dtype;
+  const int kNumTimesteps = 5;
+  const int kNumInstances = 2;
+  this->FillBottoms(kNumTimesteps, kNumInstances, false, false);
+  this->blob_top_vec_.push_back(&this->blob_top_);
+  Caffe::set_random_seed(1701);
+  FusedLSTMLayer<Dtype> layer(this->layer_param_);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> bottom_copy;
+  bottom_copy.CopyFrom(this->blob_bottom_, false, true);
+  Blob<Dtype> cont_copy;
+  cont_copy.CopyFrom(this->blob_bottom_cont_, false, true);
+  Blob<Dtype> top_copy;
+  top_copy.CopyFrom(this->blob_top_, false, true);
+
+  // Unlike the unrolled net, the layer takes any number of timesteps; one at
+  // a time, after a Reset, the state carried over gives the same outputs.
+  layer.Reset();
+  vector<int> shape = this->blob_bottom_.shape();
+  shape[0] = 1;
+  this->blob_bottom_.Reshape(shape);
+  shape.resize(2);
+  this->blob_bottom_cont_.Reshape(shape);
+  layer.Reshape(this->blob_bottom_vec_, this->blob_top_vec_);
+  const int bottom_count = this->blob_bottom_.count();
+  const int top_count = this->blob_top_.count();
+  for (int t = 0; t < kNumTimesteps; ++t) {
+    caffe_copy(bottom_count, bottom_copy.cpu_data() + t * bottom_count,
+               this->blob_bottom_.mutable_cpu_data());
+    caffe_copy(kNumInstances, cont_copy.cpu_data() + t * kNumInstances,
+               this->blob_bottom_cont_.mutable_cpu_data());
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int i = 0; i < top_count; ++i) {
+      EXPECT_NEAR(top_copy.cpu_data()[t * top_count + i],
+                  this->blob_top_.cpu_data()[i], 1e-5)
+          << "t = " << t << "; i = " << i;
+    }
+  }
+}
+
+TYPED_TEST(FusedLSTMLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->FillBottoms(3, 2, false, false);
+  this->blob_top_vec_.push_back(&this->blob_top_);
+  // The state carried over from the previous pass of the checker must not
+  // count.
+  this->StartSequences();
+  FusedLSTMLayer<Dtype> layer(this->layer_param_);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 0);
+}
+
+TYPED_TEST(FusedLSTMLayerTest, TestGradientWithStaticInput) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->FillBottoms(3, 2, true, false);
+  this->blob_top_vec_.push_back(&this->blob_top_);
+  // The state carried over from the previous pass of the checker must not
+  // count.
+  this->StartSequences();
+  FusedLSTMLayer<Dtype> layer(this->layer_param_);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 0);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 2);
+}
+
+}  // namespace caffe
@@ -8,6 +8,7 @@
 #include "gtest/gtest.h"
 
 #include "caffe/common.hpp"
+#include "caffe/cpu_parallel.hpp"
 #include "caffe/parallel.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/sgd_solvers.hpp"
@@ -26,7 +27,7 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
  protected:
   GradientBasedSolverTest() :
       seed_(1701), num_(4), channels_(3), height_(10), width_(10),
-      share_(false) {
+      share_(false), snapshot_async_(false), fused_update_(false) {
         input_file_ = new string(
         ABS_TEST_DATA_DIR "/solver_data_list.txt");
       }
@@ -39,11 +40,14 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
 #ifdef USE_NCCL
   shared_ptr<NCCL<Dtype> > nccl_;
 #endif
+  shared_ptr<CPUParallel<Dtype> > cpu_parallel_;
   int seed_;
   // Dimensions are determined by generate_sample_data.py
   // TODO this is brittle and the hdf5 file should be checked instead.
   int num_, channels_, height_, width_;
   bool share_;
+  bool snapshot_async_;
+  bool fused_update_;
   Dtype delta_;  // Stability constant for RMSProp, AdaGrad, AdaDelta and Adam
 
   // Test data: check out generate_sample_data.py in the same directory.
@@ -184,6 +188,16 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     if (snapshot) {
       proto << "snapshot: " << num_iters << " ";
     }
+    if (snapshot_async_) {
+      proto << "snapshot_async: true ";
+    }
+    if (fused_update_) {
+      proto << "fused_update: true ";
+    }
+    if (devices > 1 && Caffe::mode() == Caffe::CPU) {
+      // The data layers read their share of the data by solver rank.
+      Caffe::set_solver_count(devices);
+    }
     Caffe::set_random_seed(this->seed_);
     this->InitSolverFromProtoString(proto.str());
     if (from_snapshot) {
@@ -194,6 +208,11 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     }
     if (devices == 1) {
       this->solver_->Solve();
+    } else if (Caffe::mode() == Caffe::CPU) {
+      LOG(INFO) << "Multi-CPU test on " << devices << " workers";
+      this->cpu_parallel_.reset(new CPUParallel<Dtype>(this->solver_));
+      this->cpu_parallel_->Run(devices, from_snapshot);
+      Caffe::set_solver_count(1);
     } else {
       LOG(INFO) << "Multi-GPU test on " << devices << " devices";
       vector<int> gpus;
@@ -466,6 +485,10 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
       CUDA_CHECK(cudaGetDeviceCount(&available_devices));
     }
 #endif
+    if (Caffe::mode() == Caffe::CPU) {
+      // CPU workers are threads, so any machine can run a few.
+      available_devices = 3;
+    }
     // Takes a while to test all sizes for each test so sparse
     vector<int> sizes;
     sizes.push_back(1);
@@ -580,6 +603,192 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
       }
     }
   }
+
+  // The fused update must compute what the per-parameter steps do.
+  void TestFusedUpdate(const Dtype learning_rate, const Dtype weight_decay,
+      const Dtype momentum, const int num_iters, const int iter_size) {
+    const int kDevices = 1;
+    RunLeastSquaresSolver(learning_rate, weight_decay, momentum, num_iters,
+        iter_size, kDevices);
+    vector<shared_ptr<Blob<Dtype> > > param_copies;
+    const vector<Blob<Dtype>*>& orig_params =
+        solver_->net()->learnable_params();
+    param_copies.resize(orig_params.size());
+    for (int i = 0; i < orig_params.size(); ++i) {
+      param_copies[i].reset(new Blob<Dtype>());
+      for (int copy_diff = false; copy_diff <= true; ++copy_diff) {
+        param_copies[i]->CopyFrom(*orig_params[i], copy_diff, true);
+      }
+    }
+    vector<shared_ptr<Blob<Dtype> > > history_copies;
+    const vector<shared_ptr<Blob<Dtype> > >& orig_history = solver_->history();
+    history_copies.resize(orig_history.size());
+    for (int i = 0; i < orig_history.size(); ++i) {
+      history_copies[i].reset(new Blob<Dtype>());
+      history_copies[i]->CopyFrom(*orig_history[i], false, true);
+    }
+
+    fused_update_ = true;
+    RunLeastSquaresSolver(learning_rate, weight_decay, momentum, num_iters,
+        iter_size, kDevices);
+    const vector<Blob<Dtype>*>& params = solver_->net()->learnable_params();
+    for (int i = 0; i < params.size(); ++i) {
+      for (int j = 0; j < params[i]->count(); ++j) {
+        EXPECT_FLOAT_EQ(param_copies[i]->cpu_data()[j],
+            params[i]->cpu_data()[j])
+            << "param " << i << " data differed at dim " << j;
+        EXPECT_FLOAT_EQ(param_copies[i]->cpu_diff()[j],
+            params[i]->cpu_diff()[j])
+            << "param " << i << " diff differed at dim " << j;
+      }
+    }
+    const vector<shared_ptr<Blob<Dtype> > >& history = solver_->history();
+    for (int i = 0; i < history.size(); ++i) {
+      for (int j = 0; j < history[i]->count(); ++j) {
+        EXPECT_FLOAT_EQ(history_copies[i]->cpu_data()[j],
+            history[i]->cpu_data()[j])
+            << "history blob " << i << " data differed at dim " << j;
+      }
+    }
+  }
+
+  // Train two Embed layers sharing their weights, which look up rows 1 and 3
+  // of 6, and return the weights before and after.
+  void RunSparseEmbedSolver(const Dtype learning_rate,
+      const Dtype weight_decay, const Dtype momentum, const int num_iters,
+      const int iter_size, const bool sparse_gradient,
+      vector<shared_ptr<Blob<Dtype> > >* params_before,
+      vector<shared_ptr<Blob<Dtype> > >* params_after) {
+    ostringstream proto;
+    int device_id = 0;
+#ifndef CPU_ONLY
+    if (Caffe::mode() == Caffe::GPU) {
+      CUDA_CHECK(cudaGetDevice(&device_id));
+    }
+#endif
+    proto <<
+       "max_iter: " << num_iters << " "
+       "base_lr: " << learning_rate << " "
+       "lr_policy: 'fixed' "
+       "iter_size: " << iter_size << " "
+       "device_id: " << device_id << " "
+       "clip_gradients: 1 "
+       "net_param { "
+       "  name: 'TestNetwork' "
+       "  layer { "
+       "    name: 'data' "
+       "    type: 'DummyData' "
+       "    dummy_data_param { "
+       "      shape { dim: 2 dim: 1 } "
+       "      shape { dim: 2 dim: 1 } "
+       "      shape { dim: 4 dim: 1 dim: 5 } "
+       "      data_filler { type: 'constant' value: 1 } "
+       "      data_filler { type: 'constant' value: 3 } "
+       "      data_filler { type: 'gaussian' std: 1.0 } "
+       "    } "
+       "    top: 'indices1' "
+       "    top: 'indices2' "
+       "    top: 'targets' "
+       "  } ";
+    for (int i = 1; i <= 2; ++i) {
+      proto <<
+         "  layer { "
+         "    name: 'embed" << i << "' "
+         "    type: 'Embed' "
+         "    param { name: 'weights' } "
+         "    param { name: 'bias' } "
+         "    embed_param { "
+         "      num_output: 5 "
+         "      input_dim: 6 "
+         "      sparse_gradient: " << sparse_gradient << " "
+         "      weight_filler { "
+         "        type: 'gaussian' "
+         "        std: 1.0 "
+         "      } "
+         "      bias_filler { "
+         "        type: 'gaussian' "
+         "        std: 1.0 "
+         "      } "
+         "    } "
+         "    bottom: 'indices" << i << "' "
+         "    top: 'embed" << i << "' "
+         "  } ";
+    }
+    proto <<
+       "  layer { "
+       "    name: 'concat' "
+       "    type: 'Concat' "
+       "    bottom: 'embed1' "
+       "    bottom: 'embed2' "
+       "    top: 'embed' "
+       "    concat_param { "
+       "      axis: 0 "
+       "    } "
+       "  } "
+       "  layer { "
+       "    name: 'loss' "
+       "    type: 'EuclideanLoss' "
+       "    bottom: 'embed' "
+       "    bottom: 'targets' "
+       "  } "
+       "} ";
+    if (weight_decay != 0) {
+      proto << "weight_decay: " << weight_decay << " ";
+    }
+    if (momentum != 0) {
+      proto << "momentum: " << momentum << " ";
+    }
+    if (fused_update_) {
+      proto << "fused_update: true ";
+    }
+    Caffe::set_random_seed(this->seed_);
+    this->InitSolverFromProtoString(proto.str());
+    const vector<Blob<Dtype>*>& params = solver_->net()->learnable_params();
+    params_before->resize(params.size());
+    for (int i = 0; i < params.size(); ++i) {
+      (*params_before)[i].reset(new Blob<Dtype>());
+      (*params_before)[i]->CopyFrom(*params[i], false, true);
+    }
+    this->solver_->Solve();
+    params_after->resize(params.size());
+    for (int i = 0; i < params.size(); ++i) {
+      (*params_after)[i].reset(new Blob<Dtype>());
+      (*params_after)[i]->CopyFrom(*params[i], false, true);
+    }
+  }
+
+  // With a sparse gradient, the looked up rows and the bias must be updated
+  // as with a dense one, and in CPU mode the other rows must not be updated
+  // nor decayed.
+  void TestSparseUpdate(const Dtype learning_rate, const Dtype weight_decay,
+      const Dtype momentum, const int num_iters, const int iter_size) {
+    vector<shared_ptr<Blob<Dtype> > > dense_before, dense_after;
+    RunSparseEmbedSolver(learning_rate, weight_decay, momentum, num_iters,
+        iter_size, false, &dense_before, &dense_after);
+    vector<shared_ptr<Blob<Dtype> > > sparse_before, sparse_after;
+    RunSparseEmbedSolver(learning_rate, weight_decay, momentum, num_iters,
+        iter_size, true, &sparse_before, &sparse_after);
+    ASSERT_EQ(2, sparse_after.size());
+    const bool lazy = Caffe::mode() == Caffe::CPU;
+    for (int i = 0; i < sparse_after.size(); ++i) {
+      const int row_count = sparse_after[i]->count(1);
+      for (int j = 0; j < sparse_after[i]->count(); ++j) {
+        const int row = j / row_count;
+        const bool looked_up = i == 1 || row == 1 || row == 3;
+        EXPECT_EQ(dense_before[i]->cpu_data()[j],
+            sparse_before[i]->cpu_data()[j]);
+        if (looked_up || !lazy) {
+          EXPECT_FLOAT_EQ(dense_after[i]->cpu_data()[j],
+              sparse_after[i]->cpu_data()[j])
+              << "param " << i << " data differed at dim " << j;
+        } else {
+          EXPECT_EQ(sparse_before[i]->cpu_data()[j],
+              sparse_after[i]->cpu_data()[j])
+              << "param " << i << " data updated at dim " << j;
+        }
+      }
+    }
+  }
 };
 
 
@@ -718,6 +927,53 @@ TYPED_TEST(SGDSolverTest, TestSnapshotShare) {
   }
 }
 
+TYPED_TEST(SGDSolverTest, TestFusedUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->share_ = true;
+  this->TestFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
+TYPED_TEST(SGDSolverTest, TestSparseUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->TestSparseUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
+TYPED_TEST(SGDSolverTest, TestSparseFusedUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->fused_update_ = true;
+  this->TestSparseUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
+TYPED_TEST(SGDSolverTest, TestSnapshotAsync) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->snapshot_async_ = true;
+  for (int i = 1; i <= kNumIters; ++i) {
+    this->TestSnapshot(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 
 template <typename TypeParam>
 class AdaGradSolverTest : public GradientBasedSolverTest<TypeParam> {
@@ -818,6 +1074,29 @@ TYPED_TEST(AdaGradSolverTest, TestSnapshotShare) {
   }
 }
 
+TYPED_TEST(AdaGradSolverTest, TestFusedUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->share_ = true;
+  this->TestFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
+TYPED_TEST(AdaGradSolverTest, TestSparseUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->TestSparseUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
 
 template <typename TypeParam>
 class NesterovSolverTest : public GradientBasedSolverTest<TypeParam> {
@@ -952,6 +1231,18 @@ TYPED_TEST(NesterovSolverTest, TestSnapshotShare) {
   }
 }
 
+TYPED_TEST(NesterovSolverTest, TestFusedUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->share_ = true;
+  this->TestFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
 template <typename TypeParam>
 class AdaDeltaSolverTest : public GradientBasedSolverTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
@@ -1081,6 +1372,18 @@ TYPED_TEST(AdaDeltaSolverTest, TestSnapshotShare) {
   }
 }
 
+TYPED_TEST(AdaDeltaSolverTest, TestFusedUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.1;
+  const Dtype kWeightDecay = 0.1;
+  const Dtype kMomentum = 0.95;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->share_ = true;
+  this->TestFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
 template <typename TypeParam>
 class AdamSolverTest : public GradientBasedSolverTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
@@ -1183,6 +1486,41 @@ TYPED_TEST(AdamSolverTest, TestSnapshotShare) {
   }
 }
 
+TYPED_TEST(AdamSolverTest, TestFusedUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->share_ = true;
+  this->TestFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
+TYPED_TEST(AdamSolverTest, TestSparseUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->TestSparseUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
+TYPED_TEST(AdamSolverTest, TestSnapshotAsync) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->snapshot_async_ = true;
+  for (int i = 1; i <= kNumIters; ++i) {
+    this->TestSnapshot(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 template <typename TypeParam>
 class RMSPropSolverTest : public GradientBasedSolverTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
@@ -1286,4 +1624,16 @@ TYPED_TEST(RMSPropSolverTest, TestSnapshotShare) {
   }
 }
 
+TYPED_TEST(RMSPropSolverTest, TestFusedUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->share_ = true;
+  this->TestFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
 }  // namespace caffe
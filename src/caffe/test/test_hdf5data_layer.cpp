@@ -1,4 +1,5 @@
 #ifdef USE_HDF5
+#include <set>
 #include <string>
 #include <vector>
 
@@ -163,5 +164,43 @@ TYPED_TEST(HDF5DataLayerTest, TestSkip) {
   Caffe::set_solver_rank(0);
 }
 
+TYPED_TEST(HDF5DataLayerTest, TestShuffleChunks) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  param.add_top("data");
+  param.add_top("label");
+
+  HDF5DataParameter* hdf5_data_param = param.mutable_hdf5_data_param();
+  int batch_size = 5;
+  hdf5_data_param->set_batch_size(batch_size);
+  hdf5_data_param->set_source(*(this->filename));
+  hdf5_data_param->set_shuffle(true);
+  // Chunks of 3 rows do not divide the 10 rows of each file.
+  hdf5_data_param->set_chunk_size(3);
+  hdf5_data_param->set_prefetch(2);
+
+  HDF5DataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Every row of both files comes once per pass over the data.
+  const int data_size = 8 * 6 * 5;
+  for (int epoch = 0; epoch < 2; ++epoch) {
+    std::set<int> rows;
+    for (int iter = 0; iter < 4; ++iter) {
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      for (int i = 0; i < batch_size; ++i) {
+        const Dtype* data = this->blob_top_data_->cpu_data() + i * data_size;
+        // The second file is the first offset by 2400.
+        const int row = static_cast<int>(data[0]) / data_size;
+        EXPECT_EQ(1 + row % 10, this->blob_top_label_->cpu_data()[i]);
+        for (int j = 0; j < data_size; ++j) {
+          EXPECT_EQ(row * data_size + j, data[j]);
+        }
+        rows.insert(row);
+      }
+    }
+    EXPECT_EQ(20, rows.size());
+  }
+}
+
 }  // namespace caffe
 #endif  // USE_HDF5
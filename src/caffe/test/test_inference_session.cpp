@@ -0,0 +1,160 @@
+#include <boost/thread.hpp>
+
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/inference_session.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class InferenceSessionTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  InferenceSessionTest() {}
+
+  virtual void SetUp() {
+    const string proto =
+        "name: 'ServedNet' "
+        "layer { "
+        "  name: 'data' type: 'Input' top: 'data' "
+        "  input_param { shape { dim: 4 dim: 3 dim: 8 dim: 8 } } "
+        "} "
+        "layer { "
+        "  name: 'conv' type: 'Convolution' bottom: 'data' top: 'conv' "
+        "  convolution_param { "
+        "    num_output: 4 kernel_size: 3 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "    bias_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { name: 'relu' type: 'ReLU' bottom: 'conv' top: 'conv' } "
+        "layer { "
+        "  name: 'ip' type: 'InnerProduct' bottom: 'conv' top: 'ip' "
+        "  inner_product_param { "
+        "    num_output: 5 weight_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { name: 'prob' type: 'Softmax' bottom: 'ip' top: 'prob' } ";
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param_));
+    param_.mutable_state()->set_phase(TEST);
+    // Trained weights, saved to a file for the session to load.
+    reference_.reset(new Net<Dtype>(param_));
+    NetParameter weights;
+    reference_->ToProto(&weights);
+    MakeTempFilename(&weights_file_);
+    WriteProtoToBinaryFile(weights, weights_file_);
+  }
+
+  // Fill input with the data of request i.
+  void FillInput(int i, Blob<Dtype>* input) {
+    Caffe::set_random_seed(1701 + i);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(input);
+  }
+
+  NetParameter param_;
+  shared_ptr<Net<Dtype> > reference_;
+  string weights_file_;
+};
+
+TYPED_TEST_CASE(InferenceSessionTest, TestDtypesAndDevices);
+
+TYPED_TEST(InferenceSessionTest, TestSharesWeights) {
+  typedef typename TypeParam::Dtype Dtype;
+  InferenceSession<Dtype> session(this->param_, this->weights_file_);
+  shared_ptr<typename InferenceSession<Dtype>::Context> first =
+      session.CreateContext();
+  shared_ptr<typename InferenceSession<Dtype>::Context> second =
+      session.CreateContext();
+  const vector<shared_ptr<Blob<Dtype> > >& weights =
+      session.weights().params();
+  ASSERT_EQ(4, weights.size());
+  for (int i = 0; i < weights.size(); ++i) {
+    EXPECT_EQ(weights[i]->data(), first->net().params()[i]->data());
+    EXPECT_EQ(weights[i]->data(), second->net().params()[i]->data());
+  }
+  // The activations are the contexts' own.
+  EXPECT_NE(first->input_blobs()[0]->cpu_data(),
+            second->input_blobs()[0]->cpu_data());
+  EXPECT_NE(first->output_blobs()[0]->cpu_data(),
+            second->output_blobs()[0]->cpu_data());
+
+  // Both match the net the weights came from.
+  this->FillInput(0, this->reference_->input_blobs()[0]);
+  const Blob<Dtype>& expected = *this->reference_->Forward()[0];
+  this->FillInput(0, first->input_blobs()[0]);
+  const Blob<Dtype>& output = *first->Forward()[0];
+  ASSERT_EQ(expected.count(), output.count());
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_EQ(expected.cpu_data()[i], output.cpu_data()[i]);
+  }
+  this->FillInput(0, second->input_blobs()[0]);
+  const Blob<Dtype>& second_output = *second->Forward()[0];
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_EQ(expected.cpu_data()[i], second_output.cpu_data()[i]);
+  }
+}
+
+// Run a context over its requests, keeping the outputs.
+template <typename Dtype>
+static void ServeRequests(typename InferenceSession<Dtype>::Context* context,
+    const vector<Blob<Dtype>*>* inputs, vector<vector<Dtype> >* outputs) {
+  for (int i = 0; i < inputs->size(); ++i) {
+    context->input_blobs()[0]->CopyFrom(*(*inputs)[i]);
+    const Blob<Dtype>& output = *context->Forward()[0];
+    (*outputs)[i].assign(output.cpu_data(),
+        output.cpu_data() + output.count());
+  }
+}
+
+TYPED_TEST(InferenceSessionTest, TestConcurrentForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  const int num_threads = 4;
+  const int num_requests = 8;
+  InferenceSession<Dtype> session(this->param_, this->weights_file_);
+  vector<shared_ptr<typename InferenceSession<Dtype>::Context> > contexts;
+  vector<vector<Blob<Dtype>*> > inputs(num_threads);
+  vector<vector<vector<Dtype> > > outputs(num_threads,
+      vector<vector<Dtype> >(num_requests));
+  for (int t = 0; t < num_threads; ++t) {
+    contexts.push_back(session.CreateContext());
+    for (int i = 0; i < num_requests; ++i) {
+      inputs[t].push_back(new Blob<Dtype>(
+          this->reference_->input_blobs()[0]->shape()));
+      this->FillInput(t * num_requests + i, inputs[t].back());
+    }
+  }
+  vector<shared_ptr<boost::thread> > threads;
+  for (int t = 0; t < num_threads; ++t) {
+    threads.push_back(shared_ptr<boost::thread>(new boost::thread(
+        &ServeRequests<Dtype>, contexts[t].get(), &inputs[t], &outputs[t])));
+  }
+  for (int t = 0; t < num_threads; ++t) {
+    threads[t]->join();
+  }
+  for (int t = 0; t < num_threads; ++t) {
+    for (int i = 0; i < num_requests; ++i) {
+      this->reference_->input_blobs()[0]->CopyFrom(*inputs[t][i]);
+      const Blob<Dtype>& expected = *this->reference_->Forward()[0];
+      ASSERT_EQ(expected.count(), outputs[t][i].size());
+      for (int j = 0; j < expected.count(); ++j) {
+        EXPECT_EQ(expected.cpu_data()[j], outputs[t][i][j]);
+      }
+      delete inputs[t][i];
+    }
+  }
+}
+
+}  // namespace caffe
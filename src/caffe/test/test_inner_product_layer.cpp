@@ -292,6 +292,31 @@ TYPED_TEST(InnerProductLayerTest, TestGradientTranspose) {
   }
 }
 
+TYPED_TEST(InnerProductLayerTest, TestGradientFusedReLU) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_vec_.push_back(this->blob_bottom_);
+  bool IS_VALID_CUDA = false;
+#ifndef CPU_ONLY
+  IS_VALID_CUDA = CAFFE_TEST_CUDA_PROP.major >= 2;
+#endif
+  if (Caffe::mode() == Caffe::CPU ||
+      sizeof(Dtype) == 4 || IS_VALID_CUDA) {
+    LayerParameter layer_param;
+    InnerProductParameter* inner_product_param =
+        layer_param.mutable_inner_product_param();
+    inner_product_param->set_num_output(10);
+    inner_product_param->mutable_fused_relu()->set_negative_slope(0.01);
+    inner_product_param->mutable_weight_filler()->set_type("gaussian");
+    inner_product_param->mutable_bias_filler()->set_type("gaussian");
+    InnerProductLayer<Dtype> layer(layer_param);
+    GradientChecker<Dtype> checker(1e-2, 1e-3, 1701, 0., 0.01);
+    checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+        this->blob_top_vec_);
+  } else {
+    LOG(ERROR) << "Skipping test due to old architecture.";
+  }
+}
+
 TYPED_TEST(InnerProductLayerTest, TestBackwardTranspose) {
   typedef typename TypeParam::Dtype Dtype;
   this->blob_bottom_vec_.push_back(this->blob_bottom_);
@@ -388,4 +413,97 @@ TYPED_TEST(InnerProductLayerTest, TestBackwardTranspose) {
   }
 }
 
+// The int8 path is CPU only; Forward_gpu computes in floating point.
+template <typename Dtype>
+class CPUInnerProductLayerTest
+  : public InnerProductLayerTest<CPUDevice<Dtype> > {
+};
+
+TYPED_TEST_CASE(CPUInnerProductLayerTest, TestDtypes);
+
+TYPED_TEST(CPUInnerProductLayerTest, TestForwardInt8) {
+  typedef TypeParam Dtype;
+  // The rounding error bound below is statistical; fix the data so the test
+  // is repeatable.
+  Caffe::set_random_seed(1701);
+  FillerParameter filler_param;
+  UniformFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  this->blob_bottom_vec_.push_back(this->blob_bottom_);
+  for (int transpose = 0; transpose < 2; ++transpose) {
+    LayerParameter layer_param;
+    layer_param.set_phase(TEST);
+    InnerProductParameter* inner_product_param =
+        layer_param.mutable_inner_product_param();
+    inner_product_param->set_num_output(10);
+    inner_product_param->set_transpose(transpose);
+    inner_product_param->mutable_weight_filler()->set_type("gaussian");
+    inner_product_param->mutable_bias_filler()->set_type("gaussian");
+    InnerProductLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    Blob<Dtype> expected_top;
+    expected_top.CopyFrom(*this->blob_top_, false, true);
+
+    // The bottom is uniform in [0, 1].
+    layer_param.mutable_quantization_param()->set_input_max(1);
+    InnerProductLayer<Dtype> int8_layer(layer_param);
+    int8_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int i = 0; i < 2; ++i) {
+      int8_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+    }
+    int8_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    // Rounding 60 inputs and weights to 8 bits changes the outputs by about
+    // sqrt(60) * 1% of |weight_max|.
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(expected_top.cpu_data()[i], this->blob_top_->cpu_data()[i],
+          0.1);
+    }
+  }
+}
+
+TYPED_TEST(CPUInnerProductLayerTest, TestForwardInt8FollowsWeights) {
+  typedef TypeParam Dtype;
+  Caffe::set_random_seed(1701);
+  FillerParameter filler_param;
+  UniformFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  this->blob_bottom_vec_.push_back(this->blob_bottom_);
+  LayerParameter layer_param;
+  layer_param.set_phase(TEST);
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("gaussian");
+  InnerProductLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer_param.mutable_quantization_param()->set_input_max(1);
+  InnerProductLayer<Dtype> int8_layer(layer_param);
+  int8_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  int8_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Copy new weights into the same buffer after the weights were quantized,
+  // as loading trained weights does, then scale them in place, as an update
+  // of a training net sharing them does.
+  for (int update = 0; update < 2; ++update) {
+    if (update == 0) {
+      for (int i = 0; i < 2; ++i) {
+        int8_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+      }
+    } else {
+      layer.blobs()[0]->scale_data(-2);
+      caffe_scal(int8_layer.blobs()[0]->count(), Dtype(-2),
+          int8_layer.blobs()[0]->mutable_cpu_data());
+    }
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    Blob<Dtype> expected_top;
+    expected_top.CopyFrom(*this->blob_top_, false, true);
+    int8_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(expected_top.cpu_data()[i], this->blob_top_->cpu_data()[i],
+          0.2) << "after update " << update;
+    }
+  }
+}
+
 }  // namespace caffe
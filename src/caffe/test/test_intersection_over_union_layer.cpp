@@ -0,0 +1,191 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/intersection_over_union_layer.hpp"
+#include "caffe/util/rng.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class IntersectionOverUnionLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  IntersectionOverUnionLayerTest()
+      : blob_bottom_data_(new Blob<Dtype>(2, kNumLabels, 90, 95)),
+        blob_bottom_label_(new Blob<Dtype>(2, 1, 90, 95)),
+        blob_top_(new Blob<Dtype>()),
+        blob_top_per_class_(new Blob<Dtype>()) {
+    FillBottoms();
+    blob_bottom_vec_.push_back(blob_bottom_data_);
+    blob_bottom_vec_.push_back(blob_bottom_label_);
+    blob_top_vec_.push_back(blob_top_);
+    blob_top_vec_.push_back(blob_top_per_class_);
+  }
+  virtual ~IntersectionOverUnionLayerTest() {
+    delete blob_bottom_data_;
+    delete blob_bottom_label_;
+    delete blob_top_;
+    delete blob_top_per_class_;
+  }
+
+  void FillBottoms() {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_data_);
+    shared_ptr<Caffe::RNG> rng(new Caffe::RNG(caffe_rng_rand()));
+    caffe::rng_t* label_rng = static_cast<caffe::rng_t*>(rng->generator());
+    Dtype* label_data = blob_bottom_label_->mutable_cpu_data();
+    for (int i = 0; i < blob_bottom_label_->count(); ++i) {
+      label_data[i] = (*label_rng)() % kNumLabels;
+    }
+  }
+
+  // Add the counts of each image of the bottoms to counts, 3 x kNumLabels
+  // per image: ground truth, predictions, both.
+  void CountPixels(int ignore_label, vector<vector<int> >* counts) {
+    const int num = blob_bottom_data_->num();
+    const int spatial = blob_bottom_data_->count(2);
+    counts->resize(num, vector<int>(3 * kNumLabels, 0));
+    for (int n = 0; n < num; ++n) {
+      for (int s = 0; s < spatial; ++s) {
+        const int label = static_cast<int>(
+            blob_bottom_label_->cpu_data()[n * spatial + s]);
+        if (label == ignore_label) { continue; }
+        int max_id = 0;
+        for (int k = 1; k < kNumLabels; ++k) {
+          if (blob_bottom_data_->data_at(n, k, s / 95, s % 95) >
+              blob_bottom_data_->data_at(n, max_id, s / 95, s % 95)) {
+            max_id = k;
+          }
+        }
+        ++(*counts)[n][label];
+        ++(*counts)[n][kNumLabels + max_id];
+        (*counts)[n][2 * kNumLabels + label] += (label == max_id);
+      }
+    }
+  }
+
+  // The IoU of class j from counts, or -1 if it does not occur.
+  static double ClassIoU(const vector<int>& counts, int j) {
+    const int union_count = counts[j] + counts[kNumLabels + j] -
+        counts[2 * kNumLabels + j];
+    return union_count == 0 ? -1 :
+        static_cast<double>(counts[2 * kNumLabels + j]) / union_count;
+  }
+
+  static const int kNumLabels = 5;
+  Blob<Dtype>* const blob_bottom_data_;
+  Blob<Dtype>* const blob_bottom_label_;
+  Blob<Dtype>* const blob_top_;
+  Blob<Dtype>* const blob_top_per_class_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(IntersectionOverUnionLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(IntersectionOverUnionLayerTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  const int kNumLabels = this->kNumLabels;
+  LayerParameter layer_param;
+  IntersectionOverUnionLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+
+  vector<vector<int> > counts;
+  this->CountPixels(-1, &counts);
+  double mean_iou = 0;
+  vector<double> class_iou(kNumLabels, 0);
+  vector<int> class_images(kNumLabels, 0);
+  for (int n = 0; n < counts.size(); ++n) {
+    double image_iou = 0;
+    int num_classes = 0;
+    for (int j = 0; j < kNumLabels; ++j) {
+      const double iou = this->ClassIoU(counts[n], j);
+      if (iou < 0) { continue; }
+      image_iou += iou;
+      ++num_classes;
+      class_iou[j] += iou;
+      ++class_images[j];
+    }
+    mean_iou += image_iou / num_classes;
+  }
+  EXPECT_NEAR(mean_iou / counts.size(), this->blob_top_->cpu_data()[0], 1e-4);
+  for (int j = 0; j < kNumLabels; ++j) {
+    EXPECT_NEAR(class_iou[j] / class_images[j],
+                this->blob_top_per_class_->cpu_data()[j], 1e-4);
+  }
+}
+
+TYPED_TEST(IntersectionOverUnionLayerTest, TestForwardIgnoreLabel) {
+  typedef typename TypeParam::Dtype Dtype;
+  const int kNumLabels = this->kNumLabels;
+  LayerParameter layer_param;
+  layer_param.mutable_intersectionoverunion_param()->set_ignore_label(2);
+  IntersectionOverUnionLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+
+  vector<vector<int> > counts;
+  this->CountPixels(2, &counts);
+  double mean_iou = 0;
+  for (int n = 0; n < counts.size(); ++n) {
+    double image_iou = 0;
+    int num_classes = 0;
+    for (int j = 0; j < kNumLabels; ++j) {
+      const double iou = this->ClassIoU(counts[n], j);
+      if (j == 2 || iou < 0) { continue; }
+      image_iou += iou;
+      ++num_classes;
+    }
+    mean_iou += image_iou / num_classes;
+  }
+  EXPECT_NEAR(mean_iou / counts.size(), this->blob_top_->cpu_data()[0], 1e-4);
+  EXPECT_EQ(0, this->blob_top_per_class_->cpu_data()[2]);
+}
+
+TYPED_TEST(IntersectionOverUnionLayerTest, TestForwardAccumulate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const int kNumLabels = this->kNumLabels;
+  LayerParameter layer_param;
+  layer_param.mutable_intersectionoverunion_param()->set_accumulate(true);
+  IntersectionOverUnionLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_TRUE(layer.accumulating());
+
+  // Two passes give the IoU of the pixels of both.
+  vector<vector<int> > counts;
+  for (int pass = 0; pass < 2; ++pass) {
+    if (pass == 1) {
+      layer.ResetMetric();
+      counts.clear();
+    }
+    for (int batch = 0; batch < 2; ++batch) {
+      this->FillBottoms();
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      this->CountPixels(-1, &counts);
+    }
+    vector<int> total(3 * kNumLabels, 0);
+    for (int n = 0; n < counts.size(); ++n) {
+      for (int i = 0; i < total.size(); ++i) {
+        total[i] += counts[n][i];
+      }
+    }
+    double mean_iou = 0;
+    for (int j = 0; j < kNumLabels; ++j) {
+      const double iou = this->ClassIoU(total, j);
+      mean_iou += iou;
+      EXPECT_NEAR(iou, this->blob_top_per_class_->cpu_data()[j], 1e-4);
+    }
+    EXPECT_NEAR(mean_iou / kNumLabels, this->blob_top_->cpu_data()[0], 1e-4);
+  }
+}
+
+}  // namespace caffe
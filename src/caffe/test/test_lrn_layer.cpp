@@ -250,6 +250,46 @@ TYPED_TEST(LRNLayerTest, TestGradientWithinChannel) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(LRNLayerTest, TestForwardLargeInput) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Large enough to be split across threads, and across position blocks.
+  this->blob_bottom_->Reshape(2, 12, 37, 41);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  const LRNParameter_NormRegion regions[] = {
+      LRNParameter_NormRegion_ACROSS_CHANNELS,
+      LRNParameter_NormRegion_WITHIN_CHANNEL};
+  for (int i = 0; i < 2; ++i) {
+    LayerParameter layer_param;
+    layer_param.mutable_lrn_param()->set_norm_region(regions[i]);
+    // Not 0.75, which takes square roots instead of pow.
+    layer_param.mutable_lrn_param()->set_beta(0.6);
+    LRNLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    Blob<Dtype> top_reference;
+    this->ReferenceLRNForward(*(this->blob_bottom_), layer_param,
+        &top_reference);
+    for (int j = 0; j < this->blob_bottom_->count(); ++j) {
+      ASSERT_NEAR(this->blob_top_->cpu_data()[j],
+          top_reference.cpu_data()[j], this->epsilon_);
+    }
+  }
+}
+
+TYPED_TEST(LRNLayerTest, TestGradientWithinChannelLargeRegion) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_lrn_param()->set_norm_region(
+      LRNParameter_NormRegion_WITHIN_CHANNEL);
+  layer_param.mutable_lrn_param()->set_local_size(5);
+  LRNLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
 #ifdef USE_CUDNN
 template <typename Dtype>
 class CuDNNLRNLayerTest : public GPUDeviceTest<Dtype> {
@@ -1,6 +1,8 @@
 #include <stdint.h>  // for uint32_t & uint64_t
 #include <time.h>
+#include <algorithm>
 #include <cmath>  // for std::fabs
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -119,6 +121,108 @@ TYPED_TEST(CPUMathFunctionsTest, TestCopy) {
   }
 }
 
+TYPED_TEST(CPUMathFunctionsTest, TestActivations) {
+  // The blob is long enough to be split across threads; scale it to cover the
+  // range where the activations are not yet saturated.
+  const int n = this->blob_bottom_->count();
+  TypeParam* x = this->blob_bottom_->mutable_cpu_data();
+  caffe_scal<TypeParam>(n, 10, x);
+  TypeParam* y = this->blob_top_->mutable_cpu_data();
+  caffe_cpu_exp<TypeParam>(n, x, y);
+  for (int i = 0; i < n; ++i) {
+    EXPECT_NEAR(y[i] / std::exp(x[i]), 1, 1e-6);
+  }
+  caffe_cpu_sigmoid<TypeParam>(n, x, y);
+  for (int i = 0; i < n; ++i) {
+    EXPECT_NEAR(y[i], 1 / (1 + std::exp(-x[i])), 1e-6);
+  }
+  caffe_cpu_tanh<TypeParam>(n, x, y);
+  for (int i = 0; i < n; ++i) {
+    EXPECT_NEAR(y[i], std::tanh(x[i]), 1e-6);
+  }
+  const TypeParam alpha = 0.5;
+  caffe_cpu_elu<TypeParam>(n, alpha, x, y);
+  for (int i = 0; i < n; ++i) {
+    EXPECT_NEAR(y[i], x[i] > 0 ? x[i] : alpha * (std::exp(x[i]) - 1), 1e-6);
+  }
+  // In place, on a length that leaves a partial vector at the end.
+  const int m = 13;
+  caffe_copy(m, x, y);
+  caffe_cpu_exp<TypeParam>(m, y, y);
+  for (int i = 0; i < m; ++i) {
+    EXPECT_NEAR(y[i] / std::exp(x[i]), 1, 1e-6);
+  }
+}
+
+TYPED_TEST(CPUMathFunctionsTest, TestQuantize) {
+  const int n = this->blob_bottom_->count();
+  const TypeParam* x = this->blob_bottom_->cpu_data();
+  const TypeParam scale = 50;
+  vector<int8_t> y(n);
+  caffe_cpu_quantize<TypeParam>(n, scale, x, &y[0]);
+  for (int i = 0; i < n; ++i) {
+    const TypeParam expected = std::max<TypeParam>(-127,
+        std::min<TypeParam>(127, x[i] * scale));
+    EXPECT_LE(std::fabs(y[i] - expected), 0.5);
+  }
+}
+
+TYPED_TEST(CPUMathFunctionsTest, TestGemmS8) {
+  const int M = 3, N = 600, K = 7;
+  vector<int8_t> A(M * K), B(K * N);
+  for (int i = 0; i < A.size(); ++i) {
+    A[i] = i % 5 == 0 ? 0 : static_cast<int8_t>(caffe_rng_rand() % 255 - 127);
+  }
+  for (int i = 0; i < B.size(); ++i) {
+    B[i] = static_cast<int8_t>(caffe_rng_rand() % 255 - 127);
+  }
+  vector<int32_t> C(M * N);
+  caffe_cpu_gemm_s8(M, N, K, &A[0], &B[0], &C[0]);
+  for (int m = 0; m < M; ++m) {
+    for (int n = 0; n < N; ++n) {
+      int32_t expected = 0;
+      for (int k = 0; k < K; ++k) {
+        expected += A[m * K + k] * B[k * N + n];
+      }
+      EXPECT_EQ(expected, C[m * N + n]);
+    }
+  }
+}
+
+TYPED_TEST(CPUMathFunctionsTest, TestBiasRelu) {
+  const int M = 11 * 17, N = 19 * 23;
+  const TypeParam* x = this->blob_bottom_->cpu_data();
+  const TypeParam* bias = this->blob_top_->cpu_data();
+  const TypeParam negative_slope = 0.25;
+  for (int row_bias = 0; row_bias < 2; ++row_bias) {
+    vector<TypeParam> y(x, x + M * N);
+    caffe_cpu_bias_relu<TypeParam>(M, N, bias, row_bias, true, negative_slope,
+        &y[0]);
+    for (int i = 0; i < M; ++i) {
+      for (int j = 0; j < N; ++j) {
+        const TypeParam value = x[i * N + j] + bias[row_bias ? i : j];
+        EXPECT_EQ(value > 0 ? value : value * negative_slope, y[i * N + j]);
+      }
+    }
+    // The gradient of the bias sums the gradients it was added to.
+    vector<TypeParam> bias_diff(row_bias ? M : N, 1);
+    caffe_cpu_bias_backward<TypeParam>(M, N, x, row_bias, &bias_diff[0]);
+    for (int k = 0; k < bias_diff.size(); ++k) {
+      TypeParam expected = 1;
+      for (int l = 0; l < (row_bias ? N : M); ++l) {
+        expected += row_bias ? x[k * N + l] : x[l * N + k];
+      }
+      EXPECT_NEAR(expected, bias_diff[k], 1e-4);
+    }
+  }
+  // Without a bias, only the ReLU.
+  vector<TypeParam> y(x, x + N);
+  caffe_cpu_bias_relu<TypeParam>(1, N, NULL, false, true, TypeParam(0), &y[0]);
+  for (int j = 0; j < N; ++j) {
+    EXPECT_EQ(std::max(x[j], TypeParam(0)), y[j]);
+  }
+}
+
 #ifndef CPU_ONLY
 
 template <typename Dtype>
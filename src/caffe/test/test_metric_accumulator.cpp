@@ -0,0 +1,280 @@
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/accuracy_layer.hpp"
+#include "caffe/layers/mean_layer.hpp"
+#include "caffe/metric_accumulator.hpp"
+#include "caffe/net.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class MetricAccumulatorTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  static const int kNum = 12;
+  static const int kNumLabels = 4;
+  static const int kIgnoreLabel = 3;
+
+  MetricAccumulatorTest()
+      : blob_bottom_data_(new Blob<Dtype>(kNum, kNumLabels, 1, 1)),
+        blob_bottom_label_(new Blob<Dtype>(kNum, 1, 1, 1)),
+        blob_top_(new Blob<Dtype>()),
+        blob_top_per_class_(new Blob<Dtype>()),
+        correct_(0), total_(0), class_correct_(kNumLabels, 0),
+        class_total_(kNumLabels, 0) {
+    blob_bottom_vec_.push_back(blob_bottom_data_);
+    blob_bottom_vec_.push_back(blob_bottom_label_);
+    blob_top_vec_.push_back(blob_top_);
+    blob_top_vec_.push_back(blob_top_per_class_);
+    layer_param_.mutable_accuracy_param()->set_ignore_label(kIgnoreLabel);
+  }
+  virtual ~MetricAccumulatorTest() {
+    delete blob_bottom_data_;
+    delete blob_bottom_label_;
+    delete blob_top_;
+    delete blob_top_per_class_;
+  }
+
+  // Fill the bottoms with a batch whose later batches ignore more labels, so
+  // that the accuracy of all of them is not the mean of theirs; and count its
+  // correct predictions.
+  void FillBatch(int batch) {
+    Caffe::set_random_seed(1701 + batch);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_bottom_data_);
+    const Dtype* data = blob_bottom_data_->cpu_data();
+    Dtype* label = blob_bottom_label_->mutable_cpu_data();
+    for (int n = 0; n < kNum; ++n) {
+      const int label_value =
+          n < 4 * (batch + 1) ? kIgnoreLabel : (n * 7 + batch) % 3;
+      label[n] = label_value;
+      if (label_value == kIgnoreLabel) { continue; }
+      int max_id = 0;
+      for (int k = 1; k < kNumLabels; ++k) {
+        if (data[n * kNumLabels + k] > data[n * kNumLabels + max_id]) {
+          max_id = k;
+        }
+      }
+      const int correct = (max_id == label_value);
+      correct_ += correct;
+      ++total_;
+      class_correct_[label_value] += correct;
+      ++class_total_[label_value];
+    }
+  }
+
+  // Check the outputs of an accuracy layer against the batches filled.
+  void CheckAccuracy() {
+    ASSERT_GT(total_, 0);
+    EXPECT_NEAR(static_cast<double>(correct_) / total_,
+                blob_top_->cpu_data()[0], 1e-4);
+    for (int k = 0; k < kNumLabels; ++k) {
+      const double expected = class_total_[k] == 0 ? 0 :
+          static_cast<double>(class_correct_[k]) / class_total_[k];
+      EXPECT_NEAR(expected, blob_top_per_class_->cpu_data()[k], 1e-4);
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_data_;
+  Blob<Dtype>* const blob_bottom_label_;
+  Blob<Dtype>* const blob_top_;
+  Blob<Dtype>* const blob_top_per_class_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+  LayerParameter layer_param_;
+  int correct_;
+  int total_;
+  vector<int> class_correct_;
+  vector<int> class_total_;
+};
+
+TYPED_TEST_CASE(MetricAccumulatorTest, TestDtypesAndDevices);
+
+TYPED_TEST(MetricAccumulatorTest, TestAccuracyAccumulates) {
+  typedef typename TypeParam::Dtype Dtype;
+  AccuracyLayer<Dtype> layer(this->layer_param_);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_FALSE(layer.accumulating());
+  // A batch before the reset does not count.
+  this->FillBatch(0);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  this->CheckAccuracy();
+  layer.ResetMetric();
+  EXPECT_TRUE(layer.accumulating());
+  this->correct_ = this->total_ = 0;
+  this->class_correct_.assign(this->kNumLabels, 0);
+  this->class_total_.assign(this->kNumLabels, 0);
+  for (int batch = 0; batch < 3; ++batch) {
+    this->FillBatch(batch);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    this->CheckAccuracy();
+  }
+  // Stopped, each batch counts on its own again.
+  layer.StopAccumulating();
+  this->correct_ = this->total_ = 0;
+  this->class_correct_.assign(this->kNumLabels, 0);
+  this->class_total_.assign(this->kNumLabels, 0);
+  this->FillBatch(1);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  this->CheckAccuracy();
+}
+
+TYPED_TEST(MetricAccumulatorTest, TestMergeAccuracy) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Two layers see a batch each, as two test workers would.
+  AccuracyLayer<Dtype> first(this->layer_param_);
+  AccuracyLayer<Dtype> second(this->layer_param_);
+  first.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  second.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  first.ResetMetric();
+  second.ResetMetric();
+  this->FillBatch(0);
+  first.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  this->FillBatch(1);
+  second.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  first.MergeMetricState(second.metric_state());
+  first.FinalizeMetric(this->blob_top_vec_);
+  this->CheckAccuracy();
+}
+
+TYPED_TEST(MetricAccumulatorTest, TestMeanAccumulates) {
+  typedef typename TypeParam::Dtype Dtype;
+  Blob<Dtype> measures(vector<int>(1, 3));
+  vector<Blob<Dtype>*> bottom(1, &measures);
+  vector<Blob<Dtype>*> top(1, this->blob_top_);
+  MeanLayer<Dtype> layer(this->layer_param_);
+  layer.SetUp(bottom, top);
+  layer.ResetMetric();
+  // The mean of 1, 2, 3, 4 and 5, not of the means of the batches.
+  for (int i = 0; i < 3; ++i) {
+    measures.mutable_cpu_data()[i] = i + 1;
+  }
+  layer.Forward(bottom, top);
+  EXPECT_NEAR(2, this->blob_top_->cpu_data()[0], 1e-6);
+  measures.Reshape(vector<int>(1, 2));
+  measures.mutable_cpu_data()[0] = 4;
+  measures.mutable_cpu_data()[1] = 5;
+  layer.Forward(bottom, top);
+  EXPECT_NEAR(3, this->blob_top_->cpu_data()[0], 1e-6);
+}
+
+TYPED_TEST(MetricAccumulatorTest, TestScopedAccumulation) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string proto =
+      "name: 'TestNet' "
+      "layer { "
+      "  name: 'data' type: 'Input' top: 'data' top: 'label' "
+      "  input_param { "
+      "    shape { dim: 12 dim: 4 } shape { dim: 12 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'accuracy' type: 'Accuracy' bottom: 'data' bottom: 'label' "
+      "  top: 'accuracy' top: 'class_accuracy' "
+      "  accuracy_param { ignore_label: 3 } "
+      "} "
+      "layer { "
+      "  name: 'mean_class_accuracy' type: 'Mean' bottom: 'class_accuracy' "
+      "  top: 'mean_class_accuracy' "
+      "} "
+      "layer { "
+      "  name: 'mean_label' type: 'Mean' bottom: 'label' top: 'mean_label' "
+      "} "
+      "layer { name: 'prob' type: 'Softmax' bottom: 'data' top: 'prob' } ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Net<Dtype> net(param);
+  ASSERT_EQ(4, net.output_blobs().size());
+  MetricAccumulator<Dtype>* accuracy =
+      dynamic_cast<MetricAccumulator<Dtype>*>(
+          net.layer_by_name("accuracy").get());
+  MetricAccumulator<Dtype>* mean_class_accuracy =
+      dynamic_cast<MetricAccumulator<Dtype>*>(
+          net.layer_by_name("mean_class_accuracy").get());
+  MetricAccumulator<Dtype>* mean_label =
+      dynamic_cast<MetricAccumulator<Dtype>*>(
+          net.layer_by_name("mean_label").get());
+  {
+    ScopedMetricAccumulation<Dtype> accumulation(net);
+    // The mean of the class accuracies over all the passes is computed from
+    // them, and does not accumulate itself.
+    EXPECT_TRUE(accuracy->accumulating());
+    EXPECT_FALSE(mean_class_accuracy->accumulating());
+    EXPECT_TRUE(mean_label->accumulating());
+    EXPECT_TRUE(accumulation.accumulated_output(0));
+    EXPECT_TRUE(accumulation.accumulated_output(1));
+    EXPECT_TRUE(accumulation.accumulated_output(2));
+    EXPECT_FALSE(accumulation.accumulated_output(3));
+
+    for (int batch = 0; batch < 2; ++batch) {
+      this->blob_bottom_data_->ShareData(*net.input_blobs()[0]);
+      this->blob_bottom_label_->ShareData(*net.input_blobs()[1]);
+      this->FillBatch(batch);
+      net.Forward();
+    }
+    const Blob<Dtype>& class_accuracy = *net.blob_by_name("class_accuracy");
+    Dtype mean = 0;
+    for (int k = 0; k < this->kNumLabels; ++k) {
+      mean += class_accuracy.cpu_data()[k];
+    }
+    EXPECT_NEAR(mean / this->kNumLabels,
+        net.blob_by_name("mean_class_accuracy")->cpu_data()[0], 1e-4);
+    EXPECT_NEAR(static_cast<double>(this->correct_) / this->total_,
+        net.blob_by_name("accuracy")->cpu_data()[0], 1e-4);
+  }
+  EXPECT_FALSE(accuracy->accumulating());
+  EXPECT_FALSE(mean_label->accumulating());
+}
+
+TYPED_TEST(MetricAccumulatorTest, TestScopedAccumulationOfIoU) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string proto =
+      "name: 'TestNet' "
+      "layer { "
+      "  name: 'data' type: 'Input' top: 'data' top: 'label' "
+      "  input_param { "
+      "    shape { dim: 2 dim: 3 dim: 2 dim: 2 } "
+      "    shape { dim: 2 dim: 2 dim: 2 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'iou' type: 'IntersectionOverUnion' bottom: 'data' "
+      "  bottom: 'label' top: 'iou' "
+      "} "
+      "layer { "
+      "  name: 'dataset_iou' type: 'IntersectionOverUnion' bottom: 'data' "
+      "  bottom: 'label' top: 'dataset_iou' "
+      "  intersectionoverunion_param { accumulate: true } "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Net<Dtype> net(param);
+  MetricAccumulator<Dtype>* iou =
+      dynamic_cast<MetricAccumulator<Dtype>*>(net.layer_by_name("iou").get());
+  MetricAccumulator<Dtype>* dataset_iou =
+      dynamic_cast<MetricAccumulator<Dtype>*>(
+          net.layer_by_name("dataset_iou").get());
+  {
+    // By default, tests report the mean of the per-image IoU of the passes.
+    ScopedMetricAccumulation<Dtype> accumulation(net);
+    EXPECT_FALSE(iou->accumulating());
+    EXPECT_TRUE(dataset_iou->accumulating());
+    // The outputs are in the order of their names.
+    EXPECT_TRUE(accumulation.accumulated_output(0));
+    EXPECT_FALSE(accumulation.accumulated_output(1));
+  }
+  EXPECT_TRUE(dataset_iou->accumulating());
+}
+
+}  // namespace caffe
@@ -564,8 +564,8 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoString(proto);
   }
 
-  virtual void InitReshapableNet() {
-    const string& proto =
+  virtual void InitReshapableNet(const string& shape_buckets = "") {
+    const string& proto = shape_buckets +
         "name: 'ReshapableNetwork' "
         "layer { "
         "  name: 'data' "
@@ -839,6 +839,75 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoFileWithState(proto, phase, level, stages);
   }
 
+  virtual void InitMemoryOptimizableNet(const bool optimize_memory,
+      const string& preserve_blob = "") {
+    ostringstream proto;
+    proto <<
+        "name: 'MemoryOptimizableNetwork' "
+        "state { phase: TEST } "
+        "optimize_memory: " << (optimize_memory ? "true " : "false ");
+    if (!preserve_blob.empty()) {
+      proto << "preserve_blob: '" << preserve_blob << "' ";
+    }
+    proto <<
+        "layer { "
+        "  name: 'data' "
+        "  type: 'Input' "
+        "  top: 'data' "
+        "  input_param { shape { dim: 2 dim: 6 } } "
+        "} ";
+    const char* ip_layers[][3] = {
+      {"ip1", "data", "8"}, {"ip2", "ip1", "5"}, {"ip3", "ip2", "5"}};
+    for (int i = 0; i < 3; ++i) {
+      proto <<
+          "layer { "
+          "  name: '" << ip_layers[i][0] << "' "
+          "  type: 'InnerProduct' "
+          "  bottom: '" << ip_layers[i][1] << "' "
+          "  top: '" << ip_layers[i][0] << "' "
+          "  inner_product_param { "
+          "    num_output: " << ip_layers[i][2] << " "
+          "    weight_filler { type: 'gaussian' std: 0.5 } "
+          "    bias_filler { type: 'gaussian' std: 0.5 } "
+          "  } "
+          "} ";
+      if (i == 0) {
+        proto <<
+            "layer { "
+            "  name: 'relu1' "
+            "  type: 'ReLU' "
+            "  bottom: 'ip1' "
+            "  top: 'ip1' "
+            "} ";
+      }
+    }
+    // ip2 feeds two layers, so it gets split.
+    proto <<
+        "layer { "
+        "  name: 'sum' "
+        "  type: 'Eltwise' "
+        "  bottom: 'ip3' "
+        "  bottom: 'ip2' "
+        "  top: 'sum' "
+        "} "
+        "layer { "
+        "  name: 'out' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'sum' "
+        "  top: 'out' "
+        "  inner_product_param { "
+        "    num_output: 3 "
+        "    weight_filler { type: 'gaussian' std: 0.5 } "
+        "  } "
+        "} ";
+    Caffe::set_random_seed(this->seed_);
+    InitNetFromProtoString(proto.str());
+    FillerParameter filler_param;
+    filler_param.set_std(1);
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->net_->input_blobs()[0]);
+  }
+
   int seed_;
   shared_ptr<Net<Dtype> > net_;
 };
@@ -2446,6 +2515,60 @@ TYPED_TEST(NetTest, TestReshape) {
   EXPECT_FALSE(same_spatial_shape);
 }
 
+TYPED_TEST(NetTest, TestReshapeShapeBuckets) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  // The net is declared with a 1 x 3 x 100 x 100 input; blob3 is larger.
+  Blob<Dtype> blob1(2, 3, 12, 10);
+  Blob<Dtype> blob2(4, 3, 9, 11);
+  Blob<Dtype> blob3(1, 3, 110, 110);
+  filler.Fill(&blob1);
+  filler.Fill(&blob2);
+  filler.Fill(&blob3);
+  this->InitReshapableNet();
+  shared_ptr<Net<Dtype> > reference = this->net_;
+  this->InitReshapableNet(
+      "shape_bucket { input_shape { dim: 2 dim: 3 dim: 12 dim: 10 } } "
+      "shape_bucket { input_shape { dim: 4 dim: 3 dim: 9 dim: 11 } } "
+      "shape_bucket { input_shape { dim: 1 dim: 3 dim: 110 dim: 110 } } ");
+  Net<Dtype>& net = *this->net_;
+  net.ShareTrainedLayersWith(reference.get());
+  EXPECT_TRUE(net.has_shape_buckets());
+  EXPECT_FALSE(reference->has_shape_buckets());
+
+  // Switching between the buckets gives the reference outputs without
+  // reallocating any blob, and a repeated shape skips every layer's Reshape.
+  vector<const Dtype*> blob_data;
+  Blob<Dtype>* inputs[] = {&blob1, &blob2, &blob2, &blob3, &blob1};
+  for (int i = 0; i < 5; ++i) {
+    reference->input_blobs()[0]->CopyFrom(*inputs[i], false, true);
+    const Blob<Dtype>& expected = *reference->Forward()[0];
+    const int skipped_before = net.reshapes_skipped();
+    net.input_blobs()[0]->CopyFrom(*inputs[i], false, true);
+    const Blob<Dtype>& output = *net.Forward()[0];
+    if (i == 2) {
+      EXPECT_EQ(net.layers().size(), net.reshapes_skipped() - skipped_before);
+    }
+    ASSERT_EQ(expected.shape(), output.shape());
+    for (int j = 0; j < output.count(); ++j) {
+      EXPECT_NEAR(expected.cpu_data()[j], output.cpu_data()[j], 1e-5);
+    }
+    for (int b = 0; b < net.blobs().size(); ++b) {
+      if (i == 0) {
+        blob_data.push_back(net.blobs()[b]->cpu_data());
+      } else {
+        EXPECT_EQ(blob_data[b], net.blobs()[b]->cpu_data());
+      }
+    }
+  }
+  // Only blob3 grows the blobs past the declared shape; each of the five
+  // would have been reallocated.
+  EXPECT_EQ(5, net.reallocations_avoided());
+}
+
 TYPED_TEST(NetTest, TestSkipPropagateDown) {
   // check bottom_need_backward if propagate_down is true
   this->InitSkipPropNet(false);
@@ -2601,4 +2724,190 @@ TYPED_TEST(NetTest, TestAllInOneNetDeploy) {
   ASSERT_TRUE(found_data);
 }
 
+TYPED_TEST(NetTest, TestOptimizeMemory) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitMemoryOptimizableNet(false);
+  this->net_->Forward();
+  Blob<Dtype> expected_out;
+  expected_out.CopyFrom(*this->net_->blob_by_name("out"), false, true);
+
+  this->InitMemoryOptimizableNet(true);
+  const Net<Dtype>& net = *this->net_;
+  // ip1 is dead once ip2 is computed, so ip3 can reuse its storage, while
+  // ip2 must survive until 'sum'. The net input and output keep their own.
+  EXPECT_EQ(net.blob_by_name("ip1")->data(), net.blob_by_name("ip3")->data());
+  EXPECT_NE(net.blob_by_name("ip1")->data(), net.blob_by_name("ip2")->data());
+  EXPECT_NE(net.blob_by_name("ip3")->data(), net.blob_by_name("ip2")->data());
+  EXPECT_NE(net.blob_by_name("sum")->data(), net.blob_by_name("ip2")->data());
+  EXPECT_NE(net.blob_by_name("sum")->data(), net.blob_by_name("ip3")->data());
+  for (int i = 0; i < net.blobs().size(); ++i) {
+    if (net.blob_names()[i] != "data" && net.blob_names()[i] != "out") {
+      EXPECT_NE(net.blobs()[i]->data(), net.blob_by_name("data")->data());
+      EXPECT_NE(net.blobs()[i]->data(), net.blob_by_name("out")->data());
+    }
+  }
+  for (int iter = 0; iter < 2; ++iter) {
+    this->net_->Forward();
+    const Blob<Dtype>& out = *net.blob_by_name("out");
+    ASSERT_EQ(expected_out.count(), out.count());
+    for (int i = 0; i < out.count(); ++i) {
+      EXPECT_NEAR(expected_out.cpu_data()[i], out.cpu_data()[i], 1e-4);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestOptimizeMemoryPreserveBlob) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitMemoryOptimizableNet(false);
+  this->net_->Forward();
+  Blob<Dtype> expected_ip1;
+  expected_ip1.CopyFrom(*this->net_->blob_by_name("ip1"), false, true);
+
+  this->InitMemoryOptimizableNet(true, "ip1");
+  this->net_->Forward();
+  const Blob<Dtype>& ip1 = *this->net_->blob_by_name("ip1");
+  for (int i = 0; i < this->net_->blobs().size(); ++i) {
+    if (this->net_->blob_names()[i] != "ip1") {
+      EXPECT_NE(this->net_->blobs()[i]->data(), ip1.data());
+    }
+  }
+  for (int i = 0; i < ip1.count(); ++i) {
+    EXPECT_NEAR(expected_ip1.cpu_data()[i], ip1.cpu_data()[i], 1e-4);
+  }
+}
+
+TYPED_TEST(NetTest, TestOptimizeMemoryIgnoredForTrain) {
+  const string proto =
+      "name: 'TinyTrainNet' "
+      "optimize_memory: true "
+      "state { phase: TRAIN } "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'DummyData' "
+      "  dummy_data_param { shape { dim: 5 dim: 2 } } "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'ip1' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { num_output: 3 } "
+      "  bottom: 'data' "
+      "  top: 'ip1' "
+      "} "
+      "layer { "
+      "  name: 'ip2' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { num_output: 3 } "
+      "  bottom: 'ip1' "
+      "  top: 'ip2' "
+      "} "
+      "layer { "
+      "  name: 'ip3' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { num_output: 3 } "
+      "  bottom: 'ip2' "
+      "  top: 'ip3' "
+      "} "
+      "layer { "
+      "  name: 'ip4' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { num_output: 3 } "
+      "  bottom: 'ip3' "
+      "  top: 'ip4' "
+      "} ";
+  this->InitNetFromProtoString(proto);
+  EXPECT_NE(this->net_->blob_by_name("ip1")->data(),
+            this->net_->blob_by_name("ip3")->data());
+}
+
+TYPED_TEST(NetTest, TestContiguousParams) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string proto =
+      "name: 'ContiguousParamsNet' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'DummyData' "
+      "  dummy_data_param { "
+      "    shape { dim: 4 dim: 5 } "
+      "    shape { dim: 4 dim: 5 } "
+      "    data_filler { type: 'gaussian' } "
+      "  } "
+      "  top: 'data' "
+      "  top: 'target' "
+      "} "
+      "layer { "
+      "  name: 'ip1' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 5 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'gaussian' } "
+      "  } "
+      "  param { name: 'sharedweights' } "
+      "  bottom: 'data' "
+      "  top: 'ip1' "
+      "} "
+      "layer { "
+      "  name: 'ip2' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 5 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'gaussian' } "
+      "  } "
+      "  param { name: 'sharedweights' } "
+      "  bottom: 'ip1' "
+      "  top: 'ip2' "
+      "} "
+      "layer { "
+      "  name: 'loss' "
+      "  type: 'EuclideanLoss' "
+      "  bottom: 'ip2' "
+      "  bottom: 'target' "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Caffe::set_random_seed(this->seed_);
+  Net<Dtype> net(param);
+  EXPECT_FALSE(net.contiguous_params());
+  net.ClearParamDiffs();
+  net.ForwardBackward();
+  net.Update();
+
+  param.set_contiguous_params(true);
+  Caffe::set_random_seed(this->seed_);
+  Net<Dtype> contiguous_net(param);
+  ASSERT_TRUE(contiguous_net.contiguous_params());
+  // The shared weights and the two biases.
+  EXPECT_EQ(5 * 5 + 5 + 5, contiguous_net.params_count());
+  const vector<Blob<Dtype>*>& params = contiguous_net.learnable_params();
+  ASSERT_EQ(3, params.size());
+  const Dtype* data = contiguous_net.mutable_cpu_params_data();
+  const Dtype* diff = contiguous_net.mutable_cpu_params_diff();
+  int offset = 0;
+  for (int i = 0; i < params.size(); ++i) {
+    EXPECT_EQ(data + offset, params[i]->cpu_data());
+    EXPECT_EQ(diff + offset, params[i]->cpu_diff());
+    offset += params[i]->count();
+  }
+  // The sharer is a view of its owner's slice.
+  EXPECT_EQ(data, contiguous_net.layer_by_name("ip2")->blobs()[0]->cpu_data());
+  EXPECT_EQ(diff, contiguous_net.layer_by_name("ip2")->blobs()[0]->cpu_diff());
+
+  contiguous_net.ClearParamDiffs();
+  diff = contiguous_net.mutable_cpu_params_diff();
+  for (int i = 0; i < contiguous_net.params_count(); ++i) {
+    EXPECT_EQ(0, diff[i]);
+  }
+  contiguous_net.ForwardBackward();
+  contiguous_net.Update();
+  for (int i = 0; i < params.size(); ++i) {
+    const Blob<Dtype>& expected = *net.learnable_params()[i];
+    for (int j = 0; j < expected.count(); ++j) {
+      EXPECT_EQ(expected.cpu_diff()[j], params[i]->cpu_diff()[j]);
+      EXPECT_EQ(expected.cpu_data()[j], params[i]->cpu_data()[j]);
+    }
+  }
+}
+
 }  // namespace caffe
@@ -0,0 +1,138 @@
+#include <fstream>  // NOLINT(readability/streams)
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/sgd_solvers.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/net_profiler.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class NetProfilerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  NetProfilerTest()
+      : net_proto_(
+          "name: 'ProfiledNet' "
+          "layer { "
+          "  name: 'data' type: 'DummyData' top: 'data' top: 'target' "
+          "  dummy_data_param { "
+          "    shape { dim: 5 dim: 2 dim: 3 dim: 4 } "
+          "    shape { dim: 5 dim: 3 } "
+          "    data_filler { type: 'gaussian' } "
+          "  } "
+          "} "
+          "layer { "
+          "  name: 'ip' type: 'InnerProduct' bottom: 'data' top: 'ip' "
+          "  inner_product_param { "
+          "    num_output: 3 weight_filler { type: 'gaussian' std: 0.1 } "
+          "  } "
+          "} "
+          "layer { "
+          "  name: 'loss' type: 'EuclideanLoss' bottom: 'ip' "
+          "  bottom: 'target' top: 'loss' "
+          "} ") {}
+
+  string ReadFile(const string& filename) {
+    std::ifstream in(filename.c_str());
+    std::stringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+  }
+
+  // Number of complete ("X") events in a Chrome trace.
+  int CountTraceEvents(const string& trace) {
+    int count = 0;
+    for (size_t pos = trace.find("\"ph\": \"X\""); pos != string::npos;
+         pos = trace.find("\"ph\": \"X\"", pos + 1)) {
+      ++count;
+    }
+    return count;
+  }
+
+  const string net_proto_;
+};
+
+TYPED_TEST_CASE(NetProfilerTest, TestDtypesAndDevices);
+
+TYPED_TEST(NetProfilerTest, TestProfileNet) {
+  typedef typename TypeParam::Dtype Dtype;
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(this->net_proto_,
+      &param));
+  Net<Dtype> net(param);
+  EXPECT_TRUE(net.profiler() == NULL);
+  NetProfiler<Dtype>* profiler = net.EnableProfiling();
+  EXPECT_EQ(profiler, net.EnableProfiling());
+  EXPECT_EQ(profiler, net.profiler());
+  for (int i = 0; i < 2; ++i) {
+    net.ForwardBackward();
+  }
+  const vector<typename NetProfiler<Dtype>::LayerStats>& stats =
+      profiler->layer_stats();
+  ASSERT_EQ(3, stats.size());
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(2, stats[i].forward_calls);
+  }
+  // The data layer needs no backward.
+  EXPECT_EQ(0, stats[0].backward_calls);
+  EXPECT_EQ(2, stats[1].backward_calls);
+  EXPECT_EQ(2, stats[2].backward_calls);
+
+  // 5 outputs of 3 dot products of length 24.
+  EXPECT_EQ(2 * 5 * 3 * 24, profiler->ForwardFlops(1));
+  // Weights and bias, with their diffs.
+  EXPECT_EQ(2 * (3 * 24 + 3) * sizeof(Dtype), profiler->ParamBytes(1));
+  EXPECT_EQ(2 * 5 * 3 * sizeof(Dtype), profiler->TopBytes(1));
+  const string summary = profiler->Summary();
+  EXPECT_NE(string::npos, summary.find("InnerProduct"));
+  EXPECT_NE(string::npos, summary.find("EuclideanLoss"));
+
+  string trace_filename;
+  MakeTempFilename(&trace_filename);
+  profiler->WriteChromeTrace(trace_filename);
+  string trace = this->ReadFile(trace_filename);
+  EXPECT_NE(string::npos, trace.find("\"name\": \"ip\""));
+  EXPECT_EQ(2 * 3 + 2 * 2, this->CountTraceEvents(trace));
+
+  profiler->Reset();
+  EXPECT_EQ(0, profiler->layer_stats()[1].forward_calls);
+  profiler->WriteChromeTrace(trace_filename);
+  EXPECT_EQ(0, this->CountTraceEvents(this->ReadFile(trace_filename)));
+}
+
+TYPED_TEST(NetProfilerTest, TestSolverProfileInterval) {
+  typedef typename TypeParam::Dtype Dtype;
+  SolverParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      "base_lr: 0.01 lr_policy: 'fixed' profile_interval: 2 "
+      "snapshot_after_train: false", &param));
+  CHECK(google::protobuf::TextFormat::ParseFromString(this->net_proto_,
+      param.mutable_net_param()));
+  param.set_solver_mode(Caffe::mode() == Caffe::CPU ?
+      SolverParameter_SolverMode_CPU : SolverParameter_SolverMode_GPU);
+  string snapshot_dir;
+  MakeTempDir(&snapshot_dir);
+  param.set_snapshot_prefix(snapshot_dir + "/profiled");
+  SGDSolver<Dtype> solver(param);
+  solver.Step(3);
+  // The report after the second iteration reset the statistics.
+  NetProfiler<Dtype>* profiler = solver.net()->profiler();
+  ASSERT_TRUE(profiler != NULL);
+  EXPECT_EQ(1, profiler->layer_stats()[1].forward_calls);
+  const string trace =
+      this->ReadFile(snapshot_dir + "/profiled_iter_2.trace.json");
+  EXPECT_EQ(2 * (3 + 2), this->CountTraceEvents(trace));
+}
+
+}  // namespace caffe
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cfloat>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -6,6 +8,7 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/layers/pooling_layer.hpp"
+#include "caffe/util/math_functions.hpp"
 
 #ifdef USE_CUDNN
 #include "caffe/layers/cudnn_pooling_layer.hpp"
@@ -369,6 +372,47 @@ class PoolingLayerTest : public MultiDeviceTest<TypeParam> {
       }
     }
   }
+  // Pools blob_bottom_ one output at a time, as a reference for the plane
+  // parallel and vectorized CPU loops.
+  void ReferencePool(PoolingParameter_PoolMethod pool, int kernel_h,
+      int kernel_w, int stride, int pad, vector<Dtype>* top) {
+    const Blob<Dtype>& bottom = *blob_bottom_;
+    const int height = bottom.height();
+    const int width = bottom.width();
+    const int pooled_height = blob_top_->height();
+    const int pooled_width = blob_top_->width();
+    top->clear();
+    for (int n = 0; n < bottom.num(); ++n) {
+      for (int c = 0; c < bottom.channels(); ++c) {
+        for (int ph = 0; ph < pooled_height; ++ph) {
+          for (int pw = 0; pw < pooled_width; ++pw) {
+            int hstart = ph * stride - pad;
+            int wstart = pw * stride - pad;
+            int hend = std::min(hstart + kernel_h, height + pad);
+            int wend = std::min(wstart + kernel_w, width + pad);
+            const int pool_size = (hend - hstart) * (wend - wstart);
+            hstart = std::max(hstart, 0);
+            wstart = std::max(wstart, 0);
+            hend = std::min(hend, height);
+            wend = std::min(wend, width);
+            Dtype value =
+                pool == PoolingParameter_PoolMethod_MAX ? -FLT_MAX : 0;
+            for (int h = hstart; h < hend; ++h) {
+              for (int w = wstart; w < wend; ++w) {
+                if (pool == PoolingParameter_PoolMethod_MAX) {
+                  value = std::max(value, bottom.data_at(n, c, h, w));
+                } else {
+                  value += bottom.data_at(n, c, h, w);
+                }
+              }
+            }
+            top->push_back(pool == PoolingParameter_PoolMethod_MAX ?
+                value : value / pool_size);
+          }
+        }
+      }
+    }
+  }
 };
 
 TYPED_TEST_CASE(PoolingLayerTest, TestDtypesAndDevices);
@@ -609,6 +653,102 @@ TYPED_TEST(PoolingLayerTest, TestGradientAvePadded) {
   }
 }
 
+TYPED_TEST(PoolingLayerTest, TestForwardStride2) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Large enough for the planes to be pooled in parallel.
+  this->blob_bottom_->Reshape(4, 16, 33, 35);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  const PoolingParameter_PoolMethod pools[] = {
+      PoolingParameter_PoolMethod_MAX, PoolingParameter_PoolMethod_AVE};
+  vector<Dtype> expected;
+  for (int i = 0; i < 2; ++i) {
+    for (int kernel = 2; kernel <= 3; ++kernel) {
+      for (int pad = 0; pad <= 1; ++pad) {
+        // The TEST phase pools without a mask.
+        for (int test = 0; test <= 1; ++test) {
+          LayerParameter layer_param;
+          layer_param.set_phase(test ? TEST : TRAIN);
+          PoolingParameter* pooling_param =
+              layer_param.mutable_pooling_param();
+          pooling_param->set_kernel_size(kernel);
+          pooling_param->set_stride(2);
+          pooling_param->set_pad(pad);
+          pooling_param->set_pool(pools[i]);
+          PoolingLayer<Dtype> layer(layer_param);
+          layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+          layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+          this->ReferencePool(pools[i], kernel, kernel, 2, pad, &expected);
+          ASSERT_EQ(expected.size(), this->blob_top_->count());
+          for (int j = 0; j < expected.size(); ++j) {
+            ASSERT_NEAR(expected[j], this->blob_top_->cpu_data()[j], 1e-5);
+          }
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(PoolingLayerTest, TestForwardGlobal) {
+  typedef typename TypeParam::Dtype Dtype;
+  const PoolingParameter_PoolMethod pools[] = {
+      PoolingParameter_PoolMethod_MAX, PoolingParameter_PoolMethod_AVE};
+  vector<Dtype> expected;
+  for (int i = 0; i < 2; ++i) {
+    for (int test = 0; test <= 1; ++test) {
+      LayerParameter layer_param;
+      layer_param.set_phase(test ? TEST : TRAIN);
+      PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+      pooling_param->set_global_pooling(true);
+      pooling_param->set_pool(pools[i]);
+      PoolingLayer<Dtype> layer(layer_param);
+      layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      this->ReferencePool(pools[i], this->blob_bottom_->height(),
+          this->blob_bottom_->width(), 1, 0, &expected);
+      ASSERT_EQ(expected.size(), this->blob_top_->count());
+      for (int j = 0; j < expected.size(); ++j) {
+        EXPECT_NEAR(expected[j], this->blob_top_->cpu_data()[j], 1e-5);
+      }
+    }
+  }
+}
+
+TYPED_TEST(PoolingLayerTest, TestBackwardMaxTestPhase) {
+  typedef typename TypeParam::Dtype Dtype;
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  vector<Dtype> expected;
+  for (int test = 0; test <= 1; ++test) {
+    LayerParameter layer_param;
+    layer_param.set_phase(test ? TEST : TRAIN);
+    PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+    pooling_param->set_kernel_size(3);
+    pooling_param->set_stride(2);
+    pooling_param->set_pad(1);
+    pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+    PoolingLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    Caffe::set_random_seed(1702);
+    filler.Fill(this->blob_top_);
+    caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+        this->blob_top_->mutable_cpu_diff());
+    layer.Backward(this->blob_top_vec_, vector<bool>(1, true),
+        this->blob_bottom_vec_);
+    const Dtype* bottom_diff = this->blob_bottom_->cpu_diff();
+    if (!test) {
+      expected.assign(bottom_diff, bottom_diff + this->blob_bottom_->count());
+    } else {
+      // The maxima are found again for the gradient.
+      for (int i = 0; i < expected.size(); ++i) {
+        EXPECT_EQ(expected[i], bottom_diff[i]);
+      }
+    }
+  }
+}
+
 #ifdef USE_CUDNN
 template <typename Dtype>
 class CuDNNPoolingLayerTest : public GPUDeviceTest<Dtype> {
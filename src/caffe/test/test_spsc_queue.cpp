@@ -0,0 +1,121 @@
+#include <boost/thread.hpp>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/layers/base_data_layer.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/spsc_queue.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class SPSCQueueTest : public ::testing::Test {
+ protected:
+  typedef Batch<float>* Item;
+
+  static const int kNumBatches = 8;
+
+  Item item(int i) { return &batches_[i % kNumBatches]; }
+
+  Batch<float> batches_[kNumBatches];
+};
+
+template <typename Queue>
+static void Produce(Queue* queue, Batch<float>* batches, int num_batches,
+    int count) {
+  for (int i = 0; i < count; ++i) {
+    queue->push(&batches[i % num_batches]);
+  }
+}
+
+// Bounce an item back and forth between two threads, as the prefetch queues
+// do with batches.
+template <typename Queue>
+static void Echo(Queue* in, Queue* out, int count) {
+  for (int i = 0; i < count; ++i) {
+    out->push(in->pop());
+  }
+}
+
+template <typename Queue>
+static double PingPongMicroseconds(Queue* ping, Queue* pong, Batch<float>* b,
+    int count) {
+  CPUTimer timer;
+  boost::thread echo(&Echo<Queue>, ping, pong, count);
+  timer.Start();
+  for (int i = 0; i < count; ++i) {
+    ping->push(b);
+    EXPECT_EQ(b, pong->pop());
+  }
+  double elapsed = timer.MicroSeconds();
+  echo.join();
+  return elapsed;
+}
+
+TEST_F(SPSCQueueTest, TestPushPop) {
+  SPSCQueue<Item> queue(3);
+  EXPECT_EQ(3, queue.capacity());
+  EXPECT_EQ(0, queue.size());
+  Item t;
+  EXPECT_FALSE(queue.try_pop(&t));
+  EXPECT_FALSE(queue.try_peek(&t));
+  // Wrap around the ring a few times.
+  for (int i = 0; i < 10; ++i) {
+    queue.push(item(2 * i));
+    queue.push(item(2 * i + 1));
+    EXPECT_EQ(2, queue.size());
+    EXPECT_EQ(item(2 * i), queue.peek());
+    EXPECT_EQ(item(2 * i), queue.pop());
+    EXPECT_TRUE(queue.try_peek(&t));
+    EXPECT_EQ(item(2 * i + 1), t);
+    EXPECT_TRUE(queue.try_pop(&t));
+    EXPECT_EQ(item(2 * i + 1), t);
+    EXPECT_EQ(0, queue.size());
+  }
+}
+
+TEST_F(SPSCQueueTest, TestProducerConsumer) {
+  // A small capacity makes both sides wait on each other.
+  SPSCQueue<Item> queue(2);
+  const int count = 20000;
+  boost::thread producer(&Produce<SPSCQueue<Item> >, &queue, batches_,
+      kNumBatches, count);
+  for (int i = 0; i < count; ++i) {
+    ASSERT_EQ(item(i), queue.pop()) << "at item " << i;
+  }
+  producer.join();
+  EXPECT_EQ(0, queue.size());
+}
+
+TEST_F(SPSCQueueTest, TestInterruptWhileWaiting) {
+  SPSCQueue<Item> in(1), out(1);
+  boost::thread echo(&Echo<SPSCQueue<Item> >, &in, &out, 2);
+  in.push(item(0));
+  EXPECT_EQ(item(0), out.pop());
+  // The echo thread now parks waiting for its second item.
+  echo.interrupt();
+  echo.join();
+  EXPECT_EQ(0, in.size());
+  EXPECT_EQ(0, out.size());
+}
+
+// Not a correctness test: logs the round-trip latency of handing a batch to
+// another thread and back, with BlockingQueue and with SPSCQueue.
+TEST_F(SPSCQueueTest, BenchmarkPingPong) {
+  const int count = 20000;
+  BlockingQueue<Item> blocking_ping, blocking_pong;
+  const double blocking_us = PingPongMicroseconds(&blocking_ping,
+      &blocking_pong, item(0), count);
+  SPSCQueue<Item> spsc_ping(1), spsc_pong(1);
+  const double spsc_us = PingPongMicroseconds(&spsc_ping, &spsc_pong,
+      item(0), count);
+  LOG(INFO) << "Round trip over " << count << " iterations: BlockingQueue "
+      << blocking_us / count << " us, SPSCQueue " << spsc_us / count << " us";
+  EXPECT_EQ(0, spsc_ping.size());
+  EXPECT_EQ(0, spsc_pong.size());
+}
+
+}  // namespace caffe
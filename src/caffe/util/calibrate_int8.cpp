@@ -0,0 +1,84 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "caffe/util/calibrate_int8.hpp"
+
+namespace caffe {
+
+// Whether a layer has an int8 implementation to calibrate.
+static bool CanQuantize(const LayerParameter& layer_param) {
+  if (layer_param.type() == "InnerProduct") { return true; }
+  if (layer_param.type() != "Convolution") { return false; }
+  const ConvolutionParameter_Engine engine =
+      layer_param.convolution_param().engine();
+  return engine == ConvolutionParameter_Engine_DEFAULT ||
+      engine == ConvolutionParameter_Engine_CAFFE;
+}
+
+template <typename Dtype>
+int CalibrateInt8(Net<Dtype>* net, int iterations, NetParameter* param,
+    const std::set<string>& skip_layers) {
+  CHECK_EQ(net->phase(), TEST) << "Calibrate int8 quantization on a TEST net";
+  CHECK_GT(iterations, 0);
+  const vector<shared_ptr<Layer<Dtype> > >& layers = net->layers();
+  vector<int> quantized;
+  for (int i = 0; i < layers.size(); ++i) {
+    const LayerParameter& layer_param = layers[i]->layer_param();
+    if (CanQuantize(layer_param) && !skip_layers.count(layer_param.name())) {
+      quantized.push_back(i);
+    }
+  }
+  // Run the layers one at a time to see the inputs of each before the next
+  // layer possibly overwrites them in place.
+  vector<Dtype> input_max(layers.size(), Dtype(0));
+  for (int iter = 0; iter < iterations; ++iter) {
+    int next = 0;
+    for (int i = 0; i < layers.size(); ++i) {
+      if (next < quantized.size() && quantized[next] == i) {
+        const vector<Blob<Dtype>*>& bottom = net->bottom_vecs()[i];
+        for (int j = 0; j < bottom.size(); ++j) {
+          const Dtype* data = bottom[j]->cpu_data();
+          for (int k = 0; k < bottom[j]->count(); ++k) {
+            input_max[i] = std::max(input_max[i], std::abs(data[k]));
+          }
+        }
+        ++next;
+      }
+      net->ForwardFromTo(i, i);
+    }
+  }
+  std::map<string, Dtype> ranges;
+  for (int i = 0; i < quantized.size(); ++i) {
+    const int layer_id = quantized[i];
+    const string& name = net->layer_names()[layer_id];
+    if (input_max[layer_id] > 0) {
+      ranges[name] = input_max[layer_id];
+    } else {
+      LOG(WARNING) << "Layer " << name << " only saw zero inputs; "
+          << "leaving it in floating point";
+    }
+  }
+  for (int i = 0; i < param->layer_size(); ++i) {
+    LayerParameter* layer_param = param->mutable_layer(i);
+    typename std::map<string, Dtype>::const_iterator it =
+        ranges.find(layer_param->name());
+    if (it == ranges.end()) { continue; }
+    QuantizationParameter* quantization_param =
+        layer_param->mutable_quantization_param();
+    quantization_param->set_precision(QuantizationParameter_Precision_INT8);
+    quantization_param->set_input_max(it->second);
+    LOG(INFO) << "Layer " << it->first << " input range " << it->second;
+  }
+  return ranges.size();
+}
+
+template int CalibrateInt8<float>(Net<float>* net, int iterations,
+    NetParameter* param, const std::set<string>& skip_layers);
+template int CalibrateInt8<double>(Net<double>* net, int iterations,
+    NetParameter* param, const std::set<string>& skip_layers);
+
+}  // namespace caffe
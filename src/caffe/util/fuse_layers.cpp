@@ -0,0 +1,262 @@
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/util/fuse_layers.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// Whether the layer's output channels can absorb a per-channel affine
+// transform and a ReLU.
+static bool IsFusionProducer(const LayerParameter& layer) {
+  if (layer.bottom_size() != 1 || layer.top_size() != 1) {
+    return false;
+  }
+  if (layer.type() == "Convolution") {
+    const ConvolutionParameter& conv_param = layer.convolution_param();
+    return conv_param.axis() == 1 && !conv_param.has_fused_relu();
+  }
+  if (layer.type() == "InnerProduct") {
+    const InnerProductParameter& ip_param = layer.inner_product_param();
+    return ip_param.axis() == 1 && !ip_param.has_fused_relu();
+  }
+  return false;
+}
+
+// Index of the only layer reading the output of layers[producer_idx] before
+// it is redefined, or -1 if there is none or more than one.
+static int SoleConsumer(const vector<LayerParameter>& layers,
+    const vector<bool>& removed, int producer_idx) {
+  const string& blob_name = layers[producer_idx].top(0);
+  int consumer_idx = -1;
+  for (int i = producer_idx + 1; i < layers.size(); ++i) {
+    if (removed[i]) { continue; }
+    const LayerParameter& layer = layers[i];
+    for (int j = 0; j < layer.bottom_size(); ++j) {
+      if (layer.bottom(j) == blob_name) {
+        if (consumer_idx >= 0) { return -1; }
+        consumer_idx = i;
+      }
+    }
+    bool redefined = false;
+    for (int j = 0; j < layer.top_size(); ++j) {
+      redefined |= (layer.top(j) == blob_name);
+    }
+    if (redefined) { break; }
+  }
+  if (consumer_idx < 0) { return -1; }
+  const LayerParameter& consumer = layers[consumer_idx];
+  if (consumer.bottom_size() != 1 || consumer.top_size() != 1 ||
+      consumer.loss_weight_size() > 0) {
+    return -1;
+  }
+  return consumer_idx;
+}
+
+static int NumOutputs(const LayerParameter& layer) {
+  return layer.type() == "Convolution" ?
+      layer.convolution_param().num_output() :
+      layer.inner_product_param().num_output();
+}
+
+// Per-channel values of a Scale or Bias parameter blob, which holds either one
+// value per channel or a single value shared by all of them.
+static bool ChannelValues(const BlobProto& proto, int channels,
+    vector<double>* values) {
+  Blob<double> blob;
+  blob.FromProto(proto);
+  if (blob.count() != channels && blob.count() != 1) {
+    return false;
+  }
+  values->resize(channels);
+  for (int c = 0; c < channels; ++c) {
+    (*values)[c] = blob.cpu_data()[blob.count() == 1 ? 0 : c];
+  }
+  return true;
+}
+
+// Store blob in proto with the precision the trained weights were saved in.
+static void WriteBlob(const Blob<double>& blob, bool double_data,
+    BlobProto* proto) {
+  proto->Clear();
+  if (double_data) {
+    blob.ToProto(proto);
+  } else {
+    Blob<float> float_blob(blob.shape());
+    float* data = float_blob.mutable_cpu_data();
+    for (int i = 0; i < blob.count(); ++i) {
+      data[i] = blob.cpu_data()[i];
+    }
+    float_blob.ToProto(proto);
+  }
+}
+
+// Replace the producer's output y of every channel c by
+// scale[c] * y + shift[c], adding a bias if the producer has none.
+static void ApplyAffine(const vector<double>& scale,
+    const vector<double>& shift, LayerParameter* producer) {
+  const int channels = scale.size();
+  const bool is_conv = producer->type() == "Convolution";
+  const bool double_data = producer->blobs(0).double_data_size() > 0;
+  Blob<double> weights;
+  weights.FromProto(producer->blobs(0));
+  const int dim = weights.count() / channels;
+  // An InnerProduct with transposed weights stores one column per output.
+  const bool transposed = !is_conv &&
+      producer->inner_product_param().transpose();
+  double* w = weights.mutable_cpu_data();
+  for (int i = 0; i < weights.count(); ++i) {
+    w[i] *= scale[transposed ? i % channels : i / dim];
+  }
+  WriteBlob(weights, double_data, producer->mutable_blobs(0));
+
+  const bool bias_term = is_conv ?
+      producer->convolution_param().bias_term() :
+      producer->inner_product_param().bias_term();
+  Blob<double> bias;
+  if (bias_term) {
+    bias.FromProto(producer->blobs(1));
+  } else {
+    vector<int> bias_shape(1, channels);
+    bias.Reshape(bias_shape);
+    caffe_set(channels, 0., bias.mutable_cpu_data());
+    producer->add_blobs();
+    if (is_conv) {
+      producer->mutable_convolution_param()->set_bias_term(true);
+    } else {
+      producer->mutable_inner_product_param()->set_bias_term(true);
+    }
+  }
+  double* b = bias.mutable_cpu_data();
+  for (int c = 0; c < channels; ++c) {
+    b[c] = b[c] * scale[c] + shift[c];
+  }
+  WriteBlob(bias, double_data, producer->mutable_blobs(1));
+}
+
+static bool FoldBatchNorm(const LayerParameter& batch_norm,
+    LayerParameter* producer) {
+  const BatchNormParameter& param = batch_norm.batch_norm_param();
+  if (param.has_use_global_stats() && !param.use_global_stats()) {
+    return false;
+  }
+  const int channels = NumOutputs(*producer);
+  if (batch_norm.blobs_size() != 3 || producer->blobs_size() == 0) {
+    return false;
+  }
+  Blob<double> mean, variance, factor;
+  mean.FromProto(batch_norm.blobs(0));
+  if (mean.count() != channels) {
+    return false;
+  }
+  variance.FromProto(batch_norm.blobs(1));
+  factor.FromProto(batch_norm.blobs(2));
+  // The statistics are stored unnormalized, as in BatchNormLayer.
+  const double scale_factor = factor.cpu_data()[0] == 0 ?
+      0 : 1 / factor.cpu_data()[0];
+  vector<double> scale(channels), shift(channels);
+  for (int c = 0; c < channels; ++c) {
+    const double inv_std = 1 / std::sqrt(
+        scale_factor * variance.cpu_data()[c] + param.eps());
+    scale[c] = inv_std;
+    shift[c] = -scale_factor * mean.cpu_data()[c] * inv_std;
+  }
+  ApplyAffine(scale, shift, producer);
+  return true;
+}
+
+static bool FoldScale(const LayerParameter& scale_layer,
+    LayerParameter* producer) {
+  const ScaleParameter& param = scale_layer.scale_param();
+  const int channels = NumOutputs(*producer);
+  if (param.axis() != 1 || (param.num_axes() != 0 && param.num_axes() != 1) ||
+      producer->blobs_size() == 0 ||
+      scale_layer.blobs_size() != (param.bias_term() ? 2 : 1)) {
+    return false;
+  }
+  vector<double> scale, shift(channels, 0);
+  if (!ChannelValues(scale_layer.blobs(0), channels, &scale) ||
+      (param.bias_term() &&
+       !ChannelValues(scale_layer.blobs(1), channels, &shift))) {
+    return false;
+  }
+  ApplyAffine(scale, shift, producer);
+  return true;
+}
+
+static bool FoldBias(const LayerParameter& bias_layer,
+    LayerParameter* producer) {
+  const BiasParameter& param = bias_layer.bias_param();
+  const int channels = NumOutputs(*producer);
+  if (param.axis() != 1 || (param.num_axes() != 0 && param.num_axes() != 1) ||
+      producer->blobs_size() == 0 || bias_layer.blobs_size() != 1) {
+    return false;
+  }
+  vector<double> scale(channels, 1), shift;
+  if (!ChannelValues(bias_layer.blobs(0), channels, &shift)) {
+    return false;
+  }
+  ApplyAffine(scale, shift, producer);
+  return true;
+}
+
+static bool FuseReLU(const LayerParameter& relu, LayerParameter* producer) {
+  if (producer->type() == "Convolution") {
+    ConvolutionParameter* conv_param = producer->mutable_convolution_param();
+    if (conv_param->engine() == ConvolutionParameter_Engine_CUDNN) {
+      return false;
+    }
+    conv_param->mutable_fused_relu()->CopyFrom(relu.relu_param());
+  } else {
+    producer->mutable_inner_product_param()->mutable_fused_relu()->CopyFrom(
+        relu.relu_param());
+  }
+  return true;
+}
+
+int FuseLayers(const NetParameter& param, NetParameter* param_fused) {
+  param_fused->CopyFrom(param);
+  param_fused->clear_layer();
+  vector<LayerParameter> layers(param.layer().begin(), param.layer().end());
+  vector<bool> removed(layers.size(), false);
+  int num_removed = 0;
+  for (int i = 0; i < layers.size(); ++i) {
+    LayerParameter* producer = &layers[i];
+    if (removed[i] || !IsFusionProducer(*producer)) { continue; }
+    // Fold consumers one by one; nothing can follow a fused ReLU.
+    bool relu_fused = false;
+    int consumer_idx;
+    while (!relu_fused &&
+           (consumer_idx = SoleConsumer(layers, removed, i)) >= 0) {
+      const LayerParameter& consumer = layers[consumer_idx];
+      bool folded = false;
+      if (consumer.type() == "BatchNorm") {
+        folded = FoldBatchNorm(consumer, producer);
+      } else if (consumer.type() == "Scale") {
+        folded = FoldScale(consumer, producer);
+      } else if (consumer.type() == "Bias") {
+        folded = FoldBias(consumer, producer);
+      } else if (consumer.type() == "ReLU") {
+        folded = relu_fused = FuseReLU(consumer, producer);
+      }
+      if (!folded) { break; }
+      LOG_IF(INFO, Caffe::root_solver()) << "Folding layer '"
+          << consumer.name() << "' into '" << producer->name() << "'";
+      // The producer now computes the consumer's output.
+      producer->set_top(0, consumer.top(0));
+      removed[consumer_idx] = true;
+      ++num_removed;
+    }
+  }
+  for (int i = 0; i < layers.size(); ++i) {
+    if (!removed[i]) {
+      param_fused->add_layer()->CopyFrom(layers[i]);
+    }
+  }
+  return num_removed;
+}
+
+}  // namespace caffe
@@ -1,16 +1,27 @@
 #ifdef USE_HDF5
 #include "caffe/util/hdf5.hpp"
 
+#include <boost/thread/recursive_mutex.hpp>
 #include <string>
 #include <vector>
 
 namespace caffe {
 
-// Verifies format of data stored in HDF5 file and reshapes blob accordingly.
-template <typename Dtype>
-void hdf5_load_nd_dataset_helper(
-    hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
-    Blob<Dtype>* blob, bool reshape) {
+static boost::recursive_mutex& hdf5_mutex() {
+  static boost::recursive_mutex mutex;
+  return mutex;
+}
+
+HDF5Lock::HDF5Lock() {
+  hdf5_mutex().lock();
+}
+
+HDF5Lock::~HDF5Lock() {
+  hdf5_mutex().unlock();
+}
+
+std::vector<hsize_t> hdf5_get_nd_dataset_dims(
+    hid_t file_id, const char* dataset_name_, int min_dim, int max_dim) {
   // Verify that the dataset exists.
   CHECK(H5LTfind_dataset(file_id, dataset_name_))
       << "Failed to find HDF5 dataset " << dataset_name_;
@@ -56,8 +67,16 @@ void hdf5_load_nd_dataset_helper(
   default:
     LOG(FATAL) << "Datatype class unknown";
   }
+  return dims;
+}
 
-
+// Verifies format of data stored in HDF5 file and reshapes blob accordingly.
+template <typename Dtype>
+void hdf5_load_nd_dataset_helper(
+    hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
+    Blob<Dtype>* blob, bool reshape) {
+  const std::vector<hsize_t> dims =
+      hdf5_get_nd_dataset_dims(file_id, dataset_name_, min_dim, max_dim);
   vector<int> blob_dims(dims.size());
   for (int i = 0; i < dims.size(); ++i) {
     blob_dims[i] = dims[i];
@@ -104,6 +123,47 @@ void hdf5_load_nd_dataset<double>(hid_t file_id, const char* dataset_name_,
   CHECK_GE(status, 0) << "Failed to read double dataset " << dataset_name_;
 }
 
+static void hdf5_load_nd_dataset_rows_helper(hid_t file_id,
+    const char* dataset_name_, hsize_t row, hsize_t num_rows,
+    hid_t mem_type, void* data) {
+  hid_t dataset = H5Dopen2(file_id, dataset_name_, H5P_DEFAULT);
+  CHECK_GE(dataset, 0) << "Failed to open HDF5 dataset " << dataset_name_;
+  hid_t file_space = H5Dget_space(dataset);
+  const int ndims = H5Sget_simple_extent_ndims(file_space);
+  CHECK_GE(ndims, 1) << "Dataset " << dataset_name_ << " has no rows";
+  std::vector<hsize_t> count(ndims);
+  H5Sget_simple_extent_dims(file_space, count.data(), NULL);
+  CHECK_LE(row + num_rows, count[0]) << "Reading past the end of "
+      << dataset_name_;
+  std::vector<hsize_t> start(ndims, 0);
+  start[0] = row;
+  count[0] = num_rows;
+  herr_t status = H5Sselect_hyperslab(file_space, H5S_SELECT_SET,
+      start.data(), NULL, count.data(), NULL);
+  CHECK_GE(status, 0) << "Failed to select rows of " << dataset_name_;
+  hid_t mem_space = H5Screate_simple(ndims, count.data(), NULL);
+  status = H5Dread(dataset, mem_type, mem_space, file_space, H5P_DEFAULT,
+      data);
+  CHECK_GE(status, 0) << "Failed to read rows of dataset " << dataset_name_;
+  H5Sclose(mem_space);
+  H5Sclose(file_space);
+  H5Dclose(dataset);
+}
+
+template <>
+void hdf5_load_nd_dataset_rows<float>(hid_t file_id, const char* dataset_name_,
+    hsize_t row, hsize_t num_rows, float* data) {
+  hdf5_load_nd_dataset_rows_helper(file_id, dataset_name_, row, num_rows,
+      H5T_NATIVE_FLOAT, data);
+}
+
+template <>
+void hdf5_load_nd_dataset_rows<double>(hid_t file_id,
+    const char* dataset_name_, hsize_t row, hsize_t num_rows, double* data) {
+  hdf5_load_nd_dataset_rows_helper(file_id, dataset_name_, row, num_rows,
+      H5T_NATIVE_DOUBLE, data);
+}
+
 template <>
 void hdf5_save_nd_dataset<float>(
     const hid_t file_id, const string& dataset_name, const Blob<float>& blob,
@@ -9,8 +9,10 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #endif  // USE_OPENCV
 #include <stdint.h>
+#include <unistd.h>
 
 #include <algorithm>
+#include <cstdio>
 #include <fstream>  // NOLINT(readability/streams)
 #include <string>
 #include <vector>
@@ -69,6 +71,15 @@ void WriteProtoToBinaryFile(const Message& proto, const char* filename) {
   CHECK(proto.SerializeToOstream(&output));
 }
 
+void CommitFile(const string& temp_filename, const string& filename) {
+  int fd = open(temp_filename.c_str(), O_RDONLY);
+  CHECK_NE(fd, -1) << "File not found: " << temp_filename;
+  CHECK_EQ(fsync(fd), 0) << "Failed to flush " << temp_filename;
+  close(fd);
+  CHECK_EQ(std::rename(temp_filename.c_str(), filename.c_str()), 0)
+      << "Failed to rename " << temp_filename << " to " << filename;
+}
+
 #ifdef USE_OPENCV
 cv::Mat ReadImageToCVMat(const string& filename,
     const int height, const int width, const bool is_color) {
@@ -1,6 +1,7 @@
 #include <boost/math/special_functions/next.hpp>
 #include <boost/random.hpp>
 
+#include <algorithm>
 #include <limits>
 
 #include "caffe/common.hpp"
@@ -382,4 +383,131 @@ void caffe_cpu_scale<double>(const int n, const double alpha, const double *x,
   cblas_dscal(n, alpha, y, 1);
 }
 
+template <typename Dtype>
+void caffe_cpu_relu(const int n, const Dtype negative_slope, Dtype* x) {
+  for (int i = 0; i < n; ++i) {
+    x[i] = std::max(x[i], Dtype(0))
+        + negative_slope * std::min(x[i], Dtype(0));
+  }
+}
+
+template void caffe_cpu_relu<float>(const int n, const float negative_slope,
+    float* x);
+template void caffe_cpu_relu<double>(const int n, const double negative_slope,
+    double* x);
+
+template <typename Dtype>
+void caffe_cpu_relu_backward(const int n, const Dtype negative_slope,
+    const Dtype* y, Dtype* dy) {
+  for (int i = 0; i < n; ++i) {
+    dy[i] *= (y[i] > 0) + negative_slope * (y[i] <= 0);
+  }
+}
+
+template void caffe_cpu_relu_backward<float>(const int n,
+    const float negative_slope, const float* y, float* dy);
+template void caffe_cpu_relu_backward<double>(const int n,
+    const double negative_slope, const double* y, double* dy);
+
+template <typename Dtype>
+void caffe_cpu_bias_relu(const int M, const int N, const Dtype* bias,
+    const bool row_bias, const bool relu, const Dtype negative_slope,
+    Dtype* C) {
+  if (!bias && !relu) { return; }
+  // One pass per row; negative_slope 1 makes the ReLU a no-op, and a zero
+  // shift or step through a single zero the bias, so that every case is the
+  // same vectorized loop.
+  const Dtype slope = relu ? negative_slope : Dtype(1);
+  const Dtype zero = 0;
+  for (int i = 0; i < M; ++i) {
+    Dtype* c = C + i * N;
+    const Dtype shift = bias && row_bias ? bias[i] : Dtype(0);
+    const Dtype* b = bias && !row_bias ? bias : &zero;
+    const int b_step = bias && !row_bias ? 1 : 0;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for (int j = 0; j < N; ++j) {
+      const Dtype value = c[j] + shift + b[j * b_step];
+      c[j] = value > 0 ? value : value * slope;
+    }
+  }
+}
+
+template void caffe_cpu_bias_relu<float>(const int M, const int N,
+    const float* bias, const bool row_bias, const bool relu,
+    const float negative_slope, float* C);
+template void caffe_cpu_bias_relu<double>(const int M, const int N,
+    const double* bias, const bool row_bias, const bool relu,
+    const double negative_slope, double* C);
+
+template <typename Dtype>
+void caffe_cpu_bias_backward(const int M, const int N, const Dtype* X,
+    const bool row_bias, Dtype* y) {
+  for (int i = 0; i < M; ++i) {
+    const Dtype* x = X + i * N;
+    if (row_bias) {
+      Dtype sum = 0;
+#ifdef _OPENMP
+#pragma omp simd reduction(+:sum)
+#endif
+      for (int j = 0; j < N; ++j) {
+        sum += x[j];
+      }
+      y[i] += sum;
+    } else {
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+      for (int j = 0; j < N; ++j) {
+        y[j] += x[j];
+      }
+    }
+  }
+}
+
+template void caffe_cpu_bias_backward<float>(const int M, const int N,
+    const float* X, const bool row_bias, float* y);
+template void caffe_cpu_bias_backward<double>(const int M, const int N,
+    const double* X, const bool row_bias, double* y);
+
+template <typename Dtype>
+void caffe_cpu_quantize(const int n, const Dtype scale, const Dtype* x,
+    int8_t* y) {
+  for (int i = 0; i < n; ++i) {
+    const Dtype v = std::min(std::max(scale * x[i], Dtype(-127)), Dtype(127));
+    y[i] = static_cast<int8_t>(v >= 0 ? v + Dtype(0.5) : v - Dtype(0.5));
+  }
+}
+
+template void caffe_cpu_quantize<float>(const int n, const float scale,
+    const float* x, int8_t* y);
+template void caffe_cpu_quantize<double>(const int n, const double scale,
+    const double* x, int8_t* y);
+
+void caffe_cpu_gemm_s8(const int M, const int N, const int K,
+    const int8_t* A, const int8_t* B, int32_t* C) {
+  // Work on column blocks of C so that the block of a row stays in L1 cache
+  // while the matching rows of B stream by; the inner loop vectorizes.
+  const int kBlock = 512;
+  for (int j0 = 0; j0 < N; j0 += kBlock) {
+    const int block = std::min(kBlock, N - j0);
+    for (int i = 0; i < M; ++i) {
+      int32_t* c = C + i * N + j0;
+      std::fill(c, c + block, 0);
+      for (int k = 0; k < K; ++k) {
+        const int32_t a = A[i * K + k];
+        if (a == 0) { continue; }
+        const int8_t* b = B + k * N + j0;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+        for (int j = 0; j < block; ++j) {
+          c[j] += a * b[j];
+        }
+      }
+    }
+  }
+}
+
 }  // namespace caffe
@@ -0,0 +1,202 @@
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CAFFE_AVX2_DISPATCH
+#endif
+
+#include <algorithm>
+#include <cmath>
+
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/openmp.hpp"
+
+namespace caffe {
+
+#ifdef CAFFE_AVX2_DISPATCH
+// Compile single functions for AVX2 without requiring it of the whole build;
+// they only run after CpuHasAvx2() checked the CPU.
+#define CAFFE_AVX2 __attribute__((target("avx2,fma")))
+
+static bool DetectAvx2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+static bool CpuHasAvx2() {
+  static const bool has_avx2 = DetectAvx2();
+  return has_avx2;
+}
+
+// exp(x) = 2^n * exp(r) with n = round(x / ln 2) and |r| <= ln(2) / 2, where
+// exp(r) is the Cephes expf polynomial.
+CAFFE_AVX2 static inline __m256 exp_avx2(__m256 x) {
+  x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.f)),
+      _mm256_set1_ps(88.f));
+  const __m256 n = _mm256_round_ps(
+      _mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)),
+      _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  // Subtract n * ln 2 in two parts to keep r exact.
+  __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+  r = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), r);
+  __m256 p = _mm256_set1_ps(1.9875691500e-4f);
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507e-3f));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073e-3f));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894e-2f));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459e-1f));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201e-1f));
+  p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r),
+      _mm256_add_ps(r, _mm256_set1_ps(1.f)));
+  // 2^n, built directly in the exponent bits.
+  const __m256i pow2n = _mm256_slli_epi32(_mm256_add_epi32(
+      _mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(p, _mm256_castsi256_ps(pow2n));
+}
+#endif  // CAFFE_AVX2_DISPATCH
+
+// The elementwise operations, as a scalar and, where available, an AVX2
+// version; alpha is only used by ELU.
+struct ExpOp {
+  template <typename Dtype>
+  static Dtype Apply(Dtype x, Dtype alpha) { return std::exp(x); }
+#ifdef CAFFE_AVX2_DISPATCH
+  CAFFE_AVX2 static __m256 Apply(__m256 x, __m256 alpha) {
+    return exp_avx2(x);
+  }
+#endif
+};
+
+struct SigmoidOp {
+  template <typename Dtype>
+  static Dtype Apply(Dtype x, Dtype alpha) {
+    return Dtype(0.5) * std::tanh(Dtype(0.5) * x) + Dtype(0.5);
+  }
+#ifdef CAFFE_AVX2_DISPATCH
+  CAFFE_AVX2 static __m256 Apply(__m256 x, __m256 alpha) {
+    const __m256 one = _mm256_set1_ps(1.f);
+    return _mm256_div_ps(one, _mm256_add_ps(one,
+        exp_avx2(_mm256_sub_ps(_mm256_setzero_ps(), x))));
+  }
+#endif
+};
+
+struct TanHOp {
+  template <typename Dtype>
+  static Dtype Apply(Dtype x, Dtype alpha) { return std::tanh(x); }
+#ifdef CAFFE_AVX2_DISPATCH
+  // tanh(x) = 1 - 2 / (exp(2x) + 1)
+  CAFFE_AVX2 static __m256 Apply(__m256 x, __m256 alpha) {
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 exp2x = exp_avx2(_mm256_add_ps(x, x));
+    return _mm256_sub_ps(one, _mm256_div_ps(_mm256_set1_ps(2.f),
+        _mm256_add_ps(exp2x, one)));
+  }
+#endif
+};
+
+struct ELUOp {
+  template <typename Dtype>
+  static Dtype Apply(Dtype x, Dtype alpha) {
+    return std::max(x, Dtype(0))
+        + alpha * (std::exp(std::min(x, Dtype(0))) - Dtype(1));
+  }
+#ifdef CAFFE_AVX2_DISPATCH
+  CAFFE_AVX2 static __m256 Apply(__m256 x, __m256 alpha) {
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 expm1 = _mm256_sub_ps(exp_avx2(_mm256_min_ps(x, zero)),
+        _mm256_set1_ps(1.f));
+    return _mm256_fmadd_ps(alpha, expm1, _mm256_max_ps(x, zero));
+  }
+#endif
+};
+
+#ifdef CAFFE_AVX2_DISPATCH
+template <typename Op>
+CAFFE_AVX2 static void ApplyAvx2(const int n, const float alpha,
+    const float* x, float* y) {
+  const __m256 alpha8 = _mm256_set1_ps(alpha);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(y + i, Op::Apply(_mm256_loadu_ps(x + i), alpha8));
+  }
+  if (i < n) {
+    // Finish through a padded vector so that every value rounds the same.
+    float tail[8] = {0};
+    std::copy(x + i, x + n, tail);
+    _mm256_storeu_ps(tail, Op::Apply(_mm256_loadu_ps(tail), alpha8));
+    std::copy(tail, tail + (n - i), y + i);
+  }
+}
+#endif
+
+// Apply Op with SIMD instructions if the CPU has them for this type; returns
+// false when the caller has to use the scalar version.
+template <typename Op>
+static bool ApplySimd(const int n, const float alpha, const float* x,
+    float* y) {
+#ifdef CAFFE_AVX2_DISPATCH
+  if (CpuHasAvx2()) {
+    ApplyAvx2<Op>(n, alpha, x, y);
+    return true;
+  }
+#endif
+  return false;
+}
+
+template <typename Op>
+static bool ApplySimd(const int n, const double alpha, const double* x,
+    double* y) {
+  return false;
+}
+
+template <typename Op, typename Dtype>
+static void ApplyElementwise(const int n, const Dtype alpha, const Dtype* x,
+    Dtype* y) {
+  // Blocks give the threads equal shares and keep data in L1 cache.
+  const int kBlockSize = 4096;
+  const int num_blocks = (n + kBlockSize - 1) / kBlockSize;
+#ifdef _OPENMP
+#pragma omp parallel for if (n >= kCpuParallelMinCount)
+#endif
+  for (int block = 0; block < num_blocks; ++block) {
+    const int begin = block * kBlockSize;
+    const int end = std::min(n, begin + kBlockSize);
+    if (!ApplySimd<Op>(end - begin, alpha, x + begin, y + begin)) {
+      for (int i = begin; i < end; ++i) {
+        y[i] = Op::Apply(x[i], alpha);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void caffe_cpu_exp(const int n, const Dtype* x, Dtype* y) {
+  ApplyElementwise<ExpOp>(n, Dtype(0), x, y);
+}
+
+template <typename Dtype>
+void caffe_cpu_sigmoid(const int n, const Dtype* x, Dtype* y) {
+  ApplyElementwise<SigmoidOp>(n, Dtype(0), x, y);
+}
+
+template <typename Dtype>
+void caffe_cpu_tanh(const int n, const Dtype* x, Dtype* y) {
+  ApplyElementwise<TanHOp>(n, Dtype(0), x, y);
+}
+
+template <typename Dtype>
+void caffe_cpu_elu(const int n, const Dtype alpha, const Dtype* x, Dtype* y) {
+  ApplyElementwise<ELUOp>(n, alpha, x, y);
+}
+
+template void caffe_cpu_exp<float>(const int n, const float* x, float* y);
+template void caffe_cpu_exp<double>(const int n, const double* x, double* y);
+template void caffe_cpu_sigmoid<float>(const int n, const float* x, float* y);
+template void caffe_cpu_sigmoid<double>(const int n, const double* x,
+    double* y);
+template void caffe_cpu_tanh<float>(const int n, const float* x, float* y);
+template void caffe_cpu_tanh<double>(const int n, const double* x, double* y);
+template void caffe_cpu_elu<float>(const int n, const float alpha,
+    const float* x, float* y);
+template void caffe_cpu_elu<double>(const int n, const double alpha,
+    const double* x, double* y);
+
+}  // namespace caffe
@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <fstream>  // NOLINT(readability/streams)
+#include <iomanip>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "caffe/util/net_profiler.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+NetProfiler<Dtype>::NetProfiler(Net<Dtype>* net)
+    : net_(net), layer_stats_(net->layers().size()),
+      origin_(boost::posix_time::microsec_clock::local_time()),
+      start_us_(0) {
+  hooks_.push_back(shared_ptr<Hook>(new Hook(this, true, true)));
+  net->add_before_forward(hooks_.back().get());
+  hooks_.push_back(shared_ptr<Hook>(new Hook(this, true, false)));
+  net->add_after_forward(hooks_.back().get());
+  hooks_.push_back(shared_ptr<Hook>(new Hook(this, false, true)));
+  net->add_before_backward(hooks_.back().get());
+  hooks_.push_back(shared_ptr<Hook>(new Hook(this, false, false)));
+  net->add_after_backward(hooks_.back().get());
+}
+
+template <typename Dtype>
+void NetProfiler<Dtype>::Hook::run(int layer) {
+  if (before_) {
+    profiler_->Begin(layer);
+  } else {
+    profiler_->End(layer, forward_);
+  }
+}
+
+template <typename Dtype>
+void NetProfiler<Dtype>::Begin(int layer_id) {
+  start_us_ = (boost::posix_time::microsec_clock::local_time() - origin_)
+      .total_microseconds();
+  timer_.Start();
+}
+
+template <typename Dtype>
+void NetProfiler<Dtype>::End(int layer_id, bool forward) {
+  timer_.Stop();
+  // Net runs the backward callbacks of layers that need no backward too.
+  if (!forward && !net_->layer_need_backward()[layer_id]) { return; }
+  TraceEvent event;
+  event.layer_id = layer_id;
+  event.forward = forward;
+  event.start_us = start_us_;
+  event.duration_us = timer_.MicroSeconds();
+  events_.push_back(event);
+  LayerStats& stats = layer_stats_[layer_id];
+  if (forward) {
+    ++stats.forward_calls;
+    stats.forward_us += event.duration_us;
+  } else {
+    ++stats.backward_calls;
+    stats.backward_us += event.duration_us;
+  }
+}
+
+template <typename Dtype>
+void NetProfiler<Dtype>::Reset() {
+  layer_stats_.assign(layer_stats_.size(), LayerStats());
+  events_.clear();
+}
+
+template <typename Dtype>
+double NetProfiler<Dtype>::ForwardFlops(int layer_id) const {
+  Layer<Dtype>& layer = *net_->layers()[layer_id];
+  const vector<Blob<Dtype>*>& bottom = net_->bottom_vecs()[layer_id];
+  const vector<Blob<Dtype>*>& top = net_->top_vecs()[layer_id];
+  const string type = layer.type();
+  double flops = 0;
+  if (type == "Convolution" || type == "InnerProduct") {
+    // Every output is a dot product with one filter.
+    const int num_output = type == "Convolution" ?
+        layer.layer_param().convolution_param().num_output() :
+        layer.layer_param().inner_product_param().num_output();
+    const double filter_size = layer.blobs()[0]->count() / num_output;
+    for (int i = 0; i < top.size(); ++i) {
+      flops += 2 * filter_size * top[i]->count();
+    }
+  } else if (type == "Deconvolution") {
+    // Every input is scattered through one filter.
+    const Blob<Dtype>& weights = *layer.blobs()[0];
+    const double filter_size = weights.count() / weights.shape(0);
+    for (int i = 0; i < bottom.size(); ++i) {
+      flops += 2 * filter_size * bottom[i]->count();
+    }
+  } else if (bottom.size() > 0) {
+    // Roughly one operation per output for everything else.
+    for (int i = 0; i < top.size(); ++i) {
+      flops += top[i]->count();
+    }
+  }
+  return flops;
+}
+
+// Add the bytes allocated for the blob's data and diff that are not in seen.
+template <typename Dtype>
+static size_t NewBytes(const Blob<Dtype>& blob,
+    std::set<const SyncedMemory*>* seen) {
+  if (blob.count() == 0) { return 0; }
+  const SyncedMemory* memories[] = {blob.data().get(), blob.diff().get()};
+  size_t bytes = 0;
+  for (int i = 0; i < 2; ++i) {
+    if (memories[i]->head() != SyncedMemory::UNINITIALIZED &&
+        seen->insert(memories[i]).second) {
+      bytes += memories[i]->size();
+    }
+  }
+  return bytes;
+}
+
+template <typename Dtype>
+size_t NetProfiler<Dtype>::TopBytes(int layer_id) const {
+  std::set<const SyncedMemory*> seen;
+  size_t bytes = 0;
+  for (int i = 0; i <= layer_id; ++i) {
+    const vector<Blob<Dtype>*>& top = net_->top_vecs()[i];
+    for (int j = 0; j < top.size(); ++j) {
+      const size_t new_bytes = NewBytes(*top[j], &seen);
+      if (i == layer_id) { bytes += new_bytes; }
+    }
+  }
+  return bytes;
+}
+
+template <typename Dtype>
+size_t NetProfiler<Dtype>::ParamBytes(int layer_id) const {
+  std::set<const SyncedMemory*> seen;
+  size_t bytes = 0;
+  const vector<shared_ptr<Blob<Dtype> > >& blobs =
+      net_->layers()[layer_id]->blobs();
+  for (int i = 0; i < blobs.size(); ++i) {
+    bytes += NewBytes(*blobs[i], &seen);
+  }
+  return bytes;
+}
+
+template <typename Dtype>
+string NetProfiler<Dtype>::Summary() const {
+  const vector<string>& names = net_->layer_names();
+  int name_width = 5;
+  double total_us = 0;
+  for (int i = 0; i < names.size(); ++i) {
+    name_width = std::max<int>(name_width, names[i].size());
+    total_us += layer_stats_[i].forward_us + layer_stats_[i].backward_us;
+  }
+  std::ostringstream table;
+  table << std::fixed << std::left << std::setw(name_width + 2) << "Layer"
+        << std::setw(16) << "Type" << std::right
+        << std::setw(12) << "Forward ms" << std::setw(12) << "Backward ms"
+        << std::setw(8) << "Time %" << std::setw(10) << "GFLOP"
+        << std::setw(10) << "GFLOP/s" << std::setw(10) << "Top MB"
+        << std::setw(10) << "Param MB" << "\n";
+  // Count every allocation once, for the layer that first holds it.
+  std::set<const SyncedMemory*> seen;
+  double total_forward_ms = 0, total_backward_ms = 0, total_flops = 0;
+  size_t total_top_bytes = 0, total_param_bytes = 0;
+  for (int i = 0; i < names.size(); ++i) {
+    const LayerStats& stats = layer_stats_[i];
+    const double forward_ms = stats.forward_calls == 0 ? 0 :
+        stats.forward_us / stats.forward_calls / 1000;
+    const double backward_ms = stats.backward_calls == 0 ? 0 :
+        stats.backward_us / stats.backward_calls / 1000;
+    const double flops = ForwardFlops(i);
+    size_t top_bytes = 0, param_bytes = 0;
+    const vector<Blob<Dtype>*>& top = net_->top_vecs()[i];
+    for (int j = 0; j < top.size(); ++j) {
+      top_bytes += NewBytes(*top[j], &seen);
+    }
+    const vector<shared_ptr<Blob<Dtype> > >& blobs =
+        net_->layers()[i]->blobs();
+    for (int j = 0; j < blobs.size(); ++j) {
+      param_bytes += NewBytes(*blobs[j], &seen);
+    }
+    total_forward_ms += forward_ms;
+    total_backward_ms += backward_ms;
+    total_flops += flops;
+    total_top_bytes += top_bytes;
+    total_param_bytes += param_bytes;
+    table << std::left << std::setw(name_width + 2) << names[i]
+          << std::setw(16) << net_->layers()[i]->type() << std::right
+          << std::setprecision(3) << std::setw(12) << forward_ms
+          << std::setw(12) << backward_ms << std::setprecision(1)
+          << std::setw(8) << (total_us == 0 ? 0 :
+              100 * (stats.forward_us + stats.backward_us) / total_us)
+          << std::setprecision(3) << std::setw(10) << flops / 1e9
+          << std::setprecision(1) << std::setw(10)
+          << (forward_ms == 0 ? 0 : flops / 1e6 / forward_ms)
+          << std::setprecision(2) << std::setw(10) << top_bytes / 1048576.
+          << std::setw(10) << param_bytes / 1048576. << "\n";
+  }
+  table << std::left << std::setw(name_width + 18) << "Total" << std::right
+        << std::setprecision(3) << std::setw(12) << total_forward_ms
+        << std::setw(12) << total_backward_ms << std::setprecision(1)
+        << std::setw(8) << 100. << std::setprecision(3) << std::setw(10)
+        << total_flops / 1e9 << std::setprecision(1) << std::setw(10)
+        << (total_forward_ms == 0 ? 0 : total_flops / 1e6 / total_forward_ms)
+        << std::setprecision(2) << std::setw(10) << total_top_bytes / 1048576.
+        << std::setw(10) << total_param_bytes / 1048576. << "\n";
+  return table.str();
+}
+
+// Quote a string for JSON.
+static string JsonString(const string& s) {
+  string quoted = "\"";
+  for (int i = 0; i < s.size(); ++i) {
+    if (s[i] == '"' || s[i] == '\\') {
+      quoted += '\\';
+    }
+    quoted += s[i];
+  }
+  return quoted + "\"";
+}
+
+template <typename Dtype>
+void NetProfiler<Dtype>::WriteChromeTrace(const string& filename) const {
+  std::ofstream out(filename.c_str());
+  CHECK(out.good()) << "Failed to open trace file " << filename;
+  out << std::fixed << std::setprecision(1)
+      << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+  for (int i = 0; i < events_.size(); ++i) {
+    const TraceEvent& event = events_[i];
+    out << (i == 0 ? "\n" : ",\n")
+        << "{\"name\": " << JsonString(net_->layer_names()[event.layer_id])
+        << ", \"cat\": \"" << (event.forward ? "forward" : "backward")
+        << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": 0, \"ts\": "
+        << event.start_us << ", \"dur\": " << event.duration_us
+        << ", \"args\": {\"type\": "
+        << JsonString(net_->layers()[event.layer_id]->type()) << "}}";
+  }
+  out << "\n]}\n";
+  CHECK(out.good()) << "Failed to write trace file " << filename;
+}
+
+INSTANTIATE_CLASS(NetProfiler);
+
+}  // namespace caffe
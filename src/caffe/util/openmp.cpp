@@ -0,0 +1,35 @@
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <algorithm>
+
+#include "caffe/util/openmp.hpp"
+
+namespace caffe {
+
+int caffe_cpu_max_threads() {
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+int caffe_cpu_thread_num() {
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+int caffe_cpu_resolve_threads(int requested) {
+  const int max_threads = caffe_cpu_max_threads();
+  if (requested <= 0) {
+    return max_threads;
+  }
+  return std::min(requested, max_threads);
+}
+
+}  // namespace caffe
@@ -0,0 +1,164 @@
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "caffe/layers/base_data_layer.hpp"
+#include "caffe/solver.hpp"
+#include "caffe/util/spsc_queue.hpp"
+
+namespace caffe {
+
+// Bounds of the adaptive spin budget, in polls of the other side's counter.
+static const int kMinSpins = 16;
+static const int kMaxSpins = 16384;
+
+template<typename T>
+class SPSCQueue<T>::sync {
+ public:
+  explicit sync(size_t capacity)
+      : slots_(capacity), head_(0), tail_(0),
+        consumer_parked_(false), producer_parked_(false),
+        consumer_spins_(kMinSpins), producer_spins_(kMinSpins) {}
+
+  std::vector<T> slots_;
+  // Monotonic counts of popped and pushed items; the slot of an item is its
+  // count modulo the capacity. Each is written by one side only and kept on
+  // its own cache line so the two sides do not false-share.
+  boost::atomic<size_t> head_;
+  char head_padding_[64];
+  boost::atomic<size_t> tail_;
+  char tail_padding_[64];
+
+  // Parking: a side sets its flag before its final check, and the other side
+  // checks the flag after publishing its counter. Both use sequentially
+  // consistent order so at least one of them sees the other's write, and
+  // notifications are sent under the mutex so none is lost.
+  boost::atomic<bool> consumer_parked_;
+  boost::atomic<bool> producer_parked_;
+  boost::mutex mutex_;
+  boost::condition_variable not_empty_;
+  boost::condition_variable not_full_;
+
+  // Spin budgets, each only touched by its own side.
+  int consumer_spins_;
+  int producer_spins_;
+};
+
+template<typename T>
+SPSCQueue<T>::SPSCQueue(size_t capacity)
+    : capacity_(capacity), sync_(new sync(capacity)) {
+  CHECK_GT(capacity, 0) << "SPSCQueue capacity must be positive";
+}
+
+template<typename T>
+void SPSCQueue<T>::wait(bool consumer, const string& log_on_wait) {
+  sync& s = *sync_;
+  int& spins = consumer ? s.consumer_spins_ : s.producer_spins_;
+  boost::atomic<bool>& parked =
+      consumer ? s.consumer_parked_ : s.producer_parked_;
+  boost::condition_variable& condition =
+      consumer ? s.not_empty_ : s.not_full_;
+  // The counter we are waiting on belongs to the other side.
+  const boost::atomic<size_t>& other = consumer ? s.tail_ : s.head_;
+  const size_t own = consumer ? s.head_.load(boost::memory_order_relaxed)
+                              : s.tail_.load(boost::memory_order_relaxed);
+  const size_t ready_at = consumer ? own + 1 : own + 1 - capacity_;
+
+  for (int i = 0; i < spins; ++i) {
+    if (other.load(boost::memory_order_acquire) >= ready_at) {
+      spins = std::min(spins * 2, kMaxSpins);
+      return;
+    }
+  }
+  spins = std::max(spins / 2, kMinSpins);
+
+  boost::mutex::scoped_lock lock(s.mutex_);
+  parked.store(true);
+  while (other.load() < ready_at) {
+    if (!log_on_wait.empty()) {
+      LOG_EVERY_N(INFO, 1000)<< log_on_wait;
+    }
+    condition.wait(lock);
+  }
+  parked.store(false, boost::memory_order_relaxed);
+}
+
+template<typename T>
+void SPSCQueue<T>::push(const T& t) {
+  sync& s = *sync_;
+  const size_t tail = s.tail_.load(boost::memory_order_relaxed);
+  if (tail - s.head_.load(boost::memory_order_acquire) == capacity_) {
+    wait(false, "");
+  }
+  s.slots_[tail % capacity_] = t;
+  s.tail_.store(tail + 1);
+  if (s.consumer_parked_.load()) {
+    boost::mutex::scoped_lock lock(s.mutex_);
+    s.not_empty_.notify_one();
+  }
+}
+
+template<typename T>
+bool SPSCQueue<T>::try_pop(T* t) {
+  sync& s = *sync_;
+  const size_t head = s.head_.load(boost::memory_order_relaxed);
+  if (s.tail_.load(boost::memory_order_acquire) == head) {
+    return false;
+  }
+  *t = s.slots_[head % capacity_];
+  s.head_.store(head + 1);
+  if (s.producer_parked_.load()) {
+    boost::mutex::scoped_lock lock(s.mutex_);
+    s.not_full_.notify_one();
+  }
+  return true;
+}
+
+template<typename T>
+T SPSCQueue<T>::pop(const string& log_on_wait) {
+  T t;
+  if (!try_pop(&t)) {
+    wait(true, log_on_wait);
+    CHECK(try_pop(&t));
+  }
+  return t;
+}
+
+template<typename T>
+bool SPSCQueue<T>::try_peek(T* t) {
+  sync& s = *sync_;
+  const size_t head = s.head_.load(boost::memory_order_relaxed);
+  if (s.tail_.load(boost::memory_order_acquire) == head) {
+    return false;
+  }
+  *t = s.slots_[head % capacity_];
+  return true;
+}
+
+template<typename T>
+T SPSCQueue<T>::peek() {
+  T t;
+  if (!try_peek(&t)) {
+    wait(true, "");
+    CHECK(try_peek(&t));
+  }
+  return t;
+}
+
+template<typename T>
+size_t SPSCQueue<T>::size() const {
+  // Read head first: it only grows, so the result never underflows.
+  const size_t head = sync_->head_.load(boost::memory_order_acquire);
+  return sync_->tail_.load(boost::memory_order_acquire) - head;
+}
+
+template class SPSCQueue<Batch<float>*>;
+template class SPSCQueue<Batch<double>*>;
+template class SPSCQueue<BlobsBatch<float>*>;
+template class SPSCQueue<BlobsBatch<double>*>;
+template class SPSCQueue<SolverSnapshot<float>*>;
+template class SPSCQueue<SolverSnapshot<double>*>;
+
+}  // namespace caffe
@@ -5,13 +5,22 @@ namespace bp = boost::python;
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
-
+#include <poll.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <csignal>
 #include <cstring>
+#include <deque>
 #include <map>
 #include <string>
 #include <vector>
 
 #include "boost/algorithm/string.hpp"
+#include "boost/thread.hpp"
 #include "caffe/caffe.hpp"
 #include "caffe/layers/memory_data_layer.hpp"
 #include "caffe/util/signal_handler.h"
@@ -20,6 +29,7 @@ using caffe::Blob;
 using caffe::Caffe;
 using caffe::Net;
 using caffe::Layer;
+using caffe::ScopedMetricAccumulation;
 using caffe::Solver;
 using caffe::shared_ptr;
 using caffe::string;
@@ -31,6 +41,10 @@ DEFINE_string(gpu, "",
     "Optional; run in GPU mode on given device IDs separated by ','."
     "Use '-gpu all' to run on all available GPUs. The effective training "
     "batch size is multiplied by the number of devices.");
+DEFINE_int32(cpu_workers, 1,
+    "Optional; in CPU mode, train this many replicas of the solver on their "
+    "own threads, averaging their gradients. The effective training batch "
+    "size is multiplied by the number of workers.");
 DEFINE_string(solver, "",
     "The solver definition protocol buffer text file.");
 DEFINE_string(model, "",
@@ -47,8 +61,24 @@ DEFINE_string(snapshot, "",
 DEFINE_string(weights, "",
     "Optional; the pretrained weights to initialize finetuning, "
     "separated by ','. Cannot be set simultaneously with snapshot.");
+DEFINE_string(int8_model, "",
+    "Optional; for 'test', an int8 calibrated copy of the model (see "
+    "calibrate_int8) to score alongside it with the same weights.");
 DEFINE_int32(iterations, 50,
     "The number of iterations to run.");
+DEFINE_int32(threads, 4,
+    "Optional; for 'throughput', time 1 to this many threads serving "
+    "requests concurrently.");
+DEFINE_string(socket, "",
+    "Optional; for 'serve', the path of a Unix socket to listen on. By "
+    "default requests are read from stdin and answered on stdout.");
+DEFINE_int32(max_batch_size, 16,
+    "Optional; for 'serve', the most requests to run in one batch.");
+DEFINE_int32(max_latency_us, 2000,
+    "Optional; for 'serve', how long in microseconds a request may wait for "
+    "a batch to fill.");
+DEFINE_int32(queue_depth, 256,
+    "Optional; for 'serve', the most requests waiting at once.");
 DEFINE_string(i, "",
   "Optional; the location of the image to perform prediction on.");
 DEFINE_string(o, "",
@@ -198,10 +228,16 @@ int train() {
 
   vector<int> gpus;
   get_gpus(&gpus);
+  CHECK_GE(FLAGS_cpu_workers, 1) << "Need at least one CPU worker.";
   if (gpus.size() == 0) {
     LOG(INFO) << "Use CPU.";
     Caffe::set_mode(Caffe::CPU);
+    if (FLAGS_cpu_workers > 1) {
+      LOG(INFO) << "Using " << FLAGS_cpu_workers << " CPU workers";
+      Caffe::set_solver_count(FLAGS_cpu_workers);
+    }
   } else {
+    CHECK_EQ(FLAGS_cpu_workers, 1) << "cpu_workers only applies in CPU mode.";
     ostringstream s;
     for (int i = 0; i < gpus.size(); ++i) {
       s << (i ? ", " : "") << gpus[i];
@@ -249,6 +285,10 @@ int train() {
 #else
     LOG(FATAL) << "Multi-GPU execution not available - rebuild with USE_NCCL";
 #endif
+  } else if (FLAGS_cpu_workers > 1) {
+    caffe::CPUParallel<float> parallel(solver);
+    parallel.Run(FLAGS_cpu_workers,
+                 FLAGS_snapshot.size() > 0 ? FLAGS_snapshot.c_str() : NULL);
   } else {
     solver->Solve();
   }
@@ -283,11 +323,27 @@ int test() {
   // Instantiate the caffe net.
   Net<float> caffe_net(FLAGS_model, caffe::TEST, FLAGS_level, &stages);
   caffe_net.CopyTrainedLayersFrom(FLAGS_weights);
+  // The int8 net reads the same data, so both see the same batches.
+  shared_ptr<Net<float> > int8_net;
+  if (FLAGS_int8_model.size()) {
+    int8_net.reset(new Net<float>(FLAGS_int8_model, caffe::TEST, FLAGS_level,
+        &stages));
+    int8_net->CopyTrainedLayersFrom(FLAGS_weights);
+  }
   LOG(INFO) << "Running for " << FLAGS_iterations << " iterations.";
+  // Metrics accumulate over all the batches; their outputs are reported as
+  // they are after the last one instead of averaged over the batches.
+  ScopedMetricAccumulation<float> accumulation(caffe_net);
+  shared_ptr<ScopedMetricAccumulation<float> > int8_accumulation;
+  if (int8_net) {
+    int8_accumulation.reset(new ScopedMetricAccumulation<float>(*int8_net));
+  }
 
   vector<int> test_score_output_id;
   vector<float> test_score;
+  vector<float> int8_test_score;
   float loss = 0;
+  float int8_loss = 0;
   for (int i = 0; i < FLAGS_iterations; ++i) {
     float iter_loss;
     const vector<Blob<float>*>& result =
@@ -301,6 +357,8 @@ int test() {
         if (i == 0) {
           test_score.push_back(score);
           test_score_output_id.push_back(j);
+        } else if (accumulation.accumulated_output(j)) {
+          test_score[idx] = score;
         } else {
           test_score[idx] += score;
         }
@@ -309,21 +367,54 @@ int test() {
         LOG(INFO) << "Batch " << i << ", " << output_name << " = " << score;
       }
     }
+    if (int8_net) {
+      const vector<Blob<float>*>& int8_result = int8_net->Forward(&iter_loss);
+      int8_loss += iter_loss;
+      CHECK_EQ(int8_result.size(), result.size())
+          << "The int8 model must have the same outputs";
+      idx = 0;
+      for (int j = 0; j < int8_result.size(); ++j) {
+        CHECK_EQ(int8_result[j]->count(), result[j]->count());
+        const float* result_vec = int8_result[j]->cpu_data();
+        for (int k = 0; k < int8_result[j]->count(); ++k, ++idx) {
+          if (i == 0) {
+            int8_test_score.push_back(result_vec[k]);
+          } else if (int8_accumulation->accumulated_output(j)) {
+            int8_test_score[idx] = result_vec[k];
+          } else {
+            int8_test_score[idx] += result_vec[k];
+          }
+        }
+      }
+    }
   }
   loss /= FLAGS_iterations;
   LOG(INFO) << "Loss: " << loss;
+  if (int8_net) {
+    int8_loss /= FLAGS_iterations;
+    LOG(INFO) << "int8 Loss: " << int8_loss;
+  }
   for (int i = 0; i < test_score.size(); ++i) {
     const std::string& output_name = caffe_net.blob_names()[
         caffe_net.output_blob_indices()[test_score_output_id[i]]];
     const float loss_weight = caffe_net.blob_loss_weights()[
         caffe_net.output_blob_indices()[test_score_output_id[i]]];
     std::ostringstream loss_msg_stream;
-    const float mean_score = test_score[i] / FLAGS_iterations;
+    const int output_id = test_score_output_id[i];
+    const float mean_score = accumulation.accumulated_output(output_id) ?
+        test_score[i] : test_score[i] / FLAGS_iterations;
     if (loss_weight) {
       loss_msg_stream << " (* " << loss_weight
                       << " = " << loss_weight * mean_score << " loss)";
     }
     LOG(INFO) << output_name << " = " << mean_score << loss_msg_stream.str();
+    if (int8_net) {
+      const float int8_mean_score =
+          int8_accumulation->accumulated_output(output_id) ?
+          int8_test_score[i] : int8_test_score[i] / FLAGS_iterations;
+      LOG(INFO) << output_name << " (int8) = " << int8_mean_score
+                << " (difference " << int8_mean_score - mean_score << ")";
+    }
   }
 
   return 0;
@@ -477,6 +568,327 @@ int time() {
 }
 RegisterBrewFunction(time);
 
+// Run iterations forward passes of an inference context.
+static void ServeRequests(caffe::InferenceSession<float>::Context* context,
+    int iterations) {
+  for (int i = 0; i < iterations; ++i) {
+    context->Forward();
+  }
+}
+
+// Throughput: benchmark inference with 1 to --threads threads, each serving
+// requests through its own context over one copy of the weights.
+int throughput() {
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to time.";
+  CHECK_GT(FLAGS_threads, 0);
+  vector<string> stages = get_stages_from_flags();
+
+  // Set device id and mode
+  vector<int> gpus;
+  get_gpus(&gpus);
+  if (gpus.size() != 0) {
+    LOG(INFO) << "Use GPU with device ID " << gpus[0];
+    Caffe::SetDevice(gpus[0]);
+    Caffe::set_mode(Caffe::GPU);
+  } else {
+    LOG(INFO) << "Use CPU.";
+    Caffe::set_mode(Caffe::CPU);
+  }
+  caffe::NetParameter param;
+  caffe::ReadNetParamsFromTextFileOrDie(FLAGS_model, &param);
+  for (int i = 0; i < stages.size(); ++i) {
+    param.mutable_state()->add_stage(stages[i]);
+  }
+  param.mutable_state()->set_level(FLAGS_level);
+  caffe::InferenceSession<float> session(param, FLAGS_weights);
+  // Create every context, and do a first pass so that their memory is
+  // allocated, before timing. The net is assumed to take no input blobs or
+  // to run on whatever they hold.
+  vector<shared_ptr<caffe::InferenceSession<float>::Context> > contexts;
+  for (int t = 0; t < FLAGS_threads; ++t) {
+    contexts.push_back(session.CreateContext());
+    contexts.back()->Forward();
+  }
+  const vector<shared_ptr<Blob<float> > >& blobs = contexts[0]->net().blobs();
+  const int batch_size = blobs.size() > 0 && blobs[0]->num_axes() > 0 ?
+      blobs[0]->shape(0) : 1;
+  LOG(INFO) << "*** Benchmark begins ***";
+  LOG(INFO) << "Testing " << FLAGS_iterations << " iterations per thread, "
+      << "batch size " << batch_size << ".";
+  double single_rate = 0;
+  for (int num_threads = 1; num_threads <= FLAGS_threads; ++num_threads) {
+    caffe::CPUTimer timer;
+    timer.Start();
+    vector<shared_ptr<boost::thread> > threads;
+    for (int t = 0; t < num_threads; ++t) {
+      threads.push_back(shared_ptr<boost::thread>(new boost::thread(
+          &ServeRequests, contexts[t].get(), FLAGS_iterations)));
+    }
+    for (int t = 0; t < num_threads; ++t) {
+      threads[t]->join();
+    }
+    timer.Stop();
+    const double seconds = timer.Seconds();
+    const double rate = num_threads * FLAGS_iterations * batch_size / seconds;
+    if (num_threads == 1) {
+      single_rate = rate;
+    }
+    LOG(INFO) << num_threads << " threads: " << rate << " items/s, "
+        << seconds * 1000 / FLAGS_iterations << " ms per batch ("
+        << rate / single_rate << "x one thread).";
+  }
+  LOG(INFO) << "*** Benchmark ends ***";
+  return 0;
+}
+RegisterBrewFunction(throughput);
+
+typedef caffe::BatchingServer<float> BatchingServer;
+
+// Read or write size bytes; false at the end of the stream or on an error.
+static bool ReadFully(int fd, void* data, size_t size) {
+  char* bytes = static_cast<char*>(data);
+  while (size > 0) {
+    const ssize_t done = read(fd, bytes, size);
+    if (done < 0 && errno == EINTR) { continue; }
+    if (done <= 0) { return false; }
+    bytes += done;
+    size -= done;
+  }
+  return true;
+}
+
+static bool WriteFully(int fd, const void* data, size_t size) {
+  const char* bytes = static_cast<const char*>(data);
+  while (size > 0) {
+    const ssize_t done = write(fd, bytes, size);
+    if (done < 0 && errno == EINTR) { continue; }
+    if (done <= 0) { return false; }
+    bytes += done;
+    size -= done;
+  }
+  return true;
+}
+
+// One client of 'serve'. Each request is a uint32 count followed by that many
+// float values of one item of the input blob; each is answered in order the
+// same way, with the values of the output blobs. Requests are submitted as
+// they are read, so that those of one client can share a batch, and a writer
+// thread sends the answers as they are done.
+class ServeConnection {
+ public:
+  ServeConnection(BatchingServer* server, int in_fd, int out_fd)
+      : server_(server), in_fd_(in_fd), out_fd_(out_fd), reading_(true),
+        finished_(false) {}
+
+  // Whether Run has returned, or is about to, so that the thread running it
+  // joins at once.
+  bool finished() {
+    boost::mutex::scoped_lock lock(mutex_);
+    return finished_;
+  }
+
+  // Serve requests until the end of the input or a malformed request.
+  void Run() {
+    boost::thread writer(&ServeConnection::WriteResponses, this);
+    vector<float> input(server_->input_size());
+    uint32_t count;
+    while (ReadFully(in_fd_, &count, sizeof(count))) {
+      if (count != input.size()) {
+        LOG(ERROR) << "Request of " << count << " values; the net takes "
+            << input.size() << ".";
+        break;
+      }
+      if (!ReadFully(in_fd_, &input[0], count * sizeof(float))) {
+        break;
+      }
+      shared_ptr<BatchingServer::Request> request = server_->Submit(&input[0]);
+      boost::mutex::scoped_lock lock(mutex_);
+      pending_.push_back(request);
+      pending_changed_.notify_one();
+    }
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      reading_ = false;
+    }
+    pending_changed_.notify_one();
+    writer.join();
+    boost::mutex::scoped_lock lock(mutex_);
+    finished_ = true;
+  }
+
+ private:
+  void WriteResponses() {
+    bool connected = true;
+    while (true) {
+      shared_ptr<BatchingServer::Request> request;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        while (pending_.empty() && reading_) {
+          pending_changed_.wait(lock);
+        }
+        if (pending_.empty()) { return; }
+        request = pending_.front();
+        pending_.pop_front();
+      }
+      // Once the client is gone its requests are still waited for, but not
+      // answered.
+      const vector<float>& output = request->Wait();
+      const uint32_t count = output.size();
+      // A net may have no outputs, and then output has no element 0.
+      connected = connected && WriteFully(out_fd_, &count, sizeof(count)) &&
+          (count == 0 ||
+           WriteFully(out_fd_, &output[0], count * sizeof(float)));
+    }
+  }
+
+  BatchingServer* server_;
+  int in_fd_;
+  int out_fd_;
+  boost::mutex mutex_;
+  boost::condition_variable pending_changed_;
+  std::deque<shared_ptr<BatchingServer::Request> > pending_;
+  bool reading_;
+  bool finished_;
+};
+
+// A client of ServeSocket: its socket, and the thread serving it.
+struct ServeClient {
+  int fd;
+  shared_ptr<ServeConnection> connection;
+  shared_ptr<boost::thread> thread;
+};
+
+// Join the thread of a client and close its socket.
+static void EndServeClient(const ServeClient& client) {
+  client.thread->join();
+  close(client.fd);
+}
+
+// Accept clients on the Unix socket FLAGS_socket, each on its own thread,
+// until SIGINT.
+static void ServeSocket(BatchingServer* server) {
+  const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  CHECK_GE(listener, 0) << "Cannot create a socket: " << strerror(errno);
+  sockaddr_un address = sockaddr_un();
+  address.sun_family = AF_UNIX;
+  CHECK_LT(FLAGS_socket.size(), sizeof(address.sun_path))
+      << "Socket path too long: " << FLAGS_socket;
+  strncpy(address.sun_path, FLAGS_socket.c_str(),
+      sizeof(address.sun_path) - 1);
+  unlink(FLAGS_socket.c_str());
+  CHECK_EQ(bind(listener, reinterpret_cast<sockaddr*>(&address),
+      sizeof(address)), 0) << "Cannot bind " << FLAGS_socket << ": "
+      << strerror(errno);
+  CHECK_EQ(listen(listener, SOMAXCONN), 0) << strerror(errno);
+  LOG(INFO) << "Serving on " << FLAGS_socket << "; stop with SIGINT.";
+
+  caffe::SignalHandler signal_handler(caffe::SolverAction::STOP,
+      caffe::SolverAction::NONE);
+  caffe::ActionCallback requested_action =
+      signal_handler.GetActionFunction();
+  vector<ServeClient> clients;
+  while (requested_action() != caffe::SolverAction::STOP) {
+    // Release the sockets and threads of the clients that are done.
+    int live = 0;
+    for (int i = 0; i < clients.size(); ++i) {
+      if (clients[i].connection->finished()) {
+        EndServeClient(clients[i]);
+      } else {
+        clients[live++] = clients[i];
+      }
+    }
+    clients.resize(live);
+    // Wake up now and then to check for signals.
+    pollfd listening;
+    listening.fd = listener;
+    listening.events = POLLIN;
+    if (poll(&listening, 1, 100) <= 0) { continue; }
+    ServeClient client;
+    client.fd = accept(listener, NULL, NULL);
+    if (client.fd < 0) {
+      const int error = errno;
+      if (error != EINTR && error != ECONNABORTED) {
+        // E.g. out of file descriptors: the listener stays readable, so wait
+        // for clients to finish rather than spin.
+        LOG_EVERY_N(ERROR, 100) << "Cannot accept a client: "
+            << strerror(error);
+        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+      }
+      continue;
+    }
+    client.connection.reset(new ServeConnection(server, client.fd,
+        client.fd));
+    client.thread.reset(new boost::thread(&ServeConnection::Run,
+        client.connection.get()));
+    clients.push_back(client);
+  }
+  close(listener);
+  unlink(FLAGS_socket.c_str());
+  // Stop reading from the clients; what they already sent is still answered.
+  for (int i = 0; i < clients.size(); ++i) {
+    shutdown(clients[i].fd, SHUT_RD);
+  }
+  for (int i = 0; i < clients.size(); ++i) {
+    EndServeClient(clients[i]);
+  }
+}
+
+// Serve: answer inference requests, run in dynamic batches, until the end of
+// stdin or, with --socket, until SIGINT. Logs latency and throughput
+// statistics at exit.
+int serve() {
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to serve.";
+  vector<string> stages = get_stages_from_flags();
+
+  // Set device id and mode
+  vector<int> gpus;
+  get_gpus(&gpus);
+  if (gpus.size() != 0) {
+    LOG(INFO) << "Use GPU with device ID " << gpus[0];
+    Caffe::SetDevice(gpus[0]);
+    Caffe::set_mode(Caffe::GPU);
+  } else {
+    LOG(INFO) << "Use CPU.";
+    Caffe::set_mode(Caffe::CPU);
+  }
+  caffe::NetParameter param;
+  caffe::ReadNetParamsFromTextFileOrDie(FLAGS_model, &param);
+  for (int i = 0; i < stages.size(); ++i) {
+    param.mutable_state()->add_stage(stages[i]);
+  }
+  param.mutable_state()->set_level(FLAGS_level);
+  caffe::InferenceSession<float> session(param, FLAGS_weights);
+  shared_ptr<caffe::InferenceSession<float>::Context> context =
+      session.CreateContext();
+  BatchingServer server(context, FLAGS_max_batch_size, FLAGS_max_latency_us,
+      FLAGS_queue_depth);
+  LOG(INFO) << "Requests take " << server.input_size() << " values and are "
+      << "answered with " << server.output_size() << ".";
+  // A client that goes away is noticed by a failed write.
+  signal(SIGPIPE, SIG_IGN);
+  server.Start();
+  if (FLAGS_socket.empty()) {
+    ServeConnection(&server, STDIN_FILENO, STDOUT_FILENO).Run();
+  } else {
+    ServeSocket(&server);
+  }
+  server.Stop();
+
+  const BatchingServer::Stats stats = server.stats();
+  LOG(INFO) << "Served " << stats.requests << " requests in " << stats.batches
+      << " batches of " << stats.mean_batch_size << " on average.";
+  LOG(INFO) << "Latency: p50 " << stats.p50_latency_ms << " ms, p99 "
+      << stats.p99_latency_ms << " ms.";
+  LOG(INFO) << "Throughput: " << stats.requests_per_second << " requests/s.";
+  if (context->net().has_shape_buckets()) {
+    LOG(INFO) << "Shape buckets: " << context->net().reshapes_skipped()
+        << " layer reshapes skipped, " << context->net().reallocations_avoided()
+        << " reallocations avoided.";
+  }
+  return 0;
+}
+RegisterBrewFunction(serve);
+
 int main(int argc, char** argv) {
   // Print output to stderr (while still logging).
   FLAGS_alsologtostderr = 1;
@@ -489,7 +901,9 @@ int main(int argc, char** argv) {
       "  train           train or finetune a model\n"
       "  test            score a model\n"
       "  device_query    show GPU diagnostic information\n"
-      "  time            benchmark model execution time");
+      "  time            benchmark model execution time\n"
+      "  throughput      benchmark inference throughput on concurrent threads\n"
+      "  serve           answer inference requests in dynamic batches");
   // Run tool or show usage.
   caffe::GlobalInit(&argc, &argv);
   if (argc == 2) {
@@ -0,0 +1,51 @@
+// This is a script to calibrate a trained net for int8 inference: it runs the
+// TEST phase net over its data layers and writes the measured input range of
+// every Convolution and InnerProduct layer into the quantization_param of a
+// copy of the prototxt (see caffe/util/calibrate_int8.hpp).
+// Usage:
+//    calibrate_int8 model_prototxt weights iterations int8_prototxt_out
+//        [comma_separated_layers_to_skip]
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "boost/algorithm/string.hpp"
+#include "caffe/caffe.hpp"
+#include "caffe/util/calibrate_int8.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;  // Print output to stderr (while still logging)
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 5 && argc != 6) {
+    LOG(ERROR) << "Usage: calibrate_int8 model_prototxt weights iterations "
+        << "int8_prototxt_out [comma_separated_layers_to_skip]";
+    return 1;
+  }
+  Caffe::set_mode(Caffe::CPU);
+
+  std::set<string> skip_layers;
+  if (argc == 6) {
+    vector<string> names;
+    boost::split(names, argv[5], boost::is_any_of(","));
+    skip_layers.insert(names.begin(), names.end());
+  }
+
+  NetParameter net_param;
+  ReadNetParamsFromTextFileOrDie(string(argv[1]), &net_param);
+  net_param.mutable_state()->set_phase(TEST);
+  Net<float> net(net_param);
+  net.CopyTrainedLayersFrom(string(argv[2]));
+
+  const int num_quantized =
+      CalibrateInt8(&net, atoi(argv[3]), &net_param, skip_layers);
+  WriteProtoToTextFile(net_param, argv[4]);
+
+  LOG(INFO) << "Calibrated " << num_quantized << " layers for int8; wrote "
+            << argv[4];
+  return 0;
+}
@@ -0,0 +1,62 @@
+// This is a script to prepare a trained net for deployment by folding
+// BatchNorm, Scale, Bias and ReLU layers into the Convolution or InnerProduct
+// layers they follow (see caffe/util/fuse_layers.hpp).
+// Usage:
+//    fuse_net_layers deploy_prototxt weights_in
+//        fused_prototxt_out fused_weights_out
+
+#include <map>
+#include <string>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/fuse_layers.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using std::map;
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;  // Print output to stderr (while still logging)
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 5) {
+    LOG(ERROR) << "Usage: fuse_net_layers deploy_prototxt weights_in "
+        << "fused_prototxt_out fused_weights_out";
+    return 1;
+  }
+
+  NetParameter net_param;
+  ReadNetParamsFromTextFileOrDie(string(argv[1]), &net_param);
+  net_param.mutable_state()->set_phase(TEST);
+  NetParameter filtered_param;
+  Net<float>::FilterNet(net_param, &filtered_param);
+
+  // Attach the trained blobs to the layers of the same name.
+  NetParameter weights;
+  ReadNetParamsFromBinaryFileOrDie(string(argv[2]), &weights);
+  map<string, const LayerParameter*> trained_layers;
+  for (int i = 0; i < weights.layer_size(); ++i) {
+    trained_layers[weights.layer(i).name()] = &weights.layer(i);
+  }
+  for (int i = 0; i < filtered_param.layer_size(); ++i) {
+    LayerParameter* layer = filtered_param.mutable_layer(i);
+    map<string, const LayerParameter*>::const_iterator it =
+        trained_layers.find(layer->name());
+    if (it != trained_layers.end()) {
+      layer->mutable_blobs()->CopyFrom(it->second->blobs());
+    }
+  }
+
+  NetParameter fused_param;
+  const int num_removed = FuseLayers(filtered_param, &fused_param);
+  WriteProtoToBinaryFile(fused_param, argv[4]);
+  for (int i = 0; i < fused_param.layer_size(); ++i) {
+    fused_param.mutable_layer(i)->clear_blobs();
+  }
+  WriteProtoToTextFile(fused_param, argv[3]);
+
+  LOG(INFO) << "Folded " << num_removed << " layers; wrote fused net to "
+            << argv[3] << " and its weights to " << argv[4];
+  return 0;
+}